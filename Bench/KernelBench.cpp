@@ -0,0 +1,640 @@
+/****************************** Module Header ******************************\
+Module Name:  KernelBench.cpp
+Project:      ZipFolderEx
+
+Microbenchmarks of the inner loops of the extractor:
+
+  inflate/levelN    - Inflater on raw deflate data from zlib levels 0-9
+  inflate/zlib      - zlib's own inflate on the level 6 data, for reference
+  crc32/...         - CRC-32 kernels on a large and a small buffer
+  endscan           - FindLastSignature over the 64 KB end of archive
+                      window of a file with a long comment
+  zeroblock         - IsZeroBlock over 1 MB of zeros in 4 KB blocks, as
+                      sparse output tests it
+  cdparse           - ZipArchive reading a 100,000 entry central directory
+  path              - EntryNameToRelativePath on 100,000 entry names
+  namedecode        - DecodeEntryName on the same names in code page 437
+  pathset/...       - NormalizeEntryName and ZipPathSet on 1,000,000 names
+                      of mixed case, exact and case-insensitive
+  alpha/...         - the BitmapFromIcon alpha fix-up loops (IconAlpha.h)
+
+Each benchmark is calibrated to run for about --min-time seconds per
+repetition and reports the median of --reps repetitions. Inputs are
+generated from fixed seeds so that runs are comparable.
+
+Usage: kernelbench [--filter SUBSTRING] [--min-time SECONDS] [--reps N]
+
+Results are written to stdout as JSON; compare two runs with compare.py.
+The CRC, end scan, zero block and alpha loops run the variant ZipCpu picked for this processor,
+recorded as "cpu"; set ZIPFOLDEREX_CPU=generic to time the portable code.
+\***************************************************************************/
+
+#include "Inflate.h"
+#include "Crc32.h"
+#include "ZipArchive.h"
+#include "ZipPath.h"
+#include "ZipWriter.h"
+#include "IconAlpha.h"
+#include "ZipCpu.h"
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+
+namespace
+{
+    struct Options
+    {
+        const char *filter;
+        double minTime;
+        int cReps;
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint64_t cbPerIter;
+        uint64_t cItemsPerIter;
+        uint64_t cIters;
+        double nsPerIter;
+    };
+
+    Options g_options = { NULL, 0.2, 5 };
+    std::vector<Result> g_results;
+
+    // Keeps the optimizer from discarding a result.
+    volatile uint64_t g_sink;
+
+    uint64_t NextRandom(uint64_t &state)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    double RunIters(const std::function<void()> &fn, uint64_t cIters)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < cIters; i++)
+        {
+            fn();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //
+    //   FUNCTION: Measure
+    //
+    //   PURPOSE: Time fn and record the result under name. cbPerIter and
+    //   cItemsPerIter give the work done by one call, for the throughput
+    //   figures; either may be 0.
+    //
+    void Measure(const std::string &name, uint64_t cbPerIter, uint64_t cItemsPerIter,
+        const std::function<void()> &fn)
+    {
+        if (g_options.filter != NULL && name.find(g_options.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        // Grow the iteration count until one repetition takes long enough.
+        uint64_t cIters = 1;
+        for (;;)
+        {
+            double seconds = RunIters(fn, cIters);
+            if (seconds >= g_options.minTime || cIters >= ((uint64_t)1 << 40))
+            {
+                break;
+            }
+            double scale = seconds > 0 ? g_options.minTime / seconds * 1.2 : 100;
+            cIters = (uint64_t)(cIters * std::min(std::max(scale, 2.0), 100.0));
+        }
+
+        std::vector<double> samples;
+        for (int rep = 0; rep < g_options.cReps; rep++)
+        {
+            samples.push_back(RunIters(fn, cIters) * 1e9 / cIters);
+        }
+        std::sort(samples.begin(), samples.end());
+
+        Result result = { name, cbPerIter, cItemsPerIter, cIters, samples[samples.size() / 2] };
+        g_results.push_back(result);
+        fprintf(stderr, "%-28s %14.1f ns\n", name.c_str(), result.nsPerIter);
+    }
+
+    // Text-like data: words from a small vocabulary with occasional random
+    // runs, which compresses about as well as source code or logs.
+    std::vector<uint8_t> MakeCorpus(size_t cb, uint64_t seed)
+    {
+        uint64_t state = seed;
+        std::vector<std::string> words;
+        for (int i = 0; i < 2000; i++)
+        {
+            std::string word;
+            size_t len = 2 + NextRandom(state) % 9;
+            for (size_t k = 0; k < len; k++)
+            {
+                word.push_back((char)('a' + NextRandom(state) % 26));
+            }
+            words.push_back(word);
+        }
+
+        std::vector<uint8_t> data;
+        data.reserve(cb + 512);
+        while (data.size() < cb)
+        {
+            uint64_t r = NextRandom(state);
+            if (r % 100 == 0)
+            {
+                for (size_t k = 0, len = 16 + r % 256; k < len; k++)
+                {
+                    data.push_back((uint8_t)NextRandom(state));
+                }
+            }
+            else
+            {
+                const std::string &word = words[(r >> 8) % words.size()];
+                data.insert(data.end(), word.begin(), word.end());
+                data.push_back((r >> 40) % 12 == 0 ? '\n' : ' ');
+            }
+        }
+        data.resize(cb);
+        return data;
+    }
+
+    std::vector<uint8_t> Deflate(const std::vector<uint8_t> &data, int level)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        std::vector<uint8_t> out(deflateBound(&zs, (uLong)data.size()));
+        zs.next_in = const_cast<Bytef *>(&data[0]);
+        zs.avail_in = (uInt)data.size();
+        zs.next_out = &out[0];
+        zs.avail_out = (uInt)out.size();
+        deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return out;
+    }
+
+    class MemoryStream : public ZipInputStream, public ZipRandomAccess
+    {
+    public:
+        explicit MemoryStream(const std::vector<uint8_t> &data) : m_data(data), m_pos(0) {}
+
+        virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead)
+        {
+            ReadAt(m_pos, pv, cb, pcbRead);
+            m_pos += *pcbRead;
+            return ZR_OK;
+        }
+
+        virtual ZipResult ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead)
+        {
+            *pcbRead = offset < m_data.size() ?
+                std::min<size_t>(cb, m_data.size() - (size_t)offset) : 0;
+            if (*pcbRead > 0)
+            {
+                memcpy(pv, &m_data[(size_t)offset], *pcbRead);
+            }
+            return ZR_OK;
+        }
+
+        virtual ZipResult GetSize(uint64_t *pcb)
+        {
+            *pcb = m_data.size();
+            return ZR_OK;
+        }
+
+    private:
+        const std::vector<uint8_t> &m_data;
+        size_t m_pos;
+    };
+
+    class NullSink : public InflateSink
+    {
+    public:
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            g_sink += pb[cb - 1];
+            return ZR_OK;
+        }
+    };
+
+    void BenchInflate()
+    {
+        std::vector<uint8_t> corpus = MakeCorpus(8 * 1024 * 1024, 1);
+        Inflater inflater;
+        NullSink sink;
+        for (int level = 0; level <= 9; level++)
+        {
+            std::vector<uint8_t> compressed = Deflate(corpus, level);
+            char name[32];
+            sprintf(name, "inflate/level%d", level);
+            Measure(name, corpus.size(), 0, [&]()
+            {
+                MemoryStream stream(compressed);
+                BufferedReader reader(&stream);
+                if (inflater.Inflate(reader, sink) != ZR_OK)
+                {
+                    abort();
+                }
+            });
+        }
+
+        // A source file of a few KB, where setting up each block (the
+        // dynamic tables) costs more than decoding it.
+        std::vector<uint8_t> tiny(corpus.begin(), corpus.begin() + 2048);
+        std::vector<uint8_t> tinyCompressed = Deflate(tiny, 6);
+        Measure("inflate/tiny", tiny.size(), 1, [&]()
+        {
+            MemoryStream stream(tinyCompressed);
+            BufferedReader reader(&stream, 4096 + BufferedReader::kLookbehind);
+            if (inflater.Inflate(reader, sink) != ZR_OK)
+            {
+                abort();
+            }
+        });
+
+        // zlib on the level 6 stream, to compare with inflate/level6.
+        std::vector<uint8_t> compressed = Deflate(corpus, 6);
+        std::vector<uint8_t> out(256 * 1024);
+        Measure("inflate/zlib", corpus.size(), 0, [&]()
+        {
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            inflateInit2(&zs, -15);
+            zs.next_in = &compressed[0];
+            zs.avail_in = (uInt)compressed.size();
+            int ret;
+            do
+            {
+                zs.next_out = &out[0];
+                zs.avail_out = (uInt)out.size();
+                ret = inflate(&zs, Z_NO_FLUSH);
+                g_sink += out[0];
+            } while (ret == Z_OK);
+            inflateEnd(&zs);
+        });
+    }
+
+    uint32_t Crc32Bytewise(uint32_t crc, const uint8_t *p, size_t cb)
+    {
+        static uint32_t table[256];
+        if (table[1] == 0)
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+        }
+        crc = ~crc;
+        while (cb-- > 0)
+        {
+            crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void BenchCrc()
+    {
+        std::vector<uint8_t> data = MakeCorpus(4 * 1024 * 1024, 2);
+        const size_t sizes[] = { data.size(), 256 };
+        const char *labels[] = { "4M", "256" };
+
+        for (int i = 0; i < 2; i++)
+        {
+            size_t cb = sizes[i];
+            std::string suffix = std::string("/") + labels[i];
+            // Whichever variant ZipCpu picked; ZIPFOLDEREX_CPU=generic
+            // measures slice-by-8.
+            Measure("crc32/update" + suffix, cb, 0, [&]()
+            {
+                g_sink += Crc32Update(0, &data[1], cb);
+            });
+            Measure("crc32/bytewise" + suffix, cb, 0, [&]()
+            {
+                g_sink += Crc32Bytewise(0, &data[1], cb);
+            });
+            Measure("crc32/zlib" + suffix, cb, 0, [&]()
+            {
+                g_sink += crc32(0, &data[1], (uInt)cb);
+            });
+        }
+    }
+
+    // The worst case of the end record search: no signature in the whole
+    // window, as behind a maximal comment.
+    void BenchEndScan()
+    {
+        std::vector<uint8_t> window = MakeCorpus(ZIP_END_OF_CD_SIZE + 0xFFFF, 5);
+        Measure("endscan", window.size(), 0, [&]()
+        {
+            g_sink += FindLastSignature(&window[0], window.size(), ZIP_SIG_END_OF_CD);
+        });
+    }
+
+    void BenchZeroBlock()
+    {
+        // All zero, so every block is read to the end.
+        std::vector<uint8_t> zeros(1024 * 1024, 0);
+        Measure("zeroblock", zeros.size(), 0, [&]()
+        {
+            for (size_t i = 0; i < zeros.size(); i += 4096)
+            {
+                g_sink += IsZeroBlock(&zeros[i], 4096);
+            }
+        });
+    }
+
+    void PutLE16(std::vector<uint8_t> &out, uint32_t value)
+    {
+        out.push_back((uint8_t)value);
+        out.push_back((uint8_t)(value >> 8));
+    }
+
+    void PutLE32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        PutLE16(out, value & 0xFFFF);
+        PutLE16(out, value >> 16);
+    }
+
+    // Entry names with a realistic spread of depths and lengths.
+    std::vector<std::string> MakeNames(size_t cNames, uint64_t seed)
+    {
+        uint64_t state = seed;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < cNames; i++)
+        {
+            std::string name;
+            size_t depth = NextRandom(state) % 6;
+            for (size_t d = 0; d <= depth; d++)
+            {
+                if (d > 0)
+                {
+                    name.push_back('/');
+                }
+                size_t len = 3 + NextRandom(state) % 14;
+                for (size_t k = 0; k < len; k++)
+                {
+                    name.push_back((char)('a' + NextRandom(state) % 26));
+                }
+            }
+            name += ".dat";
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    // An archive of empty stored entries whose central directory is the
+    // only thing worth parsing.
+    std::vector<uint8_t> MakeDirectoryOnlyArchive(const std::vector<std::string> &names)
+    {
+        std::vector<uint8_t> archive;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            PutLE32(archive, ZIP_SIG_CENTRAL_HEADER);
+            PutLE16(archive, 20);
+            PutLE16(archive, 20);
+            PutLE16(archive, 0);
+            PutLE16(archive, ZIP_METHOD_DEFLATED);
+            PutLE32(archive, 0);
+            PutLE32(archive, (uint32_t)i);
+            PutLE32(archive, 1000);
+            PutLE32(archive, 4000);
+            PutLE16(archive, (uint32_t)names[i].size());
+            PutLE16(archive, 0);
+            PutLE16(archive, 0);
+            PutLE16(archive, 0);
+            PutLE16(archive, 0);
+            PutLE32(archive, 0);
+            PutLE32(archive, 0);
+            archive.insert(archive.end(), names[i].begin(), names[i].end());
+        }
+        uint32_t cbDirectory = (uint32_t)archive.size();
+        PutLE32(archive, ZIP_SIG_END_OF_CD);
+        PutLE16(archive, 0);
+        PutLE16(archive, 0);
+        PutLE16(archive, 0xFFFF);
+        PutLE16(archive, 0xFFFF);
+        PutLE32(archive, cbDirectory);
+        PutLE32(archive, 0);
+        PutLE16(archive, 0);
+        return archive;
+    }
+
+    void BenchDirectory()
+    {
+        std::vector<std::string> names = MakeNames(100000, 3);
+        std::vector<uint8_t> archive = MakeDirectoryOnlyArchive(names);
+        Measure("cdparse", archive.size(), names.size(), [&]()
+        {
+            MemoryStream source(archive);
+            ZipArchive zip;
+            if (zip.Open(&source) != ZR_OK || zip.EntryCount() != names.size())
+            {
+                abort();
+            }
+        });
+
+        std::vector<ZipEntryInfo> entries(names.size());
+        uint64_t cbNames = 0;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            entries[i].name = names[i];
+            cbNames += names[i].size();
+        }
+        Measure("path", cbNames, entries.size(), [&]()
+        {
+            NativePath path;
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                if (EntryNameToRelativePath(entries[i], &path) != ZR_OK)
+                {
+                    abort();
+                }
+            }
+            g_sink += path.size();
+        });
+
+        // The same names in code page 437, one in eight with a character
+        // outside ASCII, as DOS-era and Explorer-made archives store them.
+        std::vector<std::string> stored = names;
+        for (size_t i = 0; i < stored.size(); i += 8)
+        {
+            stored[i][stored[i].size() / 2] = (char)(0x80 + i % 128);
+        }
+        Measure("namedecode", cbNames, stored.size(), [&]()
+        {
+            for (size_t i = 0; i < stored.size(); i++)
+            {
+                entries[i].name = stored[i];
+                entries[i].flags = 0;
+                DecodeEntryName(NULL, 0, entries[i]);
+            }
+            g_sink += entries.back().name.size();
+        });
+    }
+
+    void BenchPathSet()
+    {
+        // Every eighth name has a redundant "./" or "x/../", and the first
+        // letter of every component is upper case half the time, so case
+        // folding has work to do and finds collisions.
+        std::vector<std::string> names = MakeNames(1000000, 5);
+        uint64_t state = 11;
+        uint64_t cbNames = 0;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            std::string &name = names[i];
+            for (size_t k = 0; k < name.size(); k++)
+            {
+                if ((k == 0 || name[k - 1] == '/') && NextRandom(state) % 2 == 0)
+                {
+                    name[k] = (char)(name[k] - 'a' + 'A');
+                }
+            }
+            switch (NextRandom(state) % 16)
+            {
+            case 0: name.insert(0, "./"); break;
+            case 1: name.insert(0, "x/../"); break;
+            }
+            cbNames += name.size();
+        }
+
+        const char *labels[] = { "exact", "fold" };
+        for (int fold = 0; fold < 2; fold++)
+        {
+            Measure(std::string("pathset/") + labels[fold], cbNames, names.size(), [&]()
+            {
+                ZipPathSet set(fold != 0);
+                set.Reserve(names.size(), (size_t)cbNames);
+                std::string normalized;
+                for (size_t i = 0; i < names.size(); i++)
+                {
+                    if (NormalizeEntryName(names[i], &normalized) != ZR_OK)
+                    {
+                        abort();
+                    }
+                    set.Insert(normalized, false);
+                }
+                g_sink += set.Count();
+            });
+        }
+    }
+
+    void BenchAlpha()
+    {
+        // A 256x256 icon; the shell asks for 16x16, which is too small to
+        // time on its own.
+        const size_t cPixels = 256 * 256;
+        uint64_t state = 4;
+        std::vector<uint32_t> mask(cPixels), pixels(cPixels), work(cPixels);
+        for (size_t i = 0; i < cPixels; i++)
+        {
+            mask[i] = (NextRandom(state) & 3) == 0 ? 0x00FFFFFF : 0;
+            pixels[i] = (uint32_t)NextRandom(state) & 0x00FFFFFF;
+        }
+        std::vector<uint8_t> opaque(cPixels);
+        bool *pOpaque = (bool *)&opaque[0];
+
+        Measure("alpha/build_mask", cPixels * 4, cPixels, [&]()
+        {
+            BuildOpaqueMask(&mask[0], pOpaque, cPixels);
+            g_sink += opaque[cPixels / 2];
+        });
+        Measure("alpha/has_alpha", cPixels * 4, cPixels, [&]()
+        {
+            g_sink += HasAlphaChannel(&pixels[0], cPixels);
+        });
+        Measure("alpha/apply_mask", cPixels * 4, cPixels, [&]()
+        {
+            work = pixels;
+            ApplyOpaqueMask(&work[0], pOpaque, cPixels);
+            g_sink += work[cPixels / 2];
+        });
+    }
+
+    bool ParseOptions(int argc, char **argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            if (i + 1 < argc && strcmp(argv[i], "--filter") == 0)
+            {
+                g_options.filter = argv[++i];
+            }
+            else if (i + 1 < argc && strcmp(argv[i], "--min-time") == 0)
+            {
+                g_options.minTime = atof(argv[++i]);
+            }
+            else if (i + 1 < argc && strcmp(argv[i], "--reps") == 0)
+            {
+                g_options.cReps = std::max(atoi(argv[++i]), 1);
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void PrintResults()
+    {
+        printf("{\n");
+        printf("    \"suite\": \"kernels\",\n");
+#ifdef __VERSION__
+        printf("    \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+        printf("    \"cpu\": \"%s\",\n", ZipCpuLevel());
+        printf("    \"min_time_s\": %g,\n", g_options.minTime);
+        printf("    \"reps\": %d,\n", g_options.cReps);
+        printf("    \"results\": [\n");
+        for (size_t i = 0; i < g_results.size(); i++)
+        {
+            const Result &r = g_results[i];
+            double seconds = r.nsPerIter / 1e9;
+            printf("        {\"name\": \"%s\", \"ns_per_iter\": %.1f, \"iterations\": %llu, "
+                "\"bytes_per_iter\": %llu, \"mb_per_s\": %.2f, \"items_per_s\": %.0f}%s\n",
+                r.name.c_str(), r.nsPerIter, (unsigned long long)r.cIters,
+                (unsigned long long)r.cbPerIter,
+                seconds > 0 ? r.cbPerIter / seconds / 1e6 : 0.0,
+                seconds > 0 ? r.cItemsPerIter / seconds : 0.0,
+                i + 1 < g_results.size() ? "," : "");
+        }
+        printf("    ]\n");
+        printf("}\n");
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    if (!ParseOptions(argc, argv))
+    {
+        fprintf(stderr, "usage: kernelbench [--filter SUBSTRING] [--min-time SECONDS] "
+            "[--reps N]\n");
+        return 2;
+    }
+
+    BenchInflate();
+    BenchCrc();
+    BenchEndScan();
+    BenchZeroBlock();
+    BenchDirectory();
+    BenchPathSet();
+    BenchAlpha();
+    PrintResults();
+    return 0;
+}
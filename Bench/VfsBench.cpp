@@ -0,0 +1,235 @@
+/****************************** Module Header ******************************\
+Module Name:  VfsBench.cpp
+Project:      ZipFolderEx
+
+Random read latency through ZipVfs.
+
+The benchmark mounts an archive and issues a fixed sequence of random
+preads against its files, twice:
+
+  cold - on a freshly mounted archive with an empty block cache (the
+         checkpoint index is built on the way unless it was cached);
+  hot  - the same sequence again, served from the block cache as far as
+         the cache cap allows.
+
+Usage: vfsbench <archive> [--reads N] [--size BYTES] [--cache-mb MB]
+                          [--seed N]
+
+Results are written to stdout as one JSON object.
+\***************************************************************************/
+
+#include "ZipVfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+
+namespace
+{
+    struct Options
+    {
+        const char *archive;
+        size_t cReads;
+        size_t cbRead;
+        uint64_t cacheMb;
+        unsigned seed;
+    };
+
+    struct Request
+    {
+        ZipVfsFile file;
+        uint64_t offset;
+    };
+
+    // xorshift64*, so that runs are repeatable across C libraries.
+    uint64_t NextRandom(uint64_t &state)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    void CollectFiles(ZipVfs &vfs, const std::string &dir, std::vector<ZipVfsFile> &files)
+    {
+        std::vector<std::string> names;
+        if (vfs.ReadDir(dir, &names) != ZR_OK)
+        {
+            return;
+        }
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            std::string path = dir.empty() ? names[i] : dir + "/" + names[i];
+            ZipVfsStat stat;
+            if (vfs.Stat(path, &stat) != ZR_OK)
+            {
+                continue;
+            }
+            ZipVfsFile file;
+            if (stat.fDirectory)
+            {
+                CollectFiles(vfs, path, files);
+            }
+            else if (stat.size > 0 && vfs.Open(path, &file) == ZR_OK)
+            {
+                files.push_back(file);
+            }
+        }
+    }
+
+    bool RunPass(ZipVfs &vfs, const std::vector<Request> &requests, size_t cbRead,
+        std::vector<double> &latencies, uint64_t *pcbTotal)
+    {
+        std::vector<uint8_t> buffer(cbRead);
+        latencies.clear();
+        *pcbTotal = 0;
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            size_t cbDone = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ZipResult result = vfs.PRead(requests[i].file, requests[i].offset,
+                &buffer[0], cbRead, &cbDone);
+            std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+            if (result != ZR_OK)
+            {
+                fprintf(stderr, "pread failed: %s\n", ZipResultToString(result));
+                return false;
+            }
+            latencies.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+            *pcbTotal += cbDone;
+        }
+        return true;
+    }
+
+    double Percentile(std::vector<double> sorted, double p)
+    {
+        std::sort(sorted.begin(), sorted.end());
+        size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+        return sorted[i];
+    }
+
+    void PrintPass(const char *name, const std::vector<double> &latencies,
+        uint64_t cbTotal, const BlockCacheStats &before, const BlockCacheStats &after,
+        bool fLast)
+    {
+        double total = 0;
+        for (size_t i = 0; i < latencies.size(); i++)
+        {
+            total += latencies[i];
+        }
+        uint64_t hits = after.hits - before.hits;
+        uint64_t misses = after.misses - before.misses;
+        printf("    \"%s\": {\"mean_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+            "\"p99_us\": %.2f, \"max_us\": %.2f, \"mb_per_s\": %.2f, "
+            "\"cache_hit_rate\": %.4f}%s\n",
+            name, total / latencies.size(), Percentile(latencies, 0.5),
+            Percentile(latencies, 0.9), Percentile(latencies, 0.99),
+            Percentile(latencies, 1.0), total > 0 ? cbTotal / total : 0.0,
+            hits + misses > 0 ? (double)hits / (hits + misses) : 0.0,
+            fLast ? "" : ",");
+    }
+
+    bool ParseOptions(int argc, char **argv, Options *pOptions)
+    {
+        pOptions->archive = NULL;
+        pOptions->cReads = 2000;
+        pOptions->cbRead = 4096;
+        pOptions->cacheMb = 256;
+        pOptions->seed = 1;
+        for (int i = 1; i < argc; i++)
+        {
+            if (i + 1 < argc && strcmp(argv[i], "--reads") == 0)
+            {
+                pOptions->cReads = strtoul(argv[++i], NULL, 10);
+            }
+            else if (i + 1 < argc && strcmp(argv[i], "--size") == 0)
+            {
+                pOptions->cbRead = strtoul(argv[++i], NULL, 10);
+            }
+            else if (i + 1 < argc && strcmp(argv[i], "--cache-mb") == 0)
+            {
+                pOptions->cacheMb = strtoull(argv[++i], NULL, 10);
+            }
+            else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0)
+            {
+                pOptions->seed = (unsigned)strtoul(argv[++i], NULL, 10);
+            }
+            else if (argv[i][0] != '-' && pOptions->archive == NULL)
+            {
+                pOptions->archive = argv[i];
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return pOptions->archive != NULL && pOptions->cReads > 0 && pOptions->cbRead > 0;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        fprintf(stderr, "usage: vfsbench <archive> [--reads N] [--size BYTES] "
+            "[--cache-mb MB] [--seed N]\n");
+        return 2;
+    }
+
+    ZipVfs vfs(NULL, options.cacheMb * 1024 * 1024);
+    ZipResult result = vfs.Mount(options.archive);
+    if (result != ZR_OK)
+    {
+        fprintf(stderr, "%s: %s\n", options.archive, ZipResultToString(result));
+        return 1;
+    }
+
+    std::vector<ZipVfsFile> files;
+    CollectFiles(vfs, std::string(), files);
+    if (files.empty())
+    {
+        fprintf(stderr, "%s: no files to read\n", options.archive);
+        return 1;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ull ^ options.seed;
+    std::vector<Request> requests(options.cReads);
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        requests[i].file = files[NextRandom(state) % files.size()];
+        uint64_t size = vfs.Archive().Entry(requests[i].file).uncompressedSize;
+        requests[i].offset = NextRandom(state) % size;
+    }
+
+    std::vector<double> cold, hot;
+    uint64_t cbCold, cbHot;
+    BlockCacheStats start = vfs.GetCacheStats();
+    if (!RunPass(vfs, requests, options.cbRead, cold, &cbCold))
+    {
+        return 1;
+    }
+    BlockCacheStats middle = vfs.GetCacheStats();
+    if (!RunPass(vfs, requests, options.cbRead, hot, &cbHot))
+    {
+        return 1;
+    }
+    BlockCacheStats end = vfs.GetCacheStats();
+
+    printf("{\n");
+    printf("    \"benchmark\": \"vfs_random_read\",\n");
+    printf("    \"archive\": \"%s\",\n", options.archive);
+    printf("    \"files\": %zu,\n", files.size());
+    printf("    \"reads\": %zu,\n", options.cReads);
+    printf("    \"read_size\": %zu,\n", options.cbRead);
+    printf("    \"cache_limit_bytes\": %llu,\n", (unsigned long long)end.cbLimit);
+    printf("    \"cache_used_bytes\": %llu,\n", (unsigned long long)end.cbUsed);
+    printf("    \"cache_evictions\": %llu,\n", (unsigned long long)end.evictions);
+    PrintPass("cold", cold, cbCold, start, middle, false);
+    PrintPass("hot", hot, cbHot, middle, end, true);
+    printf("}\n");
+    return 0;
+}
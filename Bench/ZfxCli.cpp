@@ -0,0 +1,518 @@
+/****************************** Module Header ******************************\
+Module Name:  ZfxCli.cpp
+Project:      ZipFolderEx
+
+A command-line front end to the native extractor, used by the scenario
+benchmarks to run the full extraction path in a process of its own.
+
+Usage: zfx [--threads N] [--stream] [--no-stats] [--trace FILE] [--progress]
+           [--ignore-case] [--writer KIND] [--fsync] [--sparse] [--direct MB]
+           [--memory MB]
+           [--overwrite POLICY] [--no-tune] [--service NAME]
+           <archive> <destination>
+       zfx [--threads N] --serve NAME
+
+  --threads N   worker threads for a seekable archive (default: one per
+                processor); how many run at once is tuned as it goes
+  --stream      read the archive front to back with ZipStreamExtractor,
+                as a pipe or download would be; "-" reads stdin
+
+<archive> may be any volume of a split archive (name.z01 ... name.zip, or
+name.zip.001, name.zip.002, ...); the whole set is read.
+  --no-stats    do not collect per-stage stats, to measure their cost
+  --trace FILE  write a Chrome trace of the extraction to FILE, to be
+                opened in chrome://tracing or ui.perfetto.dev
+  --progress    show progress and the estimated time left on stderr
+  --ignore-case treat entry names that differ only in case as one file, as
+                on Windows (the default there)
+  --writer KIND write files with "pwrite", "uring" or "auto" (the default);
+                see ZipWriter.h
+  --fsync       flush each file to the disk before closing it
+  --sparse      leave aligned 4 KB blocks of zeros as holes, making sparse
+                files
+  --direct MB   write entries of MB megabytes or more around the page cache
+                (O_DIRECT)
+  --overwrite POLICY
+                what to do about files already in the destination:
+                "always" replace them (the default), "never" keep them,
+                "newer" replace them with newer entries only, or "rename"
+                write the entry as "name (2).ext"; see ZipDestSnapshot.h.
+                Seekable archives only
+  --memory MB   limit the process memory budget (see ZipMemory.h) to MB
+                megabytes, as ZIPFOLDEREX_MEMORY_MB does
+  --no-tune     run all N threads throughout rather than tuning how many
+                run (see ZipTuner.h)
+  --service NAME
+                hand the archive to the extraction service listening on
+                NAME ("-" for the default) instead of extracting here
+  --serve NAME  run the extraction service on NAME ("-" for the default)
+                with N pool threads until a client sends SHUTDOWN
+
+A seekable archive is extracted as a ZipJob on a ZipJobQueue, as the shell
+extension does; Ctrl+C cancels it and the partly written entry is removed.
+
+A JSON summary is written to stdout: the result, files and bytes written,
+wall time per stage, peak resident set size and, where the kernel reports
+them, the number of read and write system calls. For a seekable archive
+"stats" holds the extractor's own ZipExtractStats, including per-thread
+stage counters, and "stages" lists the stage times summed over threads.
+\***************************************************************************/
+
+#include "ZipJob.h"
+#include "ZipMemory.h"
+#include "ZipService.h"
+#include "ZipStreamReader.h"
+#include "ZipVolumes.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <unistd.h>
+#include <sys/resource.h>
+
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double Seconds(Clock::time_point start, Clock::time_point stop)
+    {
+        return std::chrono::duration<double>(stop - start).count();
+    }
+
+    // Read and write system call counts from /proc/self/io; -1 if the
+    // kernel does not provide them.
+    void GetSyscallCounts(long long *pcRead, long long *pcWrite)
+    {
+        *pcRead = -1;
+        *pcWrite = -1;
+        FILE *pFile = fopen("/proc/self/io", "r");
+        if (pFile == NULL)
+        {
+            return;
+        }
+        char line[128];
+        while (fgets(line, sizeof(line), pFile) != NULL)
+        {
+            sscanf(line, "syscr: %lld", pcRead);
+            sscanf(line, "syscw: %lld", pcWrite);
+        }
+        fclose(pFile);
+    }
+
+    // Peak resident set size in KB. VmHWM belongs to this process image;
+    // ru_maxrss also carries the high-water mark of the parent that forked
+    // it, which would make a small run under a large harness look large.
+    long GetPeakRss()
+    {
+        long cKb = -1;
+        FILE *pFile = fopen("/proc/self/status", "r");
+        if (pFile != NULL)
+        {
+            char line[128];
+            while (fgets(line, sizeof(line), pFile) != NULL)
+            {
+                sscanf(line, "VmHWM: %ld", &cKb);
+            }
+            fclose(pFile);
+        }
+        if (cKb < 0)
+        {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            cKb = usage.ru_maxrss;
+        }
+        return cKb;
+    }
+
+    // The service runs with its own working directory.
+    std::string AbsolutePath(const char *pszPath)
+    {
+        if (pszPath[0] == '/')
+        {
+            return pszPath;
+        }
+        char szCwd[4096];
+        if (getcwd(szCwd, sizeof(szCwd)) == NULL)
+        {
+            return pszPath;
+        }
+        return std::string(szCwd) + "/" + pszPath;
+    }
+
+    NativePath ServiceName(const char *pszName)
+    {
+        return strcmp(pszName, "-") == 0 ? ZipServiceDefaultName() : NativePath(pszName);
+    }
+
+    volatile sig_atomic_t g_fInterrupted = 0;
+
+    void OnInterrupt(int)
+    {
+        g_fInterrupted = 1;
+    }
+
+    class CliJob : public ZipJob
+    {
+    public:
+        CliJob(const char *pszArchive, const char *pszDest, unsigned cThreads,
+            bool fStats, bool fIgnoreCase, ZipWriterKind writer, bool fSync, bool fSparse,
+            uint64_t cbDirectMin, bool fTune, ZipOverwritePolicy overwrite,
+            const char *pszTrace) :
+            ZipJob(pszArchive, pszDest), cThreads(cThreads), fStats(fStats),
+            fIgnoreCase(fIgnoreCase), writer(writer), fSync(fSync), fSparse(fSparse),
+            cbDirectMin(cbDirectMin), fTune(fTune), overwrite(overwrite), pszTrace(pszTrace),
+            fOpened(false), cEntries(0), cFiles(0), cbWritten(0)
+        {
+        }
+
+        const unsigned cThreads;
+        const bool fStats;
+        const bool fIgnoreCase;
+        const ZipWriterKind writer;
+        const bool fSync;
+        const bool fSparse;
+        const uint64_t cbDirectMin;
+        const bool fTune;
+        const ZipOverwritePolicy overwrite;
+        const char *const pszTrace;
+        bool fOpened;
+        Clock::time_point opened;
+        size_t cEntries;
+        uint64_t cFiles;
+        uint64_t cbWritten;
+        ZipExtractStats stats;
+
+    protected:
+        virtual ZipResult Run()
+        {
+            ZipArchive archive;
+            ZipResult result = archive.Open(ArchivePath());
+            opened = Clock::now();
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            fOpened = true;
+            cEntries = archive.EntryCount();
+
+            ZipExtractor extractor(DestDir(), cThreads);
+            ZipTracer tracer;
+            extractor.SetProgress(&Progress());
+            extractor.SetCancelToken(&CancelToken());
+            extractor.SetTracer(pszTrace != NULL ? &tracer : NULL);
+            if (fIgnoreCase)
+            {
+                extractor.SetIgnoreCase(true);
+            }
+            extractor.SetWriter(writer);
+            extractor.SetSyncFiles(fSync);
+            extractor.SetSparseFiles(fSparse);
+            extractor.SetDirectWriteThreshold(cbDirectMin);
+            extractor.SetAutoTune(fTune);
+            extractor.SetOverwrite(overwrite);
+            result = extractor.Extract(archive, fStats ? &stats : NULL);
+            cFiles = extractor.FilesWritten();
+            cbWritten = extractor.BytesWritten();
+
+            if (pszTrace != NULL && tracer.Save(pszTrace, &archive) != ZR_OK)
+            {
+                fprintf(stderr, "%s: cannot write trace\n", pszTrace);
+            }
+            return result;
+        }
+    };
+
+    void ShowProgress(const ZipProgressSnapshot &progress, bool fFinal)
+    {
+        fprintf(stderr, "\r%5.1f%%  %llu/%llu entries  %.1f MB",
+            progress.fraction * 100.0, (unsigned long long)progress.cEntriesDone,
+            (unsigned long long)progress.cEntriesTotal, progress.cbDone / 1e6);
+        if (!fFinal && progress.etaSeconds >= 0)
+        {
+            fprintf(stderr, "  ETA %.0f s   ", progress.etaSeconds);
+        }
+        else
+        {
+            fprintf(stderr, "  %.1f s     ", progress.elapsedSeconds);
+        }
+        fprintf(stderr, fFinal ? "\n" : "");
+    }
+
+    ZipProgressSnapshot Snapshot(const ZipJob &job)
+    {
+        ZipProgressSnapshot progress;
+        job.GetProgress(&progress);
+        return progress;
+    }
+
+    void Usage()
+    {
+        fprintf(stderr, "usage: zfx [--threads N] [--stream] [--no-stats] [--trace FILE] "
+            "[--progress] [--ignore-case] [--writer KIND] [--fsync] [--sparse] [--direct MB] "
+            "[--memory MB] "
+            "[--overwrite POLICY] [--no-tune] [--service NAME] <archive> <destination>\n"
+            "       zfx [--threads N] --serve NAME\n");
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned cThreads = 0;
+    bool fStream = false;
+    bool fStats = true;
+    bool fProgress = false;
+    bool fIgnoreCase = false;
+    bool fSync = false;
+    bool fSparse = false;
+    uint64_t cbDirectMin = 0;
+    bool fTune = true;
+    ZipWriterKind writer = ZIP_WRITER_AUTO;
+    ZipOverwritePolicy overwrite = ZIP_OVERWRITE_ALWAYS;
+    const char *pszTrace = NULL;
+    const char *pszServe = NULL;
+    const char *pszService = NULL;
+    const char *pszArchive = NULL;
+    const char *pszDest = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--threads") == 0)
+        {
+            cThreads = (unsigned)strtoul(argv[++i], NULL, 10);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--memory") == 0)
+        {
+            ZipMemoryBudget::Process().SetLimit(strtoull(argv[++i], NULL, 10) * 1024 * 1024);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--direct") == 0)
+        {
+            cbDirectMin = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--trace") == 0)
+        {
+            pszTrace = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--writer") == 0)
+        {
+            if (!ZipWriterKindFromString(argv[++i], &writer))
+            {
+                Usage();
+                return 2;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--overwrite") == 0)
+        {
+            if (!ZipOverwritePolicyFromString(argv[++i], &overwrite))
+            {
+                Usage();
+                return 2;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--serve") == 0)
+        {
+            pszServe = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--service") == 0)
+        {
+            pszService = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            fStream = true;
+        }
+        else if (strcmp(argv[i], "--progress") == 0)
+        {
+            fProgress = true;
+        }
+        else if (strcmp(argv[i], "--ignore-case") == 0)
+        {
+            fIgnoreCase = true;
+        }
+        else if (strcmp(argv[i], "--fsync") == 0)
+        {
+            fSync = true;
+        }
+        else if (strcmp(argv[i], "--sparse") == 0)
+        {
+            fSparse = true;
+        }
+        else if (strcmp(argv[i], "--no-tune") == 0)
+        {
+            fTune = false;
+        }
+        else if (strcmp(argv[i], "--no-stats") == 0)
+        {
+            fStats = false;
+        }
+        else if (pszArchive == NULL)
+        {
+            pszArchive = argv[i];
+        }
+        else if (pszDest == NULL)
+        {
+            pszDest = argv[i];
+        }
+        else
+        {
+            Usage();
+            return 2;
+        }
+    }
+    if (pszServe != NULL)
+    {
+        ZipService service(cThreads);
+        ZipResult result = service.Run(ServiceName(pszServe), 0);
+        if (result != ZR_OK)
+        {
+            fprintf(stderr, "%s: %s\n", pszServe, ZipResultToString(result));
+            return 1;
+        }
+        return 0;
+    }
+    if (pszArchive == NULL || pszDest == NULL)
+    {
+        Usage();
+        return 2;
+    }
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point opened = start;
+    ZipResult result;
+    uint64_t cFiles = 0;
+    uint64_t cbWritten = 0;
+    size_t cEntries = 0;
+    std::shared_ptr<CliJob> job;
+
+    if (pszService != NULL)
+    {
+        signal(SIGINT, OnInterrupt);
+        ZipServiceClient client(ServiceName(pszService));
+        uint64_t id = 0;
+        ZipServiceJobStatus status = {};
+        result = client.Submit(AbsolutePath(pszArchive), AbsolutePath(pszDest), false, &id);
+        opened = Clock::now();
+        bool fCancelled = false;
+        while (result == ZR_OK && (result = client.Wait(id, 200, &status)) == ZR_OK &&
+            status.state != ZJ_DONE)
+        {
+            if (g_fInterrupted && !fCancelled)
+            {
+                client.Cancel(id);
+                fCancelled = true;
+            }
+            if (fProgress)
+            {
+                ShowProgress(status.progress, false);
+            }
+        }
+        if (result == ZR_OK)
+        {
+            if (fProgress)
+            {
+                ShowProgress(status.progress, true);
+            }
+            result = status.result;
+            cEntries = (size_t)status.progress.cEntriesTotal;
+            cFiles = status.progress.cEntriesDone;
+            cbWritten = status.progress.cbDone;
+        }
+    }
+    else if (fStream)
+    {
+        NativeFile file;
+        ZipVolumeSet volumes;
+        uint64_t cbArchive = 0;
+        std::unique_ptr<RangeInputStream> pRange;
+        ZipInputStream *pInput = &file;
+        if (strcmp(pszArchive, "-") == 0)
+        {
+            file.AttachStdIn();
+            result = ZR_OK;
+        }
+        else
+        {
+            result = volumes.Open(pszArchive);
+            if (result == ZR_OK)
+            {
+                volumes.GetSize(&cbArchive);
+                pRange.reset(new RangeInputStream(&volumes, 0, cbArchive));
+                pInput = pRange.get();
+            }
+        }
+        opened = Clock::now();
+        if (result == ZR_OK)
+        {
+            PrefetchInputStream prefetch(pInput);
+            ZipStreamExtractor extractor(pszDest);
+            result = extractor.Extract(&prefetch);
+        }
+    }
+    else
+    {
+        signal(SIGINT, OnInterrupt);
+        ZipJobQueue queue;
+        job.reset(new CliJob(pszArchive, pszDest, cThreads, fStats, fIgnoreCase, writer, fSync,
+            fSparse, cbDirectMin, fTune, overwrite, pszTrace));
+        queue.Submit(job);
+        while (!job->Wait(200))
+        {
+            if (g_fInterrupted)
+            {
+                job->Cancel();
+            }
+            if (fProgress)
+            {
+                ShowProgress(Snapshot(*job), false);
+            }
+        }
+        if (fProgress)
+        {
+            ShowProgress(Snapshot(*job), true);
+        }
+
+        result = job->Result();
+        opened = job->opened;
+        cEntries = job->cEntries;
+        cFiles = job->cFiles;
+        cbWritten = job->cbWritten;
+    }
+    bool fHaveStats = job && job->fStats && job->fOpened;
+    ZipExtractStats noStats;
+    const ZipExtractStats &stats = job ? job->stats : noStats;
+    Clock::time_point stop = Clock::now();
+
+    long long cReads, cWrites;
+    GetSyscallCounts(&cReads, &cWrites);
+
+    printf("{\n");
+    printf("    \"result\": \"%s\",\n", ZipResultToString(result));
+    printf("    \"mode\": \"%s\",\n",
+        pszService != NULL ? "service" : fStream ? "stream" : "seekable");
+    printf("    \"entries\": %zu,\n", cEntries);
+    printf("    \"files\": %llu,\n", (unsigned long long)cFiles);
+    printf("    \"bytes\": %llu,\n", (unsigned long long)cbWritten);
+    printf("    \"wall_s\": %.6f,\n", Seconds(start, stop));
+    printf("    \"stages\": {\"open_s\": %.6f, \"extract_s\": %.6f",
+        Seconds(start, opened), Seconds(opened, stop));
+    for (int i = 0; fHaveStats && i < ZS_COUNT; i++)
+    {
+        printf(", \"%s_s\": %.6f", ZipStageName((ZipStage)i), stats.total.stages[i].ns / 1e9);
+    }
+    printf("},\n");
+    if (fHaveStats)
+    {
+        printf("    \"stats\": %s,\n", ZipStatsToJson(stats, "    ").c_str());
+    }
+    printf("    \"peak_rss_kb\": %ld,\n", GetPeakRss());
+    printf("    \"syscalls\": {\"read\": %lld, \"write\": %lld}\n", cReads, cWrites);
+    printf("}\n");
+
+    if (result != ZR_OK)
+    {
+        fprintf(stderr, "%s: %s\n", pszArchive, ZipResultToString(result));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1552 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipTests.cpp
+Project:      ZipFolderEx
+
+Tests of the parts of the extractor the shell extension relies on that
+can be checked without Windows:
+
+  queue/...       - ZipJobQueue running jobs in order, on several threads,
+                    cancelling queued and running jobs, progress read while
+                    a job runs, and WaitIdle
+  extract/...     - ZipExtractor on small archives built here: a good one,
+                    ones with an entry that climbs out of the destination
+                    or names an absolute path, one cut short, ones with a
+                    wrong CRC and one mostly of zeros written sparse; the
+                    check for a self-extracting archive with its size
+                    limit; and each overwrite policy, with renames around
+                    names already taken on disk and in the archive
+  index/...       - ZipSeekIndex reads at scattered offsets, its cache
+                    saved, loaded back and ignored when damaged, the cap
+                    on checkpoints for a large entry, and its windows
+                    reserved from and reclaimed by a memory budget
+  vfs/...         - ZipVfs listing, stat and reads of stored and deflated
+                    entries, cold and cached, and mounting a second
+                    archive in place of the first, and names with ".."
+  path/...        - NormalizeEntryName on ".", ".." and names that climb
+                    out; ZipPathSet exact and case-folded; and which of
+                    several entries for one file is extracted
+  name/...        - entry names decoded from code page 437, from the
+                    Unicode path extra field when its CRC matches, and
+                    kept as UTF-8 when flagged so; and small entries with
+                    long stored names read in one span
+  volume/...      - name.z01 ... name.zip and name.zip.001 ... sets opened
+                    and extracted from their first, a middle and the last
+                    volume, and a numbered split of something else
+  stream/...      - ZipStreamExtractor on entries with data descriptors:
+                    stored ones holding signatures, deflated, ZIP64, ones
+                    without the descriptor signature, and archives that
+                    start with a split or spanning marker
+
+Usage: ziptests [--filter SUBSTRING]
+
+Each test prints "ok" or the checks that failed; the exit status is the
+number of tests that failed. Scratch files go to a directory under $TMPDIR
+that is removed afterwards.
+\***************************************************************************/
+
+#include "ZipJob.h"
+#include "ZipVfs.h"
+#include "ZipPath.h"
+#include "ZipStreamReader.h"
+#include "Crc32.h"
+#include "ZipFormat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <chrono>
+#include <functional>
+
+
+namespace
+{
+    int g_cChecksFailed;
+
+    #define CHECK(expr) \
+        do \
+        { \
+            if (!(expr)) \
+            { \
+                fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+                g_cChecksFailed++; \
+            } \
+        } while (0)
+
+    std::string g_scratch;
+
+    std::string ScratchPath(const char *pszName)
+    {
+        return g_scratch + "/" + pszName;
+    }
+
+    bool ReadWholeFile(const std::string &path, std::string *pData)
+    {
+        FILE *pFile = fopen(path.c_str(), "rb");
+        if (pFile == NULL)
+        {
+            return false;
+        }
+        pData->clear();
+        char buffer[4096];
+        size_t cb;
+        while ((cb = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+        {
+            pData->append(buffer, cb);
+        }
+        fclose(pFile);
+        return true;
+    }
+
+    bool FileExists(const std::string &path)
+    {
+        return access(path.c_str(), F_OK) == 0;
+    }
+
+    #pragma region Archive builder
+
+    // How an entry records its sizes and CRC after its data (bit 3).
+    enum DescriptorForm
+    {
+        kNoDescriptor,
+        kDescriptor,                // signed, 32-bit sizes
+        kUnsignedDescriptor,        // no signature, 32-bit sizes
+        kZip64Descriptor            // signed, 64-bit sizes, ZIP64 local header
+    };
+
+    // An entry, and how to spoil it.
+    struct TestEntry
+    {
+        std::string name;
+        std::string data;
+        uint16_t method;            // ZIP_METHOD_STORED or ZIP_METHOD_DEFLATED
+        bool fBadCrc;               // record a CRC the data does not have
+        uint64_t cbMissing;         // leave out this many bytes of the data
+        uint16_t flags;             // general purpose flags, ZIP_FLAG_UTF8 say
+        std::string extra;          // extra fields, in both headers
+        DescriptorForm descriptor;
+    };
+
+    TestEntry MakeEntry(const std::string &name, const std::string &data,
+        uint16_t method = ZIP_METHOD_STORED)
+    {
+        TestEntry entry = { name, data, method, false, 0, 0, std::string(), kNoDescriptor };
+        return entry;
+    }
+
+    // Raw deflate, as entries hold it.
+    std::string Deflate(const std::string &data)
+    {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        deflateInit2(&stream, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        std::string out(deflateBound(&stream, (uLong)data.size()), '\0');
+        stream.next_in = (Bytef *)data.data();
+        stream.avail_in = (uInt)data.size();
+        stream.next_out = (Bytef *)&out[0];
+        stream.avail_out = (uInt)out.size();
+        deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return out;
+    }
+
+    void Put16(std::string &out, uint32_t value)
+    {
+        out += (char)(value & 0xFF);
+        out += (char)((value >> 8) & 0xFF);
+    }
+
+    void Put32(std::string &out, uint32_t value)
+    {
+        Put16(out, value & 0xFFFF);
+        Put16(out, value >> 16);
+    }
+
+    void Put64(std::string &out, uint64_t value)
+    {
+        Put32(out, (uint32_t)value);
+        Put32(out, (uint32_t)(value >> 32));
+    }
+
+    // An Info-ZIP Unicode path extra field giving name for an entry whose
+    // stored name has the CRC crc.
+    std::string UnicodePathExtra(const std::string &name, uint32_t crc)
+    {
+        std::string field;
+        Put16(field, ZIP_EXTRA_UNICODE_PATH);
+        Put16(field, (uint32_t)(5 + name.size()));
+        field += (char)1;
+        Put32(field, crc);
+        field += name;
+        return field;
+    }
+
+    // An archive of entries. The sizes recorded for an entry with
+    // cbMissing are those of its whole data, so that reading it runs into
+    // what follows and then off the end of the file. With cbDisk, offsets
+    // are recorded as in a PKWARE split archive whose disks are cut every
+    // cbDisk bytes of the result.
+    std::string BuildArchive(const std::vector<TestEntry> &entries, uint32_t cbDisk = 0)
+    {
+        uint32_t cbWhole = ~(uint32_t)0;
+        if (cbDisk == 0)
+        {
+            cbDisk = cbWhole;
+        }
+        std::string out, directory;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const TestEntry &entry = entries[i];
+            uint32_t crc = Crc32Update(0, entry.data.data(), entry.data.size());
+            if (entry.fBadCrc)
+            {
+                crc ^= 0x5A5A5A5A;
+            }
+            std::string stored = entry.method == ZIP_METHOD_DEFLATED ? Deflate(entry.data) :
+                entry.data;
+            uint32_t offset = (uint32_t)out.size();
+            uint32_t cb = (uint32_t)entry.data.size();
+            uint32_t cbStored = (uint32_t)stored.size();
+            bool fDescriptor = entry.descriptor != kNoDescriptor;
+            bool fZip64 = entry.descriptor == kZip64Descriptor;
+            uint16_t flags = entry.flags | (fDescriptor ? ZIP_FLAG_DATA_DESCRIPTOR : 0);
+
+            // With a descriptor, the local header leaves the sizes and CRC
+            // out; a ZIP64 one has a ZIP64 extra field with zero sizes.
+            std::string localExtra;
+            if (fZip64)
+            {
+                Put16(localExtra, ZIP_EXTRA_ZIP64);
+                Put16(localExtra, 16);
+                Put64(localExtra, 0);
+                Put64(localExtra, 0);
+            }
+            localExtra += entry.extra;
+
+            Put32(out, ZIP_SIG_LOCAL_HEADER);
+            Put16(out, fZip64 ? 45 : 20);   // version needed
+            Put16(out, flags);
+            Put16(out, entry.method);
+            Put32(out, 0x50210000);         // 2020-01-01 00:00
+            Put32(out, fDescriptor ? 0 : crc);
+            Put32(out, fZip64 ? ZIP_ZIP64_MARKER_32 : fDescriptor ? 0 : cbStored);
+            Put32(out, fZip64 ? ZIP_ZIP64_MARKER_32 : fDescriptor ? 0 : cb);
+            Put16(out, (uint32_t)entry.name.size());
+            Put16(out, (uint32_t)localExtra.size());
+            out += entry.name;
+            out += localExtra;
+            out += stored.substr(0, stored.size() - (size_t)entry.cbMissing);
+            if (fDescriptor)
+            {
+                if (entry.descriptor != kUnsignedDescriptor)
+                {
+                    Put32(out, ZIP_SIG_DATA_DESCRIPTOR);
+                }
+                Put32(out, crc);
+                if (fZip64)
+                {
+                    Put64(out, cbStored);
+                    Put64(out, cb);
+                }
+                else
+                {
+                    Put32(out, cbStored);
+                    Put32(out, cb);
+                }
+            }
+
+            Put32(directory, ZIP_SIG_CENTRAL_HEADER);
+            Put16(directory, 20);           // made by
+            Put16(directory, 20);
+            Put16(directory, flags);
+            Put16(directory, entry.method);
+            Put32(directory, 0x50210000);
+            Put32(directory, crc);
+            Put32(directory, cbStored);
+            Put32(directory, cb);
+            Put16(directory, (uint32_t)entry.name.size());
+            Put16(directory, (uint32_t)entry.extra.size());
+            Put16(directory, 0);            // comment
+            Put16(directory, offset / cbDisk);
+            Put16(directory, 0);            // internal attributes
+            Put32(directory, 0);            // external attributes
+            Put32(directory, offset % cbDisk);
+            directory += entry.name;
+            directory += entry.extra;
+        }
+
+        uint32_t cdOffset = (uint32_t)out.size();
+        out += directory;
+        uint32_t cbTotal = (uint32_t)(out.size() + ZIP_END_OF_CD_SIZE);
+        Put32(out, ZIP_SIG_END_OF_CD);
+        Put16(out, cbDisk == cbWhole ? 0 : (cbTotal - 1) / cbDisk);
+        Put16(out, cdOffset / cbDisk);
+        Put16(out, (uint32_t)entries.size());
+        Put16(out, (uint32_t)entries.size());
+        Put32(out, (uint32_t)directory.size());
+        Put32(out, cdOffset % cbDisk);
+        Put16(out, 0);
+        return out;
+    }
+
+    bool WriteData(const std::string &path, const std::string &data)
+    {
+        FILE *pFile = fopen(path.c_str(), "wb");
+        if (pFile == NULL)
+        {
+            return false;
+        }
+        bool fOk = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+        return fclose(pFile) == 0 && fOk;
+    }
+
+    bool WriteArchive(const std::string &path, const std::vector<TestEntry> &entries)
+    {
+        return WriteData(path, BuildArchive(entries));
+    }
+
+    std::string Pattern(size_t cb, unsigned seed)
+    {
+        std::string data(cb, '\0');
+        uint32_t state = seed * 2654435761u + 1;
+        for (size_t i = 0; i < cb; i++)
+        {
+            state = state * 1103515245u + 12345u;
+            data[i] = (char)(state >> 24);
+        }
+        return data;
+    }
+
+    // Open path and extract it into dest with a job of its own, as the
+    // shell does.
+    ZipResult ExtractWithJob(const std::string &path, const std::string &dest)
+    {
+        std::shared_ptr<ZipJob> job = std::make_shared<ZipJob>(path, dest);
+        ZipJobQueue queue;
+        queue.Submit(job);
+        job->Wait();
+        return job->Result();
+    }
+
+    #pragma endregion
+
+    #pragma region Test jobs
+
+    // A job that runs a function in place of an extraction and counts its
+    // calls.
+    class FunctionJob : public ZipJob
+    {
+    public:
+        explicit FunctionJob(const std::function<ZipResult(FunctionJob &)> &fn) :
+            ZipJob("", ""), m_fn(fn), m_cRuns(0), m_cCompletes(0)
+        {
+        }
+
+        int RunCount() const { return m_cRuns; }
+        int CompleteCount() const { return m_cCompletes; }
+        ZipProgress &JobProgress() { return Progress(); }
+
+    protected:
+        virtual ZipResult Run()
+        {
+            m_cRuns++;
+            return m_fn(*this);
+        }
+
+        virtual void OnComplete()
+        {
+            m_cCompletes++;
+        }
+
+    private:
+        std::function<ZipResult(FunctionJob &)> m_fn;
+        std::atomic<int> m_cRuns;
+        std::atomic<int> m_cCompletes;
+    };
+
+    // A one-way signal between a test and a job.
+    class Gate
+    {
+    public:
+        Gate() : m_fOpen(false) {}
+
+        void Open()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_fOpen = true;
+            m_cv.notify_all();
+        }
+
+        bool Wait(unsigned msTimeout = 10000)
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            return m_cv.wait_for(lock, std::chrono::milliseconds(msTimeout),
+                [this] { return m_fOpen; });
+        }
+
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_cv;
+        bool m_fOpen;
+    };
+
+    #pragma endregion
+
+    #pragma region Tests
+
+    void TestQueueOrder()
+    {
+        std::mutex lock;
+        std::vector<int> order;
+        std::vector<std::shared_ptr<FunctionJob> > jobs;
+        ZipJobQueue queue;
+        for (int i = 0; i < 5; i++)
+        {
+            jobs.push_back(std::make_shared<FunctionJob>([&lock, &order, i](FunctionJob &)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                order.push_back(i);
+                return i == 3 ? ZR_BAD_FORMAT : ZR_OK;
+            }));
+            queue.Submit(jobs.back());
+        }
+        queue.WaitIdle();
+
+        CHECK(queue.Count() == 0);
+        CHECK(queue.IsIdle());
+        CHECK(order.size() == 5);
+        for (int i = 0; i < (int)order.size(); i++)
+        {
+            CHECK(order[i] == i);
+        }
+        for (int i = 0; i < 5; i++)
+        {
+            CHECK(jobs[i]->State() == ZJ_DONE);
+            CHECK(jobs[i]->Result() == (i == 3 ? ZR_BAD_FORMAT : ZR_OK));
+            CHECK(jobs[i]->RunCount() == 1);
+            CHECK(jobs[i]->CompleteCount() == 1);
+        }
+    }
+
+    void TestQueueParallel()
+    {
+        // Every job waits for all of them to have started, which only
+        // happens if the queue runs them at the same time.
+        const int cJobs = 3;
+        std::atomic<int> cStarted(0);
+        Gate allStarted;
+        std::vector<std::shared_ptr<FunctionJob> > jobs;
+        ZipJobQueue queue(cJobs);
+        for (int i = 0; i < cJobs; i++)
+        {
+            jobs.push_back(std::make_shared<FunctionJob>([&](FunctionJob &)
+            {
+                if (++cStarted == cJobs)
+                {
+                    allStarted.Open();
+                }
+                return allStarted.Wait() ? ZR_OK : ZR_STOP;
+            }));
+            queue.Submit(jobs.back());
+        }
+        queue.WaitIdle();
+        for (int i = 0; i < cJobs; i++)
+        {
+            CHECK(jobs[i]->Result() == ZR_OK);
+        }
+
+        // An idle queue starts threads again for new work.
+        std::shared_ptr<FunctionJob> later = std::make_shared<FunctionJob>(
+            [](FunctionJob &) { return ZR_OK; });
+        queue.Submit(later);
+        CHECK(later->Wait(10000));
+        queue.WaitIdle();
+        CHECK(queue.IsIdle());
+    }
+
+    void TestQueueCancel()
+    {
+        Gate started;
+        std::shared_ptr<FunctionJob> running = std::make_shared<FunctionJob>(
+            [&started](FunctionJob &job)
+        {
+            started.Open();
+            for (int i = 0; i < 10000 && !job.IsCancelled(); i++)
+            {
+                usleep(1000);
+            }
+            return job.IsCancelled() ? ZR_STOP : ZR_OK;
+        });
+        std::shared_ptr<FunctionJob> queued = std::make_shared<FunctionJob>(
+            [](FunctionJob &) { return ZR_OK; });
+
+        ZipJobQueue queue;
+        queue.Submit(running);
+        queue.Submit(queued);
+        CHECK(started.Wait());
+        CHECK(running->State() == ZJ_RUNNING);
+        CHECK(queued->State() == ZJ_QUEUED);
+        CHECK(queue.Count() == 2);
+
+        queue.CancelAll();
+        CHECK(running->Wait(10000));
+        CHECK(queued->Wait(10000));
+        queue.WaitIdle();
+
+        CHECK(running->Result() == ZR_STOP);
+        CHECK(queued->Result() == ZR_STOP);
+        CHECK(queued->RunCount() == 0);
+        CHECK(queued->CompleteCount() == 1);
+        CHECK(running->CompleteCount() == 1);
+    }
+
+    void TestQueueProgress()
+    {
+        Gate halfway, proceed;
+        std::shared_ptr<FunctionJob> job = std::make_shared<FunctionJob>(
+            [&](FunctionJob &self)
+        {
+            self.JobProgress().Begin(4, 4000);
+            for (int i = 0; i < 4; i++)
+            {
+                if (i == 2)
+                {
+                    halfway.Open();
+                    proceed.Wait();
+                }
+                self.JobProgress().AddBytes(1000);
+                self.JobProgress().AddEntry();
+            }
+            return ZR_OK;
+        });
+
+        ZipJobQueue queue;
+        queue.Submit(job);
+        CHECK(halfway.Wait());
+        ZipProgressSnapshot snapshot;
+        job->GetProgress(&snapshot);
+        CHECK(snapshot.cEntriesTotal == 4);
+        CHECK(snapshot.cbTotal == 4000);
+        CHECK(snapshot.cEntriesDone == 2);
+        CHECK(snapshot.cbDone == 2000);
+        CHECK(snapshot.fraction > 0.49 && snapshot.fraction < 0.51);
+        CHECK(!job->Wait(0));
+
+        proceed.Open();
+        queue.WaitIdle();
+        job->GetProgress(&snapshot);
+        CHECK(snapshot.cEntriesDone == 4);
+        CHECK(snapshot.cbDone == 4000);
+        CHECK(snapshot.fraction > 0.99);
+        CHECK(job->Result() == ZR_OK);
+    }
+
+    void TestExtractGood()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("a.txt", "hello"));
+        entries.push_back(MakeEntry("dir/b.bin", Pattern(300000, 1)));
+        entries.push_back(MakeEntry("dir/sub/empty", ""));
+        std::string archive = ScratchPath("good.zip");
+        std::string dest = ScratchPath("good");
+        CHECK(WriteArchive(archive, entries));
+
+        std::shared_ptr<ZipJob> job = std::make_shared<ZipJob>(archive, dest);
+        ZipJobQueue queue;
+        queue.Submit(job);
+        queue.WaitIdle();
+        CHECK(job->Result() == ZR_OK);
+
+        ZipProgressSnapshot snapshot;
+        job->GetProgress(&snapshot);
+        CHECK(snapshot.cEntriesDone == snapshot.cEntriesTotal);
+        CHECK(snapshot.cbDone == snapshot.cbTotal);
+        CHECK(snapshot.cbTotal == 300005);
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            std::string data;
+            CHECK(ReadWholeFile(dest + "/" + entries[i].name, &data));
+            CHECK(data == entries[i].data);
+        }
+    }
+
+    void TestExtractZipSlip()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("ok.txt", "fine"));
+        entries.push_back(MakeEntry("../slip-escaped.txt", "outside"));
+        std::string archive = ScratchPath("slip.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        CHECK(ExtractWithJob(archive, ScratchPath("slip")) == ZR_BAD_PATH);
+        CHECK(!FileExists(ScratchPath("slip-escaped.txt")));
+
+        // An absolute name is taken as relative to the destination.
+        entries[1].name = ScratchPath("slip-absolute.txt");
+        CHECK(WriteArchive(archive, entries));
+        CHECK(ExtractWithJob(archive, ScratchPath("slip2")) == ZR_OK);
+        CHECK(!FileExists(ScratchPath("slip-absolute.txt")));
+        CHECK(FileExists(ScratchPath("slip2") + ScratchPath("slip-absolute.txt")));
+    }
+
+    void TestExtractTruncated()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("whole.txt", "complete"));
+        entries.push_back(MakeEntry("cut.bin", Pattern(200000, 2)));
+        entries[1].cbMissing = 150000;
+        std::string archive = ScratchPath("cut.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        CHECK(ExtractWithJob(archive, ScratchPath("cut")) == ZR_TRUNCATED);
+    }
+
+    void TestExtractBadCrc()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("small.txt", "checked"));
+        entries.push_back(MakeEntry("large.bin", Pattern(500000, 3)));
+        entries[1].fBadCrc = true;
+        std::string archive = ScratchPath("crc.zip");
+        CHECK(WriteArchive(archive, entries));
+        CHECK(ExtractWithJob(archive, ScratchPath("crc")) == ZR_CRC_MISMATCH);
+
+        entries[1].fBadCrc = false;
+        entries[0].fBadCrc = true;
+        CHECK(WriteArchive(archive, entries));
+        CHECK(ExtractWithJob(archive, ScratchPath("crc2")) == ZR_CRC_MISMATCH);
+    }
+
+    void TestExtractSparse()
+    {
+        // Zeros from just past the start of the file to just short of its
+        // end: every whole block of the file in between is a hole.
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("disk.img",
+            std::string(1000, 'x') + std::string(5 << 20, '\0') + std::string(10, 'y')));
+        std::string archive = ScratchPath("sparse.zip");
+        std::string dest = ScratchPath("sparse");
+        CHECK(WriteArchive(archive, entries));
+
+        ZipArchive zip;
+        CHECK(zip.Open(archive) == ZR_OK);
+        ZipExtractor extractor(dest, 1);
+        extractor.SetSparseFiles(true);
+        ZipExtractStats stats;
+        CHECK(extractor.Extract(zip, &stats) == ZR_OK);
+        CHECK(stats.cbHoles == (5 << 20) - 4096);     // 4 KB blocks from 4 KB to 5 MB
+
+        std::string data;
+        CHECK(ReadWholeFile(dest + "/disk.img", &data));
+        CHECK(data == entries[0].data);
+    }
+
+    void TestSfxCheck()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("setup.ini", "[setup]"));
+        std::string archive = ScratchPath("plain.zip");
+        CHECK(WriteArchive(archive, entries));
+        std::string data;
+        CHECK(ReadWholeFile(archive, &data));
+
+        // A program in front of the archive, with offsets not adjusted for it.
+        std::string sfx = ScratchPath("setup.exe");
+        std::string program = "MZ" + Pattern(200000, 4);
+        FILE *pFile = fopen(sfx.c_str(), "wb");
+        CHECK(pFile != NULL);
+        if (pFile != NULL)
+        {
+            fwrite(program.data(), 1, program.size(), pFile);
+            fwrite(data.data(), 1, data.size(), pFile);
+            fclose(pFile);
+        }
+        CHECK(ZipArchive::IsArchive(sfx));
+        CHECK(ZipArchive::IsArchive(sfx, program.size() + data.size()));
+        CHECK(!ZipArchive::IsArchive(sfx, program.size()));
+
+        std::string exe = ScratchPath("tool.exe");
+        pFile = fopen(exe.c_str(), "wb");
+        CHECK(pFile != NULL);
+        if (pFile != NULL)
+        {
+            fwrite(program.data(), 1, program.size(), pFile);
+            fclose(pFile);
+        }
+        CHECK(!ZipArchive::IsArchive(exe));
+        CHECK(!ZipArchive::IsArchive(ScratchPath("missing.exe")));
+    }
+
+    // Fill a new directory dest with files named by names, each holding
+    // "old " and its name. The entries written over them hold "new ".
+    void WriteOldFiles(const std::string &dest, const char *const *pNames, size_t cNames)
+    {
+        CHECK(mkdir(dest.c_str(), 0777) == 0);
+        for (size_t i = 0; i < cNames; i++)
+        {
+            std::string path = dest + "/" + pNames[i];
+            size_t slash = path.find_last_of('/');
+            mkdir(path.substr(0, slash).c_str(), 0777);
+            CHECK(WriteData(path, std::string("old ") + pNames[i]));
+        }
+    }
+
+    // Extract archive into dest, over what is there, with policy.
+    ZipResult ExtractWithPolicy(const std::string &archive, const std::string &dest,
+        ZipOverwritePolicy policy, ZipExtractStats *pStats)
+    {
+        ZipArchive zip;
+        ZipResult result = zip.Open(archive);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+        ZipExtractor extractor(dest, 2);
+        extractor.SetOverwrite(policy);
+        return extractor.Extract(zip, pStats);
+    }
+
+    void TestExtractOverwrite()
+    {
+        // Entries are dated 2020: older than a file written now, newer than
+        // one dated 2000.
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("a.txt", "new a.txt"));
+        entries.push_back(MakeEntry("b.txt", "new b.txt"));
+        entries.push_back(MakeEntry("sub/c.txt", "new sub/c.txt", ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("fresh.txt", "new fresh.txt"));
+        std::string archive = ScratchPath("overwrite.zip");
+        CHECK(WriteArchive(archive, entries));
+        const char *const names[] = { "a.txt", "b.txt", "sub/c.txt" };
+
+        const ZipOverwritePolicy policies[] =
+        {
+            ZIP_OVERWRITE_ALWAYS, ZIP_OVERWRITE_NEVER, ZIP_OVERWRITE_NEWER
+        };
+        for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        {
+            std::string dest = ScratchPath("overwrite-") +
+                ZipOverwritePolicyToString(policies[i]);
+            WriteOldFiles(dest, names, sizeof(names) / sizeof(names[0]));
+            struct utimbuf times = { 946684800, 946684800 };     // 2000-01-01
+            CHECK(utime((dest + "/b.txt").c_str(), &times) == 0);
+
+            ZipExtractStats stats;
+            CHECK(ExtractWithPolicy(archive, dest, policies[i], &stats) == ZR_OK);
+            bool fNew[] =
+            {
+                policies[i] == ZIP_OVERWRITE_ALWAYS,
+                policies[i] != ZIP_OVERWRITE_NEVER,
+                policies[i] == ZIP_OVERWRITE_ALWAYS,
+                true
+            };
+            uint64_t cKept = 0;
+            for (size_t k = 0; k < entries.size(); k++)
+            {
+                std::string data;
+                CHECK(ReadWholeFile(dest + "/" + entries[k].name, &data));
+                CHECK(data == (fNew[k] ? "new " : "old ") + entries[k].name);
+                cKept += fNew[k] ? 0 : 1;
+            }
+            CHECK(stats.cKept == cKept && stats.cRenamed == 0);
+            CHECK(stats.cFiles == entries.size() - cKept);
+        }
+    }
+
+    void TestExtractOverwriteRename()
+    {
+        // "a (2).txt" is on disk and "a (3).txt" is in the archive, so a.txt
+        // goes to "a (4).txt"; "a (1).txt" is not a name renaming makes.
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("a.txt", "new a.txt"));
+        entries.push_back(MakeEntry("a (3).txt", "new a (3).txt"));
+        entries.push_back(MakeEntry("A.TXT", "new A.TXT"));
+        entries.push_back(MakeEntry(".profile", "new .profile"));
+        entries.push_back(MakeEntry("sub/notes", "new sub/notes", ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("fresh.txt", "new fresh.txt"));
+        std::string archive = ScratchPath("rename.zip");
+        CHECK(WriteArchive(archive, entries));
+        const char *const names[] =
+        {
+            "a.txt", "a (1).txt", "a (2).txt", ".profile", "sub/notes", "sub/notes (2)"
+        };
+        std::string dest = ScratchPath("rename");
+        WriteOldFiles(dest, names, sizeof(names) / sizeof(names[0]));
+
+        ZipExtractStats stats;
+        CHECK(ExtractWithPolicy(archive, dest, ZIP_OVERWRITE_RENAME, &stats) == ZR_OK);
+        CHECK(stats.cRenamed == 3 && stats.cKept == 0);
+        CHECK(stats.cFiles == entries.size());
+
+        const char *const expected[][2] =
+        {
+            { "a.txt",          "old a.txt" },
+            { "a (1).txt",      "old a (1).txt" },
+            { "a (2).txt",      "old a (2).txt" },
+            { "a (3).txt",      "new a (3).txt" },
+            { "a (4).txt",      "new a.txt" },
+            { "A.TXT",          "new A.TXT" },
+            { ".profile",       "old .profile" },
+            { ".profile (2)",   "new .profile" },
+            { "sub/notes",      "old sub/notes" },
+            { "sub/notes (2)",  "old sub/notes (2)" },
+            { "sub/notes (3)",  "new sub/notes" },
+            { "fresh.txt",      "new fresh.txt" },
+        };
+        for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+        {
+            std::string data;
+            CHECK(ReadWholeFile(dest + "/" + expected[i][0], &data) && data == expected[i][1]);
+        }
+    }
+
+    // Read the whole of a VFS file in pieces of cbPiece.
+    std::string VfsReadAll(ZipVfs &vfs, const std::string &path, size_t cbPiece)
+    {
+        std::string data;
+        ZipVfsFile file;
+        if (vfs.Open(path, &file) != ZR_OK)
+        {
+            return "<not opened>";
+        }
+        std::vector<char> buffer(cbPiece);
+        for (;;)
+        {
+            size_t cbRead = 0;
+            if (vfs.PRead(file, data.size(), &buffer[0], cbPiece, &cbRead) != ZR_OK)
+            {
+                return "<read failed>";
+            }
+            if (cbRead == 0)
+            {
+                return data;
+            }
+            data.append(&buffer[0], cbRead);
+        }
+    }
+
+    void TestVfsRead()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("docs/readme.txt", "read me", ZIP_METHOD_STORED));
+        entries.push_back(MakeEntry("data/big.bin", Pattern(1000000, 5) + std::string(300000, 'z'),
+            ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("data/sub/", ""));
+        std::string archive = ScratchPath("vfs.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        ZipVfs vfs;
+        CHECK(vfs.Mount(archive) == ZR_OK);
+
+        ZipVfsStat stat;
+        CHECK(vfs.Stat("data/big.bin", &stat) == ZR_OK);
+        CHECK(!stat.fDirectory && stat.size == 1300000);
+        CHECK(vfs.Stat("/data//./sub", &stat) == ZR_OK && stat.fDirectory);
+        CHECK(vfs.Stat("docs", &stat) == ZR_OK && stat.fDirectory);
+        CHECK(vfs.Stat("missing", &stat) == ZR_NOT_FOUND);
+
+        std::vector<std::string> names;
+        CHECK(vfs.ReadDir("", &names) == ZR_OK && names.size() == 2);
+        CHECK(vfs.ReadDir("data", &names) == ZR_OK && names.size() == 2);
+        CHECK(vfs.ReadDir("docs/readme.txt", &names) == ZR_BAD_PATH);
+        ZipVfsFile file;
+        CHECK(vfs.Open("data", &file) == ZR_BAD_PATH);
+
+        CHECK(VfsReadAll(vfs, "docs/readme.txt", 3) == entries[0].data);
+        CHECK(VfsReadAll(vfs, "data/big.bin", 100000) == entries[1].data);
+
+        // Reads at scattered offsets, some across cache blocks, served cold
+        // and from the cache.
+        CHECK(vfs.Open("data/big.bin", &file) == ZR_OK);
+        const std::string &data = entries[1].data;
+        uint64_t offsets[] = { 1299990, 5, 65530, 700001, 65530, 1000000 - 3 };
+        for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+        {
+            char buffer[100];
+            size_t cbRead = 0;
+            CHECK(vfs.PRead(file, offsets[i], buffer, sizeof(buffer), &cbRead) == ZR_OK);
+            size_t cbWanted = std::min<size_t>(sizeof(buffer), data.size() - (size_t)offsets[i]);
+            CHECK(cbRead == cbWanted &&
+                memcmp(buffer, data.data() + offsets[i], cbWanted) == 0);
+        }
+        BlockCacheStats stats = vfs.GetCacheStats();
+        CHECK(stats.hits > 0);
+    }
+
+    void TestVfsRemount()
+    {
+        // Two archives with the same layout: every block of the second has
+        // the owner and number a block of the first had.
+        std::string archiveA = ScratchPath("vfs-a.zip");
+        std::string archiveB = ScratchPath("vfs-b.zip");
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("f", std::string(200000, 'A'), ZIP_METHOD_DEFLATED));
+        CHECK(WriteArchive(archiveA, entries));
+        entries[0].data = std::string(200000, 'B');
+        CHECK(WriteArchive(archiveB, entries));
+
+        BlockCache shared(16 * 1024 * 1024);
+        ZipVfs own;
+        ZipVfs first(&shared);
+        ZipVfs second(&shared);
+        ZipVfs *views[] = { &own, &first };
+        for (size_t i = 0; i < 2; i++)
+        {
+            ZipVfs &vfs = *views[i];
+            CHECK(vfs.Mount(archiveA) == ZR_OK);
+            CHECK(VfsReadAll(vfs, "f", 4096) == std::string(200000, 'A'));
+            CHECK(vfs.Mount(archiveB) == ZR_OK);
+            CHECK(VfsReadAll(vfs, "f", 4096) == std::string(200000, 'B'));
+        }
+
+        // Two views of one cache keep apart too.
+        CHECK(second.Mount(archiveA) == ZR_OK);
+        CHECK(VfsReadAll(second, "f", 65536) == std::string(200000, 'A'));
+        CHECK(VfsReadAll(first, "f", 65536) == std::string(200000, 'B'));
+    }
+
+    // Offsets spread over cb bytes, and some next to the ends.
+    std::vector<uint64_t> ReadOffsets(uint64_t cb)
+    {
+        std::vector<uint64_t> offsets;
+        offsets.push_back(0);
+        offsets.push_back(cb - 1);
+        uint32_t state = 7;
+        for (int i = 0; i < 40; i++)
+        {
+            state = state * 1103515245u + 12345u;
+            offsets.push_back(((uint64_t)state << 8) % cb);
+        }
+        return offsets;
+    }
+
+    bool IndexReadsMatch(ZipSeekIndex &index, size_t entry, const std::string &data)
+    {
+        std::vector<uint64_t> offsets = ReadOffsets(data.size());
+        bool fMatch = true;
+        for (size_t i = 0; i < offsets.size(); i++)
+        {
+            char buffer[5000];
+            size_t cbRead = 0;
+            size_t cbWanted = std::min<size_t>(sizeof(buffer), data.size() - (size_t)offsets[i]);
+            fMatch = fMatch &&
+                index.Read(entry, offsets[i], buffer, sizeof(buffer), &cbRead) == ZR_OK &&
+                cbRead == cbWanted && memcmp(buffer, data.data() + offsets[i], cbWanted) == 0;
+        }
+        return fMatch;
+    }
+
+    void TestIndexSaveLoad()
+    {
+        // Random bytes go into stored blocks of up to 64 KB, text into
+        // compressed ones: both kinds of block boundary get checkpoints.
+        std::string text;
+        for (int i = 0; text.size() < 2000000; i++)
+        {
+            text += "line " + std::to_string(i * 7919 % 100003) + " of the text\n";
+        }
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("small.txt", "short", ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("large.bin", Pattern(1500000, 6) + text + Pattern(700000, 7),
+            ZIP_METHOD_DEFLATED));
+        std::string archive = ScratchPath("index.zip");
+        std::string cache = archive + ".zfxidx";
+        CHECK(WriteArchive(archive, entries));
+
+        ZipArchive zip;
+        CHECK(zip.Open(archive) == ZR_OK);
+        std::string saved;
+        {
+            ZipSeekIndex index(&zip, 64 * 1024);
+            index.Load();
+            CHECK(!FileExists(cache));
+            CHECK(index.BuildEntry(1) == ZR_OK);
+            CHECK(IndexReadsMatch(index, 1, entries[1].data));
+            CHECK(IndexReadsMatch(index, 0, entries[0].data));
+            CHECK(index.Save() == ZR_OK);
+            CHECK(ReadWholeFile(cache, &saved));
+            CHECK(saved.size() > 10 * 32768);
+        }
+        CHECK(!FileExists(cache + "." + std::to_string(getpid()) + ".tmp"));
+
+        // A second index takes the checkpoints from the cache rather than
+        // building them: saving it again writes the same file.
+        {
+            ZipSeekIndex index(&zip, 64 * 1024);
+            index.Load();
+            CHECK(index.Save() == ZR_OK);
+            std::string again;
+            CHECK(ReadWholeFile(cache, &again) && again == saved);
+            CHECK(IndexReadsMatch(index, 1, entries[1].data));
+        }
+
+        // A damaged cache is ignored and the index built again.
+        FILE *pFile = fopen(cache.c_str(), "wb");
+        CHECK(pFile != NULL);
+        if (pFile != NULL)
+        {
+            fwrite(saved.data(), 1, saved.size() / 2, pFile);
+            fclose(pFile);
+        }
+        {
+            ZipSeekIndex index(&zip, 64 * 1024);
+            index.Load();
+            CHECK(IndexReadsMatch(index, 1, entries[1].data));
+        }
+        std::string rebuilt;
+        CHECK(ReadWholeFile(cache, &rebuilt) && rebuilt == saved);
+    }
+
+    void TestIndexCheckpointCap()
+    {
+        // At the smallest span, 64 MB of random bytes would take about 1400
+        // checkpoints.
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("huge.bin", Pattern(64 << 20, 8), ZIP_METHOD_DEFLATED));
+        std::string archive = ScratchPath("cap.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        ZipArchive zip;
+        CHECK(zip.Open(archive) == ZR_OK);
+        ZipSeekIndex index(&zip, 32768);
+        CHECK(index.BuildEntry(0) == ZR_OK);
+        CHECK(IndexReadsMatch(index, 0, entries[0].data));
+        CHECK(index.Save() == ZR_OK);
+
+        // The checkpoint count of the one entry, after the 20 byte header
+        // and the 32 bytes in front of it in the entry.
+        std::string saved;
+        CHECK(ReadWholeFile(archive + ".zfxidx", &saved) && saved.size() > 56);
+        uint32_t cPoints = saved.size() > 56 ? ReadLE32((const uint8_t *)saved.data() + 52) : 0;
+        CHECK(cPoints > 512 && cPoints <= 1024);
+    }
+
+    void TestIndexBudget()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("large.bin", Pattern(4 << 20, 9), ZIP_METHOD_DEFLATED));
+        std::string archive = ScratchPath("budget.zip");
+        CHECK(WriteArchive(archive, entries));
+        ZipArchive zip;
+        CHECK(zip.Open(archive) == ZR_OK);
+
+        // Without a limit every span gets its checkpoint, each reserved.
+        ZipMemoryBudget budget;
+        uint64_t cbAll = 0;
+        {
+            ZipSeekIndex index(&zip, 64 * 1024, &budget);
+            CHECK(index.BuildEntry(0) == ZR_OK);
+            cbAll = budget.Used();
+            CHECK(cbAll > 50 * 32768);
+
+            // The budget takes them back for someone else, and the entry
+            // is built again on its next read.
+            budget.SetLimit(cbAll);
+            CHECK(budget.TryReserve(cbAll));
+            CHECK(budget.Used() == cbAll);
+            budget.Release(cbAll);
+            CHECK(IndexReadsMatch(index, 0, entries[0].data));
+            CHECK(budget.Used() == cbAll);
+        }
+        CHECK(budget.Used() == 0);
+
+        // Under a limit, fewer checkpoints and the same data.
+        budget.SetLimit(cbAll / 4);
+        {
+            ZipSeekIndex index(&zip, 64 * 1024, &budget);
+            CHECK(IndexReadsMatch(index, 0, entries[0].data));
+            CHECK(budget.Used() > 0 && budget.Used() <= cbAll / 4);
+        }
+        CHECK(budget.Used() == 0);
+    }
+
+    // The normal form of name, or "<refused>".
+    std::string Normalized(const char *pszName, bool fAllowEmpty = false)
+    {
+        std::string normalized;
+        return NormalizeEntryName(pszName, &normalized, fAllowEmpty) == ZR_OK ? normalized :
+            "<refused>";
+    }
+
+    void TestPathNormalize()
+    {
+        CHECK(Normalized("a/b/c.txt") == "a/b/c.txt");
+        CHECK(Normalized("a//b") == "a/b");
+        CHECK(Normalized("a/./b/.") == "a/b");
+        CHECK(Normalized("./a\\b") == "a/b");
+        CHECK(Normalized("/a/b/") == "a/b");
+        CHECK(Normalized("x/../a/b") == "a/b");
+        CHECK(Normalized("a/b/c/../../d") == "a/d");
+        CHECK(Normalized("a/b/../..//c") == "c");
+
+        // Above the top, at the top, or nothing at all.
+        CHECK(Normalized("../a") == "<refused>");
+        CHECK(Normalized("a/../../b") == "<refused>");
+        CHECK(Normalized("a\\..\\..\\b") == "<refused>");
+        CHECK(Normalized("a/..") == "<refused>");
+        CHECK(Normalized("") == "<refused>");
+        CHECK(Normalized("./") == "<refused>");
+        CHECK(Normalized("a/..", true) == "");
+        CHECK(Normalized("/", true) == "");
+        CHECK(Normalized("..", true) == "<refused>");
+
+        // Not components of their own.
+        CHECK(Normalized("...") == "...");
+        CHECK(Normalized("a/..b/.c") == "a/..b/.c");
+    }
+
+    void TestPathSet()
+    {
+        ZipPathSet exact(false);
+        CHECK(exact.Insert("dir/File.txt", true));
+        CHECK(!exact.Insert("dir/File.txt", true));
+        CHECK(exact.Insert("dir/file.txt", true));
+        CHECK(exact.Insert("dir", true));
+        CHECK(exact.Count() == 3);
+
+        ZipPathSet folded(true);
+        CHECK(folded.Insert("Dir/File.TXT", true));
+        CHECK(!folded.Insert("dir/file.txt", true));
+        CHECK(!folded.Insert("DIR/FILE.TXT", true));
+        CHECK(folded.Insert("dir/file.txt2", true));
+
+        // Beyond ASCII: UTF-8 "ÄÖ" and "äö", and the same letters in code
+        // page 437 (0x8E 0x99), all fold alike.
+        CHECK(folded.Insert("\xC3\x84\xC3\x96", true));
+        CHECK(!folded.Insert("\xC3\xA4\xC3\xB6", true));
+        CHECK(!folded.Insert("\x8E\x99", false));
+        CHECK(folded.Insert("\xCE\xA3", true));                  // Greek capital sigma
+        CHECK(!folded.Insert("\xCF\x83", true));                 // and small
+        CHECK(folded.Count() == 4);
+
+        // Enough names to make the table grow several times.
+        ZipPathSet many(true);
+        char name[32];
+        bool fAllNew = true;
+        for (int i = 0; i < 100000; i++)
+        {
+            snprintf(name, sizeof(name), "d%d/F%d", i % 97, i);
+            fAllNew = many.Insert(name, true) && fAllNew;
+        }
+        CHECK(fAllNew);
+        bool fAllSeen = true;
+        for (int i = 0; i < 100000; i += 7)
+        {
+            snprintf(name, sizeof(name), "D%d/f%d", i % 97, i);
+            fAllSeen = !many.Insert(name, true) && fAllSeen;
+        }
+        CHECK(fAllSeen);
+        CHECK(many.Count() == 100000);
+        many.Clear();
+        CHECK(many.Count() == 0 && many.Insert("d0/F0", true));
+    }
+
+    void TestPathSuperseded()
+    {
+        // Each of these writes dir/a.txt, ignoring case; the last one wins.
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("dir/a.txt", "first"));
+        entries.push_back(MakeEntry("dir/other.txt", "other"));
+        entries.push_back(MakeEntry("x/../dir/A.TXT", "second"));
+        entries.push_back(MakeEntry("dir//./a.txt", "last", ZIP_METHOD_DEFLATED));
+        std::string archive = ScratchPath("dup.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        for (int fIgnoreCase = 0; fIgnoreCase < 2; fIgnoreCase++)
+        {
+            std::string dest = ScratchPath(fIgnoreCase ? "dup-folded" : "dup-exact");
+            ZipArchive zip;
+            CHECK(zip.Open(archive) == ZR_OK);
+            ZipExtractor extractor(dest, 2);
+            extractor.SetIgnoreCase(fIgnoreCase != 0);
+            ZipExtractStats stats;
+            CHECK(extractor.Extract(zip, &stats) == ZR_OK);
+            CHECK(stats.cFiles == (fIgnoreCase ? 2u : 3u));
+
+            std::string data;
+            CHECK(ReadWholeFile(dest + "/dir/a.txt", &data) && data == "last");
+            CHECK(ReadWholeFile(dest + "/dir/other.txt", &data) && data == "other");
+            CHECK(FileExists(dest + "/dir/A.TXT") == !fIgnoreCase);
+        }
+    }
+
+    void TestVfsDotDot()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("x/../y.txt", "why", ZIP_METHOD_STORED));
+        entries.push_back(MakeEntry("a/b/../c.txt", "see", ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("../escape.txt", "out", ZIP_METHOD_STORED));
+        std::string archive = ScratchPath("vfs-dots.zip");
+        CHECK(WriteArchive(archive, entries));
+
+        ZipVfs vfs;
+        CHECK(vfs.Mount(archive) == ZR_OK);
+        CHECK(VfsReadAll(vfs, "y.txt", 16) == "why");
+        CHECK(VfsReadAll(vfs, "a/c.txt", 16) == "see");
+        CHECK(VfsReadAll(vfs, "a/q/../c.txt", 16) == "see");
+        ZipVfsStat stat;
+        CHECK(vfs.Stat("x", &stat) == ZR_NOT_FOUND);
+        CHECK(vfs.Stat("escape.txt", &stat) == ZR_NOT_FOUND);
+        CHECK(vfs.Stat("../escape.txt", &stat) == ZR_NOT_FOUND);
+        CHECK(vfs.Stat("a/..", &stat) == ZR_OK && stat.fDirectory);
+
+        std::vector<std::string> names;
+        CHECK(vfs.ReadDir("/", &names) == ZR_OK && names.size() == 2);
+    }
+
+    // The decoded name of the only entry of an archive of entries.
+    std::string DecodedName(const char *pszArchive, const TestEntry &entry)
+    {
+        std::string archive = ScratchPath(pszArchive);
+        if (!WriteArchive(archive, std::vector<TestEntry>(1, entry)))
+        {
+            return std::string();
+        }
+        ZipArchive zip;
+        if (zip.Open(archive) != ZR_OK || zip.EntryCount() != 1)
+        {
+            return std::string();
+        }
+        size_t index;
+        if (!zip.FindEntry(zip.Entry(0).name, &index) ||
+            zip.Entry(0).cbStoredName != entry.name.size() ||
+            (zip.Entry(0).flags & ZIP_FLAG_UTF8) == 0)
+        {
+            return std::string();
+        }
+        return zip.Entry(0).name;
+    }
+
+    void TestNameCp437()
+    {
+        // 0x8E and 0x84 are A and a with diaeresis in code page 437.
+        TestEntry entry = MakeEntry("\x8E\x84.txt", "x");
+        CHECK(DecodedName("cp437.zip", entry) == "\xC3\x84\xC3\xA4.txt");
+
+        entry = MakeEntry("plain.txt", "x");
+        CHECK(DecodedName("ascii.zip", entry) == "plain.txt");
+    }
+
+    void TestNameUnicodeExtra()
+    {
+        std::string stored = "\x8E.txt";
+        uint32_t crc = Crc32Update(0, stored.data(), stored.size());
+        TestEntry entry = MakeEntry(stored, "x");
+        entry.extra = UnicodePathExtra("\xE2\x82\xAC.txt", crc);
+        CHECK(DecodedName("unicode.zip", entry) == "\xE2\x82\xAC.txt");
+
+        // Written for another name: the stored name is decoded instead.
+        entry.extra = UnicodePathExtra("\xE2\x82\xAC.txt", crc ^ 1);
+        CHECK(DecodedName("unicode-stale.zip", entry) == "\xC3\x84.txt");
+    }
+
+    void TestNameUtf8Flag()
+    {
+        TestEntry entry = MakeEntry("\xC3\xA9t\xC3\xA9.txt", "x");
+        entry.flags = ZIP_FLAG_UTF8;
+        CHECK(DecodedName("utf8.zip", entry) == "\xC3\xA9t\xC3\xA9.txt");
+
+        // Not flagged, the same bytes are code page 437.
+        entry.flags = 0;
+        CHECK(DecodedName("utf8-unflagged.zip", entry) ==
+            "\xE2\x94\x9C\xE2\x8C\x90t\xE2\x94\x9C\xE2\x8C\x90.txt");
+
+        // Flagged but not valid UTF-8, they are taken as code page 437.
+        entry = MakeEntry("\x8E.txt", "x");
+        entry.flags = ZIP_FLAG_UTF8;
+        CHECK(DecodedName("utf8-bad.zip", entry) == "\xC3\x84.txt");
+    }
+
+    void TestNameBatch()
+    {
+        // Long stored names with short Unicode names: the small entries
+        // are read in one span only if it is sized from the stored names.
+        std::vector<TestEntry> entries;
+        for (int i = 0; i < 8; i++)
+        {
+            char szName[16];
+            snprintf(szName, sizeof(szName), "%d.txt", i);
+            std::string stored = std::string(300, '\x8E') + szName;
+            entries.push_back(MakeEntry(stored, Pattern(100, i)));
+            entries.back().extra = UnicodePathExtra(szName,
+                Crc32Update(0, stored.data(), stored.size()));
+        }
+        std::string archive = ScratchPath("batch-names.zip");
+        std::string dest = ScratchPath("batch-names");
+        CHECK(WriteArchive(archive, entries));
+
+        ZipArchive zip;
+        CHECK(zip.Open(archive) == ZR_OK);
+        ZipExtractor extractor(dest, 1);
+        ZipExtractStats stats;
+        CHECK(extractor.Extract(zip, &stats) == ZR_OK);
+        CHECK(stats.cFiles == 8 && stats.cBatchedFiles == 8);
+        for (int i = 0; i < 8; i++)
+        {
+            char szName[16];
+            snprintf(szName, sizeof(szName), "/%d.txt", i);
+            std::string data;
+            CHECK(ReadWholeFile(dest + szName, &data) && data == entries[i].data);
+        }
+    }
+
+    // Entries for a split archive: one spans several volumes.
+    std::vector<TestEntry> VolumeEntries()
+    {
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("a.txt", "first"));
+        entries.push_back(MakeEntry("big.bin", Pattern(200000, 7)));
+        entries.push_back(MakeEntry("dir/c.txt", std::string(5000, 'c'), ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("d.bin", Pattern(40000, 8), ZIP_METHOD_DEFLATED));
+        return entries;
+    }
+
+    // Cut data every cb bytes into the files pszFormat names with 1, 2, ...
+    // and return how many there are. The last is named pszLast if given.
+    int WriteVolumes(const std::string &data, size_t cb, const char *pszFormat,
+        const char *pszLast)
+    {
+        int cVolumes = (int)((data.size() + cb - 1) / cb);
+        for (int i = 0; i < cVolumes; i++)
+        {
+            char szName[64];
+            snprintf(szName, sizeof(szName), pszFormat, i + 1);
+            std::string path = ScratchPath(pszLast != NULL && i == cVolumes - 1 ? pszLast : szName);
+            if (!WriteData(path, data.substr(i * cb, cb)))
+            {
+                return 0;
+            }
+        }
+        return cVolumes;
+    }
+
+    // Open the set through path, check it has cVolumes volumes, and
+    // extract it.
+    void CheckVolumeSet(const char *pszPath, int cVolumes, const char *pszDest)
+    {
+        std::string path = ScratchPath(pszPath);
+        std::string dest = ScratchPath(pszDest);
+        CHECK(ZipArchive::IsArchive(path));
+        ZipArchive zip;
+        CHECK(zip.Open(path) == ZR_OK);
+        CHECK(zip.VolumeCount() == (size_t)cVolumes && zip.EntryCount() == 4);
+        zip.Close();
+
+        CHECK(ExtractWithJob(path, dest) == ZR_OK);
+        std::vector<TestEntry> entries = VolumeEntries();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            std::string data;
+            CHECK(ReadWholeFile(dest + "/" + entries[i].name, &data) &&
+                data == entries[i].data);
+        }
+    }
+
+    void TestVolumeSpanned()
+    {
+        // name.z01, name.z02, ... name.zip, with offsets within each disk.
+        const size_t cbDisk = 64 * 1024;
+        int cVolumes = WriteVolumes(BuildArchive(VolumeEntries(), cbDisk), cbDisk,
+            "span.z%02d", "span.zip");
+        CHECK(cVolumes > 2);
+        CheckVolumeSet("span.z01", cVolumes, "span-first");
+        CheckVolumeSet("span.z02", cVolumes, "span-middle");
+        CheckVolumeSet("span.zip", cVolumes, "span-last");
+    }
+
+    void TestVolumeSplit()
+    {
+        // name.zip.001, name.zip.002, ...: an ordinary archive cut up.
+        const size_t cbVolume = 50000;
+        int cVolumes = WriteVolumes(BuildArchive(VolumeEntries()), cbVolume,
+            "split.zip.%03d", NULL);
+        CHECK(cVolumes > 3);
+        CheckVolumeSet("split.zip.001", cVolumes, "split-first");
+        CheckVolumeSet("split.zip.003", cVolumes, "split-middle");
+
+        // Another tool's split output is not offered for extraction.
+        CHECK(WriteVolumes(Pattern(120000, 9), cbVolume, "other.bin.%03d", NULL) == 3);
+        CHECK(!ZipArchive::IsArchive(ScratchPath("other.bin.001")));
+        CHECK(!ZipArchive::IsArchive(ScratchPath("other.bin.002")));
+    }
+
+    // Read data front to back with ZipStreamExtractor into pszDest and
+    // check that each of entries came out whole.
+    void CheckStreamed(const std::string &data, const std::vector<TestEntry> &entries,
+        const char *pszDest)
+    {
+        std::string dest = ScratchPath(pszDest);
+        MemoryInputStream stream(data.data(), data.size());
+        ZipStreamExtractor extractor(dest);
+        CHECK(extractor.Extract(&stream) == ZR_OK);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            std::string out;
+            CHECK(ReadWholeFile(dest + "/" + entries[i].name, &out) && out == entries[i].data);
+        }
+    }
+
+    // Entries of each method written with the given descriptor form. The
+    // stored ones hold signatures that are not the end of their data: an
+    // archive of their own, and "PK" runs.
+    std::vector<TestEntry> DescriptorEntries(DescriptorForm form)
+    {
+        std::vector<TestEntry> inner;
+        inner.push_back(MakeEntry("inner.txt", "inside"));
+        inner.back().descriptor = form;
+
+        std::vector<TestEntry> entries;
+        entries.push_back(MakeEntry("nested.zip", BuildArchive(inner)));
+        entries.push_back(MakeEntry("pk.txt", "PKPK\x07\x08PK\x01\x02" + Pattern(3000, 11)));
+        entries.push_back(MakeEntry("empty.txt", ""));
+        entries.push_back(MakeEntry("text.txt", std::string(20000, 't'), ZIP_METHOD_DEFLATED));
+        entries.push_back(MakeEntry("random.bin", Pattern(70000, 12), ZIP_METHOD_DEFLATED));
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            entries[i].descriptor = form;
+        }
+        return entries;
+    }
+
+    void TestStreamStored()
+    {
+        std::vector<TestEntry> entries = DescriptorEntries(kDescriptor);
+        entries.resize(3);
+        CheckStreamed(BuildArchive(entries), entries, "stream-stored");
+    }
+
+    void TestStreamDeflated()
+    {
+        std::vector<TestEntry> entries = DescriptorEntries(kDescriptor);
+        entries.erase(entries.begin(), entries.begin() + 3);
+        CheckStreamed(BuildArchive(entries), entries, "stream-deflated");
+    }
+
+    void TestStreamZip64()
+    {
+        std::vector<TestEntry> entries = DescriptorEntries(kZip64Descriptor);
+        CheckStreamed(BuildArchive(entries), entries, "stream-zip64");
+    }
+
+    void TestStreamUnsigned()
+    {
+        std::vector<TestEntry> entries = DescriptorEntries(kUnsignedDescriptor);
+        CheckStreamed(BuildArchive(entries), entries, "stream-unsigned");
+
+        // Mixed with signed ones and entries that record their sizes.
+        entries[0].descriptor = kDescriptor;
+        entries[2].descriptor = kNoDescriptor;
+        entries[3].descriptor = kZip64Descriptor;
+        CheckStreamed(BuildArchive(entries), entries, "stream-mixed");
+    }
+
+    void TestStreamMarker()
+    {
+        // Split archives start with PK\7\8, single disk "spanned" ones
+        // with PK00; neither is an entry.
+        std::vector<TestEntry> entries = DescriptorEntries(kDescriptor);
+        std::string archive = BuildArchive(entries);
+        std::string marked;
+        Put32(marked, ZIP_SIG_SPANNING_MARKER);
+        CheckStreamed(marked + archive, entries, "stream-pk00");
+        marked.clear();
+        Put32(marked, ZIP_SIG_DATA_DESCRIPTOR);
+        CheckStreamed(marked + archive, entries, "stream-pk78");
+    }
+
+    #pragma endregion
+
+    struct Test
+    {
+        const char *pszName;
+        void (*pfn)();
+    };
+
+    const Test g_tests[] =
+    {
+        { "queue/order",        TestQueueOrder },
+        { "queue/parallel",     TestQueueParallel },
+        { "queue/cancel",       TestQueueCancel },
+        { "queue/progress",     TestQueueProgress },
+        { "extract/good",       TestExtractGood },
+        { "extract/zipslip",    TestExtractZipSlip },
+        { "extract/truncated",  TestExtractTruncated },
+        { "extract/badcrc",     TestExtractBadCrc },
+        { "extract/sparse",     TestExtractSparse },
+        { "extract/sfxcheck",   TestSfxCheck },
+        { "extract/overwrite",  TestExtractOverwrite },
+        { "extract/rename",     TestExtractOverwriteRename },
+        { "index/saveload",     TestIndexSaveLoad },
+        { "index/cap",          TestIndexCheckpointCap },
+        { "index/budget",       TestIndexBudget },
+        { "vfs/read",           TestVfsRead },
+        { "vfs/remount",        TestVfsRemount },
+        { "vfs/dotdot",         TestVfsDotDot },
+        { "path/normalize",     TestPathNormalize },
+        { "path/set",           TestPathSet },
+        { "path/superseded",    TestPathSuperseded },
+        { "name/cp437",         TestNameCp437 },
+        { "name/unicode",       TestNameUnicodeExtra },
+        { "name/utf8",          TestNameUtf8Flag },
+        { "name/batch",         TestNameBatch },
+        { "volume/spanned",     TestVolumeSpanned },
+        { "volume/split",       TestVolumeSplit },
+        { "stream/stored",      TestStreamStored },
+        { "stream/deflated",    TestStreamDeflated },
+        { "stream/zip64",       TestStreamZip64 },
+        { "stream/unsigned",    TestStreamUnsigned },
+        { "stream/marker",      TestStreamMarker },
+    };
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *pszFilter = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            pszFilter = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: ziptests [--filter SUBSTRING]\n");
+            return 2;
+        }
+    }
+
+    const char *pszTemp = getenv("TMPDIR");
+    std::string scratch = std::string(pszTemp != NULL ? pszTemp : "/tmp") + "/ziptests.XXXXXX";
+    if (mkdtemp(&scratch[0]) == NULL)
+    {
+        perror("mkdtemp");
+        return 2;
+    }
+    g_scratch = scratch;
+
+    int cFailed = 0;
+    for (size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); i++)
+    {
+        if (pszFilter != NULL && strstr(g_tests[i].pszName, pszFilter) == NULL)
+        {
+            continue;
+        }
+        g_cChecksFailed = 0;
+        fprintf(stderr, "%-20s ", g_tests[i].pszName);
+        g_tests[i].pfn();
+        fprintf(stderr, "%s\n", g_cChecksFailed == 0 ? "ok" : "FAILED");
+        cFailed += g_cChecksFailed != 0;
+    }
+
+    std::string command = "rm -rf '" + g_scratch + "'";
+    if (system(command.c_str()) != 0)
+    {
+        fprintf(stderr, "could not remove %s\n", g_scratch.c_str());
+    }
+    return cFailed;
+}
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Compare two kernelbench JSON result files.
+
+Usage: compare.py BASE.json NEW.json [--threshold PERCENT]
+
+Prints the change in time per iteration of every benchmark present in both
+files and exits with status 1 if any of them got slower by more than the
+threshold (default 5%), so it can gate a change in a script or CI job.
+
+A file may hold several results of the same name, as run_scenarios.py
+--runs N writes; they are compared by their median, and the spread column
+shows how far the slowest and fastest of the new runs are from it.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    runs = {}
+    for r in data["results"]:
+        runs.setdefault(r["name"], []).append(r["ns_per_iter"])
+    return runs
+
+
+def spread(times):
+    middle = statistics.median(times)
+    if len(times) < 2 or middle <= 0:
+        return ""
+    return "%+.1f/%+.1f%%" % ((min(times) - middle) / middle * 100.0,
+                              (max(times) - middle) / middle * 100.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="slowdown in percent that counts as a regression")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+
+    regressions = []
+    print("%-28s %14s %14s %9s %15s" % ("benchmark", "base ns", "new ns", "change",
+                                         "spread"))
+    for name in base:
+        if name not in new:
+            continue
+        before = statistics.median(base[name])
+        after = statistics.median(new[name])
+        change = (after - before) / before * 100.0 if before > 0 else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions.append(name)
+        elif change < -args.threshold:
+            mark = "  improved"
+        print("%-28s %14.1f %14.1f %+8.1f%% %15s%s" % (name, before, after, change,
+                                                     spread(new[name]), mark))
+
+    for name in sorted(set(base) ^ set(new)):
+        print("%-28s only in %s" % (name, args.base if name in base else args.new))
+
+    if regressions:
+        print("\n%d regression(s) over %.1f%%" % (len(regressions), args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
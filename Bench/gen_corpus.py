@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Generate the synthetic archives used by run_scenarios.py.
+
+Usage: gen_corpus.py [--out DIR] [--scale FACTOR] [--seed N] [SCENARIO ...]
+
+Scenarios (all by default):
+
+  tiny    1,000,000 files of 0-2 KB in directories of 1,000
+  huge    a single 20 GiB entry (ZIP64)
+  mixed   about 2 GiB of mixed media: already compressed data stored,
+          text and binaries deflated, sizes from 1 KB to 64 MB
+  deep    20,000 files spread over directory trees up to 64 levels deep
+  many    64 archives of 500 files each, to be extracted at the same time
+
+--scale multiplies file counts and sizes, so --scale 0.01 gives a corpus
+small enough for a quick check. Every scenario directory gets a
+manifest.json listing its archives and the total files and bytes they
+expand to, which the harness uses for throughput figures. The same seed
+and scale give byte-for-byte the same archives.
+"""
+
+import argparse
+import json
+import os
+import random
+import sys
+import zipfile
+
+GIB = 1 << 30
+MIB = 1 << 20
+
+
+class DataSource:
+    """Cheap pseudo-random content, sliced from pre-generated pools."""
+
+    def __init__(self, seed):
+        rng = random.Random(seed)
+        words = [bytes(rng.choice(b"abcdefghijklmnopqrstuvwxyz")
+                       for _ in range(rng.randint(2, 10))) for _ in range(3000)]
+        lines = []
+        size = 0
+        while size < 8 * MIB:
+            line = b" ".join(rng.choices(words, k=12)) + b"\n"
+            lines.append(line)
+            size += len(line)
+        self.text = b"".join(lines)
+        self.random = rng.getrandbits(8 * 8 * MIB).to_bytes(8 * MIB, "little")
+        # Executable-like: short random runs between repeated text.
+        parts = []
+        size = 0
+        while size < 8 * MIB:
+            at = rng.randrange(4 * MIB)
+            parts.append(self.random[at:at + rng.randint(8, 64)])
+            parts.append(self.text[at:at + rng.randint(16, 256)])
+            size += len(parts[-1]) + len(parts[-2])
+        self.binary = b"".join(parts)
+        self.rng = rng
+
+    def take(self, pool, size):
+        out = bytearray()
+        while len(out) < size:
+            start = self.rng.randrange(len(pool) // 2)
+            out += pool[start:start + min(size - len(out), len(pool) // 2)]
+        return bytes(out)
+
+
+def scaled(value, scale, minimum=1):
+    return max(minimum, int(value * scale))
+
+
+def entry(name):
+    # A fixed time stamp, so that the same seed gives the same archive.
+    return zipfile.ZipInfo(name, (2020, 1, 1, 0, 0, 0))
+
+
+def write_manifest(directory, name, archives, files, size):
+    manifest = {
+        "scenario": name,
+        "archives": [os.path.basename(a) for a in archives],
+        "files": files,
+        "bytes": size,
+    }
+    with open(os.path.join(directory, "manifest.json"), "w") as f:
+        json.dump(manifest, f, indent=4)
+        f.write("\n")
+
+
+def gen_tiny(directory, scale, source):
+    count = scaled(1000000, scale)
+    path = os.path.join(directory, "tiny.zip")
+    total = 0
+    with zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED, allowZip64=True) as z:
+        for i in range(count):
+            size = source.rng.randint(0, 2048)
+            z.writestr(entry("d%04d/f%07d.txt" % (i // 1000, i)),
+                       source.take(source.text, size) if size else b"",
+                       compress_type=zipfile.ZIP_DEFLATED)
+            total += size
+    return [path], count, total
+
+
+def gen_huge(directory, scale, source):
+    size = scaled(20 * GIB, scale, MIB)
+    path = os.path.join(directory, "huge.zip")
+    with zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED, compresslevel=1,
+                         allowZip64=True) as z:
+        info = entry("huge.bin")
+        info.compress_type = zipfile.ZIP_DEFLATED
+        info._compresslevel = 1
+        with z.open(info, "w", force_zip64=True) as f:
+            written = 0
+            while written < size:
+                chunk = min(4 * MIB, size - written)
+                pool = source.text if (written // (64 * MIB)) % 2 == 0 else source.binary
+                f.write(source.take(pool, chunk))
+                written += chunk
+    return [path], 1, size
+
+
+def gen_mixed(directory, scale, source):
+    budget = scaled(2 * GIB, scale, MIB)
+    path = os.path.join(directory, "mixed.zip")
+    files = 0
+    total = 0
+    with zipfile.ZipFile(path, "w", allowZip64=True) as z:
+        while total < budget:
+            # Log-uniform sizes between 1 KB and 64 MB.
+            size = int(2 ** source.rng.uniform(10, 26))
+            size = min(size, budget - total)
+            kind = source.rng.random()
+            if kind < 0.4:
+                name, pool, method = "media/%06d.jpg" % files, source.random, zipfile.ZIP_STORED
+            elif kind < 0.8:
+                name, pool, method = "docs/%06d.txt" % files, source.text, zipfile.ZIP_DEFLATED
+            else:
+                name, pool, method = "bin/%06d.dll" % files, source.binary, zipfile.ZIP_DEFLATED
+            z.writestr(entry(name), source.take(pool, size),
+                       compress_type=method)
+            files += 1
+            total += size
+    return [path], files, total
+
+
+def gen_deep(directory, scale, source):
+    count = scaled(20000, scale)
+    path = os.path.join(directory, "deep.zip")
+    total = 0
+    with zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED, allowZip64=True) as z:
+        for i in range(count):
+            depth = source.rng.randint(1, 64)
+            branch = i % 97
+            parts = ["l%02d_%d" % (level, (branch + level) % 7) for level in range(depth)]
+            size = source.rng.randint(0, 16384)
+            z.writestr(entry("/".join(parts + ["f%06d.txt" % i])),
+                       source.take(source.text, size), compress_type=zipfile.ZIP_DEFLATED)
+            total += size
+    return [path], count, total
+
+
+def gen_many(directory, scale, source):
+    archives = []
+    files = 0
+    total = 0
+    per_archive = scaled(500, scale)
+    for a in range(64):
+        path = os.path.join(directory, "many%02d.zip" % a)
+        with zipfile.ZipFile(path, "w", zipfile.ZIP_DEFLATED, allowZip64=True) as z:
+            for i in range(per_archive):
+                size = int(2 ** source.rng.uniform(8, 18))
+                pool = source.text if i % 3 else source.binary
+                z.writestr(entry("part%d/f%05d.dat" % (i % 4, i)), source.take(pool, size),
+                           compress_type=zipfile.ZIP_DEFLATED)
+                files += 1
+                total += size
+        archives.append(path)
+    return archives, files, total
+
+
+SCENARIOS = {
+    "tiny": gen_tiny,
+    "huge": gen_huge,
+    "mixed": gen_mixed,
+    "deep": gen_deep,
+    "many": gen_many,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--out", default="corpus")
+    parser.add_argument("--scale", type=float, default=1.0)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("scenarios", nargs="*", metavar="SCENARIO")
+    args = parser.parse_args()
+    for name in args.scenarios:
+        if name not in SCENARIOS:
+            parser.error("unknown scenario '%s'" % name)
+
+    for name in args.scenarios or list(SCENARIOS):
+        directory = os.path.join(args.out, name)
+        os.makedirs(directory, exist_ok=True)
+        print("generating %s ..." % name, file=sys.stderr)
+        archives, files, size = SCENARIOS[name](directory, args.scale, DataSource(args.seed))
+        write_manifest(directory, name, archives, files, size)
+        print("  %d archive(s), %d files, %.1f MB" % (len(archives), files, size / 1e6),
+              file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Run the end-to-end extraction scenarios against a gen_corpus.py corpus.
+
+Usage: run_scenarios.py [--corpus DIR] [--zfx PATH] [--dest DIR]
+                        [--modes cold,warm] [--runs N] [--threads N]
+                        [--jobs N] [--strace] [--drop-caches] [-o FILE]
+                        [SCENARIO ...]
+
+Each scenario is extracted with the zfx command-line tool once per mode
+and run. A cold run first evicts the archives from the page cache with
+posix_fadvise(POSIX_FADV_DONTNEED), or drops all caches when --drop-caches
+is given and the script runs as root; a warm run reads the archives once
+beforehand. Scenarios with several archives extract up to --jobs of them
+at the same time.
+
+For every run the JSON output records wall time, MB/s and files/s of
+uncompressed data, peak resident set size of the largest zfx process, the
+read and write system call counts (from /proc/self/io, or every system
+call from strace -c with --strace) and the per-stage times zfx reports,
+summed over its processes. Results also carry "name" and "ns_per_iter"
+keys, so two runs can be compared with compare.py.
+"""
+
+import argparse
+import concurrent.futures
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def evict(path):
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        os.fdatasync(fd)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+    finally:
+        os.close(fd)
+
+
+def preload(path):
+    with open(path, "rb") as f:
+        while f.read(8 << 20):
+            pass
+
+
+def prepare_cache(archives, mode, drop_caches):
+    if mode == "warm":
+        for path in archives:
+            preload(path)
+        return
+    os.sync()
+    if drop_caches and os.geteuid() == 0:
+        with open("/proc/sys/vm/drop_caches", "w") as f:
+            f.write("3\n")
+    else:
+        for path in archives:
+            evict(path)
+
+
+def strace_total(path):
+    # The last line of strace -c is the total: "100.00 secs usecs/call calls [errors] total".
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if fields and fields[-1] == "total":
+                return int(fields[3])
+    return -1
+
+
+def run_zfx(args, archive, dest):
+    command = [args.zfx, archive, dest]
+    if args.threads:
+        command[1:1] = ["--threads", str(args.threads)]
+    trace = None
+    if args.strace:
+        handle, trace = tempfile.mkstemp(suffix=".strace")
+        os.close(handle)
+        command = ["strace", "-f", "-c", "-o", trace] + command
+    try:
+        proc = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                              universal_newlines=True)
+        if proc.returncode not in (0, 1) or not proc.stdout.strip():
+            raise RuntimeError("%s failed: %s" % (" ".join(command), proc.stderr.strip()))
+        report = json.loads(proc.stdout)
+        if trace:
+            report["syscalls"] = {"total": strace_total(trace)}
+        return report
+    finally:
+        if trace:
+            os.unlink(trace)
+
+
+def run_scenario(args, directory, manifest, mode, run):
+    archives = [os.path.join(directory, name) for name in manifest["archives"]]
+    dest_root = os.path.join(args.dest, manifest["scenario"])
+    shutil.rmtree(dest_root, ignore_errors=True)
+    os.makedirs(dest_root)
+    prepare_cache(archives, mode, args.drop_caches)
+
+    def extract(archive):
+        name = os.path.splitext(os.path.basename(archive))[0]
+        return run_zfx(args, archive, os.path.join(dest_root, name))
+
+    start = time.perf_counter()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        reports = list(pool.map(extract, archives))
+    wall = time.perf_counter() - start
+    shutil.rmtree(dest_root, ignore_errors=True)
+
+    failed = [r["result"] for r in reports if r["result"] != "ok"]
+    stages = {}
+    syscalls = {}
+    for report in reports:
+        for key, value in report.get("stages", {}).items():
+            stages[key] = stages.get(key, 0.0) + value
+        for key, value in report.get("syscalls", {}).items():
+            if value >= 0:
+                syscalls[key] = syscalls.get(key, 0) + value
+
+    name = "%s/%s" % (manifest["scenario"], mode)
+    return {
+        "name": name,
+        "scenario": manifest["scenario"],
+        "mode": mode,
+        "run": run,
+        "result": failed[0] if failed else "ok",
+        "archives": len(archives),
+        "files": sum(r["files"] for r in reports),
+        "bytes": sum(r["bytes"] for r in reports),
+        "wall_s": wall,
+        "ns_per_iter": wall * 1e9,
+        "mb_per_s": manifest["bytes"] / wall / 1e6 if wall > 0 else 0.0,
+        "files_per_s": manifest["files"] / wall if wall > 0 else 0.0,
+        "peak_rss_kb": max(r["peak_rss_kb"] for r in reports),
+        "syscalls": syscalls,
+        "stages": stages,
+    }
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--corpus", default="corpus")
+    parser.add_argument("--zfx", default=os.path.join(here, "build", "zfx"))
+    parser.add_argument("--dest", default=None,
+                        help="scratch directory for output (default: <corpus>/_out)")
+    parser.add_argument("--modes", default="cold,warm")
+    parser.add_argument("--runs", type=int, default=1)
+    parser.add_argument("--threads", type=int, default=0,
+                        help="zfx worker threads per archive (default: zfx decides)")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count() or 1,
+                        help="archives extracted at the same time")
+    parser.add_argument("--strace", action="store_true",
+                        help="count every system call with strace -c")
+    parser.add_argument("--drop-caches", action="store_true",
+                        help="drop the whole page cache before cold runs (root only)")
+    parser.add_argument("-o", "--output", default=None)
+    parser.add_argument("scenarios", nargs="*", metavar="SCENARIO")
+    args = parser.parse_args()
+    args.dest = args.dest or os.path.join(args.corpus, "_out")
+
+    if args.strace and shutil.which("strace") is None:
+        parser.error("--strace given but strace is not installed")
+    modes = [m for m in args.modes.split(",") if m]
+    for mode in modes:
+        if mode not in ("cold", "warm"):
+            parser.error("unknown mode '%s'" % mode)
+
+    scenarios = args.scenarios or sorted(
+        d for d in os.listdir(args.corpus)
+        if os.path.isfile(os.path.join(args.corpus, d, "manifest.json")))
+
+    results = []
+    failed = False
+    for scenario in scenarios:
+        directory = os.path.join(args.corpus, scenario)
+        with open(os.path.join(directory, "manifest.json")) as f:
+            manifest = json.load(f)
+        for mode in modes:
+            for run in range(args.runs):
+                r = run_scenario(args, directory, manifest, mode, run)
+                results.append(r)
+                failed = failed or r["result"] != "ok"
+                print("%-12s %8.3f s %9.1f MB/s %10.0f files/s %8d KB  %s" % (
+                    r["name"], r["wall_s"], r["mb_per_s"], r["files_per_s"],
+                    r["peak_rss_kb"], r["result"]), file=sys.stderr)
+
+    out = {"suite": "scenarios", "results": results}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(out, f, indent=4)
+            f.write("\n")
+    else:
+        json.dump(out, sys.stdout, indent=4)
+        print()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,255 @@
+/****************************** Module Header ******************************\
+Module Name:  BlockCache.cpp
+Project:      ZipFolderEx
+
+The file implements the sharded LRU block cache declared in BlockCache.h.
+\***************************************************************************/
+
+#include "BlockCache.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace
+{
+    // Rough per-block bookkeeping (list node, hash node, vector header), so
+    // that a cache of small blocks still respects its cap.
+    const uint64_t kNodeOverhead = 96;
+
+    // Owner IDs are handed out in ranges of this size; an archive uses its
+    // entry index as the low bits.
+    const uint64_t kOwnerRange = (uint64_t)1 << 32;
+
+    const uint64_t kMinShardBlocks = 8;
+}
+
+
+BlockCache::BlockCache(uint64_t cbLimit, size_t cbBlock, size_t cShards,
+    ZipMemoryBudget *pBudget) :
+    m_pBudget(pBudget), m_nextReclaimShard(0), m_cbBlock(std::max<size_t>(cbBlock, 1)),
+    m_cbLimit(cbLimit), m_nextOwner(0)
+{
+    // Each shard evicts on its own, so a shard must hold a few blocks for a
+    // small cap to be useful at all.
+    cShards = (size_t)std::min<uint64_t>(cShards, cbLimit / (kMinShardBlocks * Cost(m_cbBlock)));
+    cShards = std::max<size_t>(cShards, 1);
+    m_cbShardLimit = cbLimit / cShards;
+    m_shards.resize(cShards);
+    for (size_t i = 0; i < cShards; i++)
+    {
+        m_shards[i] = new Shard();
+        m_shards[i]->cbUsed = 0;
+        m_shards[i]->hits = 0;
+        m_shards[i]->misses = 0;
+        m_shards[i]->insertions = 0;
+        m_shards[i]->evictions = 0;
+    }
+    if (m_pBudget != NULL)
+    {
+        m_pBudget->AddReclaimer(this);
+    }
+}
+
+BlockCache::~BlockCache()
+{
+    if (m_pBudget != NULL)
+    {
+        m_pBudget->RemoveReclaimer(this);
+    }
+    Clear();
+    for (size_t i = 0; i < m_shards.size(); i++)
+    {
+        delete m_shards[i];
+    }
+}
+
+uint64_t BlockCache::NewOwnerRange()
+{
+    return m_nextOwner.fetch_add(kOwnerRange);
+}
+
+BlockCache::Shard &BlockCache::ShardFor(const Key &key)
+{
+    return *m_shards[KeyHash()(key) % m_shards.size()];
+}
+
+uint64_t BlockCache::Cost(size_t cbData)
+{
+    return cbData + kNodeOverhead;
+}
+
+void BlockCache::ReleaseMemory(uint64_t cb)
+{
+    if (m_pBudget != NULL && cb > 0)
+    {
+        m_pBudget->Release(cb);
+    }
+}
+
+bool BlockCache::Read(uint64_t owner, uint64_t block, size_t offset, void *pv, size_t cb)
+{
+    Key key = { owner, block };
+    Shard &shard = ShardFor(key);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    std::unordered_map<Key, LruList::iterator, KeyHash>::iterator it = shard.map.find(key);
+    if (it == shard.map.end() || it->second->data.size() < offset + cb)
+    {
+        shard.misses++;
+        return false;
+    }
+
+    LruList::iterator node = it->second;
+    if (node != shard.lru.begin())
+    {
+        shard.lru.splice(shard.lru.begin(), shard.lru, node);
+    }
+    if (cb > 0)
+    {
+        memcpy(pv, &node->data[offset], cb);
+    }
+    shard.hits++;
+    return true;
+}
+
+void BlockCache::Insert(uint64_t owner, uint64_t block, const void *pv, size_t cb)
+{
+    Key key = { owner, block };
+    cb = std::min(cb, m_cbBlock);
+    if (Cost(cb) > m_cbShardLimit)
+    {
+        return;
+    }
+
+    // No lock may be held here: the budget can call back into Reclaim.
+    if (m_pBudget != NULL && !m_pBudget->TryReserve(Cost(cb)))
+    {
+        return;
+    }
+
+    // Copy outside the lock; only the list and map updates need it.
+    LruList fresh;
+    fresh.push_back(Node());
+    fresh.back().key = key;
+    fresh.back().data.assign((const uint8_t *)pv, (const uint8_t *)pv + cb);
+
+    LruList evicted;
+    uint64_t cbEvicted = 0;
+    {
+        Shard &shard = ShardFor(key);
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        std::unordered_map<Key, LruList::iterator, KeyHash>::iterator it = shard.map.find(key);
+        if (it != shard.map.end())
+        {
+            cbEvicted = Cost(it->second->data.size());
+            shard.cbUsed -= cbEvicted;
+            evicted.splice(evicted.end(), shard.lru, it->second);
+            shard.map.erase(it);
+        }
+
+        shard.lru.splice(shard.lru.begin(), fresh);
+        shard.map[key] = shard.lru.begin();
+        shard.cbUsed += Cost(cb);
+        shard.insertions++;
+
+        while (shard.cbUsed > m_cbShardLimit)
+        {
+            LruList::iterator last = --shard.lru.end();
+            uint64_t cost = Cost(last->data.size());
+            shard.cbUsed -= cost;
+            cbEvicted += cost;
+            shard.map.erase(last->key);
+            evicted.splice(evicted.end(), shard.lru, last);
+            shard.evictions++;
+        }
+    }
+
+    // The evicted blocks are freed here, after the lock is released.
+    ReleaseMemory(cbEvicted);
+}
+
+void BlockCache::Remove(uint64_t owner, uint64_t block)
+{
+    Key key = { owner, block };
+    LruList removed;
+    uint64_t cbRemoved = 0;
+    {
+        Shard &shard = ShardFor(key);
+        std::lock_guard<std::mutex> lock(shard.lock);
+
+        std::unordered_map<Key, LruList::iterator, KeyHash>::iterator it = shard.map.find(key);
+        if (it != shard.map.end())
+        {
+            cbRemoved = Cost(it->second->data.size());
+            shard.cbUsed -= cbRemoved;
+            removed.splice(removed.end(), shard.lru, it->second);
+            shard.map.erase(it);
+        }
+    }
+    ReleaseMemory(cbRemoved);
+}
+
+void BlockCache::Clear()
+{
+    for (size_t i = 0; i < m_shards.size(); i++)
+    {
+        LruList removed;
+        uint64_t cbRemoved;
+        {
+            Shard &shard = *m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.lock);
+            removed.swap(shard.lru);
+            shard.map.clear();
+            cbRemoved = shard.cbUsed;
+            shard.cbUsed = 0;
+        }
+        ReleaseMemory(cbRemoved);
+    }
+}
+
+uint64_t BlockCache::Reclaim(uint64_t cbWanted)
+{
+    // Start at a different shard each time, so no shard is always the one
+    // emptied.
+    uint64_t cbFreed = 0;
+    size_t first = m_nextReclaimShard++;
+    for (size_t i = 0; i < m_shards.size() && cbFreed < cbWanted; i++)
+    {
+        LruList evicted;
+        uint64_t cbEvicted = 0;
+        {
+            Shard &shard = *m_shards[(first + i) % m_shards.size()];
+            std::lock_guard<std::mutex> lock(shard.lock);
+            while (!shard.lru.empty() && cbFreed + cbEvicted < cbWanted)
+            {
+                LruList::iterator last = --shard.lru.end();
+                uint64_t cost = Cost(last->data.size());
+                shard.cbUsed -= cost;
+                cbEvicted += cost;
+                shard.map.erase(last->key);
+                evicted.splice(evicted.end(), shard.lru, last);
+                shard.evictions++;
+            }
+        }
+        ReleaseMemory(cbEvicted);
+        cbFreed += cbEvicted;
+    }
+    return cbFreed;
+}
+
+BlockCacheStats BlockCache::GetStats() const
+{
+    BlockCacheStats stats = { 0, 0, 0, 0, 0, m_cbLimit };
+    for (size_t i = 0; i < m_shards.size(); i++)
+    {
+        Shard &shard = *m_shards[i];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.insertions += shard.insertions;
+        stats.evictions += shard.evictions;
+        stats.cbUsed += shard.cbUsed;
+    }
+    return stats;
+}
@@ -0,0 +1,139 @@
+/****************************** Module Header ******************************\
+Module Name:  BlockCache.h
+Project:      ZipFolderEx
+
+The file declares a least-recently-used cache of fixed size data blocks
+with a memory cap.
+
+Blocks are identified by an owner (for example one entry of one archive)
+and a block number. The cache is split into shards, each with its own lock
+and LRU list, so that readers on different threads rarely contend. Every
+shard gets an equal part of the memory cap and evicts its least recently
+used blocks once it is over its part.
+
+Blocks are also reserved from a ZipMemoryBudget (see ZipMemory.h). A block
+the budget has no room for is not kept, and the cache gives up its least
+recently used blocks when the budget asks it to reclaim memory.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipMemory.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+
+struct BlockCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t cbUsed;
+    uint64_t cbLimit;
+};
+
+
+class BlockCache : private ZipMemoryReclaimer
+{
+public:
+    //
+    //   FUNCTION: BlockCache::BlockCache
+    //
+    //   PURPOSE: Create a cache that holds at most cbLimit bytes of blocks
+    //   of cbBlock bytes each, split over cShards locks, reserving them
+    //   from pBudget (NULL for none).
+    //
+    BlockCache(uint64_t cbLimit, size_t cbBlock = 64 * 1024, size_t cShards = 16,
+        ZipMemoryBudget *pBudget = &ZipMemoryBudget::Process());
+    virtual ~BlockCache();
+
+    size_t BlockSize() const { return m_cbBlock; }
+
+    // Reserve a range of owner IDs that no other user of the cache has.
+    uint64_t NewOwnerRange();
+
+    //
+    //   FUNCTION: BlockCache::Read
+    //
+    //   PURPOSE: Copy cb bytes at offset within a cached block into pv.
+    //   Returns false, and copies nothing, if the block is not cached or is
+    //   shorter than offset + cb. A hit makes the block most recently used.
+    //
+    bool Read(uint64_t owner, uint64_t block, size_t offset, void *pv, size_t cb);
+
+    // Add a block of up to BlockSize() bytes; replaces an existing copy.
+    void Insert(uint64_t owner, uint64_t block, const void *pv, size_t cb);
+
+    // Drop one block, or every block.
+    void Remove(uint64_t owner, uint64_t block);
+    void Clear();
+
+    BlockCacheStats GetStats() const;
+
+private:
+    BlockCache(const BlockCache &);
+    BlockCache &operator=(const BlockCache &);
+
+    struct Key
+    {
+        uint64_t owner;
+        uint64_t block;
+
+        bool operator==(const Key &other) const
+        {
+            return owner == other.owner && block == other.block;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const
+        {
+            uint64_t h = key.owner * 0x9E3779B97F4A7C15ull ^ key.block;
+            h ^= h >> 29;
+            h *= 0xBF58476D1CE4E5B9ull;
+            return (size_t)(h ^ (h >> 32));
+        }
+    };
+
+    struct Node
+    {
+        Key key;
+        std::vector<uint8_t> data;
+    };
+
+    typedef std::list<Node> LruList;
+
+    struct Shard
+    {
+        std::mutex lock;
+        LruList lru;                // Most recently used first.
+        std::unordered_map<Key, LruList::iterator, KeyHash> map;
+        uint64_t cbUsed;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t insertions;
+        uint64_t evictions;
+    };
+
+    Shard &ShardFor(const Key &key);
+    static uint64_t Cost(size_t cbData);
+    void ReleaseMemory(uint64_t cb);
+
+    // Evict least recently used blocks, a shard at a time, for the budget.
+    virtual uint64_t Reclaim(uint64_t cbWanted);
+
+    ZipMemoryBudget *m_pBudget;
+    std::atomic<size_t> m_nextReclaimShard;
+    size_t m_cbBlock;
+    uint64_t m_cbShardLimit;
+    uint64_t m_cbLimit;
+    std::vector<Shard *> m_shards;
+    std::atomic<uint64_t> m_nextOwner;
+};
@@ -28,7 +28,10 @@ WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
 \***************************************************************************/
 
 #include "ContextMenuExtractTo.h"
+#include "IconAlpha.h"
+#include "ZipService.h"
 #include <string>
+#include <stdio.h>
 #include <strsafe.h>
 #include <memory>
 #include <Shlwapi.h>
@@ -41,7 +44,7 @@ extern long g_cDllRef;
 
 #define IDM_DISPLAY             0  // The command's identifier offset
 
-ContextMenuExtractTo::ContextMenuExtractTo(void) : m_cRef(1),
+ContextMenuExtractTo::ContextMenuExtractTo(void) : m_cRef(1), m_fExtendedOnly(false),
     m_pszMenuText(L"&Extract to"),
     m_pszVerb("cppdisplay"),
     m_pwszVerb(L"cppdisplay"),
@@ -81,8 +84,272 @@ ContextMenuExtractTo::~ContextMenuExtractTo(void)
 }
 
 
-void ContextMenuExtractTo::UnZipFile(BSTR strSrc, BSTR strDest)
+// Extraction jobs run here, one at a time, off the thread Explorer called
+// InvokeCommand on. The queue has no threads while it is idle. It is made
+// for the first job and deleted by DllCanUnloadNow once idle, never by a
+// static destructor: those run under the loader lock, where waiting for a
+// queue thread would deadlock.
+static ZipJobQueue *volatile g_pExtractQueue = NULL;
+
+// Explorer initializes the handler for every executable it shows a menu
+// for. Larger ones than this are not opened to look for an archive, since
+// opening a program can cost a virus scan of all of it.
+static const uint64_t kMaxSfxCheck = 256ull << 20;
+
+
+//
+//   FUNCTION: IsVolumeExtension
+//
+//   PURPOSE: Whether an extension is the number of a plain split volume
+//            (.001, .002, ...).
+//
+static bool IsVolumeExtension(LPCWSTR pszExtension)
+{
+	return pszExtension[0] == L'.' && pszExtension[1] >= L'0' && pszExtension[1] <= L'9';
+}
+
+
+//
+//   FUNCTION: RemoveArchiveExtension
+//
+//   PURPOSE: Strip the extension from an archive's path, along with the
+//            .zip in front of the number of a split volume
+//            (name.zip.001), to name the folder it is extracted to.
+//
+static void RemoveArchiveExtension(LPWSTR pszPath)
+{
+	bool fVolume = IsVolumeExtension(PathFindExtension(pszPath));
+	PathRemoveExtension(pszPath);
+	if (fVolume && lstrcmpi(PathFindExtension(pszPath), L".zip") == 0)
+	{
+		PathRemoveExtension(pszPath);
+	}
+}
+
+
+//
+//   CLASS: ContextMenuExtractTo::ExtractJob
+//
+//   PURPOSE: Extracts one archive on a queue thread. The work is handed
+//            to the extraction service (see ZipService.h), which is
+//            started if it is not running; if it cannot be reached the
+//            archive is extracted in this process. If the
+//            ZIPFOLDEREX_STATS environment variable names a file, the
+//            extraction runs here and its stats are appended to the file
+//            as JSON, which is how a slow extraction on a user's machine
+//            can be diagnosed. If ZIPFOLDEREX_TRACE names a file, a Chrome
+//            trace of the extraction is written there. The queue thread
+//            the job runs on keeps the DLL loaded until it exits.
+//
+class ContextMenuExtractTo::ExtractJob : public ZipJob
+{
+public:
+	ExtractJob(LPCWSTR pszSrc, LPCWSTR pszDest) : ZipJob(pszSrc, pszDest)
+	{
+	}
+
+protected:
+	virtual ZipResult Run();
+	virtual void OnComplete();
+
+private:
+	ZipResult UnZipFile(ZipExtractStats *pStats, LPCWSTR pszTracePath);
+	bool UnZipFileWithService(ZipResult *pResult);
+	void UnZipFileWithShell();
+	static bool StartService(ZipServiceClient &client);
+	void WriteStats(LPCWSTR pszPath, const ZipExtractStats &stats);
+};
+
+ZipResult ContextMenuExtractTo::ExtractJob::Run()
+{
+	WCHAR szStatsPath[MAX_PATH];
+	DWORD cch = GetEnvironmentVariable(L"ZIPFOLDEREX_STATS", szStatsPath, MAX_PATH);
+	bool fStats = cch > 0 && cch < MAX_PATH;
+	WCHAR szTracePath[MAX_PATH];
+	cch = GetEnvironmentVariable(L"ZIPFOLDEREX_TRACE", szTracePath, MAX_PATH);
+	bool fTrace = cch > 0 && cch < MAX_PATH;
+
+	// Stats and traces come from the extractor, so those runs stay here.
+	ZipResult result;
+	if (!fStats && !fTrace && UnZipFileWithService(&result))
+	{
+		return result;
+	}
+
+	ZipExtractStats stats;
+	result = UnZipFile(fStats ? &stats : NULL, fTrace ? szTracePath : NULL);
+	if (fStats)
+	{
+		stats.result = result;
+		WriteStats(szStatsPath, stats);
+	}
+	return result;
+}
+
+void ContextMenuExtractTo::ExtractJob::OnComplete()
+{
+	// A cancelled job needs no message; the user asked for it.
+	if (Result() != ZR_OK && Result() != ZR_STOP)
+	{
+		ShowZipError(Result());
+	}
+}
+
+ZipResult ContextMenuExtractTo::ExtractJob::UnZipFile(ZipExtractStats *pStats,
+	LPCWSTR pszTracePath)
+{
+	ZipArchive archive;
+	ZipResult result = archive.Open(ArchivePath());
+	if (result != ZR_OK)
+	{
+		return result;
+	}
+
+	// Archives with entries the native extractor cannot decode (encryption,
+	// methods other than stored and deflated) are left to the shell's own
+	// ZIP folder, as all archives were before.
+	for (size_t i = 0; i < archive.EntryCount(); i++)
+	{
+		if (!ZipExtractor::IsSupported(archive.Entry(i)))
+		{
+			archive.Close();
+			UnZipFileWithShell();
+			return ZR_OK;
+		}
+	}
+
+	ZipTracer tracer;
+	result = Extract(archive, pStats, pszTracePath != NULL ? &tracer : NULL);
+	if (pszTracePath != NULL)
+	{
+		tracer.Save(pszTracePath, &archive);
+	}
+	return result;
+}
+
+//
+//   FUNCTION: ContextMenuExtractTo::ExtractJob::UnZipFileWithService
+//
+//   PURPOSE: Have the extraction service extract the archive, mirroring
+//            its progress into this job and passing on a cancellation.
+//            Returns false, having written nothing, if the service could
+//            not be started or reached.
+//
+bool ContextMenuExtractTo::ExtractJob::UnZipFileWithService(ZipResult *pResult)
+{
+	ZipServiceClient client(ZipServiceDefaultName());
+	if (client.Ping() != ZR_OK && !StartService(client))
+	{
+		return false;
+	}
+	uint64_t id;
+	if (client.Submit(ArchivePath(), DestDir(), true, &id) != ZR_OK)
+	{
+		return false;
+	}
+
+	ZipServiceJobStatus status;
+	uint64_t cEntriesSeen = 0, cbSeen = 0;
+	bool fStarted = false, fCancelSent = false;
+	for (;;)
+	{
+		// Should the service die mid-job, report it rather than extract
+		// again over what it has written.
+		ZipResult result = client.Wait(id, 250, &status);
+		if (result != ZR_OK)
+		{
+			*pResult = result;
+			return true;
+		}
+
+		const ZipProgressSnapshot &progress = status.progress;
+		if (!fStarted && progress.cEntriesTotal > 0)
+		{
+			Progress().Begin(progress.cEntriesTotal, progress.cbTotal);
+			fStarted = true;
+		}
+		for (; cEntriesSeen < progress.cEntriesDone; cEntriesSeen++)
+		{
+			Progress().AddEntry();
+		}
+		if (progress.cbDone > cbSeen)
+		{
+			Progress().AddBytes(progress.cbDone - cbSeen);
+			cbSeen = progress.cbDone;
+		}
+
+		if (status.state == ZJ_DONE)
+		{
+			break;
+		}
+		if (IsCancelled() && !fCancelSent)
+		{
+			client.Cancel(id);
+			fCancelSent = true;
+		}
+	}
+
+	// The service refuses archives it cannot fully decode before writing
+	// anything; those go to the shell as they do in process.
+	*pResult = status.result;
+	if (status.result == ZR_UNSUPPORTED)
+	{
+		UnZipFileWithShell();
+		*pResult = ZR_OK;
+	}
+	return true;
+}
+
+//
+//   FUNCTION: ContextMenuExtractTo::ExtractJob::StartService
+//
+//   PURPOSE: Start the service in a rundll32 process of its own and wait
+//            briefly for it to answer. Two jobs may race to start it; the
+//            loser's process finds the name taken and exits.
+//
+bool ContextMenuExtractTo::ExtractJob::StartService(ZipServiceClient &client)
+{
+	WCHAR szRundll[MAX_PATH];
+	WCHAR szModule[MAX_PATH];
+	UINT cch = GetSystemDirectory(szRundll, MAX_PATH);
+	if (cch == 0 || cch >= MAX_PATH || !PathAppend(szRundll, L"rundll32.exe") ||
+		GetModuleFileName(g_hInst, szModule, MAX_PATH) == 0)
+	{
+		return false;
+	}
+	std::wstring commandLine = std::wstring(L"\"") + szRundll + L"\" \"" + szModule +
+		L"\",ZipFolderExService";
+
+	// Run from the system directory so the service does not hold the
+	// folder Explorer happened to be in.
+	WCHAR szSystemDir[MAX_PATH];
+	GetSystemDirectory(szSystemDir, MAX_PATH);
+
+	STARTUPINFO si = { sizeof(si) };
+	PROCESS_INFORMATION pi;
+	if (!CreateProcess(szRundll, &commandLine[0], NULL, NULL, FALSE,
+		CREATE_NO_WINDOW, NULL, szSystemDir, &si, &pi))
+	{
+		return false;
+	}
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+
+	for (int i = 0; i < 40; i++)
+	{
+		Sleep(50);
+		if (client.Ping() == ZR_OK)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ContextMenuExtractTo::ExtractJob::UnZipFileWithShell()
 {
+	BSTR strSrc = SysAllocString(ArchivePath().c_str());
+	BSTR strDest = SysAllocString(DestDir().c_str());
 	HRESULT hResult = S_FALSE;
 	IShellDispatch *pIShellDispatch = NULL;
 	Folder *pToFolder = NULL;
@@ -134,6 +401,76 @@ void ContextMenuExtractTo::UnZipFile(BSTR strSrc, BSTR strDest)
 	}
 
 	CoUninitialize();
+	SysFreeString(strSrc);
+	SysFreeString(strDest);
+}
+
+void ContextMenuExtractTo::ExtractJob::WriteStats(LPCWSTR pszPath, const ZipExtractStats &stats)
+{
+	FILE *pFile = NULL;
+	if (_wfopen_s(&pFile, pszPath, L"ab") == 0 && pFile != NULL)
+	{
+		std::string json = ZipStatsToJson(stats);
+		json += "\n";
+		fwrite(json.data(), 1, json.size(), pFile);
+		fclose(pFile);
+	}
+}
+
+//
+//   FUNCTION: ContextMenuExtractTo::ExtractTo
+//
+//   PURPOSE: Queue the extraction of the selected file into strDest and
+//            return at once.
+//
+void ContextMenuExtractTo::ExtractTo(LPWSTR strDest)
+{
+	ZipJobQueue *pQueue = g_pExtractQueue;
+	if (pQueue == NULL)
+	{
+		// Two windows' threads may get here at once; one queue wins.
+		ZipJobQueue *pNewQueue = new ZipJobQueue();
+		pQueue = static_cast<ZipJobQueue *>(InterlockedCompareExchangePointer(
+			reinterpret_cast<PVOID volatile *>(&g_pExtractQueue), pNewQueue, NULL));
+		if (pQueue == NULL)
+		{
+			pQueue = pNewQueue;
+		}
+		else
+		{
+			delete pNewQueue;
+		}
+	}
+	pQueue->Submit(std::make_shared<ExtractJob>(this->m_szSelectedFile, strDest));
+}
+
+//
+//   FUNCTION: ContextMenuExtractTo::ReleaseQueue
+//
+//   PURPOSE: Delete the extraction queue if no job is queued or running.
+//            Returns false, and keeps it, if one is. Only called once no
+//            object of the DLL is left to submit another.
+//
+bool ContextMenuExtractTo::ReleaseQueue()
+{
+	ZipJobQueue *pQueue = g_pExtractQueue;
+	if (pQueue != NULL)
+	{
+		if (!pQueue->IsIdle())
+		{
+			return false;
+		}
+		g_pExtractQueue = NULL;
+		delete pQueue;
+	}
+	return true;
+}
+
+void ContextMenuExtractTo::ShowZipError(ZipResult result)
+{
+	const char *pszText = ZipResultToString(result);
+	std::wstring text(pszText, pszText + strlen(pszText));
+	MessageBox(NULL, text.c_str(), L"error", 0);
 }
 
 void ContextMenuExtractTo::ShowMessage(DWORD code)
@@ -215,40 +552,14 @@ HBITMAP ContextMenuExtractTo::BitmapFromIcon(HICON hIcon)
 
 		pOpaque = new(std::nothrow) bool[nPixelCount];
 		if (pOpaque == NULL) break;
-		for (INT i = 0; i < nPixelCount; ++i)
-		{
-			pOpaque[i] = !pData[i];
-		}
+		BuildOpaqueMask((const uint32_t*)pData, pOpaque, nPixelCount);
 
 		memset(pData, 0, nPixelCount * 4);
 		::DrawIconEx(dcMem, 0, 0, hIcon, nWidth, nHeight, 0, NULL, DI_NORMAL);
 
-		BOOL bPixelHasAlpha = FALSE;
-		UINT* pPixel = (UINT*)pData;
-		for (INT i = 0; i<nPixelCount; ++i, ++pPixel)
+		if (!HasAlphaChannel((const uint32_t*)pData, nPixelCount))
 		{
-			if ((*pPixel & 0xff000000) != 0)
-			{
-				bPixelHasAlpha = TRUE;
-				//MessageBox(L"has alpha");
-				break;
-			}
-		}
-
-		if (!bPixelHasAlpha)
-		{
-			pPixel = (UINT*)pData;
-			for (INT i = 0; i <nPixelCount; ++i, ++pPixel)
-			{
-				if (pOpaque[i])
-				{
-					*pPixel |= 0xFF000000;
-				}
-				else
-				{
-					*pPixel &= 0x00FFFFFF;
-				}
-			}
+			ApplyOpaqueMask((uint32_t*)pData, pOpaque, nPixelCount);
 		}
 
 		bSuccess = TRUE;
@@ -356,6 +667,44 @@ IFACEMETHODIMP ContextMenuExtractTo::Initialize(
                     ARRAYSIZE(m_szSelectedFile)))
                 {
                     hr = S_OK;
+                    m_fExtendedOnly = false;
+
+                    // Most executables are not self-extracting archives;
+                    // only offer extraction for those that end in one.
+                    // One on a network share or above kMaxSfxCheck is not
+                    // read here at all, and gets the item as an extended
+                    // verb instead.
+                    LPCWSTR pszExtension = PathFindExtension(m_szSelectedFile);
+                    if (0 == lstrcmpi(pszExtension, L".exe"))
+                    {
+                        WIN32_FILE_ATTRIBUTE_DATA data;
+                        if (PathIsNetworkPath(m_szSelectedFile) ||
+                            !GetFileAttributesEx(m_szSelectedFile, GetFileExInfoStandard, &data) ||
+                            ((uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow) > kMaxSfxCheck)
+                        {
+                            m_fExtendedOnly = true;
+                        }
+                        else if (!ZipArchive::IsArchive(m_szSelectedFile, kMaxSfxCheck))
+                        {
+                            hr = E_FAIL;
+                        }
+                    }
+                    else if (IsVolumeExtension(pszExtension))
+                    {
+                        // Any tool's split output is numbered .001, .002,
+                        // ...; offer extraction only for a set that ends in
+                        // a ZIP directory. Only the tail of the last volume
+                        // is read, so there is no size limit, but a set on
+                        // a network share gets the extended verb too.
+                        if (PathIsNetworkPath(m_szSelectedFile))
+                        {
+                            m_fExtendedOnly = true;
+                        }
+                        else if (!ZipArchive::IsArchive(m_szSelectedFile))
+                        {
+                            hr = E_FAIL;
+                        }
+                    }
                 }
             }
 
@@ -462,6 +811,12 @@ IFACEMETHODIMP ContextMenuExtractTo::QueryContextMenu(
         return MAKE_HRESULT(SEVERITY_SUCCESS, 0, USHORT(0));
     }
 
+    // An executable that was not checked is offered on Shift+right-click only.
+    if (m_fExtendedOnly && !(CMF_EXTENDEDVERBS & uFlags))
+    {
+        return MAKE_HRESULT(SEVERITY_SUCCESS, 0, USHORT(0));
+    }
+
     // Use either InsertMenu or InsertMenuItem to add menu items.
     // Learn how to add sub-menu from:
     // http://www.codeproject.com/KB/shell/ctxextsubmenu.aspx
@@ -489,7 +844,7 @@ IFACEMETHODIMP ContextMenuExtractTo::QueryContextMenu(
 	TCHAR selectedFile[MAX_PATH] = L"";
 	StringCchCopy(selectedFile, MAX_PATH, this->m_szSelectedFile);
 	PWSTR folder = PathFindFileName(selectedFile);
-	PathRemoveExtension(folder);
+	RemoveArchiveExtension(folder);
 	StringCchCat(extractTo, MAX_PATH, folder);
 	StringCchCat(extractTo, MAX_PATH, L"\\\"");
 
@@ -602,18 +957,18 @@ IFACEMETHODIMP ContextMenuExtractTo::InvokeCommand(LPCMINVOKECOMMANDINFO pici)
 				TCHAR DestPath[MAX_PATH];
 				StringCchCopy(DestPath, MAX_PATH, this->m_szSelectedFile);
 				PathRemoveFileSpec(DestPath);
-				UnZipFile(this->m_szSelectedFile, DestPath);
+				ExtractTo(DestPath);
 			}
 			else if (LOWORD(pici->lpVerb) == IDM_DISPLAY + 1)
 			{
 				TCHAR DestPath[MAX_PATH];
 				StringCchCopy(DestPath, MAX_PATH, this->m_szSelectedFile);
-				PathRemoveExtension(DestPath);
+				RemoveArchiveExtension(DestPath);
 
 				if (!PathFileExists(DestPath))
 					CreateDirectory(DestPath, NULL);
 
-				UnZipFile(this->m_szSelectedFile, DestPath);
+				ExtractTo(DestPath);
 			}
 			else
 			{
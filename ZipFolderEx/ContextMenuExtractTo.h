@@ -31,6 +31,7 @@ WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
 
 #include <windows.h>
 #include <shlobj.h>     // For IShellExtInit and IContextMenu
+#include "ZipJob.h"
 
 
 class ContextMenuExtractTo : public IShellExtInit, public IContextMenu3
@@ -59,6 +60,10 @@ public:
 	STDMETHODIMP HandleMenuMsg(UINT, WPARAM, LPARAM);
 	STDMETHODIMP HandleMenuMsg2(UINT, WPARAM, LPARAM, LRESULT*);
 
+	// For DllCanUnloadNow: delete the job queue, unless a job is still
+	// queued or running.
+	static bool ReleaseQueue();
+
 protected:
 	~ContextMenuExtractTo(void);
 
@@ -69,8 +74,15 @@ private:
     // The name of the selected file.
     wchar_t m_szSelectedFile[MAX_PATH];
 
-	void UnZipFile(LPWSTR strSrc, LPWSTR strDest);
-	void ShowMessage(DWORD code);
+    // Set for an executable too large or too far away to be checked for a
+    // self-extracting archive; the item then shows only with Shift held.
+    bool m_fExtendedOnly;
+
+	class ExtractJob;
+
+	void ExtractTo(LPWSTR strDest);
+	static void ShowMessage(DWORD code);
+	static void ShowZipError(ZipResult result);
 	HBITMAP BitmapFromIcon(HICON hIcon);
 	HBITMAP hBitmap;  //Menu Icon
 	SHFILEINFOW sfi;
@@ -0,0 +1,205 @@
+/****************************** Module Header ******************************\
+Module Name:  Crc32.cpp
+Project:      ZipFolderEx
+
+The file implements CRC-32 with the slice-by-8 method: eight 256-entry
+tables let the loop fold eight input bytes per iteration instead of one.
+
+Processors with carry-less multiplication (PCLMULQDQ) fold 64 bytes per
+iteration instead, four 16-byte lanes at a time, as described in Intel's
+"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+Instruction". Crc32Update picks that variant when the module is loaded.
+\***************************************************************************/
+
+#include "Crc32.h"
+#include "ZipCpu.h"
+#include <string.h>
+
+#ifdef ZIP_CPU_X86
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+    // Computed by the compiler, so there is nothing to build at startup
+    // and no lazy, thread-safe local static (those rely on TLS, which is
+    // unreliable in DLLs on the XP toolset we target).
+    struct Crc32Tables
+    {
+        uint32_t t[8][256];
+
+        constexpr Crc32Tables() : t()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k)
+                {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                for (int k = 1; k < 8; ++k)
+                {
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    constexpr Crc32Tables kCrcTables;
+
+    uint32_t Crc32Slice8(uint32_t crc, const void *pv, size_t cb)
+    {
+        const uint32_t (*t)[256] = kCrcTables.t;
+        const uint8_t *p = static_cast<const uint8_t *>(pv);
+
+        crc = ~crc;
+
+        while (cb > 0 && ((uintptr_t)p & 7) != 0)
+        {
+            crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            --cb;
+        }
+
+        while (cb >= 8)
+        {
+            uint32_t lo, hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap32(lo);
+            hi = __builtin_bswap32(hi);
+#endif
+            lo ^= crc;
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+                t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+                t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+            p += 8;
+            cb -= 8;
+        }
+
+        while (cb-- > 0)
+        {
+            crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+#ifdef ZIP_CPU_X86
+    // Folds a multiple of 16 bytes, at least 64, into the CRC register crc
+    // (the complement of the value Crc32Update passes around). The
+    // constants are x^(4*128+32), x^(4*128-32), x^(128+32) and x^(128-32)
+    // mod P for the 4- and 1-lane folds, x^64 mod P for the last 64 bits,
+    // and P with its Barrett quotient, all bit reflected as the paper
+    // gives them.
+    ZIP_TARGET("sse4.1,pclmul")
+    uint32_t FoldPclmul(uint32_t crc, const uint8_t *p, size_t cb)
+    {
+        static const uint64_t k1k2[2] = { 0x0154442bd4, 0x01c6e41596 };
+        static const uint64_t k3k4[2] = { 0x01751997d0, 0x00ccaa009e };
+        static const uint64_t k5k0[2] = { 0x0163cd6124, 0x0000000000 };
+        static const uint64_t poly[2] = { 0x01db710641, 0x01f7011641 };
+
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+        __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+        __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+        __m128i x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+        p += 64;
+        cb -= 64;
+
+        __m128i k = _mm_loadu_si128((const __m128i *)k1k2);
+        while (cb >= 64)
+        {
+            __m128i y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+            __m128i y2 = _mm_clmulepi64_si128(x2, k, 0x00);
+            __m128i y3 = _mm_clmulepi64_si128(x3, k, 0x00);
+            __m128i y4 = _mm_clmulepi64_si128(x4, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, y2), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, y3), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, y4), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+            p += 64;
+            cb -= 64;
+        }
+
+        // Fold the four lanes into one, then the remaining 16-byte blocks.
+        k = _mm_loadu_si128((const __m128i *)k3k4);
+        __m128i lanes[3] = { x2, x3, x4 };
+        for (int i = 0; i < 3; i++)
+        {
+            __m128i y = _mm_clmulepi64_si128(x1, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), y);
+        }
+        while (cb >= 16)
+        {
+            __m128i y = _mm_clmulepi64_si128(x1, k, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p)), y);
+            p += 16;
+            cb -= 16;
+        }
+
+        // 128 bits to 64.
+        const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+        __m128i y = _mm_clmulepi64_si128(x1, k, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), y);
+        k = _mm_loadu_si128((const __m128i *)k5k0);
+        y = _mm_srli_si128(x1, 4);
+        x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00);
+        x1 = _mm_xor_si128(x1, y);
+
+        // Barrett reduction to 32 bits.
+        k = _mm_loadu_si128((const __m128i *)poly);
+        y = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+        y = _mm_clmulepi64_si128(_mm_and_si128(y, mask32), k, 0x00);
+        x1 = _mm_xor_si128(x1, y);
+        return (uint32_t)_mm_extract_epi32(x1, 1);
+    }
+
+    uint32_t Crc32Pclmul(uint32_t crc, const void *pv, size_t cb)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(pv);
+        if (cb >= 64)
+        {
+            size_t cbFold = cb & ~(size_t)15;
+            crc = ~FoldPclmul(~crc, p, cbFold);
+            p += cbFold;
+            cb -= cbFold;
+        }
+        return Crc32Slice8(crc, p, cb);
+    }
+#endif
+
+    typedef uint32_t (*Crc32Function)(uint32_t crc, const void *pv, size_t cb);
+
+    Crc32Function ChooseCrc32()
+    {
+#ifdef ZIP_CPU_X86
+        if (ZipCpu().fPclmul && ZipCpu().fSse41)
+        {
+            return Crc32Pclmul;
+        }
+#endif
+        return Crc32Slice8;
+    }
+
+    const Crc32Function g_pfnCrc32 = ChooseCrc32();
+}
+
+
+uint32_t Crc32Update(uint32_t crc, const void *pv, size_t cb)
+{
+    return g_pfnCrc32(crc, pv, cb);
+}
@@ -0,0 +1,22 @@
+/****************************** Module Header ******************************\
+Module Name:  Crc32.h
+Project:      ZipFolderEx
+
+The file declares the CRC-32 (ISO-HDLC, polynomial 0xEDB88320) used to
+verify ZIP entries.
+\***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+//
+//   FUNCTION: Crc32Update
+//
+//   PURPOSE: Continue a CRC-32 over the next cb bytes. Start with crc = 0;
+//   the pre- and post-conditioning is done internally, so the running value
+//   can be passed straight back in and compared with the stored CRC.
+//
+uint32_t Crc32Update(uint32_t crc, const void *pv, size_t cb);
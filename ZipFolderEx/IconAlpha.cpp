@@ -0,0 +1,250 @@
+/****************************** Module Header ******************************\
+Module Name:  IconAlpha.cpp
+Project:      ZipFolderEx
+
+The file implements the icon alpha loops declared in IconAlpha.h, in
+portable C++ and with SSE2 and AVX2 intrinsics. The variant is picked
+when the module is loaded (see ZipCpu.h).
+\***************************************************************************/
+
+#include "IconAlpha.h"
+#include "ZipCpu.h"
+
+#ifdef ZIP_CPU_X86
+#include <immintrin.h>
+#endif
+
+
+namespace
+{
+#pragma region Portable
+
+    void BuildOpaqueMaskGeneric(const uint32_t *pMaskPixels, bool *pOpaque, size_t cPixels)
+    {
+        for (size_t i = 0; i < cPixels; ++i)
+        {
+            pOpaque[i] = !pMaskPixels[i];
+        }
+    }
+
+    bool HasAlphaChannelGeneric(const uint32_t *pPixels, size_t cPixels)
+    {
+        for (size_t i = 0; i < cPixels; ++i)
+        {
+            if ((pPixels[i] & 0xff000000) != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ApplyOpaqueMaskGeneric(uint32_t *pPixels, const bool *pOpaque, size_t cPixels)
+    {
+        for (size_t i = 0; i < cPixels; ++i)
+        {
+            if (pOpaque[i])
+            {
+                pPixels[i] |= 0xFF000000;
+            }
+            else
+            {
+                pPixels[i] &= 0x00FFFFFF;
+            }
+        }
+    }
+
+#pragma endregion
+
+#ifdef ZIP_CPU_X86
+
+#pragma region SSE2
+
+    // 16 pixels per step: four compares, narrowed to 16 bytes of 0 or 1.
+    ZIP_TARGET("sse2")
+    void BuildOpaqueMaskSse2(const uint32_t *pMaskPixels, bool *pOpaque, size_t cPixels)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        size_t i = 0;
+        for (; i + 16 <= cPixels; i += 16)
+        {
+            const __m128i *p = (const __m128i *)(pMaskPixels + i);
+            __m128i m0 = _mm_cmpeq_epi32(_mm_loadu_si128(p + 0), zero);
+            __m128i m1 = _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), zero);
+            __m128i m2 = _mm_cmpeq_epi32(_mm_loadu_si128(p + 2), zero);
+            __m128i m3 = _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), zero);
+            __m128i m = _mm_packs_epi16(_mm_packs_epi32(m0, m1), _mm_packs_epi32(m2, m3));
+            _mm_storeu_si128((__m128i *)(pOpaque + i), _mm_and_si128(m, one));
+        }
+        BuildOpaqueMaskGeneric(pMaskPixels + i, pOpaque + i, cPixels - i);
+    }
+
+    ZIP_TARGET("sse2")
+    bool HasAlphaChannelSse2(const uint32_t *pPixels, size_t cPixels)
+    {
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        size_t i = 0;
+        for (; i + 16 <= cPixels; i += 16)
+        {
+            const __m128i *p = (const __m128i *)(pPixels + i);
+            __m128i any = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1)),
+                _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+            any = _mm_and_si128(any, alpha);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) != 0xFFFF)
+            {
+                return true;
+            }
+        }
+        return HasAlphaChannelGeneric(pPixels + i, cPixels - i);
+    }
+
+    // 16 pixels per step: the opacity bytes are widened to 32-bit masks and
+    // blended in, with no branch per pixel.
+    ZIP_TARGET("sse2")
+    void ApplyOpaqueMaskSse2(uint32_t *pPixels, const bool *pOpaque, size_t cPixels)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+        size_t i = 0;
+        for (; i + 16 <= cPixels; i += 16)
+        {
+            __m128i clear = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pOpaque + i)), zero);
+            __m128i set = _mm_andnot_si128(clear, _mm_cmpeq_epi8(zero, zero));
+            __m128i lo = _mm_unpacklo_epi8(set, set);
+            __m128i hi = _mm_unpackhi_epi8(set, set);
+            __m128i masks[4] =
+            {
+                _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+                _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)
+            };
+            __m128i *p = (__m128i *)(pPixels + i);
+            for (int k = 0; k < 4; k++)
+            {
+                __m128i pixels = _mm_and_si128(_mm_loadu_si128(p + k), color);
+                _mm_storeu_si128(p + k, _mm_or_si128(pixels, _mm_and_si128(masks[k], alpha)));
+            }
+        }
+        ApplyOpaqueMaskGeneric(pPixels + i, pOpaque + i, cPixels - i);
+    }
+
+#pragma endregion
+
+#pragma region AVX2
+
+    ZIP_TARGET("avx2")
+    void BuildOpaqueMaskAvx2(const uint32_t *pMaskPixels, bool *pOpaque, size_t cPixels)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi8(1);
+        // The packs work within 128-bit lanes; this puts the pixels back in
+        // order.
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        size_t i = 0;
+        for (; i + 32 <= cPixels; i += 32)
+        {
+            const __m256i *p = (const __m256i *)(pMaskPixels + i);
+            __m256i m0 = _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 0), zero);
+            __m256i m1 = _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 1), zero);
+            __m256i m2 = _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 2), zero);
+            __m256i m3 = _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 3), zero);
+            __m256i m = _mm256_packs_epi16(_mm256_packs_epi32(m0, m1), _mm256_packs_epi32(m2, m3));
+            m = _mm256_permutevar8x32_epi32(m, order);
+            _mm256_storeu_si256((__m256i *)(pOpaque + i), _mm256_and_si256(m, one));
+        }
+        BuildOpaqueMaskSse2(pMaskPixels + i, pOpaque + i, cPixels - i);
+    }
+
+    ZIP_TARGET("avx2")
+    bool HasAlphaChannelAvx2(const uint32_t *pPixels, size_t cPixels)
+    {
+        const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+        size_t i = 0;
+        for (; i + 32 <= cPixels; i += 32)
+        {
+            const __m256i *p = (const __m256i *)(pPixels + i);
+            __m256i any = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(p + 0), _mm256_loadu_si256(p + 1)),
+                _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+            if (!_mm256_testz_si256(any, alpha))
+            {
+                return true;
+            }
+        }
+        return HasAlphaChannelSse2(pPixels + i, cPixels - i);
+    }
+
+    ZIP_TARGET("avx2")
+    void ApplyOpaqueMaskAvx2(uint32_t *pPixels, const bool *pOpaque, size_t cPixels)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+        const __m256i color = _mm256_set1_epi32(0x00FFFFFF);
+        size_t i = 0;
+        for (; i + 8 <= cPixels; i += 8)
+        {
+            __m256i opaque = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pOpaque + i)));
+            __m256i set = _mm256_andnot_si256(_mm256_cmpeq_epi32(opaque, zero), alpha);
+            __m256i *p = (__m256i *)(pPixels + i);
+            __m256i pixels = _mm256_and_si256(_mm256_loadu_si256(p), color);
+            _mm256_storeu_si256(p, _mm256_or_si256(pixels, set));
+        }
+        ApplyOpaqueMaskGeneric(pPixels + i, pOpaque + i, cPixels - i);
+    }
+
+#pragma endregion
+
+#endif
+
+    typedef void (*BuildOpaqueMaskFunction)(const uint32_t *, bool *, size_t);
+    typedef bool (*HasAlphaChannelFunction)(const uint32_t *, size_t);
+    typedef void (*ApplyOpaqueMaskFunction)(uint32_t *, const bool *, size_t);
+
+    struct AlphaFunctions
+    {
+        BuildOpaqueMaskFunction pfnBuildOpaqueMask;
+        HasAlphaChannelFunction pfnHasAlphaChannel;
+        ApplyOpaqueMaskFunction pfnApplyOpaqueMask;
+    };
+
+    AlphaFunctions ChooseAlphaFunctions()
+    {
+#ifdef ZIP_CPU_X86
+        if (ZipCpu().fAvx2)
+        {
+            AlphaFunctions avx2 = { BuildOpaqueMaskAvx2, HasAlphaChannelAvx2, ApplyOpaqueMaskAvx2 };
+            return avx2;
+        }
+        if (ZipCpu().fSse2)
+        {
+            AlphaFunctions sse2 = { BuildOpaqueMaskSse2, HasAlphaChannelSse2, ApplyOpaqueMaskSse2 };
+            return sse2;
+        }
+#endif
+        AlphaFunctions generic =
+        {
+            BuildOpaqueMaskGeneric, HasAlphaChannelGeneric, ApplyOpaqueMaskGeneric
+        };
+        return generic;
+    }
+
+    const AlphaFunctions g_alpha = ChooseAlphaFunctions();
+}
+
+
+void BuildOpaqueMask(const uint32_t *pMaskPixels, bool *pOpaque, size_t cPixels)
+{
+    g_alpha.pfnBuildOpaqueMask(pMaskPixels, pOpaque, cPixels);
+}
+
+bool HasAlphaChannel(const uint32_t *pPixels, size_t cPixels)
+{
+    return g_alpha.pfnHasAlphaChannel(pPixels, cPixels);
+}
+
+void ApplyOpaqueMask(uint32_t *pPixels, const bool *pOpaque, size_t cPixels)
+{
+    g_alpha.pfnApplyOpaqueMask(pPixels, pOpaque, cPixels);
+}
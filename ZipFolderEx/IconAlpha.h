@@ -0,0 +1,29 @@
+/****************************** Module Header ******************************\
+Module Name:  IconAlpha.h
+Project:      ZipFolderEx
+
+The file declares the pixel loops that give a menu icon bitmap a proper
+alpha channel. Icons without per-pixel alpha are drawn twice by
+ContextMenuExtractTo::BitmapFromIcon: once with DI_MASK, where opaque
+pixels come out black, and once normally. The loops below turn the first
+drawing into an opacity mask and apply it to the second.
+
+Pixels are 32bpp DIB pixels, 0xAARRGGBB. The loops have no Windows
+dependencies so that they can be benchmarked on their own.
+\***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// Opaque where the DI_MASK drawing left the pixel black.
+void BuildOpaqueMask(const uint32_t *pMaskPixels, bool *pOpaque, size_t cPixels);
+
+// TRUE if any pixel has a non-zero alpha byte, in which case the icon
+// carries its own alpha channel and must not be touched.
+bool HasAlphaChannel(const uint32_t *pPixels, size_t cPixels);
+
+// Make opaque pixels fully opaque and clear the alpha of the others.
+void ApplyOpaqueMask(uint32_t *pPixels, const bool *pOpaque, size_t cPixels);
@@ -0,0 +1,752 @@
+/****************************** Module Header ******************************\
+Module Name:  Inflate.cpp
+Project:      ZipFolderEx
+
+The file implements the raw DEFLATE decoder declared in Inflate.h.
+
+Huffman codes are decoded with two-level lookup tables. A table entry is a
+32-bit value:
+
+    bits  0-7   number of bits to consume (0 marks an unused code)
+    bits  8-11  for a sub-table link, the number of index bits it uses
+    bit   15    set for a link to a sub-table
+    bits 16-31  the decoded symbol, or the offset of the sub-table
+
+The root table is indexed by the next kLitLenRootBits (or kDistRootBits)
+input bits. Codes longer than that continue in a sub-table.
+
+The tables that never change - the fixed Huffman code of RFC 1951 3.2.6,
+and the bit reversal used to build the others - are computed by the
+compiler, so nothing is built when the decoder starts. The fixed code is
+shorter than the root everywhere, so its blocks are decoded by their own
+instantiation of the Huffman loop, which has no sub-table lookups.
+\***************************************************************************/
+
+#include "Inflate.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace
+{
+    const size_t kWindowSize = 32768;
+    const size_t kOutBufferSize = 4 * kWindowSize;
+    const size_t kMaxMatch = 258;
+
+    const unsigned kMaxCodeBits = 15;
+    const unsigned kLitLenRootBits = 10;
+    const unsigned kDistRootBits = 8;
+    const unsigned kCodeLenRootBits = 7;
+
+    // Upper bounds for a root table plus one sub-table per long symbol.
+    const size_t kLitLenTableSize = (1 << kLitLenRootBits) + 288 * (1 << (kMaxCodeBits - kLitLenRootBits));
+    const size_t kDistTableSize = (1 << kDistRootBits) + 32 * (1 << (kMaxCodeBits - kDistRootBits));
+
+    const uint32_t ENTRY_SUBTABLE = 0x8000;
+
+    const uint16_t kLengthBase[29] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    const uint8_t kLengthExtra[29] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    const uint16_t kDistBase[30] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    const uint8_t kDistExtra[30] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    const uint8_t kCodeLenOrder[19] =
+    {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+
+    // Each byte value with its bits in reverse order. Huffman codes are
+    // assigned most significant bit first but read least significant first.
+    struct ReverseTable
+    {
+        uint8_t r[256];
+
+        constexpr ReverseTable() : r()
+        {
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                unsigned rev = 0;
+                for (unsigned bit = 0; bit < 8; ++bit)
+                {
+                    rev |= ((i >> bit) & 1) << (7 - bit);
+                }
+                r[i] = (uint8_t)rev;
+            }
+        }
+    };
+
+    constexpr ReverseTable kReverse;
+
+    // The len-bit code c (len <= 16) in the order it is read.
+    constexpr unsigned ReverseCode(unsigned c, unsigned len)
+    {
+        return ((unsigned)kReverse.r[c & 0xFF] << 8 | kReverse.r[(c >> 8) & 0xFF]) >> (16 - len);
+    }
+
+
+    //
+    //   FUNCTION: BuildDecodeTable
+    //
+    //   PURPOSE: Build a two-level lookup table for the canonical Huffman
+    //   code described by the code lengths in pLens. Incomplete codes are
+    //   accepted (RFC 1951 allows a single distance code); the unused
+    //   entries stay zero and are rejected when decoded.
+    //
+    //   RETURN VALUE: false if the lengths over-subscribe the code space or
+    //   the table would not fit in cTable entries.
+    //
+    bool BuildDecodeTable(const uint8_t *pLens, unsigned cSymbols,
+        unsigned rootBits, uint32_t *pTable, size_t cTable)
+    {
+        unsigned count[kMaxCodeBits + 1] = { 0 };
+        for (unsigned s = 0; s < cSymbols; ++s)
+        {
+            count[pLens[s]]++;
+        }
+        count[0] = 0;
+
+        int left = 1;
+        for (unsigned len = 1; len <= kMaxCodeBits; ++len)
+        {
+            left <<= 1;
+            left -= count[len];
+            if (left < 0)
+            {
+                return false;
+            }
+        }
+
+        unsigned nextCode[kMaxCodeBits + 1];
+        unsigned code = 0;
+        nextCode[0] = 0;
+        for (unsigned len = 1; len <= kMaxCodeBits; ++len)
+        {
+            code = (code + count[len - 1]) << 1;
+            nextCode[len] = code;
+        }
+
+        const size_t rootSize = (size_t)1 << rootBits;
+        memset(pTable, 0, rootSize * sizeof(uint32_t));
+
+        // First pass, only if some code is longer than the root: size a
+        // sub-table for every root prefix shared by such codes.
+        unsigned maxLen = kMaxCodeBits;
+        while (maxLen > 0 && count[maxLen] == 0)
+        {
+            maxLen--;
+        }
+        if (maxLen > rootBits)
+        {
+            uint8_t subBits[1 << kLitLenRootBits] = { 0 };
+            unsigned codes[kMaxCodeBits + 1];
+            memcpy(codes, nextCode, sizeof(codes));
+            for (unsigned s = 0; s < cSymbols; ++s)
+            {
+                unsigned len = pLens[s];
+                if (len <= rootBits)
+                {
+                    if (len != 0)
+                    {
+                        codes[len]++;
+                    }
+                    continue;
+                }
+                unsigned prefix = ReverseCode(codes[len]++, len) & (unsigned)(rootSize - 1);
+                subBits[prefix] = (uint8_t)std::max<unsigned>(subBits[prefix], len - rootBits);
+            }
+
+            size_t offset = rootSize;
+            for (size_t prefix = 0; prefix < rootSize; ++prefix)
+            {
+                if (subBits[prefix] != 0)
+                {
+                    size_t subSize = (size_t)1 << subBits[prefix];
+                    if (offset + subSize > cTable)
+                    {
+                        return false;
+                    }
+                    memset(pTable + offset, 0, subSize * sizeof(uint32_t));
+                    pTable[prefix] = ((uint32_t)offset << 16) | ENTRY_SUBTABLE |
+                        ((uint32_t)subBits[prefix] << 8) | rootBits;
+                    offset += subSize;
+                }
+            }
+        }
+
+        // Second pass: fill in the symbols.
+        for (unsigned s = 0; s < cSymbols; ++s)
+        {
+            unsigned len = pLens[s];
+            if (len == 0)
+            {
+                continue;
+            }
+            unsigned rev = ReverseCode(nextCode[len]++, len);
+            if (len <= rootBits)
+            {
+                uint32_t entry = ((uint32_t)s << 16) | len;
+                for (size_t i = rev; i < rootSize; i += (size_t)1 << len)
+                {
+                    pTable[i] = entry;
+                }
+            }
+            else
+            {
+                uint32_t link = pTable[rev & (rootSize - 1)];
+                uint32_t *pSub = pTable + (link >> 16);
+                size_t subSize = (size_t)1 << ((link >> 8) & 0xF);
+                unsigned extraLen = len - rootBits;
+                uint32_t entry = ((uint32_t)s << 16) | extraLen;
+                for (size_t i = rev >> rootBits; i < subSize; i += (size_t)1 << extraLen)
+                {
+                    pSub[i] = entry;
+                }
+            }
+        }
+
+        return true;
+    }
+
+
+    //
+    //   STRUCT: FixedTables
+    //
+    //   PURPOSE: Root tables for the fixed code: literal/length codes of 7
+    //   to 9 bits and 5-bit distance codes, all within the root, so there
+    //   are no sub-tables. Symbols 286-287 and distances 30-31 are in the
+    //   code but invalid, and are rejected when decoded.
+    //
+    struct FixedTables
+    {
+        uint32_t litLen[1 << kLitLenRootBits];
+        uint32_t dist[1 << kDistRootBits];
+
+        static constexpr unsigned LitLenBits(unsigned s)
+        {
+            return s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+        }
+
+        constexpr FixedTables() : litLen(), dist()
+        {
+            // Canonical codes: the first code of each length follows the
+            // codes one bit shorter, then symbols take them in order.
+            unsigned count[10] = {};
+            for (unsigned s = 0; s < 288; ++s)
+            {
+                count[LitLenBits(s)]++;
+            }
+            unsigned nextCode[10] = {};
+            for (unsigned len = 1, code = 0; len < 10; ++len)
+            {
+                code = (code + count[len - 1]) << 1;
+                nextCode[len] = code;
+            }
+            for (unsigned s = 0; s < 288; ++s)
+            {
+                unsigned len = LitLenBits(s);
+                unsigned rev = ReverseCode(nextCode[len]++, len);
+                for (unsigned i = rev; i < (1u << kLitLenRootBits); i += 1u << len)
+                {
+                    litLen[i] = (s << 16) | len;
+                }
+            }
+
+            for (unsigned s = 0; s < 32; ++s)
+            {
+                for (unsigned i = ReverseCode(s, 5); i < (1u << kDistRootBits); i += 1u << 5)
+                {
+                    dist[i] = (s << 16) | 5;
+                }
+            }
+        }
+    };
+
+    constexpr FixedTables kFixedTables;
+}
+
+
+Inflater::Inflater() : m_pIn(NULL), m_inStart(0), m_pNext(NULL), m_pEnd(NULL),
+    m_bitBuf(0), m_bitCnt(0), m_padBytes(0), m_pSink(NULL),
+    m_out(kOutBufferSize), m_outPos(0), m_outFlushed(0), m_totalOut(0),
+    m_pObserver(NULL), m_litLenTable(kLitLenTableSize),
+    m_distTable(kDistTableSize)
+{
+}
+
+
+// Make at least cBits bits available in m_bitBuf (cBits <= 56).
+inline ZipResult Inflater::Need(unsigned cBits)
+{
+    if (m_bitCnt >= cBits)
+    {
+        return ZR_OK;
+    }
+    if (m_pEnd - m_pNext >= 8)
+    {
+        while (m_bitCnt <= 56)
+        {
+            m_bitBuf |= (uint64_t)*m_pNext++ << m_bitCnt;
+            m_bitCnt += 8;
+        }
+        return ZR_OK;
+    }
+    return RefillSlow(cBits);
+}
+
+ZipResult Inflater::RefillSlow(unsigned cBits)
+{
+    while (m_bitCnt < cBits)
+    {
+        if (m_pNext == m_pEnd)
+        {
+            Commit();
+            ZipResult result = m_pIn->Fill(m_pIn->Capacity());
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            m_pNext = m_pIn->Data();
+            m_pEnd = m_pNext + m_pIn->Available();
+            if (m_pNext == m_pEnd)
+            {
+                // Past the end of input. Pretend to read zero bytes so a
+                // final short code can still be looked up; if any of these
+                // bits are actually consumed the stream was truncated.
+                if (m_padBytes >= 8)
+                {
+                    return ZR_TRUNCATED;
+                }
+                m_padBytes++;
+                m_bitCnt += 8;
+                continue;
+            }
+        }
+        m_bitBuf |= (uint64_t)*m_pNext++ << m_bitCnt;
+        m_bitCnt += 8;
+    }
+    return ZR_OK;
+}
+
+void Inflater::Commit()
+{
+    m_pIn->SetCursor(m_pNext);
+}
+
+ZipResult Inflater::FlushOutput()
+{
+    if (m_outPos > m_outFlushed)
+    {
+        size_t cb = m_outPos - m_outFlushed;
+        ZipResult result = m_pSink->Write(&m_out[m_outFlushed], cb);
+        m_totalOut += cb;
+        m_outFlushed = m_outPos;
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+
+    // Keep only the last window of history once the buffer is nearly full.
+    if (m_outPos > kOutBufferSize - kMaxMatch)
+    {
+        memmove(&m_out[0], &m_out[m_outPos - kWindowSize], kWindowSize);
+        m_outPos = m_outFlushed = kWindowSize;
+    }
+    return ZR_OK;
+}
+
+
+#define NEED(n) \
+    do { \
+        if (m_bitCnt < (n)) \
+        { \
+            ZipResult needResult = Need(n); \
+            if (needResult != ZR_OK) return needResult; \
+        } \
+    } while (0)
+
+#define BITS(n) ((unsigned)(m_bitBuf & (((uint64_t)1 << (n)) - 1)))
+#define DROP(n) do { m_bitBuf >>= (n); m_bitCnt -= (n); } while (0)
+
+
+ZipResult Inflater::Inflate(BufferedReader &in, InflateSink &sink)
+{
+    return Run(in, sink, 0, NULL, 0);
+}
+
+ZipResult Inflater::InflateFrom(BufferedReader &in, InflateSink &sink,
+    unsigned skipBits, const uint8_t *pWindow, size_t cbWindow)
+{
+    return Run(in, sink, skipBits, pWindow, cbWindow);
+}
+
+ZipResult Inflater::Run(BufferedReader &in, InflateSink &sink, unsigned skipBits,
+    const uint8_t *pWindow, size_t cbWindow)
+{
+    m_pIn = &in;
+    m_inStart = in.Position();
+    m_pNext = in.Data();
+    m_pEnd = m_pNext + in.Available();
+    m_bitBuf = 0;
+    m_bitCnt = 0;
+    m_padBytes = 0;
+    m_pSink = &sink;
+    m_totalOut = 0;
+
+    // Preset history is addressable by matches but is not output again.
+    cbWindow = std::min(cbWindow, kWindowSize);
+    if (cbWindow > 0)
+    {
+        memcpy(&m_out[0], pWindow, cbWindow);
+    }
+    m_outPos = cbWindow;
+    m_outFlushed = cbWindow;
+
+    ZipResult result;
+    if (skipBits > 0)
+    {
+        NEED(skipBits);
+        DROP(skipBits);
+    }
+
+    bool fFinal = false;
+    bool fFirst = true;
+    while (!fFinal)
+    {
+        if (m_pObserver != NULL && !fFirst)
+        {
+            uint64_t inByte = m_pIn->Position() + (m_pNext - m_pIn->Data()) +
+                m_padBytes - m_inStart;
+            size_t cbHistory = std::min(m_outPos, kWindowSize);
+            m_pObserver->OnBlockBoundary(inByte * 8 - m_bitCnt,
+                m_totalOut + (m_outPos - m_outFlushed),
+                &m_out[m_outPos - cbHistory], cbHistory);
+        }
+        fFirst = false;
+
+        NEED(3);
+        fFinal = (m_bitBuf & 1) != 0;
+        unsigned type = BITS(3) >> 1;
+        DROP(3);
+
+        switch (type)
+        {
+        case 0:
+            result = StoredBlock();
+            break;
+        case 1:
+            result = HuffmanBlock<true>(kFixedTables.litLen, kFixedTables.dist);
+            break;
+        case 2:
+            result = ReadDynamicTables();
+            if (result == ZR_OK)
+            {
+                result = HuffmanBlock<false>(&m_litLenTable[0], &m_distTable[0]);
+            }
+            break;
+        default:
+            result = ZR_BAD_FORMAT;
+            break;
+        }
+
+        if (result != ZR_OK)
+        {
+            Commit();
+            return result;
+        }
+    }
+
+    // Discard the padding to the byte boundary and give back whole bytes
+    // that were read ahead, except the made-up ones past the end of input.
+    DROP(m_bitCnt & 7);
+    unsigned cUnused = m_bitCnt / 8;
+    if (cUnused < m_padBytes)
+    {
+        Commit();
+        return ZR_TRUNCATED;
+    }
+    m_pNext -= cUnused - m_padBytes;
+    m_bitBuf = 0;
+    m_bitCnt = 0;
+    Commit();
+
+    return FlushOutput();
+}
+
+ZipResult Inflater::StoredBlock()
+{
+    DROP(m_bitCnt & 7);
+    NEED(32);
+    unsigned len = BITS(16);
+    unsigned nlen = (unsigned)(m_bitBuf >> 16) & 0xFFFF;
+    DROP(32);
+    if (len != (~nlen & 0xFFFF))
+    {
+        return ZR_BAD_FORMAT;
+    }
+    if (m_padBytes > 0)
+    {
+        return ZR_TRUNCATED;
+    }
+
+    // Hand the whole bytes still in the bit buffer back to the input and
+    // copy the block straight from the reader.
+    m_pNext -= m_bitCnt / 8;
+    m_bitBuf = 0;
+    m_bitCnt = 0;
+
+    while (len > 0)
+    {
+        if (m_outPos > kOutBufferSize - kMaxMatch)
+        {
+            ZipResult result = FlushOutput();
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+        }
+        if (m_pNext == m_pEnd)
+        {
+            Commit();
+            ZipResult result = m_pIn->Fill(m_pIn->Capacity());
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            m_pNext = m_pIn->Data();
+            m_pEnd = m_pNext + m_pIn->Available();
+            if (m_pNext == m_pEnd)
+            {
+                return ZR_TRUNCATED;
+            }
+        }
+        size_t cb = std::min<size_t>(len, std::min<size_t>(m_pEnd - m_pNext,
+            kOutBufferSize - m_outPos));
+        memcpy(&m_out[m_outPos], m_pNext, cb);
+        m_outPos += cb;
+        m_pNext += cb;
+        len -= (unsigned)cb;
+    }
+    return ZR_OK;
+}
+
+ZipResult Inflater::ReadDynamicTables()
+{
+    NEED(14);
+    unsigned nLitLen = BITS(5) + 257;
+    DROP(5);
+    unsigned nDist = BITS(5) + 1;
+    DROP(5);
+    unsigned nCodeLen = BITS(4) + 4;
+    DROP(4);
+    if (nLitLen > 286 || nDist > 30)
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    uint8_t lens[288 + 32];
+    memset(lens, 0, 19);
+    for (unsigned i = 0; i < nCodeLen; ++i)
+    {
+        NEED(3);
+        lens[kCodeLenOrder[i]] = (uint8_t)BITS(3);
+        DROP(3);
+    }
+
+    uint32_t codeLenTable[1 << kCodeLenRootBits];
+    if (!BuildDecodeTable(lens, 19, kCodeLenRootBits, codeLenTable,
+        1 << kCodeLenRootBits))
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    unsigned n = 0;
+    while (n < nLitLen + nDist)
+    {
+        NEED(kCodeLenRootBits + 7);
+        uint32_t entry = codeLenTable[BITS(kCodeLenRootBits)];
+        unsigned cBits = entry & 0xFF;
+        if (cBits == 0)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        DROP(cBits);
+        unsigned sym = entry >> 16;
+
+        if (sym < 16)
+        {
+            lens[n++] = (uint8_t)sym;
+            continue;
+        }
+
+        unsigned repeat;
+        uint8_t value = 0;
+        if (sym == 16)
+        {
+            if (n == 0)
+            {
+                return ZR_BAD_FORMAT;
+            }
+            value = lens[n - 1];
+            repeat = 3 + BITS(2);
+            DROP(2);
+        }
+        else if (sym == 17)
+        {
+            repeat = 3 + BITS(3);
+            DROP(3);
+        }
+        else
+        {
+            repeat = 11 + BITS(7);
+            DROP(7);
+        }
+        if (n + repeat > nLitLen + nDist)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        memset(lens + n, value, repeat);
+        n += repeat;
+    }
+
+    // A block without an end-of-block code can never terminate.
+    if (lens[256] == 0)
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    if (!BuildDecodeTable(lens, nLitLen, kLitLenRootBits, &m_litLenTable[0],
+        m_litLenTable.size()) ||
+        !BuildDecodeTable(lens + nLitLen, nDist, kDistRootBits,
+        &m_distTable[0], m_distTable.size()))
+    {
+        return ZR_BAD_FORMAT;
+    }
+    return ZR_OK;
+}
+
+template <bool fFixed>
+ZipResult Inflater::HuffmanBlock(const uint32_t *pLitLen, const uint32_t *pDist)
+{
+    uint8_t *pOut = &m_out[0];
+
+    for (;;)
+    {
+        if (m_outPos > kOutBufferSize - kMaxMatch)
+        {
+            ZipResult result = FlushOutput();
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+        }
+
+        NEED(kMaxCodeBits);
+        uint32_t entry = pLitLen[BITS(kLitLenRootBits)];
+        if (!fFixed && (entry & ENTRY_SUBTABLE))
+        {
+            DROP(kLitLenRootBits);
+            entry = pLitLen[(entry >> 16) + BITS((entry >> 8) & 0xF)];
+        }
+        unsigned cBits = entry & 0xFF;
+        if (cBits == 0)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        DROP(cBits);
+        unsigned sym = entry >> 16;
+
+        if (sym < 256)
+        {
+            pOut[m_outPos++] = (uint8_t)sym;
+            continue;
+        }
+        if (sym == 256)
+        {
+            return ZR_OK;
+        }
+
+        sym -= 257;
+        if (sym >= 29)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        NEED(5);
+        size_t length = kLengthBase[sym] + BITS(kLengthExtra[sym]);
+        DROP(kLengthExtra[sym]);
+
+        NEED(kMaxCodeBits);
+        entry = pDist[BITS(kDistRootBits)];
+        if (!fFixed && (entry & ENTRY_SUBTABLE))
+        {
+            DROP(kDistRootBits);
+            entry = pDist[(entry >> 16) + BITS((entry >> 8) & 0xF)];
+        }
+        cBits = entry & 0xFF;
+        if (cBits == 0)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        DROP(cBits);
+        sym = entry >> 16;
+        if (sym >= 30)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        NEED(13);
+        size_t dist = kDistBase[sym] + BITS(kDistExtra[sym]);
+        DROP(kDistExtra[sym]);
+
+        if (dist > m_outPos)
+        {
+            return ZR_BAD_FORMAT;
+        }
+
+        uint8_t *pDst = pOut + m_outPos;
+        const uint8_t *pSrc = pDst - dist;
+        m_outPos += length;
+        if (dist >= length)
+        {
+            memcpy(pDst, pSrc, length);
+        }
+        else if (dist >= 8)
+        {
+            // Overlapping, but each 8-byte step only reads bytes that were
+            // already written.
+            while (length >= 8)
+            {
+                memcpy(pDst, pSrc, 8);
+                pDst += 8;
+                pSrc += 8;
+                length -= 8;
+            }
+            while (length-- > 0)
+            {
+                *pDst++ = *pSrc++;
+            }
+        }
+        else
+        {
+            while (length-- > 0)
+            {
+                *pDst++ = *pSrc++;
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/****************************** Module Header ******************************\
+Module Name:  Inflate.h
+Project:      ZipFolderEx
+
+The file declares a raw DEFLATE (RFC 1951) decoder.
+
+The Inflater pulls compressed bytes from a BufferedReader and pushes the
+decompressed bytes to an InflateSink in chunks of up to 96 KB. It stops
+exactly at the end of the deflate stream and hands any bytes it read ahead
+back to the reader, so whatever follows the stream (a data descriptor or
+the next local header) can be parsed without knowing the compressed size.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+
+
+class InflateSink
+{
+public:
+    virtual ~InflateSink() {}
+
+    // Receive the next cb bytes of output. Returning anything other than
+    // ZR_OK stops the decoder, which passes the value back to its caller.
+    virtual ZipResult Write(const uint8_t *pb, size_t cb) = 0;
+};
+
+
+class InflateObserver
+{
+public:
+    virtual ~InflateObserver() {}
+
+    // Called before each block header after the first. inBit is the bit
+    // offset in the compressed stream, out the number of bytes decoded so
+    // far, and pWindow the last cbWindow (up to 32 KB) of those bytes.
+    virtual void OnBlockBoundary(uint64_t inBit, uint64_t out,
+        const uint8_t *pWindow, size_t cbWindow) = 0;
+};
+
+
+class Inflater
+{
+public:
+    Inflater();
+
+    //
+    //   FUNCTION: Inflater::Inflate
+    //
+    //   PURPOSE: Decode one complete raw deflate stream from the current
+    //   position of the reader. On success the reader is left on the first
+    //   byte after the stream.
+    //
+    ZipResult Inflate(BufferedReader &in, InflateSink &sink);
+
+    //
+    //   FUNCTION: Inflater::InflateFrom
+    //
+    //   PURPOSE: Resume decoding at a block boundary recorded by an
+    //   InflateObserver. The reader must be positioned on the byte holding
+    //   the boundary, skipBits (0-7) says how many of its low bits belong to
+    //   the previous block, and pWindow holds the history at that point.
+    //
+    ZipResult InflateFrom(BufferedReader &in, InflateSink &sink,
+        unsigned skipBits, const uint8_t *pWindow, size_t cbWindow);
+
+    // Receive block boundaries during the following calls; NULL to stop.
+    void SetObserver(InflateObserver *pObserver) { m_pObserver = pObserver; }
+
+    // Bytes produced by the last call to Inflate.
+    uint64_t TotalOut() const { return m_totalOut; }
+
+private:
+    Inflater(const Inflater &);
+    Inflater &operator=(const Inflater &);
+
+    ZipResult Run(BufferedReader &in, InflateSink &sink, unsigned skipBits,
+        const uint8_t *pWindow, size_t cbWindow);
+    ZipResult Need(unsigned cBits);
+    ZipResult RefillSlow(unsigned cBits);
+    void Commit();
+    ZipResult FlushOutput();
+
+    ZipResult StoredBlock();
+    ZipResult ReadDynamicTables();
+    // Decode one block with the given tables. fFixed says they are the
+    // fixed code's, which has no sub-tables to look for.
+    template <bool fFixed>
+    ZipResult HuffmanBlock(const uint32_t *pLitLen, const uint32_t *pDist);
+
+    // Bit reader state. Bytes are taken directly from the reader's buffer
+    // between m_pNext and m_pEnd.
+    BufferedReader *m_pIn;
+    uint64_t m_inStart;
+    const uint8_t *m_pNext;
+    const uint8_t *m_pEnd;
+    uint64_t m_bitBuf;
+    unsigned m_bitCnt;
+    unsigned m_padBytes;
+
+    // Output window: the last 32 KB of history followed by new output.
+    InflateSink *m_pSink;
+    std::vector<uint8_t> m_out;
+    size_t m_outPos;
+    size_t m_outFlushed;
+    uint64_t m_totalOut;
+
+    InflateObserver *m_pObserver;
+
+    // Decode tables for the current dynamic block.
+    std::vector<uint32_t> m_litLenTable;
+    std::vector<uint32_t> m_distTable;
+};
@@ -0,0 +1,542 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipArchive.cpp
+Project:      ZipFolderEx
+
+The file implements the seekable archive reader declared in ZipArchive.h.
+\***************************************************************************/
+
+#include "ZipArchive.h"
+#include "ZipStats.h"
+#include "ZipPath.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace
+{
+    // The end of central directory record is followed by a comment of at
+    // most 64 KB, so it lies within this many bytes of the end of the file.
+    const size_t kMaxEndSearch = ZIP_END_OF_CD_SIZE + 0xFFFF;
+
+    // Most archives have no comment or a short one, so the record is first
+    // looked for this near the end, and the whole window read only if it
+    // is not there.
+    const size_t kFirstEndSearch = 4096;
+
+    const uint64_t kOffsetUnknown = ~(uint64_t)0;
+}
+
+
+ZipArchive::ZipArchive() : m_pSource(NULL), m_cbArchive(0), m_nsDirectory(0), m_cbPrefix(0)
+{
+}
+
+ZipArchive::~ZipArchive()
+{
+    Close();
+}
+
+ZipResult ZipArchive::Open(const NativePath &path)
+{
+    Close();
+    ZipResult result = m_volumes.Open(path);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    m_pSource = &m_volumes;
+    m_path = path;
+
+    uint64_t start = ZipStatsNow();
+    result = ReadDirectory();
+    m_nsDirectory = ZipStatsNow() - start;
+    if (result != ZR_OK)
+    {
+        Close();
+    }
+    return result;
+}
+
+ZipResult ZipArchive::Open(ZipRandomAccess *pSource)
+{
+    Close();
+    m_pSource = pSource;
+
+    uint64_t start = ZipStatsNow();
+    ZipResult result = ReadDirectory();
+    m_nsDirectory = ZipStatsNow() - start;
+    if (result != ZR_OK)
+    {
+        Close();
+    }
+    return result;
+}
+
+void ZipArchive::Close()
+{
+    m_volumes.Close();
+    m_pSource = NULL;
+    m_path.clear();
+    m_cbArchive = 0;
+    m_nsDirectory = 0;
+    m_entries.clear();
+    m_diskStarts.clear();
+    m_cbPrefix = 0;
+    m_names.clear();
+    m_dataOffsets.clear();
+}
+
+bool ZipArchive::IsArchive(const NativePath &path, uint64_t cbMax)
+{
+    ZipArchive archive;
+    if (archive.m_volumes.Open(path) != ZR_OK ||
+        archive.m_volumes.GetSize(&archive.m_cbArchive) != ZR_OK ||
+        archive.m_cbArchive > cbMax || archive.m_cbArchive < ZIP_END_OF_CD_SIZE)
+    {
+        return false;
+    }
+    archive.m_pSource = &archive.m_volumes;
+
+    // The whole window at once, unlike Open: most files asked about are
+    // programs with no record at all, which the short first search would
+    // only read twice.
+    size_t cbTail = (size_t)std::min<uint64_t>(archive.m_cbArchive, kMaxEndSearch);
+    uint64_t endOffset, cdOffset, cdSize, cEntries;
+    uint8_t end[ZIP_END_OF_CD_SIZE];
+    return archive.SearchEndOfDirectory(cbTail, true, &endOffset, end) == ZR_OK &&
+        archive.LocateDirectory(endOffset, end, false, &cdOffset, &cdSize, &cEntries) == ZR_OK &&
+        cdOffset <= archive.m_cbArchive && cdSize <= archive.m_cbArchive - cdOffset;
+}
+
+void ZipArchive::ReleaseFile()
+{
+    if (m_pSource == &m_volumes)
+    {
+        m_volumes.Release();
+    }
+}
+
+ZipResult ZipArchive::ReopenFile()
+{
+    if (m_pSource != &m_volumes)
+    {
+        return ZR_OK;
+    }
+    return m_volumes.Reopen();
+}
+
+size_t ZipArchive::VolumeCount() const
+{
+    return m_pSource == &m_volumes ? m_volumes.VolumeCount() : 1;
+}
+
+ZipResult ZipArchive::SetDiskCount(uint32_t cDisks)
+{
+    m_diskStarts.clear();
+    if (cDisks <= 1)
+    {
+        return ZR_OK;
+    }
+
+    // Without all of the disks, the entries on the missing ones cannot be
+    // read and the offsets of the others cannot be placed.
+    if (VolumeCount() != cDisks)
+    {
+        return ZR_TRUNCATED;
+    }
+    for (uint32_t i = 0; i < cDisks; i++)
+    {
+        m_diskStarts.push_back(m_volumes.VolumeStart(i));
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipArchive::DiskToOffset(uint32_t disk, uint64_t offset, uint64_t *pOffset) const
+{
+    if (m_diskStarts.empty())
+    {
+        *pOffset = m_cbPrefix + offset;
+        return ZR_OK;
+    }
+    if (disk >= m_diskStarts.size())
+    {
+        return ZR_BAD_FORMAT;
+    }
+    *pOffset = m_diskStarts[disk] + offset;
+    return ZR_OK;
+}
+
+ZipResult ZipArchive::ReadDirectory()
+{
+    ZipResult result = m_pSource->GetSize(&m_cbArchive);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    uint64_t cdOffset, cdSize, cEntries;
+    result = FindEndOfDirectory(&cdOffset, &cdSize, &cEntries);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // Every central header takes at least 46 bytes, which bounds the entry
+    // count a corrupt record can claim before anything is allocated.
+    if (cdOffset > m_cbArchive || cdSize > m_cbArchive - cdOffset ||
+        cEntries > cdSize / ZIP_CENTRAL_HEADER_SIZE || cdSize > SIZE_MAX)
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    std::vector<uint8_t> directory((size_t)cdSize);
+    if (cdSize > 0)
+    {
+        result = ReadFullAt(m_pSource, cdOffset, &directory[0], (size_t)cdSize);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+
+    result = ParseDirectory(directory.empty() ? NULL : &directory[0],
+        directory.size(), cEntries);
+    if (result == ZR_OK)
+    {
+        m_dataOffsets.assign(m_entries.size(), kOffsetUnknown);
+    }
+    return result;
+}
+
+ZipResult ZipArchive::FindEndOfDirectory(uint64_t *pcdOffset, uint64_t *pcdSize,
+    uint64_t *pcEntries)
+{
+    size_t cbWhole = (size_t)std::min<uint64_t>(m_cbArchive, kMaxEndSearch);
+    size_t cbFirst = std::min(cbWhole, kFirstEndSearch);
+    if (cbFirst < ZIP_END_OF_CD_SIZE)
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    uint64_t endOffset;
+    uint8_t end[ZIP_END_OF_CD_SIZE];
+    ZipResult result = SearchEndOfDirectory(cbFirst, cbFirst == cbWhole, &endOffset, end);
+    if (result == ZR_BAD_FORMAT && cbFirst < cbWhole)
+    {
+        result = SearchEndOfDirectory(cbWhole, true, &endOffset, end);
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // Checking other candidates may have left the disks and the prefix of
+    // another behind.
+    return LocateDirectory(endOffset, end, false, pcdOffset, pcdSize, pcEntries);
+}
+
+ZipResult ZipArchive::SearchEndOfDirectory(size_t cbTail, bool fWhole, uint64_t *pEndOffset,
+    uint8_t *pEnd)
+{
+    uint64_t tailOffset = m_cbArchive - cbTail;
+    std::vector<uint8_t> tail(cbTail);
+    ZipResult result = ReadFullAt(m_pSource, tailOffset, &tail[0], cbTail);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // Take the last record whose comment runs to the end of the file and
+    // whose central directory is where it says, or failing that the last
+    // one whose directory is, so that a signature in a comment or in the
+    // program of a self-extracting archive is passed over. Only a search
+    // of the whole window may settle for less.
+    const uint8_t *pTail = &tail[0];
+    size_t validPos = SIZE_MAX;
+    size_t exactPos = SIZE_MAX;
+    size_t lastPos = SIZE_MAX;
+    size_t cbScan = cbTail - ZIP_END_OF_CD_SIZE + 4;
+    for (;;)
+    {
+        size_t pos = FindLastSignature(pTail, cbScan, ZIP_SIG_END_OF_CD);
+        if (pos == cbScan)
+        {
+            break;
+        }
+        cbScan = pos + 3;
+
+        bool fExact = pos + ZIP_END_OF_CD_SIZE + ReadLE16(pTail + pos + 20) == cbTail;
+        uint64_t cdOffset, cdSize, cEntries;
+        bool fValid = LocateDirectory(tailOffset + pos, pTail + pos, !fExact,
+            &cdOffset, &cdSize, &cEntries) == ZR_OK;
+        if (fValid && fExact)
+        {
+            validPos = pos;
+            break;
+        }
+        if (fValid && validPos == SIZE_MAX)
+        {
+            validPos = pos;
+        }
+        if (fExact && exactPos == SIZE_MAX)
+        {
+            exactPos = pos;
+        }
+        if (lastPos == SIZE_MAX)
+        {
+            lastPos = pos;
+        }
+    }
+
+    // Without a valid record, keep to the old choice and let the directory
+    // read report what is wrong with it.
+    size_t endPos = validPos != SIZE_MAX ? validPos : exactPos != SIZE_MAX ? exactPos : lastPos;
+    if (endPos == SIZE_MAX || (validPos == SIZE_MAX && !fWhole))
+    {
+        return ZR_BAD_FORMAT;
+    }
+    *pEndOffset = tailOffset + endPos;
+    memcpy(pEnd, pTail + endPos, ZIP_END_OF_CD_SIZE);
+    return ZR_OK;
+}
+
+ZipResult ZipArchive::LocateDirectory(uint64_t endOffset, const uint8_t *pEnd, bool fCheck,
+    uint64_t *pcdOffset, uint64_t *pcdSize, uint64_t *pcEntries)
+{
+    m_cbPrefix = 0;
+
+    // The record is on the last disk of a split archive, so its disk
+    // number tells how many there are.
+    uint32_t cDisks = ReadLE16(pEnd + 4) + 1u;
+    uint32_t cdDisk = ReadLE16(pEnd + 6);
+    *pcEntries = ReadLE16(pEnd + 10);
+    *pcdSize = ReadLE32(pEnd + 12);
+    uint64_t cdOffset = ReadLE32(pEnd + 16);
+
+    // Where the directory ends in the file: at the end record, or at the
+    // ZIP64 one if there is one.
+    uint64_t cdEnd = endOffset;
+
+    // A ZIP64 locator right in front of the record points at the ZIP64 end
+    // of central directory record, which holds the full-width values.
+    uint8_t locator[ZIP_ZIP64_LOCATOR_SIZE];
+    ZipResult result = ZR_OK;
+    if (endOffset >= ZIP_ZIP64_LOCATOR_SIZE)
+    {
+        result = ReadFullAt(m_pSource, endOffset - ZIP_ZIP64_LOCATOR_SIZE,
+            locator, sizeof(locator));
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+    if (endOffset < ZIP_ZIP64_LOCATOR_SIZE || ReadLE32(locator) != ZIP_SIG_ZIP64_LOCATOR)
+    {
+        result = SetDiskCount(cDisks);
+    }
+    else
+    {
+        uint64_t end64Offset = 0;
+        result = SetDiskCount(ReadLE32(locator + 16));
+        if (result == ZR_OK)
+        {
+            result = DiskToOffset(ReadLE32(locator + 4), ReadLE64(locator + 8), &end64Offset);
+        }
+        uint8_t end64[ZIP_ZIP64_END_OF_CD_SIZE];
+        if (result == ZR_OK)
+        {
+            result = ReadFullAt(m_pSource, end64Offset, end64, sizeof(end64));
+        }
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+
+        // Behind a prefix the recorded offset is short by its size; the
+        // record is then usually right in front of the locator.
+        uint64_t cbInFront = ZIP_ZIP64_LOCATOR_SIZE + ZIP_ZIP64_END_OF_CD_SIZE;
+        if (ReadLE32(end64) != ZIP_SIG_ZIP64_END_OF_CD && m_diskStarts.empty() &&
+            endOffset >= cbInFront)
+        {
+            end64Offset = endOffset - cbInFront;
+            result = ReadFullAt(m_pSource, end64Offset, end64, sizeof(end64));
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+        }
+        if (ReadLE32(end64) != ZIP_SIG_ZIP64_END_OF_CD)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        cdDisk = ReadLE32(end64 + 20);
+        *pcEntries = ReadLE64(end64 + 32);
+        *pcdSize = ReadLE64(end64 + 40);
+        cdOffset = ReadLE64(end64 + 48);
+        cdEnd = end64Offset;
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // The directory ends where it was found, so if it was recorded as
+    // ending earlier the difference is the size of whatever is in front of
+    // the archive - provided a central header is where that puts it.
+    uint8_t signature[4];
+    if (m_diskStarts.empty() && cdOffset <= cdEnd && *pcdSize < cdEnd - cdOffset)
+    {
+        uint64_t cbPrefix = cdEnd - cdOffset - *pcdSize;
+        if (ReadFullAt(m_pSource, cdOffset + cbPrefix, signature, sizeof(signature)) == ZR_OK &&
+            ReadLE32(signature) == ZIP_SIG_CENTRAL_HEADER)
+        {
+            m_cbPrefix = cbPrefix;
+        }
+    }
+    result = DiskToOffset(cdDisk, cdOffset, pcdOffset);
+    if (result != ZR_OK || !fCheck || *pcdSize == 0 || m_cbPrefix != 0)
+    {
+        return result;
+    }
+    result = ReadFullAt(m_pSource, *pcdOffset, signature, sizeof(signature));
+    if (result == ZR_OK && ReadLE32(signature) != ZIP_SIG_CENTRAL_HEADER)
+    {
+        result = ZR_BAD_FORMAT;
+    }
+    return result;
+}
+
+ZipResult ZipArchive::ParseDirectory(const uint8_t *p, size_t cb, uint64_t cEntries)
+{
+    m_entries.reserve((size_t)cEntries);
+    size_t pos = 0;
+
+    // The count in the end record is only a hint; some writers get it
+    // wrong past 65535 entries, so read headers until the directory ends.
+    while (cb - pos >= ZIP_CENTRAL_HEADER_SIZE &&
+        ReadLE32(p + pos) == ZIP_SIG_CENTRAL_HEADER)
+    {
+        const uint8_t *pHeader = p + pos;
+        size_t cbName = ReadLE16(pHeader + 28);
+        size_t cbExtra = ReadLE16(pHeader + 30);
+        size_t cbComment = ReadLE16(pHeader + 32);
+        size_t cbRecord = ZIP_CENTRAL_HEADER_SIZE + cbName + cbExtra + cbComment;
+        if (cbRecord > cb - pos)
+        {
+            return ZR_BAD_FORMAT;
+        }
+
+        ZipEntryInfo entry;
+        entry.versionMadeBy = ReadLE16(pHeader + 4);
+        entry.flags = ReadLE16(pHeader + 8);
+        entry.method = ReadLE16(pHeader + 10);
+        entry.dosTime = ReadLE16(pHeader + 12);
+        entry.dosDate = ReadLE16(pHeader + 14);
+        entry.crc32 = ReadLE32(pHeader + 16);
+        entry.compressedSize = ReadLE32(pHeader + 20);
+        entry.uncompressedSize = ReadLE32(pHeader + 24);
+        entry.diskStart = ReadLE16(pHeader + 34);
+        entry.externalAttributes = ReadLE32(pHeader + 38);
+        entry.localHeaderOffset = ReadLE32(pHeader + 42);
+        entry.name.assign((const char *)pHeader + ZIP_CENTRAL_HEADER_SIZE, cbName);
+
+        const uint8_t *pExtra = pHeader + ZIP_CENTRAL_HEADER_SIZE + cbName;
+        DecodeEntryName(pExtra, cbExtra, entry);
+        ParseTimestampExtra(pExtra, cbExtra, entry);
+        ZipResult result = ParseZip64Extra(pExtra, cbExtra, entry, false, NULL);
+        if (result == ZR_OK)
+        {
+            result = DiskToOffset(entry.diskStart, entry.localHeaderOffset,
+                &entry.localHeaderOffset);
+        }
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+
+        m_entries.push_back(entry);
+        pos += cbRecord;
+    }
+
+    return m_entries.empty() && cEntries > 0 ? ZR_BAD_FORMAT : ZR_OK;
+}
+
+uint64_t ZipArchive::MemoryFootprint() const
+{
+    // Names too long for the string's own buffer are on the heap, and the
+    // name index, once built, holds a tree node and a copy of each.
+    const uint64_t kMapNodeOverhead = 64;
+    uint64_t cb = m_entries.capacity() * sizeof(ZipEntryInfo) +
+        m_dataOffsets.capacity() * sizeof(uint64_t);
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        uint64_t cbName = m_entries[i].name.capacity() + 1;
+        cb += cbName > sizeof(std::string) ? cbName : 0;
+        cb += m_names.empty() ? 0 : kMapNodeOverhead + cbName;
+    }
+    return cb;
+}
+
+bool ZipArchive::FindEntry(const std::string &name, size_t *pIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_names.empty())
+    {
+        // Later duplicates win, as they do when extracting in order.
+        for (size_t i = 0; i < m_entries.size(); i++)
+        {
+            m_names[m_entries[i].name] = i;
+        }
+    }
+
+    std::map<std::string, size_t>::const_iterator it = m_names.find(name);
+    if (it == m_names.end())
+    {
+        return false;
+    }
+    *pIndex = it->second;
+    return true;
+}
+
+ZipResult ZipArchive::GetDataOffset(size_t index, uint64_t *pOffset)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_dataOffsets[index] != kOffsetUnknown)
+        {
+            *pOffset = m_dataOffsets[index];
+            return ZR_OK;
+        }
+    }
+
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    ZipResult result = ReadFullAt(m_pSource, m_entries[index].localHeaderOffset,
+        header, sizeof(header));
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    return GetDataOffset(index, header, pOffset);
+}
+
+ZipResult ZipArchive::GetDataOffset(size_t index, const uint8_t *pHeader, uint64_t *pOffset)
+{
+    const ZipEntryInfo &entry = m_entries[index];
+    if (ReadLE32(pHeader) != ZIP_SIG_LOCAL_HEADER)
+    {
+        return ZR_BAD_FORMAT;
+    }
+
+    uint64_t offset = entry.localHeaderOffset + ZIP_LOCAL_HEADER_SIZE +
+        ReadLE16(pHeader + 26) + ReadLE16(pHeader + 28);
+    if (offset > m_cbArchive || entry.compressedSize > m_cbArchive - offset)
+    {
+        return ZR_TRUNCATED;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_dataOffsets[index] = offset;
+    *pOffset = offset;
+    return ZR_OK;
+}
@@ -0,0 +1,147 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipArchive.h
+Project:      ZipFolderEx
+
+The file declares the seekable archive reader.
+
+ZipArchive locates the end of central directory record (and its ZIP64
+counterpart) at the tail of the file and loads the whole central directory
+into memory, so that any entry can be looked up by index or name and its
+data read in place without walking the local headers in front of it.
+
+An archive opened by path may be split over several files (ZipVolumes.h).
+The offsets of a split archive count from the start of the disk they are
+on; ZipArchive turns them into offsets in the whole set, so the entries
+and Source() look the same as those of a single file.
+
+An archive may also sit behind other data: a self-extracting executable
+is a program with an archive appended, and its offsets usually still
+count from the start of the archive rather than of the file. The end
+record is found by a vectorized backward scan (FindLastSignature), each
+candidate is checked against the central directory it points at, and the
+difference between where the directory was recorded and where it is
+found is added to every offset (PrefixSize).
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipVolumes.h"
+#include <map>
+
+
+class ZipArchive
+{
+public:
+    ZipArchive();
+    ~ZipArchive();
+
+    //
+    //   FUNCTION: ZipArchive::Open
+    //
+    //   PURPOSE: Open the archive at path and read its central directory.
+    //   If path is one volume of a split archive, the rest of the set is
+    //   opened with it. The second form reads from a source owned by the
+    //   caller, which must outlive the archive.
+    //
+    ZipResult Open(const NativePath &path);
+    ZipResult Open(ZipRandomAccess *pSource);
+    void Close();
+
+    //
+    //   FUNCTION: ZipArchive::IsArchive
+    //
+    //   PURPOSE: Tell whether the file at path holds a readable end of
+    //   central directory, without loading the directory. Used to offer
+    //   extraction for executables that turn out to be self-extracting
+    //   archives and for .001 files that are the start of a split one, so
+    //   it reads the last 64 KB of the file, or of its set, at most, in one
+    //   read. A file larger than cbMax is not read and is not an archive.
+    //
+    static bool IsArchive(const NativePath &path, uint64_t cbMax = ~(uint64_t)0);
+
+    //
+    //   FUNCTION: ZipArchive::ReleaseFile
+    //
+    //   PURPOSE: Close the files of an archive opened by path but keep its
+    //   directory, so a cached archive does not hold them open (and, on
+    //   Windows, locked against deletion) between uses. ReopenFile opens
+    //   them again and fails if any has changed size meanwhile.
+    //
+    void ReleaseFile();
+    ZipResult ReopenFile();
+
+    size_t EntryCount() const { return m_entries.size(); }
+    const ZipEntryInfo &Entry(size_t index) const { return m_entries[index]; }
+
+    // Look up an entry by its decoded UTF-8 name (see DecodeEntryName), as
+    // Entry(index).name has it. Thread safe.
+    bool FindEntry(const std::string &name, size_t *pIndex) const;
+
+    //
+    //   FUNCTION: ZipArchive::GetDataOffset
+    //
+    //   PURPOSE: Read the local header of an entry and return the offset of
+    //   its first data byte. The local name and extra field lengths may
+    //   differ from the central ones, so the header must be read. Thread
+    //   safe; the result is cached.
+    //
+    ZipResult GetDataOffset(size_t index, uint64_t *pOffset);
+
+    // The same for a caller that has already read the entry's local header
+    // (ZIP_LOCAL_HEADER_SIZE bytes at pHeader), as part of a larger read.
+    ZipResult GetDataOffset(size_t index, const uint8_t *pHeader, uint64_t *pOffset);
+
+    ZipRandomAccess *Source() const { return m_pSource; }
+    uint64_t ArchiveSize() const { return m_cbArchive; }
+
+    // The size of the data in front of the archive that its offsets do not
+    // count, such as the program of a self-extracting archive.
+    uint64_t PrefixSize() const { return m_cbPrefix; }
+
+    // The number of files the archive was opened from; more than one for
+    // a split archive.
+    size_t VolumeCount() const;
+
+    // The path passed to Open, or empty for a caller supplied source.
+    const NativePath &Path() const { return m_path; }
+
+    // Nanoseconds Open spent finding and parsing the central directory.
+    uint64_t DirectoryReadTime() const { return m_nsDirectory; }
+
+    // Roughly how much memory the loaded directory takes, for budgeting.
+    uint64_t MemoryFootprint() const;
+
+private:
+    ZipArchive(const ZipArchive &);
+    ZipArchive &operator=(const ZipArchive &);
+
+    ZipResult ReadDirectory();
+    ZipResult FindEndOfDirectory(uint64_t *pcdOffset, uint64_t *pcdSize,
+        uint64_t *pcEntries);
+    ZipResult SearchEndOfDirectory(size_t cbTail, bool fWhole, uint64_t *pEndOffset,
+        uint8_t *pEnd);
+    ZipResult LocateDirectory(uint64_t endOffset, const uint8_t *pEnd, bool fCheck,
+        uint64_t *pcdOffset, uint64_t *pcdSize, uint64_t *pcEntries);
+    ZipResult ParseDirectory(const uint8_t *p, size_t cb, uint64_t cEntries);
+    ZipResult SetDiskCount(uint32_t cDisks);
+    ZipResult DiskToOffset(uint32_t disk, uint64_t offset, uint64_t *pOffset) const;
+
+    ZipVolumeSet m_volumes;
+    ZipRandomAccess *m_pSource;
+    NativePath m_path;
+    uint64_t m_cbArchive;
+    uint64_t m_nsDirectory;
+    std::vector<ZipEntryInfo> m_entries;
+
+    // Where each disk of a split archive starts in m_volumes; empty when
+    // the archive is on a single disk and its offsets need no mapping.
+    std::vector<uint64_t> m_diskStarts;
+
+    // Added to the offsets of a single-disk archive; see PrefixSize.
+    uint64_t m_cbPrefix;
+
+    // Built on first use; guarded by m_lock.
+    mutable std::mutex m_lock;
+    mutable std::map<std::string, size_t> m_names;
+    std::vector<uint64_t> m_dataOffsets;
+};
@@ -0,0 +1,210 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipCpu.cpp
+Project:      ZipFolderEx
+
+The file implements the CPU feature detection declared in ZipCpu.h.
+\***************************************************************************/
+
+#include "ZipCpu.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if defined(ZIP_CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(ZIP_CPU_X86)
+#include <cpuid.h>
+#endif
+
+
+namespace
+{
+    enum CpuLevel
+    {
+        LEVEL_GENERIC,
+        LEVEL_SSE2,
+        LEVEL_SSE42,
+        LEVEL_AVX2,
+        LEVEL_AVX512
+    };
+
+    const char *const kLevelNames[] = { "generic", "sse2", "sse4.2", "avx2", "avx512" };
+
+    // Not a function-local static: those are not thread safe on the XP
+    // toolset. ZipCpu fills these in on its first call, which is made while
+    // the modules are initialized (see g_fDetectedAtLoad).
+    ZipCpuFeatures g_features;
+    CpuLevel g_level;
+    bool g_fDetected;
+
+#ifdef ZIP_CPU_X86
+    void CpuId(unsigned leaf, unsigned subleaf, unsigned regs[4])
+    {
+#ifdef _MSC_VER
+        int r[4];
+        __cpuidex(r, (int)leaf, (int)subleaf);
+        for (int i = 0; i < 4; i++)
+        {
+            regs[i] = (unsigned)r[i];
+        }
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // The register state the system saves on a context switch (XCR0).
+    uint64_t SavedState()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t lo, hi;
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((uint64_t)hi << 32) | lo;
+#endif
+    }
+
+    void DetectFeatures(ZipCpuFeatures *pFeatures)
+    {
+        unsigned regs[4];
+        CpuId(0, 0, regs);
+        unsigned maxLeaf = regs[0];
+        if (maxLeaf < 1)
+        {
+            return;
+        }
+
+        CpuId(1, 0, regs);
+        unsigned ecx1 = regs[2];
+        unsigned edx1 = regs[3];
+        pFeatures->fSse2 = (edx1 & (1u << 26)) != 0;
+        pFeatures->fSsse3 = (ecx1 & (1u << 9)) != 0;
+        pFeatures->fSse41 = (ecx1 & (1u << 19)) != 0;
+        pFeatures->fSse42 = (ecx1 & (1u << 20)) != 0;
+        pFeatures->fPclmul = (ecx1 & (1u << 1)) != 0;
+        pFeatures->fPopcnt = (ecx1 & (1u << 23)) != 0;
+
+        // AVX registers are only usable if the system saves them.
+        bool fOsXsave = (ecx1 & (1u << 27)) != 0;
+        uint64_t state = fOsXsave ? SavedState() : 0;
+        bool fYmm = (state & 0x06) == 0x06;
+        bool fZmm = (state & 0xE6) == 0xE6;
+        pFeatures->fAvx = fYmm && (ecx1 & (1u << 28)) != 0;
+
+        if (maxLeaf >= 7)
+        {
+            CpuId(7, 0, regs);
+            unsigned ebx7 = regs[1];
+            pFeatures->fAvx2 = pFeatures->fAvx && (ebx7 & (1u << 5)) != 0;
+            pFeatures->fBmi2 = (ebx7 & (1u << 8)) != 0;
+            const unsigned avx512 = (1u << 16) | (1u << 30) | (1u << 31);   // F, BW, VL
+            pFeatures->fAvx512 = pFeatures->fAvx2 && fZmm && (ebx7 & avx512) == avx512;
+        }
+    }
+#else
+    void DetectFeatures(ZipCpuFeatures *)
+    {
+    }
+#endif
+
+    CpuLevel LevelOf(const ZipCpuFeatures &features)
+    {
+        if (features.fAvx512)
+        {
+            return LEVEL_AVX512;
+        }
+        if (features.fAvx2 && features.fBmi2)
+        {
+            return LEVEL_AVX2;
+        }
+        if (features.fSse42 && features.fPclmul)
+        {
+            return LEVEL_SSE42;
+        }
+        return features.fSse2 ? LEVEL_SSE2 : LEVEL_GENERIC;
+    }
+
+    // The level named by ZIPFOLDEREX_CPU, or LEVEL_AVX512 (no cap) if it is
+    // unset or names none.
+    CpuLevel LevelFromEnvironment()
+    {
+        char sz[16];
+#ifdef _WIN32
+        DWORD cch = GetEnvironmentVariableA("ZIPFOLDEREX_CPU", sz, sizeof(sz));
+        if (cch == 0 || cch >= sizeof(sz))
+        {
+            return LEVEL_AVX512;
+        }
+#else
+        const char *psz = getenv("ZIPFOLDEREX_CPU");
+        if (psz == NULL || strlen(psz) >= sizeof(sz))
+        {
+            return LEVEL_AVX512;
+        }
+        strcpy(sz, psz);
+#endif
+        for (int i = LEVEL_GENERIC; i <= LEVEL_AVX512; i++)
+        {
+            if (strcmp(sz, kLevelNames[i]) == 0)
+            {
+                return (CpuLevel)i;
+            }
+        }
+        return LEVEL_AVX512;
+    }
+
+    void CapFeatures(ZipCpuFeatures *pFeatures, CpuLevel level)
+    {
+        if (level < LEVEL_AVX512)
+        {
+            pFeatures->fAvx512 = false;
+        }
+        if (level < LEVEL_AVX2)
+        {
+            pFeatures->fAvx = false;
+            pFeatures->fAvx2 = false;
+            pFeatures->fBmi2 = false;
+        }
+        if (level < LEVEL_SSE42)
+        {
+            pFeatures->fSsse3 = false;
+            pFeatures->fSse41 = false;
+            pFeatures->fSse42 = false;
+            pFeatures->fPclmul = false;
+            pFeatures->fPopcnt = false;
+        }
+        if (level < LEVEL_SSE2)
+        {
+            pFeatures->fSse2 = false;
+        }
+    }
+
+    const bool g_fDetectedAtLoad = (ZipCpu(), true);
+}
+
+
+const ZipCpuFeatures &ZipCpu()
+{
+    if (!g_fDetected)
+    {
+        ZipCpuFeatures features;
+        memset(&features, 0, sizeof(features));
+        DetectFeatures(&features);
+        CapFeatures(&features, LevelFromEnvironment());
+        g_features = features;
+        g_level = LevelOf(features);
+        g_fDetected = true;
+    }
+    return g_features;
+}
+
+const char *ZipCpuLevel()
+{
+    ZipCpu();
+    return kLevelNames[g_level];
+}
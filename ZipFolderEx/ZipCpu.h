@@ -0,0 +1,70 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipCpu.h
+Project:      ZipFolderEx
+
+The file declares the CPU feature detection that the hot loops use to pick
+their fastest variant.
+
+The extension ships as one Win32 and one x64 binary, built for the oldest
+CPU it has to run on. Loops that gain from newer instructions - CRC-32,
+the signature scans, the icon pixel loops - are built in several
+variants, each compiled for its own instruction set, and a module picks
+one when it is loaded by calling ZipCpu() from the initializer of a
+function pointer. The choice is made once per process, so a call costs
+one indirect jump and no feature test.
+
+Setting ZIPFOLDEREX_CPU to generic, sse2, sse4.2 or avx2 caps the
+instruction sets used at that level, to compare the variants or rule one
+out. On other processors than x86 every flag is false and the portable
+code runs.
+\***************************************************************************/
+
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define ZIP_CPU_X86 1
+#endif
+
+// Compiles one function for an instruction set the rest of the file is not
+// built for. MSVC needs nothing: it emits any intrinsic it is given.
+#if defined(ZIP_CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ZIP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ZIP_TARGET(isa)
+#endif
+
+
+//
+//   STRUCT: ZipCpuFeatures
+//
+//   PURPOSE: The instruction sets that both the processor and the operating
+//   system support. The AVX flags are only set if the system saves the
+//   wide registers on a context switch.
+//
+struct ZipCpuFeatures
+{
+    bool fSse2;
+    bool fSsse3;
+    bool fSse41;
+    bool fSse42;
+    bool fPclmul;
+    bool fPopcnt;
+    bool fAvx;
+    bool fAvx2;
+    bool fBmi2;
+    bool fAvx512;           // F, BW and VL, the subsets worth coding for
+};
+
+
+//
+//   FUNCTION: ZipCpu
+//
+//   PURPOSE: Return the features of this processor, less those ruled out by
+//   ZIPFOLDEREX_CPU. Detected on the first call, which is made while the
+//   modules are initialized and so before any other thread runs.
+//
+const ZipCpuFeatures &ZipCpu();
+
+// The highest level in use, as ZIPFOLDEREX_CPU names it: "generic",
+// "sse2", "sse4.2", "avx2" or "avx512".
+const char *ZipCpuLevel();
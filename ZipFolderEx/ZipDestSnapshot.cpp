@@ -0,0 +1,244 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipDestSnapshot.cpp
+Project:      ZipFolderEx
+
+The file implements the overwrite policies and the destination snapshot
+declared in ZipDestSnapshot.h.
+\***************************************************************************/
+
+#include "ZipDestSnapshot.h"
+#include "ZipPath.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace
+{
+    const uint64_t kUnixEpochTicks = 116444736000000000ull;
+
+#ifdef _WIN32
+    // Windows 7 and later; older systems refuse them as invalid, and are
+    // asked again the old way.
+    const FINDEX_INFO_LEVELS kFindExInfoBasic = (FINDEX_INFO_LEVELS)1;
+    const DWORD kFindFirstExLargeFetch = 2;
+#endif
+
+    bool IsDotOrDotDot(const NativePath::value_type *psz)
+    {
+        return psz[0] == '.' && (psz[1] == 0 || (psz[1] == '.' && psz[2] == 0));
+    }
+}
+
+
+const char *ZipOverwritePolicyToString(ZipOverwritePolicy policy)
+{
+    switch (policy)
+    {
+    case ZIP_OVERWRITE_ALWAYS:  return "always";
+    case ZIP_OVERWRITE_NEVER:   return "never";
+    case ZIP_OVERWRITE_NEWER:   return "newer";
+    case ZIP_OVERWRITE_RENAME:  return "rename";
+    }
+    return "unknown";
+}
+
+bool ZipOverwritePolicyFromString(const char *psz, ZipOverwritePolicy *pPolicy)
+{
+    const ZipOverwritePolicy policies[] =
+    {
+        ZIP_OVERWRITE_ALWAYS, ZIP_OVERWRITE_NEVER, ZIP_OVERWRITE_NEWER, ZIP_OVERWRITE_RENAME
+    };
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+    {
+        if (strcmp(psz, ZipOverwritePolicyToString(policies[i])) == 0)
+        {
+            *pPolicy = policies[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+ZipDestinationSnapshot::ZipDestinationSnapshot() : m_fIgnoreCase(false)
+{
+}
+
+void ZipDestinationSnapshot::Reset(size_t cDirectories, bool fIgnoreCase)
+{
+    Clear();
+    m_fIgnoreCase = fIgnoreCase;
+    m_listings.resize(cDirectories);
+}
+
+void ZipDestinationSnapshot::Clear()
+{
+    m_listings.clear();
+}
+
+NativePath ZipDestinationSnapshot::Key(const NativePath &name) const
+{
+    if (!m_fIgnoreCase)
+    {
+        return name;
+    }
+#ifdef _WIN32
+    // What NTFS compares by, near enough: the simple upper case mapping.
+    NativePath key = name;
+    if (!key.empty())
+    {
+        CharUpperBuffW(&key[0], (DWORD)key.size());
+    }
+    return key;
+#else
+    NativePath key;
+    AppendFoldedName(name, true, &key);
+    return key;
+#endif
+}
+
+ZipResult ZipDestinationSnapshot::ReadDirectory(uint32_t dir, int fd, const NativePath &path)
+{
+    Listing &listing = m_listings[dir];
+    Item item = { 0, true, false };
+#ifdef _WIN32
+    (void)fd;
+    NativePath pattern = JoinPath(path, L"*");
+    WIN32_FIND_DATAW data;
+    HANDLE hFind = FindFirstFileExW(pattern.c_str(), kFindExInfoBasic, &data,
+        FindExSearchNameMatch, NULL, kFindFirstExLargeFetch);
+    if (hFind == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER)
+    {
+        hFind = FindFirstFileExW(pattern.c_str(), FindExInfoStandard, &data,
+            FindExSearchNameMatch, NULL, 0);
+    }
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? ZR_OK : ZR_IO_ERROR;
+    }
+    do
+    {
+        if (IsDotOrDotDot(data.cFileName))
+        {
+            continue;
+        }
+        item.modified = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+            data.ftLastWriteTime.dwLowDateTime;
+        item.fModified = true;
+        listing[Key(data.cFileName)] = item;
+    } while (FindNextFileW(hFind, &data));
+    DWORD error = GetLastError();
+    FindClose(hFind);
+    return error == ERROR_NO_MORE_FILES ? ZR_OK : ZR_IO_ERROR;
+#else
+    // fdopendir takes over the descriptor it is given, and the tree keeps
+    // its own.
+    int dirFd = fd >= 0 ? openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) :
+        open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *pDir = dirFd >= 0 ? fdopendir(dirFd) : NULL;
+    if (pDir == NULL)
+    {
+        if (dirFd >= 0)
+        {
+            close(dirFd);
+        }
+        return ZR_IO_ERROR;
+    }
+    while (struct dirent *pEntry = readdir(pDir))
+    {
+        if (!IsDotOrDotDot(pEntry->d_name))
+        {
+            listing[Key(pEntry->d_name)] = item;
+        }
+    }
+    closedir(pDir);
+    return ZR_OK;
+#endif
+}
+
+void ZipDestinationSnapshot::Reserve(uint32_t dir, const NativePath &name)
+{
+    Item item = { 0, false, false };
+    m_listings[dir].insert(std::make_pair(Key(name), item));
+}
+
+uint64_t ZipDestinationSnapshot::ModifiedTime(int fd, const NativePath &dirPath,
+    const NativePath &name, Item &item)
+{
+    if (!item.fModified)
+    {
+        item.fModified = true;
+#ifndef _WIN32
+        struct stat st;
+        int result = fd >= 0 ? fstatat(fd, name.c_str(), &st, 0) :
+            stat(JoinPath(dirPath, name).c_str(), &st);
+        if (result == 0)
+        {
+            item.modified = (uint64_t)((int64_t)st.st_mtim.tv_sec * 10000000 +
+                st.st_mtim.tv_nsec / 100 + (int64_t)kUnixEpochTicks);
+        }
+#else
+        (void)fd;
+        (void)dirPath;
+        (void)name;
+#endif
+    }
+    return item.modified;
+}
+
+ZipOverwriteAction ZipDestinationSnapshot::Decide(uint32_t dir, int fd,
+    const NativePath &dirPath, const NativePath &name, uint64_t entryModified,
+    ZipOverwritePolicy policy, NativePath *pNewName)
+{
+    Listing &listing = m_listings[dir];
+    Listing::iterator it = listing.find(Key(name));
+    if (policy == ZIP_OVERWRITE_ALWAYS || it == listing.end() || !it->second.fOnDisk)
+    {
+        return ZIP_ACTION_WRITE;
+    }
+    if (policy == ZIP_OVERWRITE_NEVER)
+    {
+        return ZIP_ACTION_KEEP;
+    }
+    if (policy == ZIP_OVERWRITE_NEWER)
+    {
+        // An entry of unknown age does not count as newer; a file whose
+        // time cannot be read does not count as newer than the entry.
+        return entryModified > ModifiedTime(fd, dirPath, name, it->second) ?
+            ZIP_ACTION_WRITE : ZIP_ACTION_KEEP;
+    }
+
+    // "name (2).ext": the number goes before the extension, unless the
+    // only dot starts the name (".profile (2)").
+    size_t dot = name.find_last_of((NativePath::value_type)'.');
+    if (dot == 0 || dot == NativePath::npos)
+    {
+        dot = name.size();
+    }
+    for (unsigned n = 2; ; n++)
+    {
+        char sz[16];
+        snprintf(sz, sizeof(sz), " (%u)", n);
+        NativePath candidate = name.substr(0, dot);
+        for (const char *psz = sz; *psz != '\0'; psz++)
+        {
+            candidate += (NativePath::value_type)*psz;
+        }
+        candidate += name.substr(dot);
+        NativePath key = Key(candidate);
+        if (listing.find(key) == listing.end())
+        {
+            Item item = { 0, false, false };
+            listing.insert(std::make_pair(key, item));
+            pNewName->swap(candidate);
+            return ZIP_ACTION_RENAME;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipDestSnapshot.h
+Project:      ZipFolderEx
+
+The file declares the overwrite policies of the extractor and the snapshot
+of the destination they are decided from.
+
+Deciding whether to replace, keep or rename a file that is already there
+takes knowing what is there. Asking the file system once per entry costs a
+round trip each on a network share, and most of the answers are "nothing".
+ZipDestinationSnapshot instead reads each destination directory that
+existed before the extraction once, in large batches (readdir, which
+fetches with getdents64, or FindFirstFileEx with FIND_FIRST_EX_LARGE_FETCH),
+into a hash table, and answers every entry from memory. Directories the
+extraction created itself are empty and are not read at all.
+
+Win32 returns each file's last write time with its name, so every decision
+comes from the listing. POSIX listings carry names only, so the newer-only
+policy looks up the time of a file that is there, and only of those.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+#include <unordered_map>
+
+
+enum ZipOverwritePolicy
+{
+    ZIP_OVERWRITE_ALWAYS,       // replace whatever is there (the default)
+    ZIP_OVERWRITE_NEVER,        // keep it and skip the entry
+    ZIP_OVERWRITE_NEWER,        // replace it only with a newer entry
+    ZIP_OVERWRITE_RENAME,       // keep it and write the entry as "name (2).ext"
+};
+
+// "always", "never", "newer" and "rename", for options and stats.
+const char *ZipOverwritePolicyToString(ZipOverwritePolicy policy);
+bool ZipOverwritePolicyFromString(const char *psz, ZipOverwritePolicy *pPolicy);
+
+enum ZipOverwriteAction
+{
+    ZIP_ACTION_WRITE,           // nothing is in the way, or it is replaced
+    ZIP_ACTION_KEEP,            // what is there stays and the entry is skipped
+    ZIP_ACTION_RENAME,          // the entry is written under another name
+};
+
+
+class ZipDestinationSnapshot
+{
+public:
+    ZipDestinationSnapshot();
+
+    //
+    //   FUNCTION: ZipDestinationSnapshot::Reset
+    //
+    //   PURPOSE: Forget any snapshot and make room for cDirectories
+    //   directories, numbered as in ZipDirectoryTree. With fIgnoreCase,
+    //   names that differ only in case are one name.
+    //
+    void Reset(size_t cDirectories, bool fIgnoreCase);
+    void Clear();
+
+    //
+    //   FUNCTION: ZipDestinationSnapshot::ReadDirectory
+    //
+    //   PURPOSE: Read the names in directory dir, open as fd or, if fd is
+    //   -1 (always on Windows), at path. Different directories may be read
+    //   on different threads at the same time.
+    //
+    ZipResult ReadDirectory(uint32_t dir, int fd, const NativePath &path);
+
+    // Claim name in dir for an entry that will be written there, so that
+    // no renamed entry is given it.
+    void Reserve(uint32_t dir, const NativePath &name);
+
+    //
+    //   FUNCTION: ZipDestinationSnapshot::Decide
+    //
+    //   PURPOSE: Apply policy to an entry to be written as name in
+    //   directory dir (open as fd, or at dirPath), whose modified time is
+    //   entryModified in FILETIME ticks, 0 if unknown. For
+    //   ZIP_ACTION_RENAME, pNewName receives the first "name (n).ext" that
+    //   is neither there nor reserved, which is then reserved in turn.
+    //
+    ZipOverwriteAction Decide(uint32_t dir, int fd, const NativePath &dirPath,
+        const NativePath &name, uint64_t entryModified, ZipOverwritePolicy policy,
+        NativePath *pNewName);
+
+private:
+    ZipDestinationSnapshot(const ZipDestinationSnapshot &);
+    ZipDestinationSnapshot &operator=(const ZipDestinationSnapshot &);
+
+    struct Item
+    {
+        uint64_t modified;      // FILETIME ticks, once fModified is set
+        bool fOnDisk;           // there before the extraction, not reserved
+        bool fModified;
+    };
+
+    typedef std::unordered_map<NativePath, Item> Listing;
+
+    NativePath Key(const NativePath &name) const;
+    uint64_t ModifiedTime(int fd, const NativePath &dirPath, const NativePath &name,
+        Item &item);
+
+    bool m_fIgnoreCase;
+    std::vector<Listing> m_listings;
+};
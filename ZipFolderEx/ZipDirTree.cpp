@@ -0,0 +1,402 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipDirTree.cpp
+Project:      ZipFolderEx
+
+The file implements the output directory tree declared in ZipDirTree.h.
+\***************************************************************************/
+
+#include "ZipDirTree.h"
+#include "ZipPath.h"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace
+{
+    const uint32_t kNone = ZipDirectoryTree::kNoDirectory;
+
+    // Handles kept for file creation, at most; a quarter of the process's
+    // descriptor limit if that is lower.
+    const size_t kMaxKeptHandles = 512;
+
+    // Handles held open at once while walking one subtree. A deeper
+    // directory is created by its full path instead.
+    const size_t kMaxOpenDepth = 32;
+
+    void CloseDirectory(int fd)
+    {
+#ifndef _WIN32
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+#else
+        (void)fd;
+#endif
+    }
+
+    //
+    //   FUNCTION: MakeDirectory
+    //
+    //   PURPOSE: Create the directory name in the directory open as
+    //   parentFd, or at path if there is no handle, and open it if
+    //   fOpen is set. A directory that already exists is fine, and sets
+    //   *pfExisted; pFd receives -1 if it could not be opened.
+    //
+    ZipResult MakeDirectory(int parentFd, const NativePath &name, const NativePath &path,
+        bool fOpen, int *pFd, bool *pfExisted)
+    {
+        *pFd = -1;
+        *pfExisted = false;
+#ifdef _WIN32
+        (void)parentFd;
+        (void)name;
+        (void)fOpen;
+        if (CreateDirectoryW(path.c_str(), NULL))
+        {
+            return ZR_OK;
+        }
+        *pfExisted = GetLastError() == ERROR_ALREADY_EXISTS;
+        return *pfExisted ? ZR_OK : ZR_IO_ERROR;
+#else
+        int result = parentFd >= 0 ? mkdirat(parentFd, name.c_str(), 0777) :
+            mkdir(path.c_str(), 0777);
+        if (result != 0 && errno != EEXIST)
+        {
+            return ZR_IO_ERROR;
+        }
+        *pfExisted = result != 0;
+        if (fOpen)
+        {
+            int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+            *pFd = parentFd >= 0 ? openat(parentFd, name.c_str(), flags) :
+                open(path.c_str(), flags);
+        }
+        return ZR_OK;
+#endif
+    }
+}
+
+
+ZipDirectoryTree::ZipDirectoryTree()
+{
+}
+
+ZipDirectoryTree::~ZipDirectoryTree()
+{
+    CloseHandles();
+}
+
+void ZipDirectoryTree::Clear()
+{
+    CloseHandles();
+    m_destDir.clear();
+    m_nodes.clear();
+    m_entryDirs.clear();
+    m_subtrees.clear();
+    m_keepHandle.clear();
+    m_existed.clear();
+}
+
+void ZipDirectoryTree::Build(const ZipArchive &archive, const std::vector<bool> &skip)
+{
+    Clear();
+    Node root = { kNone, kNone, kNone, 0, 0, NativePath() };
+    m_nodes.push_back(root);
+    m_entryDirs.assign(archive.EntryCount(), kNone);
+
+    // Entries of one directory are usually stored together, so most
+    // lookups are answered by the previous entry's.
+    DirectoryIndex index;
+    NativePath lastPath;
+    uint32_t lastDir = kRoot;
+    for (size_t i = 0; i < archive.EntryCount(); i++)
+    {
+        if (!skip.empty() && skip[i])
+        {
+            continue;
+        }
+        const ZipEntryInfo &entry = archive.Entry(i);
+        NativePath relative;
+        if (EntryNameToRelativePath(entry, &relative) != ZR_OK)
+        {
+            continue;
+        }
+
+        NativePath dirPath;
+        if (entry.IsDirectory())
+        {
+            dirPath.swap(relative);
+        }
+        else
+        {
+            size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR);
+            if (sep != NativePath::npos)
+            {
+                dirPath = relative.substr(0, sep);
+            }
+        }
+
+        if (dirPath != lastPath)
+        {
+            lastDir = dirPath.empty() ? kRoot : AddDirectory(index, dirPath);
+            lastPath.swap(dirPath);
+        }
+        m_entryDirs[i] = lastDir;
+        if (!entry.IsDirectory())
+        {
+            m_nodes[lastDir].cFiles++;
+        }
+    }
+
+    // Parents are added before their children, so one pass from the end
+    // totals every subtree.
+    for (size_t i = m_nodes.size(); i-- > 1; )
+    {
+        m_nodes[m_nodes[i].parent].cDescendants += m_nodes[i].cDescendants + 1;
+    }
+    for (uint32_t child = m_nodes[kRoot].firstChild; child != kNone;
+        child = m_nodes[child].nextSibling)
+    {
+        m_subtrees.push_back(child);
+    }
+    std::sort(m_subtrees.begin(), m_subtrees.end(), [this](uint32_t a, uint32_t b)
+    {
+        return m_nodes[a].cDescendants > m_nodes[b].cDescendants;
+    });
+
+    m_existed.assign(m_nodes.size(), 0);
+    ChooseHandles();
+}
+
+uint32_t ZipDirectoryTree::AddDirectory(DirectoryIndex &index, const NativePath &relative)
+{
+    DirectoryIndex::iterator it = index.find(relative);
+    if (it != index.end())
+    {
+        return it->second;
+    }
+
+    // Find the deepest ancestor already known, then add the rest below it.
+    // Names can be tens of thousands of levels deep, so no recursion.
+    uint32_t parent = kRoot;
+    size_t start = 0;
+    size_t end = relative.size();
+    for (;;)
+    {
+        size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR, end - 1);
+        if (sep == NativePath::npos || sep == 0)
+        {
+            break;
+        }
+        it = index.find(relative.substr(0, sep));
+        if (it != index.end())
+        {
+            parent = it->second;
+            start = sep + 1;
+            break;
+        }
+        end = sep;
+    }
+
+    while (start < relative.size())
+    {
+        size_t sep = relative.find(ZIP_NATIVE_SEPARATOR, start);
+        if (sep == NativePath::npos)
+        {
+            sep = relative.size();
+        }
+        uint32_t id = (uint32_t)m_nodes.size();
+        Node node = { parent, kNone, m_nodes[parent].firstChild, 0, 0,
+            relative.substr(start, sep - start) };
+        m_nodes.push_back(node);
+        m_nodes[parent].firstChild = id;
+        index[relative.substr(0, sep)] = id;
+        parent = id;
+        start = sep + 1;
+    }
+    return parent;
+}
+
+void ZipDirectoryTree::ChooseHandles()
+{
+    m_keepHandle.assign(m_nodes.size(), false);
+#ifndef _WIN32
+    m_handles.assign(m_nodes.size(), -1);
+
+    size_t cMax = kMaxKeptHandles;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    {
+        cMax = std::min<size_t>(cMax, (size_t)limit.rlim_cur / 4);
+    }
+
+    // A handle pays off for a directory with several files; keep those
+    // with the most. The root is always kept, as the base of every subtree.
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 1; i < m_nodes.size(); i++)
+    {
+        if (m_nodes[i].cFiles >= 2)
+        {
+            candidates.push_back(i);
+        }
+    }
+    size_t cKeep = std::min(candidates.size(), cMax > 0 ? cMax - 1 : 0);
+    std::partial_sort(candidates.begin(), candidates.begin() + cKeep, candidates.end(),
+        [this](uint32_t a, uint32_t b) { return m_nodes[a].cFiles > m_nodes[b].cFiles; });
+    m_keepHandle[kRoot] = true;
+    for (size_t i = 0; i < cKeep; i++)
+    {
+        m_keepHandle[candidates[i]] = true;
+    }
+#endif
+}
+
+ZipResult ZipDirectoryTree::CreateRoot(const NativePath &destDir)
+{
+    m_destDir = destDir;
+    ZipResult result = CreateDirectoryTree(destDir);
+#ifndef _WIN32
+    if (result == ZR_OK && !m_handles.empty())
+    {
+        m_handles[kRoot] = open(destDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+#endif
+    return result;
+}
+
+ZipResult ZipDirectoryTree::CreateSubtree(size_t i, ZipThreadStats *pStats)
+{
+    struct Frame
+    {
+        uint32_t node;
+        int fd;
+        bool fOwned;
+        size_t cchPath;
+        uint32_t nextChild;
+    };
+
+    // Depth first, so only the handles of the directories on the current
+    // path are open; each directory is made relative to its parent's.
+    NativePath path = m_destDir;
+    std::vector<Frame> stack;
+    Frame root = { kRoot, -1, false, path.size(), m_subtrees[i] };
+#ifndef _WIN32
+    root.fd = m_handles[kRoot];
+#endif
+    stack.push_back(root);
+
+    ZipResult result = ZR_OK;
+    while (!stack.empty() && result == ZR_OK)
+    {
+        Frame &top = stack.back();
+        uint32_t child = top.nextChild;
+        if (child == kNone)
+        {
+            if (top.fOwned)
+            {
+                CloseDirectory(top.fd);
+            }
+            stack.pop_back();
+            continue;
+        }
+        // The root frame stands for the destination and yields just this
+        // subtree, not the root's other children.
+        top.nextChild = top.node == kRoot ? kNone : m_nodes[child].nextSibling;
+        int parentFd = top.fd;
+
+        const Node &node = m_nodes[child];
+        path.resize(top.cchPath);
+        if (!path.empty() && path[path.size() - 1] != ZIP_NATIVE_SEPARATOR)
+        {
+            path += ZIP_NATIVE_SEPARATOR;
+        }
+        path += node.name;
+
+        bool fKeep = m_keepHandle[child];
+        bool fOpen = fKeep || (node.firstChild != kNone && stack.size() < kMaxOpenDepth);
+        int fd;
+        bool fExisted;
+        {
+            ZipStageTimer timer(pStats, ZS_MKDIR);
+            result = MakeDirectory(parentFd, node.name, path, fOpen, &fd, &fExisted);
+        }
+        m_existed[child] = fExisted;
+#ifndef _WIN32
+        if (fKeep)
+        {
+            m_handles[child] = fd;
+        }
+#endif
+        if (result == ZR_OK && node.firstChild != kNone)
+        {
+            Frame frame = { child, fd, !fKeep, path.size(), node.firstChild };
+            stack.push_back(frame);
+        }
+        else if (!fKeep)
+        {
+            CloseDirectory(fd);
+        }
+    }
+
+    // On failure, close what the walk still holds.
+    for (size_t j = 0; j < stack.size(); j++)
+    {
+        if (stack[j].fOwned)
+        {
+            CloseDirectory(stack[j].fd);
+        }
+    }
+    return result;
+}
+
+int ZipDirectoryTree::Handle(uint32_t dir) const
+{
+#ifndef _WIN32
+    if (dir < m_handles.size())
+    {
+        return m_handles[dir];
+    }
+#else
+    (void)dir;
+#endif
+    return -1;
+}
+
+NativePath ZipDirectoryTree::DirectoryPath(uint32_t dir) const
+{
+    // Names from the leaf up, then joined the right way round.
+    std::vector<const NativePath *> names;
+    for (; dir != kRoot; dir = m_nodes[dir].parent)
+    {
+        names.push_back(&m_nodes[dir].name);
+    }
+    NativePath path = m_destDir;
+    for (size_t i = names.size(); i-- > 0; )
+    {
+        if (!path.empty() && path[path.size() - 1] != ZIP_NATIVE_SEPARATOR)
+        {
+            path += ZIP_NATIVE_SEPARATOR;
+        }
+        path += *names[i];
+    }
+    return path;
+}
+
+void ZipDirectoryTree::CloseHandles()
+{
+#ifndef _WIN32
+    for (size_t i = 0; i < m_handles.size(); i++)
+    {
+        CloseDirectory(m_handles[i]);
+    }
+    m_handles.clear();
+#endif
+}
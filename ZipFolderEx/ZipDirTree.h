@@ -0,0 +1,125 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipDirTree.h
+Project:      ZipFolderEx
+
+The file declares the output directory tree of an archive.
+
+Creating each file's parent on the way (CreateDirectoryTree per entry)
+costs a mkdir, or a failed one, for every file and a walk up the path for
+every new directory. ZipDirectoryTree instead collects every directory the
+entries need from the central directory before anything is written, then
+creates each of them exactly once. Subtrees below the destination are
+independent, so several threads can create them at the same time.
+
+On POSIX systems a directory is created relative to an open handle on its
+parent (mkdirat), and the directories holding the most files keep their
+handles open so files are created relative to them (openat); neither walks
+the full path again. Win32 has no such calls, so there every directory and
+file is opened by its full path.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipArchive.h"
+#include "ZipStats.h"
+#include <unordered_map>
+
+
+class ZipDirectoryTree
+{
+public:
+    // The directory of an entry whose name cannot be mapped to a path.
+    static const uint32_t kNoDirectory = 0xFFFFFFFF;
+
+    // The destination itself.
+    static const uint32_t kRoot = 0;
+
+    ZipDirectoryTree();
+    ~ZipDirectoryTree();
+
+    //
+    //   FUNCTION: ZipDirectoryTree::Build
+    //
+    //   PURPOSE: Collect the directories needed by the entries of archive,
+    //   leaving out those marked in skip (it may be empty). An entry's
+    //   directory is its parent, or the entry itself for a directory
+    //   entry.
+    //
+    void Build(const ZipArchive &archive, const std::vector<bool> &skip);
+
+    //
+    //   FUNCTION: ZipDirectoryTree::CreateRoot
+    //
+    //   PURPOSE: Create destDir if need be and open it. Call after Build
+    //   and before CreateSubtree.
+    //
+    ZipResult CreateRoot(const NativePath &destDir);
+
+    // Independent subtrees below the root, largest first.
+    size_t SubtreeCount() const { return m_subtrees.size(); }
+    size_t DirectoryCount() const { return m_nodes.size(); }
+
+    //
+    //   FUNCTION: ZipDirectoryTree::CreateSubtree
+    //
+    //   PURPOSE: Create the directories of subtree i, parents first. Each
+    //   subtree must be created once, but different ones may be created
+    //   on different threads at the same time.
+    //
+    ZipResult CreateSubtree(size_t i, ZipThreadStats *pStats);
+
+    uint32_t EntryDirectory(size_t entry) const { return m_entryDirs[entry]; }
+
+    // Files the entries put in directory dir.
+    uint32_t FileCount(uint32_t dir) const { return m_nodes[dir].cFiles; }
+
+    // Whether directory dir was there before CreateSubtree made it; the
+    // root always counts as there. Only valid once its subtree is made.
+    bool Existed(uint32_t dir) const { return dir == kRoot || m_existed[dir] != 0; }
+
+    // The open handle of directory dir, or -1 if it kept none. Files in
+    // it are best created relative to the handle.
+    int Handle(uint32_t dir) const;
+
+    // The full path of directory dir.
+    NativePath DirectoryPath(uint32_t dir) const;
+
+    // Close the handles and forget the tree.
+    void Clear();
+
+private:
+    ZipDirectoryTree(const ZipDirectoryTree &);
+    ZipDirectoryTree &operator=(const ZipDirectoryTree &);
+
+    struct Node
+    {
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t nextSibling;
+        uint32_t cFiles;
+        uint32_t cDescendants;
+        NativePath name;
+    };
+
+    typedef std::unordered_map<NativePath, uint32_t> DirectoryIndex;
+
+    uint32_t AddDirectory(DirectoryIndex &index, const NativePath &relative);
+    void ChooseHandles();
+    void CloseHandles();
+
+    NativePath m_destDir;
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_entryDirs;
+    std::vector<uint32_t> m_subtrees;
+
+    // Whether a directory keeps its handle for file creation.
+    std::vector<bool> m_keepHandle;
+
+    // Set by CreateSubtree for each directory that already existed; bytes,
+    // since subtrees are made on several threads at once.
+    std::vector<uint8_t> m_existed;
+#ifndef _WIN32
+    // Open handles of the kept directories, -1 until created.
+    std::vector<int> m_handles;
+#endif
+};
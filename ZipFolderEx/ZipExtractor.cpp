@@ -0,0 +1,1284 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipExtractor.cpp
+Project:      ZipFolderEx
+
+The file implements the multi-threaded extractor declared in ZipExtractor.h.
+\***************************************************************************/
+
+#include "ZipExtractor.h"
+#include "ZipPath.h"
+#include "ZipMetadata.h"
+#include "ZipWriter.h"
+#include "Crc32.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+
+namespace
+{
+    const size_t kMaxReadBuffer = 256 * 1024;
+    const size_t kMinReadBuffer = 4 * 1024;
+
+    // Entries no larger than this compressed are small: a run of them is
+    // read with one call, and they share one reader.
+    const uint64_t kSmallEntry = 4 * 1024;
+    const size_t kMaxBatchEntries = 64;
+    const uint64_t kMaxBatchBytes = 256 * 1024;
+
+    // Bytes between two small entries (a data descriptor, a longer local
+    // extra field) that may be read for nothing to keep them in one batch.
+    const uint64_t kMaxBatchGap = 4 * 1024;
+
+    // Read past the last entry of a batch, since its local extra field is
+    // not in the central directory and may be longer than none.
+    const uint64_t kLocalExtraSlack = 128;
+
+    // Fewer directories than this are created on the calling thread alone.
+    const size_t kMinParallelDirectories = 256;
+
+    // Fewer existing directories than this are listed on the calling
+    // thread alone.
+    const size_t kMinParallelListings = 8;
+
+    // What a worker's buffers come to, for the memory budget: the
+    // inflater's window and tables (about 190 KB), a batch span and a
+    // large entry's read buffer (256 KB each), and the io_uring writer's
+    // buffers (1 MB). A direct writer's buffer is reserved when it is made.
+    const uint64_t kWorkerMemory = 2 * 1024 * 1024;
+
+    // What the extractor keeps per entry: its place in the read order, the
+    // batch plan, the superseded and written flags, the entry's directory
+    // and its name in the set of names seen.
+    const uint64_t kEntryMemory = 72;
+
+    // How far ahead of the batches being claimed the archive is hinted
+    // to be read.
+    const uint64_t kReadahead = 8 * 1024 * 1024;
+
+    // How often a worker waiting for the tuner to let it run looks at
+    // whether the job is over.
+    const unsigned kIdlePollMs = 50;
+
+    // Entries a metadata worker claims at a time.
+    const size_t kMetadataBatch = 256;
+
+    // The unit of sparse output: aligned blocks of the file this size that
+    // are all zero are left as holes.
+    const size_t kSparseBlock = 4096;
+
+    // Whether names that differ only in case reach the same file, as they
+    // do on the file systems each platform normally extracts to.
+#ifdef _WIN32
+    const bool kIgnoreCaseDefault = true;
+#else
+    const bool kIgnoreCaseDefault = false;
+#endif
+
+    // Charges the reads of an entry's data to the read stage.
+    class TimedInputStream : public ZipInputStream
+    {
+    public:
+        TimedInputStream(ZipInputStream *pSource, ZipThreadStats *pStats) :
+            m_pSource(pSource), m_pStats(pStats)
+        {
+        }
+
+        virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead)
+        {
+            ZipStageTimer timer(m_pStats, ZS_READ);
+            ZipResult result = m_pSource->Read(pv, cb, pcbRead);
+            timer.Stop(*pcbRead);
+            return result;
+        }
+
+    private:
+        ZipInputStream *m_pSource;
+        ZipThreadStats *m_pStats;
+    };
+
+    // Told of each block of output as it is written.
+    class OutputObserver
+    {
+    public:
+        virtual void OnOutput(size_t cb) = 0;
+
+    protected:
+        ~OutputObserver() {}
+    };
+
+    class FileSink : public InflateSink
+    {
+    public:
+        FileSink() : pWriter(NULL), pStats(NULL), pProgress(NULL), pCancel(NULL),
+            pObserver(NULL), fSparse(false), cbHoles(0), m_crc(0), m_cb(0), m_cbPartial(0)
+        {
+        }
+
+        ZipFileWriter *pWriter;
+        ZipThreadStats *pStats;
+        ZipProgress *pProgress;
+        const ZipCancelToken *pCancel;
+        OutputObserver *pObserver;
+        bool fSparse;
+        uint64_t cbHoles;       // left as holes, over every file
+
+        void Reset()
+        {
+            m_crc = 0;
+            m_cb = 0;
+            m_cbPartial = 0;
+        }
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            if (pCancel != NULL && pCancel->IsCancelled())
+            {
+                return ZR_STOP;
+            }
+            {
+                ZipStageTimer timer(pStats, ZS_CRC);
+                m_crc = Crc32Update(m_crc, pb, cb);
+                timer.Stop(cb);
+            }
+            m_cb += cb;
+            ZipStageTimer timer(pStats, ZS_WRITE);
+            ZipResult result = fSparse ? WriteSparse(pb, cb) : pWriter->Write(pb, cb);
+            timer.Stop(cb);
+            if (pProgress != NULL)
+            {
+                pProgress->AddBytes(cb);
+            }
+            if (pObserver != NULL)
+            {
+                pObserver->OnOutput(cb);
+            }
+            return result;
+        }
+
+        // Write what sparse output is still holding back, once the entry
+        // has no more data: the end of the file, short of a whole block.
+        ZipResult Flush()
+        {
+            if (m_cbPartial == 0)
+            {
+                return ZR_OK;
+            }
+            ZipStageTimer timer(pStats, ZS_WRITE);
+            ZipResult result = pWriter->Write(m_partial, m_cbPartial);
+            timer.Stop(m_cbPartial);
+            m_cbPartial = 0;
+            return result;
+        }
+
+        uint32_t Crc() const { return m_crc; }
+        uint64_t Count() const { return m_cb; }
+
+    private:
+        // Blocks are counted from the start of the file, not of each call:
+        // the part of a block a call ends in is kept until the next call
+        // completes it, so a block of zeros split between two calls is
+        // still a hole.
+        ZipResult WriteSparse(const uint8_t *pb, size_t cb)
+        {
+            ZipResult result = ZR_OK;
+            if (m_cbPartial > 0)
+            {
+                size_t cbCopy = std::min(cb, kSparseBlock - m_cbPartial);
+                memcpy(m_partial + m_cbPartial, pb, cbCopy);
+                m_cbPartial += cbCopy;
+                pb += cbCopy;
+                cb -= cbCopy;
+                if (m_cbPartial < kSparseBlock)
+                {
+                    return ZR_OK;
+                }
+                m_cbPartial = 0;
+                result = WriteBlocks(m_partial, kSparseBlock);
+            }
+            size_t cbWhole = cb - cb % kSparseBlock;
+            if (result == ZR_OK && cbWhole > 0)
+            {
+                result = WriteBlocks(pb, cbWhole);
+            }
+            if (result == ZR_OK && cb > cbWhole)
+            {
+                m_cbPartial = cb - cbWhole;
+                memcpy(m_partial, pb + cbWhole, m_cbPartial);
+            }
+            return result;
+        }
+
+        // Write cb bytes of whole blocks, leaving those that are all zero
+        // as holes.
+        ZipResult WriteBlocks(const uint8_t *pb, size_t cb)
+        {
+            size_t data = 0;
+            size_t i = 0;
+            ZipResult result = ZR_OK;
+            while (i < cb && result == ZR_OK)
+            {
+                if (!IsZeroBlock(pb + i, kSparseBlock))
+                {
+                    i += kSparseBlock;
+                    continue;
+                }
+                size_t zeros = i;
+                do
+                {
+                    i += kSparseBlock;
+                } while (i < cb && IsZeroBlock(pb + i, kSparseBlock));
+                if (zeros > data)
+                {
+                    result = pWriter->Write(pb + data, zeros - data);
+                }
+                if (result == ZR_OK)
+                {
+                    result = pWriter->Skip(i - zeros);
+                    cbHoles += i - zeros;
+                }
+                data = i;
+            }
+            if (result == ZR_OK && cb > data)
+            {
+                result = pWriter->Write(pb + data, cb - data);
+            }
+            return result;
+        }
+
+        uint32_t m_crc;
+        uint64_t m_cb;
+        uint8_t m_partial[kSparseBlock];    // the start of the block a call ended in
+        size_t m_cbPartial;
+    };
+}
+
+
+// Per-thread state, reused from one entry to the next.
+class ZipExtractor::Worker : private OutputObserver
+{
+public:
+    Worker(ZipExtractor &owner, ZipThreadStats *pStats) : m_owner(owner), m_pStats(pStats),
+        m_pWriter(ZipFileWriter::Create(owner.m_writerKind, owner.m_fSyncFiles)),
+        m_fDirectTried(false), m_smallReader(NULL, kSmallEntry + BufferedReader::kLookbehind),
+        m_spanOffset(0), m_cbSpan(0)
+    {
+        m_sink.pWriter = m_pWriter.get();
+        m_sink.pStats = pStats;
+        m_sink.pProgress = owner.m_pProgress;
+        m_sink.pCancel = owner.m_pCancel;
+        m_sink.pObserver = this;
+        m_sink.fSparse = owner.m_fSparse;
+    }
+
+    ~Worker()
+    {
+        if (m_pDirectWriter)
+        {
+            m_owner.m_pMemory->Release(ZipFileWriter::kDirectBufferSize);
+        }
+    }
+
+    // Fetch the span of a batch, if it has one, for its entries to use.
+    void ReadBatch(const Batch &batch);
+
+    ZipResult ExtractEntry(size_t index);
+
+    // Wait for the writer to finish every file.
+    ZipResult Finish();
+
+    ZipWriterKind WriterKind() const { return m_pWriter->Kind(); }
+    uint64_t HoleBytes() const { return m_sink.cbHoles; }
+
+private:
+    // Counts output as the sink takes it, and samples the tuner from inside
+    // an entry so that one large entry is still tuned while it is written.
+    virtual void OnOutput(size_t cb)
+    {
+        m_owner.m_cbOutput += cb;
+        if (m_owner.m_fTuning)
+        {
+            m_owner.Tune();
+        }
+    }
+
+    ZipFileWriter *WriterFor(const ZipEntryInfo &entry);
+    ZipResult CopyData(const ZipEntryInfo &entry, uint64_t dataOffset);
+
+    // The cb bytes at offset in the archive if the span holds them, else NULL.
+    const uint8_t *InSpan(uint64_t offset, uint64_t cb) const
+    {
+        return m_cbSpan != 0 && offset >= m_spanOffset && offset - m_spanOffset <= m_cbSpan &&
+            cb <= m_cbSpan - (offset - m_spanOffset) ? &m_span[0] + (offset - m_spanOffset) :
+            NULL;
+    }
+
+    ZipExtractor &m_owner;
+    ZipThreadStats *m_pStats;
+    Inflater m_inflater;
+    std::unique_ptr<ZipFileWriter> m_pWriter;
+    std::unique_ptr<ZipFileWriter> m_pDirectWriter;    // made for the first huge entry
+    bool m_fDirectTried;
+    FileSink m_sink;
+    BufferedReader m_smallReader;
+    std::vector<uint8_t> m_span;
+    uint64_t m_spanOffset;
+    size_t m_cbSpan;
+};
+
+
+void ZipExtractor::Worker::ReadBatch(const Batch &batch)
+{
+    m_cbSpan = 0;
+    if (batch.cbSpan == 0)
+    {
+        return;
+    }
+    if (m_span.size() < batch.cbSpan)
+    {
+        m_span.resize(batch.cbSpan);
+    }
+
+    // If the read fails the entries are read one by one instead, and
+    // report the error if there is one.
+    ZipStageTimer timer(m_pStats, ZS_READ);
+    size_t cbRead = 0;
+    if (m_owner.m_pArchive->Source()->ReadAt(batch.offset, &m_span[0], batch.cbSpan,
+        &cbRead) == ZR_OK)
+    {
+        m_spanOffset = batch.offset;
+        m_cbSpan = cbRead;
+        m_owner.m_cBatches++;
+    }
+    timer.Stop(cbRead);
+}
+
+
+ZipResult ZipExtractor::Worker::ExtractEntry(size_t index)
+{
+    ZipArchive &archive = *m_owner.m_pArchive;
+    const ZipEntryInfo &entry = archive.Entry(index);
+
+    NativePath relative;
+    ZipResult result = m_owner.RelativePath(index, &relative);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    NativePath path = JoinPath(m_owner.m_destDir, relative);
+
+    if (entry.IsDirectory())
+    {
+        // Already made with the rest of the tree.
+        m_owner.m_cDirectories++;
+        m_owner.m_written[index] = 1;
+        return ZR_OK;
+    }
+    if (!IsSupported(entry))
+    {
+        m_owner.m_cSkipped++;
+        if (m_owner.m_pProgress != NULL)
+        {
+            m_owner.m_pProgress->AddBytes(entry.uncompressedSize);
+        }
+        return ZR_OK;
+    }
+
+    uint64_t dataOffset;
+    {
+        ZipStageTimer timer(m_pStats, ZS_READ);
+        const uint8_t *pHeader = InSpan(entry.localHeaderOffset, ZIP_LOCAL_HEADER_SIZE);
+        result = pHeader != NULL ? archive.GetDataOffset(index, pHeader, &dataOffset) :
+            archive.GetDataOffset(index, &dataOffset);
+    }
+    bool fOpen = false;
+    ZipFileWriter *pWriter = WriterFor(entry);
+    m_sink.pWriter = pWriter;
+    if (result == ZR_OK)
+    {
+        size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR);
+        NativePath name = sep != NativePath::npos ? relative.substr(sep + 1) : relative;
+        ZipStageTimer timer(m_pStats, ZS_CREATE);
+        result = pWriter->Open(m_owner.m_tree.Handle(m_owner.m_tree.EntryDirectory(index)),
+            name, path);
+        fOpen = result == ZR_OK;
+    }
+    if (result == ZR_OK)
+    {
+        result = CopyData(entry, dataOffset);
+    }
+    if (fOpen)
+    {
+        ZipStageTimer timer(m_pStats, ZS_CREATE);
+        if (result == ZR_STOP)
+        {
+            // Cancelled part way: do not leave a truncated file behind.
+            pWriter->Abandon();
+        }
+        else
+        {
+            ZipResult closeResult = pWriter->Close();
+            result = result == ZR_OK ? closeResult : result;
+        }
+    }
+
+    if (result == ZR_OK)
+    {
+        m_owner.m_cFiles++;
+        m_owner.m_cbWritten += m_sink.Count();
+        m_owner.m_written[index] = 1;
+        if (pWriter != m_pWriter.get())
+        {
+            m_owner.m_cDirectFiles++;
+        }
+    }
+    return result;
+}
+
+ZipFileWriter *ZipExtractor::Worker::WriterFor(const ZipEntryInfo &entry)
+{
+    // A huge entry goes around the system cache once there is memory for
+    // the writer's buffer; without it, through the usual writer.
+    uint64_t cbMin = m_owner.m_cbDirectMin;
+    if (cbMin == 0 || entry.uncompressedSize < cbMin)
+    {
+        return m_pWriter.get();
+    }
+    if (!m_fDirectTried)
+    {
+        m_fDirectTried = true;
+        if (m_owner.m_pMemory->TryReserve(ZipFileWriter::kDirectBufferSize))
+        {
+            m_pDirectWriter.reset(ZipFileWriter::CreateDirect(m_owner.m_fSyncFiles));
+            if (!m_pDirectWriter)
+            {
+                m_owner.m_pMemory->Release(ZipFileWriter::kDirectBufferSize);
+            }
+        }
+    }
+    return m_pDirectWriter ? m_pDirectWriter.get() : m_pWriter.get();
+}
+
+ZipResult ZipExtractor::Worker::Finish()
+{
+    ZipStageTimer timer(m_pStats, ZS_WRITE);
+    return m_pWriter->Finish();
+}
+
+ZipResult ZipExtractor::Worker::CopyData(const ZipEntryInfo &entry, uint64_t dataOffset)
+{
+    m_sink.Reset();
+    const uint8_t *pData = InSpan(dataOffset, entry.compressedSize);
+    MemoryInputStream memory(pData, pData != NULL ? (size_t)entry.compressedSize : 0);
+    RangeInputStream range(m_owner.m_pArchive->Source(), dataOffset, entry.compressedSize);
+    TimedInputStream timed(&range, m_pStats);
+    ZipInputStream *pInput = m_pStats != NULL ? (ZipInputStream *)&timed : &range;
+    if (pData != NULL)
+    {
+        // Already charged to the read stage with the rest of the batch.
+        pInput = &memory;
+        m_owner.m_cBatchedFiles++;
+    }
+
+    // Small entries share one reader; larger ones get a buffer to match,
+    // up to a limit.
+    std::unique_ptr<BufferedReader> pLargeReader;
+    BufferedReader *pReader = &m_smallReader;
+    if (entry.compressedSize <= kSmallEntry)
+    {
+        m_smallReader.Reset(pInput);
+    }
+    else
+    {
+        size_t cbBuffer = (size_t)std::min<uint64_t>(kMaxReadBuffer,
+            std::max<uint64_t>(kMinReadBuffer, entry.compressedSize + BufferedReader::kLookbehind));
+        pLargeReader.reset(new BufferedReader(pInput, cbBuffer));
+        pReader = pLargeReader.get();
+    }
+    BufferedReader &reader = *pReader;
+
+    ZipResult result = ZR_OK;
+    if (entry.method == ZIP_METHOD_DEFLATED)
+    {
+        ZipStageTimer timer(m_pStats, ZS_INFLATE);
+        result = m_inflater.Inflate(reader, m_sink);
+        timer.Stop(entry.compressedSize);
+    }
+    else
+    {
+        uint64_t cbLeft = entry.compressedSize;
+        while (result == ZR_OK && cbLeft > 0)
+        {
+            result = reader.Fill((size_t)std::min<uint64_t>(cbLeft, reader.Capacity()));
+            if (result == ZR_OK && reader.Available() == 0)
+            {
+                result = ZR_TRUNCATED;
+            }
+            if (result == ZR_OK)
+            {
+                size_t cb = (size_t)std::min<uint64_t>(cbLeft, reader.Available());
+                result = m_sink.Write(reader.Data(), cb);
+                reader.Consume(cb);
+                cbLeft -= cb;
+            }
+        }
+    }
+
+    if (result == ZR_OK)
+    {
+        result = m_sink.Flush();
+    }
+    if (result == ZR_OK &&
+        (m_sink.Count() != entry.uncompressedSize || m_sink.Crc() != entry.crc32))
+    {
+        result = ZR_CRC_MISMATCH;
+    }
+    return result;
+}
+
+
+ZipExtractor::ZipExtractor(const NativePath &destDir, unsigned cThreads) :
+    m_destDir(destDir), m_cThreads(cThreads), m_pArchive(NULL), m_pTracer(NULL),
+    m_pProgress(NULL), m_pCancel(NULL), m_pPool(NULL), m_fIgnoreCase(kIgnoreCaseDefault),
+    m_fRestoreMetadata(true), m_writerKind(ZIP_WRITER_AUTO), m_writerUsed(ZIP_WRITER_AUTO),
+    m_fSyncFiles(false), m_fSparse(false), m_cbDirectMin(0), m_fAutoTune(true),
+    m_overwrite(ZIP_OVERWRITE_ALWAYS), m_pBudget(&ZipMemoryBudget::Process()), m_pMemory(NULL),
+    m_nextSubtree(0), m_nextListing(0), m_nextBatch(0), m_nextEntry(0), m_adviseEnd(0),
+    m_fStop(false), m_cSkipped(0), m_cKept(0), m_cRenamed(0), m_cDirectories(0), m_cFiles(0),
+    m_cbWritten(0), m_cbOutput(0), m_cbHoles(0), m_cDirectFiles(0), m_cBatches(0),
+    m_cBatchedFiles(0),
+    m_cThrottled(0), m_fTuning(false), m_nextSample(0), m_cActive(0), m_error(ZR_OK)
+{
+    if (m_cThreads == 0)
+    {
+        m_cThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+}
+
+bool ZipExtractor::IsSupported(const ZipEntryInfo &entry)
+{
+    return (entry.flags & (ZIP_FLAG_ENCRYPTED | ZIP_FLAG_STRONG_ENCRYPTION)) == 0 &&
+        (entry.method == ZIP_METHOD_STORED || entry.method == ZIP_METHOD_DEFLATED);
+}
+
+ZipResult ZipExtractor::Extract(ZipArchive &archive, ZipExtractStats *pStats)
+{
+    uint64_t start = pStats != NULL ? ZipStatsNow() : 0;
+    m_pArchive = &archive;
+    m_nextSubtree = 0;
+    m_nextBatch = 0;
+    m_nextEntry = 0;
+    m_adviseEnd = 0;
+    m_fStop = false;
+    m_cSkipped = 0;
+    m_cKept = 0;
+    m_cRenamed = 0;
+    m_cDirectories = 0;
+    m_cFiles = 0;
+    m_cbWritten = 0;
+    m_cbOutput = 0;
+    m_cbHoles = 0;
+    m_cDirectFiles = 0;
+    m_cBatches = 0;
+    m_cBatchedFiles = 0;
+    m_cThrottled = 0;
+    m_error = ZR_OK;
+
+    unsigned cThreads = (unsigned)std::min<size_t>(m_cThreads,
+        std::max<size_t>(archive.EntryCount(), 1));
+    if (m_pPool != NULL)
+    {
+        cThreads = std::min(cThreads, m_pPool->ThreadCount() + 1);
+    }
+    bool fTimers = pStats != NULL || m_pTracer != NULL;
+    m_threadStats.assign(fTimers ? cThreads : 0, ZipThreadStats());
+    for (unsigned i = 0; m_pTracer != NULL && i < cThreads; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "worker %u", i);
+        m_threadStats[i].pTrace = m_pTracer->AddThread(name);
+    }
+
+    if (m_pProgress != NULL)
+    {
+        uint64_t cbTotal = 0;
+        for (size_t i = 0; i < archive.EntryCount(); i++)
+        {
+            cbTotal += archive.Entry(i).uncompressedSize;
+        }
+        m_pProgress->Begin(archive.EntryCount(), cbTotal);
+    }
+
+    // One worker and the tables kept per entry are needed whatever the
+    // budget says, so this waits for room rather than fail.
+    ZipMemoryAccount memory(m_pBudget);
+    m_pMemory = &memory;
+    ZipResult result = ZR_OK;
+    if (!memory.Reserve(archive.EntryCount() * kEntryMemory + kWorkerMemory, m_pCancel))
+    {
+        result = ZR_STOP;
+    }
+    if (result == ZR_OK)
+    {
+        FindSupersededEntries();
+        m_written.assign(archive.EntryCount(), 0);
+        result = CreateDirectories(cThreads, fTimers ? &m_threadStats[0] : NULL);
+    }
+    if (result == ZR_OK)
+    {
+        // The policy may leave more entries out, so the batches wait for it.
+        result = ApplyOverwritePolicy(cThreads);
+        PlanBatches();
+    }
+    if (result == ZR_OK)
+    {
+        m_fTuning = m_fAutoTune && cThreads > 1;
+        m_cActive = m_fTuning ? m_tuner.Start(cThreads, ZipStatsNow()) : cThreads;
+        m_nextSample = m_tuner.NextSample();
+        RunWorkers(cThreads, &ZipExtractor::WorkerThread);
+        result = m_error;
+        if (result == ZR_OK && m_fRestoreMetadata)
+        {
+            RestoreMetadata(cThreads);
+        }
+        if (result == ZR_OK && m_cSkipped > 0)
+        {
+            result = ZR_UNSUPPORTED;
+        }
+    }
+
+    if (pStats != NULL)
+    {
+        pStats->Reset();
+        pStats->result = result;
+        pStats->cThreads = cThreads;
+        pStats->cEntries = archive.EntryCount();
+        pStats->cFiles = m_cFiles;
+        pStats->cDirectories = m_cDirectories;
+        pStats->cSkipped = m_cSkipped;
+        pStats->cKept = m_cKept;
+        pStats->cRenamed = m_cRenamed;
+        pStats->cbWritten = m_cbWritten;
+        pStats->cbHoles = m_cbHoles;
+        pStats->cDirectFiles = m_cDirectFiles;
+        pStats->cBatches = m_cBatches;
+        pStats->cBatchedFiles = m_cBatchedFiles;
+        pStats->cThrottledWorkers = m_cThrottled;
+        pStats->cbMemoryPeak = memory.Peak();
+        pStats->cbMemoryLimit = m_pBudget->Limit();
+        pStats->pszWriter = ZipWriterKindToString(m_writerUsed);
+        pStats->total.Add(ZS_CD_PARSE, archive.DirectoryReadTime(), 0);
+        for (size_t i = 0; i < m_threadStats.size(); i++)
+        {
+            pStats->total.Merge(m_threadStats[i]);
+        }
+        pStats->threads.swap(m_threadStats);
+        if (m_fTuning)
+        {
+            pStats->tuning = m_tuner.Steps();
+        }
+        pStats->wallNs = ZipStatsNow() - start + archive.DirectoryReadTime();
+    }
+    m_threadStats.clear();
+    m_batches.clear();
+    m_order.clear();
+    m_written.clear();
+    m_listed.clear();
+    m_snapshot.Clear();
+    m_renamed.clear();
+    m_tree.Clear();
+    m_fTuning = false;
+    m_pMemory = NULL;
+    m_pArchive = NULL;
+    return result;
+}
+
+ZipResult ZipExtractor::CreateDirectories(unsigned cThreads, ZipThreadStats *pStats)
+{
+    // Entries that will not be written need no directory.
+    std::vector<bool> skip(m_superseded);
+    for (size_t i = 0; i < skip.size(); i++)
+    {
+        const ZipEntryInfo &entry = m_pArchive->Entry(i);
+        if (!entry.IsDirectory() && !IsSupported(entry))
+        {
+            skip[i] = true;
+        }
+    }
+
+    ZipResult result;
+    {
+        ZipStageTimer timer(pStats, ZS_MKDIR);
+        m_tree.Build(*m_pArchive, skip);
+        result = m_tree.CreateRoot(m_destDir);
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    if (m_tree.DirectoryCount() >= kMinParallelDirectories && m_tree.SubtreeCount() > 1)
+    {
+        RunWorkers((unsigned)std::min<size_t>(cThreads, m_tree.SubtreeCount()),
+            &ZipExtractor::DirectoryThread);
+    }
+    else
+    {
+        DirectoryThread(0);
+    }
+    return m_error;
+}
+
+void ZipExtractor::DirectoryThread(size_t id)
+{
+    ZipThreadStats *pStats = id < m_threadStats.size() ? &m_threadStats[id] : NULL;
+    while (!m_fStop)
+    {
+        if (m_pCancel != NULL && m_pCancel->IsCancelled())
+        {
+            SetError(ZR_STOP);
+            break;
+        }
+        size_t i = m_nextSubtree++;
+        if (i >= m_tree.SubtreeCount())
+        {
+            break;
+        }
+        ZipResult result = m_tree.CreateSubtree(i, pStats);
+        if (result != ZR_OK)
+        {
+            SetError(result);
+            break;
+        }
+    }
+}
+
+ZipResult ZipExtractor::ApplyOverwritePolicy(unsigned cThreads)
+{
+    if (m_overwrite == ZIP_OVERWRITE_ALWAYS)
+    {
+        return ZR_OK;
+    }
+
+    // Only a directory that was there before can hold a file in the way,
+    // and only one the archive puts files in matters.
+    for (uint32_t dir = 0; dir < m_tree.DirectoryCount(); dir++)
+    {
+        if (m_tree.Existed(dir) && m_tree.FileCount(dir) > 0)
+        {
+            m_listed.push_back(dir);
+        }
+    }
+    m_snapshot.Reset(m_tree.DirectoryCount(), m_fIgnoreCase);
+    m_nextListing = 0;
+    if (m_listed.size() >= kMinParallelListings)
+    {
+        RunWorkers((unsigned)std::min<size_t>(cThreads, m_listed.size()),
+            &ZipExtractor::SnapshotThread);
+    }
+    else
+    {
+        SnapshotThread(0);
+    }
+    if (m_error != ZR_OK)
+    {
+        return m_error;
+    }
+
+    // Every name the archive writes is claimed first, so an entry renamed
+    // out of the way never lands on a later entry's file.
+    ZipThreadStats *pStats = m_threadStats.empty() ? NULL : &m_threadStats[0];
+    ZipStageTimer timer(pStats, ZS_SCAN);
+    size_t cEntries = m_pArchive->EntryCount();
+    NativePath relative;
+    for (size_t i = 0; i < cEntries; i++)
+    {
+        if (WillWrite(i) && RelativePath(i, &relative) == ZR_OK)
+        {
+            size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR);
+            m_snapshot.Reserve(m_tree.EntryDirectory(i),
+                sep != NativePath::npos ? relative.substr(sep + 1) : relative);
+        }
+    }
+
+    uint32_t lastDir = ZipDirectoryTree::kNoDirectory;
+    NativePath dirPath;
+    NativePath newName;
+    ZipFileMetadata metadata;
+    for (size_t i = 0; i < cEntries; i++)
+    {
+        if (!WillWrite(i) || RelativePath(i, &relative) != ZR_OK)
+        {
+            continue;
+        }
+        size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR);
+        NativePath name = sep != NativePath::npos ? relative.substr(sep + 1) : relative;
+        uint32_t dir = m_tree.EntryDirectory(i);
+        int fd = m_tree.Handle(dir);
+        if (fd < 0 && dir != lastDir)
+        {
+            dirPath = m_tree.DirectoryPath(dir);
+            lastDir = dir;
+        }
+        uint64_t entryModified = 0;
+        if (m_overwrite == ZIP_OVERWRITE_NEWER)
+        {
+            GetEntryMetadata(m_pArchive->Entry(i), &metadata);
+            entryModified = metadata.modifiedTime;
+        }
+        switch (m_snapshot.Decide(dir, fd, dirPath, name, entryModified, m_overwrite, &newName))
+        {
+        case ZIP_ACTION_KEEP:
+            m_superseded[i] = true;
+            m_cKept++;
+            break;
+        case ZIP_ACTION_RENAME:
+            m_renamed[i].swap(newName);
+            m_cRenamed++;
+            break;
+        default:
+            break;
+        }
+    }
+    return ZR_OK;
+}
+
+void ZipExtractor::SnapshotThread(size_t id)
+{
+    ZipThreadStats *pStats = id < m_threadStats.size() ? &m_threadStats[id] : NULL;
+    while (!m_fStop)
+    {
+        if (m_pCancel != NULL && m_pCancel->IsCancelled())
+        {
+            SetError(ZR_STOP);
+            break;
+        }
+        size_t i = m_nextListing++;
+        if (i >= m_listed.size())
+        {
+            break;
+        }
+        uint32_t dir = m_listed[i];
+        int fd = m_tree.Handle(dir);
+        ZipStageTimer timer(pStats, ZS_SCAN);
+        ZipResult result = m_snapshot.ReadDirectory(dir, fd,
+            fd >= 0 ? NativePath() : m_tree.DirectoryPath(dir));
+        if (result != ZR_OK)
+        {
+            SetError(result);
+            break;
+        }
+    }
+}
+
+bool ZipExtractor::WillWrite(size_t index) const
+{
+    const ZipEntryInfo &entry = m_pArchive->Entry(index);
+    return !m_superseded[index] && !entry.IsDirectory() && IsSupported(entry) &&
+        m_tree.EntryDirectory(index) != ZipDirectoryTree::kNoDirectory;
+}
+
+ZipResult ZipExtractor::RelativePath(size_t index, NativePath *pRelative) const
+{
+    ZipResult result = EntryNameToRelativePath(m_pArchive->Entry(index), pRelative);
+    if (result == ZR_OK && !m_renamed.empty())
+    {
+        std::unordered_map<size_t, NativePath>::const_iterator it = m_renamed.find(index);
+        if (it != m_renamed.end())
+        {
+            size_t sep = pRelative->find_last_of(ZIP_NATIVE_SEPARATOR);
+            pRelative->resize(sep != NativePath::npos ? sep + 1 : 0);
+            *pRelative += it->second;
+        }
+    }
+    return result;
+}
+
+void ZipExtractor::RunWorkers(unsigned cThreads, void (ZipExtractor::*pfnWorker)(size_t))
+{
+    if (m_pPool == NULL)
+    {
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < cThreads; i++)
+        {
+            threads.push_back(std::thread(pfnWorker, this, (size_t)i));
+        }
+        (this->*pfnWorker)(0);
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            threads[i].join();
+        }
+        return;
+    }
+
+    // A pooled worker may start late, when the calling thread has already
+    // claimed every entry, but it still uses this object, so wait for all
+    // of them before returning.
+    std::mutex doneLock;
+    std::condition_variable cvDone;
+    unsigned cPending = cThreads - 1;
+    for (unsigned i = 1; i < cThreads; i++)
+    {
+        m_pPool->Post([this, pfnWorker, i, &doneLock, &cvDone, &cPending]
+        {
+            (this->*pfnWorker)(i);
+            std::lock_guard<std::mutex> lock(doneLock);
+            cPending--;
+            cvDone.notify_all();
+        });
+    }
+    (this->*pfnWorker)(0);
+    std::unique_lock<std::mutex> lock(doneLock);
+    cvDone.wait(lock, [&cPending] { return cPending == 0; });
+}
+
+void ZipExtractor::WorkerThread(size_t id)
+{
+    // The first worker's memory was reserved with the rest; the others
+    // only run if the budget has room for them.
+    if (id > 0 && !m_pMemory->TryReserve(kWorkerMemory))
+    {
+        m_cThrottled++;
+        return;
+    }
+
+    ZipThreadStats *pStats = id < m_threadStats.size() ? &m_threadStats[id] : NULL;
+    Worker worker(*this, pStats);
+    const ZipArchive &archive = *m_pArchive;
+
+    while (!m_fStop)
+    {
+        if (id > 0 && m_pMemory->Budget()->HasWaiters())
+        {
+            // Another extraction needs the memory more than this one
+            // needs a further thread.
+            m_cThrottled++;
+            break;
+        }
+        if (id >= m_cActive && !WaitUntilActive(id))
+        {
+            break;
+        }
+        size_t i = m_nextBatch++;
+        if (i >= m_batches.size())
+        {
+            // Workers the tuner has parked can go too.
+            std::lock_guard<std::mutex> lock(m_activeLock);
+            m_cvActive.notify_all();
+            break;
+        }
+        if (m_fTuning)
+        {
+            Tune();
+        }
+        const Batch &batch = m_batches[i];
+        ReadAhead(batch);
+        worker.ReadBatch(batch);
+        for (size_t k = batch.first; k < batch.last && !m_fStop; k++)
+        {
+            size_t index = m_order[k];
+            if (m_pCancel != NULL && m_pCancel->IsCancelled())
+            {
+                SetError(ZR_STOP);
+                break;
+            }
+            if (m_superseded[index])
+            {
+                if (m_pProgress != NULL)
+                {
+                    m_pProgress->AddEntry();
+                    m_pProgress->AddBytes(archive.Entry(index).uncompressedSize);
+                }
+                continue;
+            }
+
+            uint64_t start = 0;
+            if (pStats != NULL)
+            {
+                pStats->entry = (uint32_t)index;
+                start = pStats->pTrace != NULL ? ZipStatsNow() : 0;
+            }
+            ZipResult result = worker.ExtractEntry(index);
+            if (m_pProgress != NULL)
+            {
+                m_pProgress->AddEntry();
+            }
+            if (pStats != NULL)
+            {
+                pStats->entries++;
+                if (pStats->pTrace != NULL)
+                {
+                    pStats->pTrace->Add(start, ZipStatsNow() - start, ZIP_TRACE_ENTRY,
+                        (uint32_t)index);
+                }
+            }
+            if (result != ZR_OK)
+            {
+                SetError(result);
+                break;
+            }
+        }
+    }
+
+    ZipResult result = worker.Finish();
+    if (result != ZR_OK)
+    {
+        SetError(result);
+    }
+    m_cbHoles += worker.HoleBytes();
+    if (id == 0)
+    {
+        m_writerUsed = worker.WriterKind();
+    }
+    else
+    {
+        m_pMemory->Release(kWorkerMemory);
+    }
+}
+
+void ZipExtractor::ReadAhead(const Batch &batch)
+{
+    // Keep the next stretch of the archive past the batches being claimed
+    // on its way in, so a disk or share sees one forward stream rather than
+    // each worker's reads on their own. One worker moves the window at a
+    // time; the others go on.
+    uint64_t adviseEnd = m_adviseEnd;
+    if (batch.offset + kReadahead / 2 <= adviseEnd)
+    {
+        return;
+    }
+    uint64_t start = std::max(adviseEnd, batch.offset);
+    uint64_t newEnd = batch.offset + kReadahead;
+    if (m_adviseEnd.compare_exchange_strong(adviseEnd, newEnd))
+    {
+        m_pArchive->Source()->Advise(start, newEnd - start);
+    }
+}
+
+void ZipExtractor::Tune()
+{
+    if (ZipStatsNow() < m_nextSample)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_tuneLock, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;     // another worker is taking the sample
+    }
+    unsigned cActive = m_tuner.Sample(ZipStatsNow(), m_cbOutput, m_cFiles);
+    m_nextSample = m_tuner.NextSample();
+    if (cActive != m_cActive)
+    {
+        std::lock_guard<std::mutex> activeLock(m_activeLock);
+        m_cActive = cActive;
+        m_cvActive.notify_all();
+    }
+}
+
+bool ZipExtractor::WaitUntilActive(size_t id)
+{
+    // Returns false, with the worker still over the count, if the job is
+    // over or another extraction wants its memory.
+    std::unique_lock<std::mutex> lock(m_activeLock);
+    while (id >= m_cActive)
+    {
+        if (m_fStop || m_nextBatch >= m_batches.size())
+        {
+            return false;
+        }
+        if (m_pMemory->Budget()->HasWaiters())
+        {
+            m_cThrottled++;
+            return false;
+        }
+        m_cvActive.wait_for(lock, std::chrono::milliseconds(kIdlePollMs));
+    }
+    return true;
+}
+
+void ZipExtractor::RestoreMetadata(unsigned cThreads)
+{
+    // Files first, in parallel; the tree still holds the directory handles
+    // they were created through.
+    m_nextEntry = 0;
+    size_t cBatches = (m_written.size() + kMetadataBatch - 1) / kMetadataBatch;
+    RunWorkers((unsigned)std::max<size_t>(std::min<size_t>(cThreads, cBatches), 1),
+        &ZipExtractor::MetadataThread);
+
+    // Then directories, deepest first. A directory is added to the tree
+    // after its parent, so a higher index is never an ancestor of a lower
+    // one. Of several entries for one directory the last wins.
+    std::vector<std::pair<uint32_t, size_t> > dirs;
+    for (size_t i = 0; i < m_written.size(); i++)
+    {
+        if (m_written[i] && m_pArchive->Entry(i).IsDirectory())
+        {
+            dirs.push_back(std::make_pair(m_tree.EntryDirectory(i), i));
+        }
+    }
+    std::sort(dirs.begin(), dirs.end());
+    ZipThreadStats *pStats = m_threadStats.empty() ? NULL : &m_threadStats[0];
+    for (size_t i = dirs.size(); i-- > 0; )
+    {
+        uint32_t dir = dirs[i].first;
+        if ((i + 1 < dirs.size() && dirs[i + 1].first == dir) ||
+            dir == ZipDirectoryTree::kRoot || dir == ZipDirectoryTree::kNoDirectory)
+        {
+            continue;
+        }
+        ZipFileMetadata metadata;
+        GetEntryMetadata(m_pArchive->Entry(dirs[i].second), &metadata);
+        ZipStageTimer timer(pStats, ZS_METADATA);
+        ApplyMetadata(-1, NativePath(), m_tree.DirectoryPath(dir), true, metadata);
+    }
+}
+
+void ZipExtractor::MetadataThread(size_t id)
+{
+    ZipThreadStats *pStats = id < m_threadStats.size() ? &m_threadStats[id] : NULL;
+    NativePath relative;
+    ZipFileMetadata metadata;
+    for (;;)
+    {
+        if (m_pCancel != NULL && m_pCancel->IsCancelled())
+        {
+            // The data is all there; only the times are left as they are.
+            break;
+        }
+        size_t first = m_nextEntry.fetch_add(kMetadataBatch);
+        if (first >= m_written.size())
+        {
+            break;
+        }
+        size_t last = std::min(first + kMetadataBatch, m_written.size());
+        for (size_t i = first; i < last; i++)
+        {
+            const ZipEntryInfo &entry = m_pArchive->Entry(i);
+            if (!m_written[i] || entry.IsDirectory() || RelativePath(i, &relative) != ZR_OK)
+            {
+                continue;
+            }
+            size_t sep = relative.find_last_of(ZIP_NATIVE_SEPARATOR);
+            NativePath name = sep != NativePath::npos ? relative.substr(sep + 1) : relative;
+            uint32_t dir = m_tree.EntryDirectory(i);
+            GetEntryMetadata(entry, &metadata);
+
+            // Failing to set a time is not worth failing the extraction for.
+            ZipStageTimer timer(pStats, ZS_METADATA);
+            int fd = m_tree.Handle(dir);
+            ApplyMetadata(fd, name, fd >= 0 ? NativePath() : JoinPath(m_destDir, relative),
+                false, metadata);
+        }
+    }
+}
+
+void ZipExtractor::FindSupersededEntries()
+{
+    // Names that reach the same file are written by the last such entry
+    // only, as a sequential extraction would leave it; two workers must
+    // never write the same file at once.
+    size_t cEntries = m_pArchive->EntryCount();
+    m_superseded.assign(cEntries, false);
+    size_t cbNames = 0;
+    for (size_t i = 0; i < cEntries; i++)
+    {
+        cbNames += m_pArchive->Entry(i).name.size();
+    }
+    ZipPathSet seen(m_fIgnoreCase);
+    seen.Reserve(cEntries, cbNames);
+    std::string normalized;
+    for (size_t i = cEntries; i-- > 0; )
+    {
+        const ZipEntryInfo &entry = m_pArchive->Entry(i);
+        if (entry.IsDirectory() || NormalizeEntryName(entry.name, &normalized) != ZR_OK)
+        {
+            continue;
+        }
+        if (!seen.Insert(normalized, (entry.flags & ZIP_FLAG_UTF8) != 0))
+        {
+            m_superseded[i] = true;
+        }
+    }
+}
+
+void ZipExtractor::PlanBatches()
+{
+    // Entries go in the order they are stored, which need not be the order
+    // of the central directory, so the archive is read front to back.
+    size_t cEntries = m_pArchive->EntryCount();
+    m_order.resize(cEntries);
+    for (size_t i = 0; i < cEntries; i++)
+    {
+        m_order[i] = i;
+    }
+    const ZipArchive &archive = *m_pArchive;
+    std::stable_sort(m_order.begin(), m_order.end(), [&archive](size_t a, size_t b)
+    {
+        return archive.Entry(a).localHeaderOffset < archive.Entry(b).localHeaderOffset;
+    });
+
+    // An entry with no data to read goes with whatever is around it. A
+    // small one joins the small entries before it if it is stored right
+    // after them; anything else starts a batch.
+    m_batches.clear();
+    Batch batch = { 0, 0, 0, 0 };
+    size_t cSmall = 0;          // entries of the batch read through the span
+    bool fLarge = false;        // the batch holds an entry too large for that
+    uint64_t end = 0;           // where the data of the last of them ends
+    for (size_t k = 0; k < cEntries; k++)
+    {
+        size_t i = m_order[k];
+        const ZipEntryInfo &entry = archive.Entry(i);
+        bool fData = !m_superseded[i] && !entry.IsDirectory() && IsSupported(entry);
+        bool fSmall = fData && entry.compressedSize <= kSmallEntry;
+        uint64_t entryEnd = entry.localHeaderOffset + ZIP_LOCAL_HEADER_SIZE +
+            entry.cbStoredName + entry.compressedSize;
+        bool fRoom = k > 0 && k - batch.first < kMaxBatchEntries;
+        if (fRoom && !fData)
+        {
+            batch.last = k + 1;
+            continue;
+        }
+        if (fRoom && fSmall && !fLarge && (cSmall == 0 ||
+            (entry.localHeaderOffset >= end && entry.localHeaderOffset - end <= kMaxBatchGap &&
+            entryEnd - batch.offset <= kMaxBatchBytes)))
+        {
+            if (cSmall++ == 0)
+            {
+                batch.offset = entry.localHeaderOffset;
+            }
+            end = entryEnd;
+            batch.last = k + 1;
+            continue;
+        }
+
+        if (k > 0)
+        {
+            batch.cbSpan = cSmall > 1 ? (size_t)(end + kLocalExtraSlack - batch.offset) : 0;
+            m_batches.push_back(batch);
+        }
+        batch.first = k;
+        batch.last = k + 1;
+        batch.offset = entry.localHeaderOffset;
+        cSmall = fSmall ? 1 : 0;
+        fLarge = fData && !fSmall;
+        end = entryEnd;
+    }
+    if (cEntries > 0)
+    {
+        batch.cbSpan = cSmall > 1 ? (size_t)(end + kLocalExtraSlack - batch.offset) : 0;
+        m_batches.push_back(batch);
+    }
+}
+
+void ZipExtractor::SetError(ZipResult result)
+{
+    std::lock_guard<std::mutex> lock(m_errorLock);
+    if (m_error == ZR_OK)
+    {
+        m_error = result;
+    }
+    m_fStop = true;
+}
@@ -0,0 +1,259 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipExtractor.h
+Project:      ZipFolderEx
+
+The file declares the extractor for seekable archives.
+
+ZipExtractor takes the entry list from the central directory of a
+ZipArchive and extracts the entries on several worker threads at once.
+Entries whose names reach the same file ("a/./b" and "a/b", or "A" and
+"a" when case is ignored) are found first (see ZipPath.h) and only the
+last of each is written. Then every directory the entries need is
+created, once each and one subtree per worker (see ZipDirTree.h). Finally
+each worker claims the next batch of entries, reads their data in place,
+decodes it and writes it under the destination directory through a
+writer of its own (see ZipWriter.h), verifying the CRC-32 as it goes.
+
+Batches are planned and claimed in the order the entries are stored, not
+the order of the central directory, which tools are free to shuffle. So
+the workers move through the archive from front to back together, and the
+stretch ahead of them is hinted to the system to be read in the background
+(ZipRandomAccess::Advise): a spinning disk or a network share streams the
+file rather than seek for each entry. Which worker decodes which batch is
+still whichever is free, so the CPU work stays spread across them.
+
+Most batches are one entry. Archives of source trees hold mostly files of
+a few KB, though, where the calls made for each entry cost more than
+decoding it; so a run of small entries stored one after another is a
+batch of up to 64, whose headers and data are fetched with a single read
+and decoded back to back on one thread, with the same reader and window.
+
+Files already in the destination are replaced unless an overwrite policy
+says otherwise (see ZipDestSnapshot.h). The policy is settled for every
+entry before the workers start, from one listing of each directory that
+was there before: entries it keeps out are left out like superseded ones,
+and renamed ones are written under their new name.
+
+The first error stops all workers and is returned; entries with an
+unsupported method or encryption are skipped and reported as
+ZR_UNSUPPORTED once the rest has been extracted. Timestamps and attributes
+are restored afterwards, in a pass of their own (see ZipMetadata.h).
+
+A caller that passes a ZipExtractStats gets per-stage counters from every
+worker (see ZipStats.h); without one the timers are not read at all. With
+a ZipTracer set, each worker also records a timeline of its entries and
+stages (see ZipTrace.h). A ZipProgress receives entry and byte counts as
+they complete, and a cancelled ZipCancelToken stops the workers before
+the next entry or block; the entry being written is removed and Extract
+returns ZR_STOP. Given a ZipThreadPool, the workers run on the pool's
+threads instead of threads started for the call.
+
+How many of the workers run at a time is tuned as the job goes (see
+ZipTuner.h): the ones over the count wait, and take up entries again when
+the count rises, so a disk that does better with fewer writers gets fewer.
+
+Each worker's buffers are reserved from a memory budget (see ZipMemory.h),
+the process one by default. The first worker waits for room if it must;
+the others start only if there is room, and stop early, handing theirs
+back, when another extraction is waiting for memory.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipArchive.h"
+#include "Inflate.h"
+#include "ZipStats.h"
+#include "ZipTrace.h"
+#include "ZipProgress.h"
+#include "ZipThreadPool.h"
+#include "ZipDirTree.h"
+#include "ZipWriter.h"
+#include "ZipDestSnapshot.h"
+#include "ZipMemory.h"
+#include "ZipTuner.h"
+#include <atomic>
+
+
+class ZipExtractor
+{
+public:
+    //
+    //   FUNCTION: ZipExtractor::ZipExtractor
+    //
+    //   PURPOSE: Prepare to extract under destDir with cThreads workers;
+    //   0 uses one per processor.
+    //
+    explicit ZipExtractor(const NativePath &destDir, unsigned cThreads = 0);
+
+    //
+    //   FUNCTION: ZipExtractor::Extract
+    //
+    //   PURPOSE: Extract every entry of archive. If pStats is not NULL it
+    //   receives the counts, the result and the per-thread stage times.
+    //
+    ZipResult Extract(ZipArchive &archive, ZipExtractStats *pStats = NULL);
+
+    // Counts from the last call to Extract.
+    uint64_t FilesWritten() const { return m_cFiles; }
+    uint64_t BytesWritten() const { return m_cbWritten; }
+
+    // Record a timeline of later calls to Extract into pTracer, which must
+    // outlive them; NULL stops recording.
+    void SetTracer(ZipTracer *pTracer) { m_pTracer = pTracer; }
+
+    // Report progress to pProgress and stop once pCancel is cancelled.
+    // Either may be NULL; both must outlive later calls to Extract.
+    void SetProgress(ZipProgress *pProgress) { m_pProgress = pProgress; }
+    void SetCancelToken(const ZipCancelToken *pCancel) { m_pCancel = pCancel; }
+
+    // Run workers on pPool, which must outlive later calls to Extract. At
+    // most one more worker than the pool has threads is used, since the
+    // calling thread works too.
+    void SetThreadPool(ZipThreadPool *pPool) { m_pPool = pPool; }
+
+    // Treat entry names that differ only in case as one file, so only the
+    // last of them is written. The default is set on Windows, where NTFS
+    // compares names that way, and clear elsewhere.
+    void SetIgnoreCase(bool fIgnoreCase) { m_fIgnoreCase = fIgnoreCase; }
+
+    // Restore the entries' timestamps and attributes once their data is
+    // written, which is the default.
+    void SetRestoreMetadata(bool fRestore) { m_fRestoreMetadata = fRestore; }
+
+    // How the workers write files (see ZipWriter.h), and whether each file
+    // is flushed to the disk before it is closed. The default is
+    // ZIP_WRITER_AUTO without flushing.
+    void SetWriter(ZipWriterKind kind) { m_writerKind = kind; }
+    void SetSyncFiles(bool fSync) { m_fSyncFiles = fSync; }
+
+    // Leave aligned 4 KB blocks of zeros in the output as holes instead of
+    // writing them, which makes disk images and the like sparse files. Off
+    // by default, since copying or backing up a sparse file may not keep
+    // its holes.
+    void SetSparseFiles(bool fSparse) { m_fSparse = fSparse; }
+
+    // Write entries of cbMin bytes or more around the system cache (see
+    // ZipFileWriter::CreateDirect), so that a huge entry does not evict
+    // everything else from memory; 0, the default, never does.
+    void SetDirectWriteThreshold(uint64_t cbMin) { m_cbDirectMin = cbMin; }
+
+    // What to do about files that are already in the destination; the
+    // default, ZIP_OVERWRITE_ALWAYS, replaces them without looking.
+    void SetOverwrite(ZipOverwritePolicy policy) { m_overwrite = policy; }
+
+    // Tune how many workers run at once from the rate they achieve, which
+    // is the default; otherwise all of them run throughout. Either way no
+    // more than the count given to the constructor run.
+    void SetAutoTune(bool fAutoTune) { m_fAutoTune = fAutoTune; }
+
+    // Reserve memory from pBudget, which must outlive later calls to
+    // Extract, rather than from the process budget.
+    void SetMemoryBudget(ZipMemoryBudget *pBudget) { m_pBudget = pBudget; }
+
+    // Whether Extract can decode an entry; others are skipped.
+    static bool IsSupported(const ZipEntryInfo &entry);
+
+private:
+    ZipExtractor(const ZipExtractor &);
+    ZipExtractor &operator=(const ZipExtractor &);
+
+    class Worker;
+
+    // A run of entries one worker takes at a time: m_order[first] up to
+    // m_order[last], the first of them stored at offset. If cbSpan is not
+    // 0, the local headers and data of the batch's small entries lie
+    // within the cbSpan bytes at offset, which are read in one go.
+    struct Batch
+    {
+        size_t first;
+        size_t last;
+        uint64_t offset;
+        size_t cbSpan;
+    };
+
+    void FindSupersededEntries();
+    void PlanBatches();
+    ZipResult CreateDirectories(unsigned cThreads, ZipThreadStats *pStats);
+    void DirectoryThread(size_t id);
+    ZipResult ApplyOverwritePolicy(unsigned cThreads);
+    void SnapshotThread(size_t id);
+    bool WillWrite(size_t index) const;
+    ZipResult RelativePath(size_t index, NativePath *pRelative) const;
+    void WorkerThread(size_t id);
+    void RestoreMetadata(unsigned cThreads);
+    void MetadataThread(size_t id);
+    void RunWorkers(unsigned cThreads, void (ZipExtractor::*pfnWorker)(size_t));
+    void ReadAhead(const Batch &batch);
+    void Tune();
+    bool WaitUntilActive(size_t id);
+    void SetError(ZipResult result);
+
+    NativePath m_destDir;
+    unsigned m_cThreads;
+    ZipArchive *m_pArchive;
+    ZipTracer *m_pTracer;
+    ZipProgress *m_pProgress;
+    const ZipCancelToken *m_pCancel;
+    ZipThreadPool *m_pPool;
+    bool m_fIgnoreCase;
+    bool m_fRestoreMetadata;
+    ZipWriterKind m_writerKind;
+    ZipWriterKind m_writerUsed;
+    bool m_fSyncFiles;
+    bool m_fSparse;
+    uint64_t m_cbDirectMin;
+    bool m_fAutoTune;
+    ZipOverwritePolicy m_overwrite;
+    ZipMemoryBudget *m_pBudget;
+    ZipMemoryAccount *m_pMemory;    // during Extract
+    std::vector<bool> m_superseded;
+    std::vector<size_t> m_order;    // entry indexes by local header offset
+    std::vector<Batch> m_batches;
+
+    // Set by the worker that wrote an entry; each worker only touches the
+    // entries it claimed, so bytes rather than bits.
+    std::vector<uint8_t> m_written;
+    ZipDirectoryTree m_tree;
+
+    // The existing directories to list, the listings, and the new names
+    // of the entries the policy renames.
+    std::vector<uint32_t> m_listed;
+    ZipDestinationSnapshot m_snapshot;
+    std::unordered_map<size_t, NativePath> m_renamed;
+
+    // One record per worker when stats or a trace were requested, else empty.
+    std::vector<ZipThreadStats> m_threadStats;
+
+    std::atomic<size_t> m_nextSubtree;
+    std::atomic<size_t> m_nextListing;
+    std::atomic<size_t> m_nextBatch;
+    std::atomic<size_t> m_nextEntry;
+    std::atomic<uint64_t> m_adviseEnd;  // where the read-ahead hints reach
+    std::atomic<bool> m_fStop;
+    std::atomic<uint64_t> m_cSkipped;
+    uint64_t m_cKept;
+    uint64_t m_cRenamed;
+    std::atomic<uint64_t> m_cDirectories;
+    std::atomic<uint64_t> m_cFiles;
+    std::atomic<uint64_t> m_cbWritten;
+    std::atomic<uint64_t> m_cbOutput;    // as the sinks take it, whole files or not; tuned on
+    std::atomic<uint64_t> m_cbHoles;
+    std::atomic<uint64_t> m_cDirectFiles;
+    std::atomic<uint64_t> m_cBatches;
+    std::atomic<uint64_t> m_cBatchedFiles;
+    std::atomic<unsigned> m_cThrottled;
+
+    // Workers with an id below m_cActive run; the others wait on
+    // m_cvActive. Whichever worker finds a sample due takes m_tuneLock and
+    // feeds the tuner.
+    bool m_fTuning;
+    ZipTuner m_tuner;
+    std::mutex m_tuneLock;
+    std::atomic<uint64_t> m_nextSample;
+    std::atomic<unsigned> m_cActive;
+    std::mutex m_activeLock;
+    std::condition_variable m_cvActive;
+
+    std::mutex m_errorLock;
+    ZipResult m_error;
+};
@@ -0,0 +1,390 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipFormat.cpp
+Project:      ZipFolderEx
+
+The file implements the format helpers declared in ZipFormat.h.
+\***************************************************************************/
+
+#include "ZipFormat.h"
+#include "ZipCpu.h"
+#include <string.h>
+
+#ifdef ZIP_CPU_X86
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace
+{
+    // FILETIME ticks between 1601 and the Unix epoch.
+    const uint64_t kUnixEpochTicks = 116444736000000000ull;
+
+    uint64_t UnixTimeToTicks(int32_t t)
+    {
+        return (uint64_t)((int64_t)t * 10000000 + (int64_t)kUnixEpochTicks);
+    }
+
+    size_t FindRecordMarkerGeneric(const uint8_t *p, size_t pos, size_t cb)
+    {
+        while (pos + 1 < cb)
+        {
+            const void *pFound = memchr(p + pos, 'P', cb - 1 - pos);
+            if (pFound == NULL)
+            {
+                break;
+            }
+            pos = (const uint8_t *)pFound - p;
+            if (p[pos + 1] == 'K')
+            {
+                return pos;
+            }
+            pos++;
+        }
+        return cb;
+    }
+
+    size_t FindLastSignatureGeneric(const uint8_t *p, size_t cb, uint32_t signature)
+    {
+        for (size_t pos = cb >= 4 ? cb - 3 : 0; pos-- > 0; )
+        {
+            if (p[pos] == (uint8_t)signature && ReadLE32(p + pos) == signature)
+            {
+                return pos;
+            }
+        }
+        return cb;
+    }
+
+#ifdef ZIP_CPU_X86
+    unsigned LowestBit(uint32_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return index;
+#else
+        return __builtin_ctz(bits);
+#endif
+    }
+
+    unsigned HighestBit(uint32_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse(&index, bits);
+        return index;
+#else
+        return 31 - __builtin_clz(bits);
+#endif
+    }
+
+    // Compares each byte with 'P' and the byte after it with 'K', 16 or 32
+    // positions at a time.
+    ZIP_TARGET("sse2")
+    size_t FindRecordMarkerSse2(const uint8_t *p, size_t pos, size_t cb)
+    {
+        const __m128i first = _mm_set1_epi8('P');
+        const __m128i second = _mm_set1_epi8('K');
+        for (; pos + 17 <= cb; pos += 16)
+        {
+            __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + pos)), first);
+            __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + pos + 1)), second);
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_and_si128(a, b));
+            if (bits != 0)
+            {
+                return pos + LowestBit(bits);
+            }
+        }
+        return FindRecordMarkerGeneric(p, pos, cb);
+    }
+
+    ZIP_TARGET("avx2")
+    size_t FindRecordMarkerAvx2(const uint8_t *p, size_t pos, size_t cb)
+    {
+        const __m256i first = _mm256_set1_epi8('P');
+        const __m256i second = _mm256_set1_epi8('K');
+        for (; pos + 33 <= cb; pos += 32)
+        {
+            __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + pos)), first);
+            __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + pos + 1)), second);
+            uint32_t bits = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(a, b));
+            if (bits != 0)
+            {
+                return pos + LowestBit(bits);
+            }
+        }
+        return FindRecordMarkerSse2(p, pos, cb);
+    }
+
+    // Compares the four bytes of the signature at 16 or 32 positions at a
+    // time, moving back from the end; the highest match is the last one.
+    ZIP_TARGET("sse2")
+    size_t FindLastSignatureSse2(const uint8_t *p, size_t cb, uint32_t signature)
+    {
+        __m128i bytes[4];
+        for (int k = 0; k < 4; k++)
+        {
+            bytes[k] = _mm_set1_epi8((char)(signature >> (8 * k)));
+        }
+        // Positions [start, start + 16) are compared; the last one needs
+        // the 3 bytes after it.
+        size_t end = cb >= 3 ? cb - 3 : 0;
+        for (; end >= 16; end -= 16)
+        {
+            const uint8_t *pStart = p + end - 16;
+            __m128i match = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)pStart), bytes[0]);
+            for (int k = 1; k < 4; k++)
+            {
+                __m128i next = _mm_loadu_si128((const __m128i *)(pStart + k));
+                match = _mm_and_si128(match, _mm_cmpeq_epi8(next, bytes[k]));
+            }
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(match);
+            if (bits != 0)
+            {
+                return end - 16 + HighestBit(bits);
+            }
+        }
+        size_t pos = FindLastSignatureGeneric(p, end + 3, signature);
+        return pos < end ? pos : cb;
+    }
+
+    ZIP_TARGET("avx2")
+    size_t FindLastSignatureAvx2(const uint8_t *p, size_t cb, uint32_t signature)
+    {
+        __m256i bytes[4];
+        for (int k = 0; k < 4; k++)
+        {
+            bytes[k] = _mm256_set1_epi8((char)(signature >> (8 * k)));
+        }
+        size_t end = cb >= 3 ? cb - 3 : 0;
+        for (; end >= 32; end -= 32)
+        {
+            const uint8_t *pStart = p + end - 32;
+            __m256i match = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)pStart), bytes[0]);
+            for (int k = 1; k < 4; k++)
+            {
+                __m256i next = _mm256_loadu_si256((const __m256i *)(pStart + k));
+                match = _mm256_and_si256(match, _mm256_cmpeq_epi8(next, bytes[k]));
+            }
+            uint32_t bits = (uint32_t)_mm256_movemask_epi8(match);
+            if (bits != 0)
+            {
+                return end - 32 + HighestBit(bits);
+            }
+        }
+        size_t pos = FindLastSignatureSse2(p, end + 3, signature);
+        return pos < end ? pos : cb;
+    }
+#endif
+
+    typedef size_t (*FindRecordMarkerFunction)(const uint8_t *p, size_t pos, size_t cb);
+    typedef size_t (*FindLastSignatureFunction)(const uint8_t *p, size_t cb, uint32_t signature);
+
+    struct ScanFunctions
+    {
+        FindRecordMarkerFunction pfnFindRecordMarker;
+        FindLastSignatureFunction pfnFindLastSignature;
+    };
+
+    ScanFunctions ChooseScanFunctions()
+    {
+#ifdef ZIP_CPU_X86
+        if (ZipCpu().fAvx2)
+        {
+            ScanFunctions avx2 = { FindRecordMarkerAvx2, FindLastSignatureAvx2 };
+            return avx2;
+        }
+        if (ZipCpu().fSse2)
+        {
+            ScanFunctions sse2 = { FindRecordMarkerSse2, FindLastSignatureSse2 };
+            return sse2;
+        }
+#endif
+        ScanFunctions generic = { FindRecordMarkerGeneric, FindLastSignatureGeneric };
+        return generic;
+    }
+
+    const ScanFunctions g_scan = ChooseScanFunctions();
+}
+
+
+const char *ZipResultToString(ZipResult result)
+{
+    switch (result)
+    {
+    case ZR_OK:             return "ok";
+    case ZR_STOP:           return "stopped";
+    case ZR_IO_ERROR:       return "i/o error";
+    case ZR_TRUNCATED:      return "unexpected end of archive";
+    case ZR_BAD_FORMAT:     return "malformed archive";
+    case ZR_UNSUPPORTED:    return "unsupported feature";
+    case ZR_CRC_MISMATCH:   return "CRC mismatch";
+    case ZR_BAD_PATH:       return "unsafe entry path";
+    case ZR_OUT_OF_MEMORY:  return "out of memory";
+    case ZR_NOT_FOUND:      return "not found";
+    }
+    return "unknown error";
+}
+
+
+size_t FindRecordMarker(const uint8_t *p, size_t pos, size_t cb)
+{
+    return g_scan.pfnFindRecordMarker(p, pos, cb);
+}
+
+size_t FindLastSignature(const uint8_t *p, size_t cb, uint32_t signature)
+{
+    return g_scan.pfnFindLastSignature(p, cb, signature);
+}
+
+ZipResult ParseZip64Extra(const uint8_t *pExtra, size_t cbExtra,
+    ZipEntryInfo &entry, bool fSizesOnly, bool *pfFound)
+{
+    if (pfFound != NULL)
+    {
+        *pfFound = false;
+    }
+
+    while (cbExtra >= 4)
+    {
+        uint16_t id = ReadLE16(pExtra);
+        size_t cbField = ReadLE16(pExtra + 2);
+        pExtra += 4;
+        cbExtra -= 4;
+        if (cbField > cbExtra)
+        {
+            // Some writers pad the extra block; a short trailing field is
+            // not worth rejecting the whole entry for.
+            break;
+        }
+
+        if (id == ZIP_EXTRA_ZIP64)
+        {
+            if (pfFound != NULL)
+            {
+                *pfFound = true;
+            }
+
+            const uint8_t *p = pExtra;
+            const uint8_t *pEnd = pExtra + cbField;
+
+            if (fSizesOnly)
+            {
+                // The local header form always carries both sizes.
+                if (pEnd - p < 16)
+                {
+                    return ZR_BAD_FORMAT;
+                }
+                entry.uncompressedSize = ReadLE64(p);
+                entry.compressedSize = ReadLE64(p + 8);
+                return ZR_OK;
+            }
+
+            // The central directory form only carries the values whose
+            // 32-bit field holds the marker, in this fixed order.
+            if (entry.uncompressedSize == ZIP_ZIP64_MARKER_32)
+            {
+                if (pEnd - p < 8) return ZR_BAD_FORMAT;
+                entry.uncompressedSize = ReadLE64(p);
+                p += 8;
+            }
+            if (entry.compressedSize == ZIP_ZIP64_MARKER_32)
+            {
+                if (pEnd - p < 8) return ZR_BAD_FORMAT;
+                entry.compressedSize = ReadLE64(p);
+                p += 8;
+            }
+            if (entry.localHeaderOffset == ZIP_ZIP64_MARKER_32)
+            {
+                if (pEnd - p < 8) return ZR_BAD_FORMAT;
+                entry.localHeaderOffset = ReadLE64(p);
+                p += 8;
+            }
+            if (entry.diskStart == ZIP_ZIP64_MARKER_16)
+            {
+                if (pEnd - p < 4) return ZR_BAD_FORMAT;
+                entry.diskStart = ReadLE32(p);
+            }
+            return ZR_OK;
+        }
+
+        pExtra += cbField;
+        cbExtra -= cbField;
+    }
+
+    return ZR_OK;
+}
+
+
+void ParseTimestampExtra(const uint8_t *pExtra, size_t cbExtra, ZipEntryInfo &entry)
+{
+    // Higher ranks are better: the NTFS field has full precision and all
+    // three times, the Unix ones only whole seconds.
+    int rank = 0;
+    while (cbExtra >= 4)
+    {
+        uint16_t id = ReadLE16(pExtra);
+        size_t cbField = ReadLE16(pExtra + 2);
+        pExtra += 4;
+        cbExtra -= 4;
+        if (cbField > cbExtra)
+        {
+            break;
+        }
+        const uint8_t *p = pExtra;
+        const uint8_t *pEnd = pExtra + cbField;
+        pExtra += cbField;
+        cbExtra -= cbField;
+
+        if (id == ZIP_EXTRA_NTFS && rank < 3 && pEnd - p >= 4)
+        {
+            // Four reserved bytes, then tagged attributes; tag 1 holds
+            // the times.
+            for (p += 4; pEnd - p >= 4; )
+            {
+                uint16_t tag = ReadLE16(p);
+                size_t cbTag = ReadLE16(p + 2);
+                p += 4;
+                if ((size_t)(pEnd - p) < cbTag)
+                {
+                    break;
+                }
+                if (tag == 0x0001 && cbTag >= 24)
+                {
+                    entry.modifiedTime = ReadLE64(p);
+                    entry.accessTime = ReadLE64(p + 8);
+                    entry.creationTime = ReadLE64(p + 16);
+                    rank = 3;
+                    break;
+                }
+                p += cbTag;
+            }
+        }
+        else if (id == ZIP_EXTRA_TIMESTAMP && rank < 2 && pEnd - p >= 1)
+        {
+            // The flags say which times were recorded, but the central
+            // directory copy carries the modified time only; take what fits.
+            uint8_t flags = *p++;
+            uint64_t *pTimes[] = { &entry.modifiedTime, &entry.accessTime,
+                &entry.creationTime };
+            for (int i = 0; i < 3; i++)
+            {
+                if ((flags & (1 << i)) != 0 && pEnd - p >= 4)
+                {
+                    *pTimes[i] = UnixTimeToTicks((int32_t)ReadLE32(p));
+                    p += 4;
+                }
+            }
+            rank = 2;
+        }
+        else if (id == ZIP_EXTRA_UNIX_OLD && rank < 1 && pEnd - p >= 8)
+        {
+            entry.accessTime = UnixTimeToTicks((int32_t)ReadLE32(p));
+            entry.modifiedTime = UnixTimeToTicks((int32_t)ReadLE32(p + 4));
+            rank = 1;
+        }
+    }
+}
@@ -0,0 +1,202 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipFormat.h
+Project:      ZipFolderEx
+
+The file declares the on-disk constants of the ZIP format (PKWARE APPNOTE),
+the result codes shared by the native extractor, the ZipEntryInfo record
+that describes one archive member, and little-endian field readers.
+
+Nothing in this file depends on the Windows SDK so the native extractor can
+be compiled and exercised on other platforms as well.
+\***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+//
+//   Result codes returned by the native extractor. ZR_STOP is not an error:
+//   a sink returns it to ask the producer to stop early.
+//
+enum ZipResult
+{
+    ZR_OK = 0,
+    ZR_STOP,
+    ZR_IO_ERROR,
+    ZR_TRUNCATED,
+    ZR_BAD_FORMAT,
+    ZR_UNSUPPORTED,
+    ZR_CRC_MISMATCH,
+    ZR_BAD_PATH,
+    ZR_OUT_OF_MEMORY,
+    ZR_NOT_FOUND,
+};
+
+const char *ZipResultToString(ZipResult result);
+
+
+// Record signatures.
+const uint32_t ZIP_SIG_LOCAL_HEADER         = 0x04034b50;   // PK\3\4
+const uint32_t ZIP_SIG_DATA_DESCRIPTOR      = 0x08074b50;   // PK\7\8
+const uint32_t ZIP_SIG_CENTRAL_HEADER       = 0x02014b50;   // PK\1\2
+const uint32_t ZIP_SIG_END_OF_CD            = 0x06054b50;   // PK\5\6
+const uint32_t ZIP_SIG_ZIP64_END_OF_CD      = 0x06064b50;   // PK\6\6
+const uint32_t ZIP_SIG_ZIP64_LOCATOR        = 0x07064b50;   // PK\6\7
+const uint32_t ZIP_SIG_DIGITAL_SIGNATURE    = 0x05054b50;   // PK\5\5
+
+// A split or spanned archive may start with ZIP_SIG_DATA_DESCRIPTOR as a
+// marker; one that turned out to fit on a single disk, with this instead.
+const uint32_t ZIP_SIG_SPANNING_MARKER      = 0x30304b50;   // PK00
+
+// Fixed record sizes, excluding the variable length fields.
+const size_t ZIP_LOCAL_HEADER_SIZE          = 30;
+const size_t ZIP_CENTRAL_HEADER_SIZE        = 46;
+const size_t ZIP_END_OF_CD_SIZE             = 22;
+const size_t ZIP_ZIP64_END_OF_CD_SIZE       = 56;
+const size_t ZIP_ZIP64_LOCATOR_SIZE         = 20;
+
+// General purpose bit flags.
+const uint16_t ZIP_FLAG_ENCRYPTED           = 0x0001;
+const uint16_t ZIP_FLAG_DATA_DESCRIPTOR     = 0x0008;
+const uint16_t ZIP_FLAG_STRONG_ENCRYPTION   = 0x0040;
+const uint16_t ZIP_FLAG_UTF8                = 0x0800;
+
+// Compression methods.
+const uint16_t ZIP_METHOD_STORED            = 0;
+const uint16_t ZIP_METHOD_DEFLATED          = 8;
+
+// Extra field header IDs.
+const uint16_t ZIP_EXTRA_ZIP64              = 0x0001;
+const uint16_t ZIP_EXTRA_NTFS               = 0x000a;
+const uint16_t ZIP_EXTRA_TIMESTAMP          = 0x5455;   // "UT", Info-ZIP
+const uint16_t ZIP_EXTRA_UNIX_OLD           = 0x5855;   // "UX", Info-ZIP
+const uint16_t ZIP_EXTRA_UNICODE_PATH       = 0x7075;   // "up", Info-ZIP
+
+// Host systems, the high byte of "version made by". It says how the
+// external attributes are to be read.
+const uint8_t ZIP_HOST_MSDOS                = 0;
+const uint8_t ZIP_HOST_UNIX                 = 3;
+const uint8_t ZIP_HOST_NTFS                 = 10;
+const uint8_t ZIP_HOST_VFAT                 = 14;
+const uint8_t ZIP_HOST_OSX                  = 19;
+
+// A 32-bit size or offset with this value is stored in the ZIP64 extra field.
+const uint32_t ZIP_ZIP64_MARKER_32          = 0xFFFFFFFF;
+const uint16_t ZIP_ZIP64_MARKER_16          = 0xFFFF;
+
+
+//
+//   STRUCT: ZipEntryInfo
+//
+//   PURPOSE: Describes one archive member as read from its local header or
+//   central directory header. ZipArchive and ZipStreamReader decode the
+//   name to UTF-8 as they read it (DecodeEntryName); cbStoredName keeps
+//   the length of the name in the header, which the decoded one need not
+//   have. The times from the
+//   NTFS or extended timestamp extra fields are kept as Win32 FILETIME
+//   ticks (100 ns since 1601, UTC), 0 where the archive has none; the DOS
+//   date and time are always there as a fallback.
+//
+struct ZipEntryInfo
+{
+    std::string name;
+    uint16_t cbStoredName;
+    uint16_t versionMadeBy;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    uint32_t crc32;
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    uint64_t localHeaderOffset;
+    uint32_t diskStart;
+    uint32_t externalAttributes;
+    uint64_t modifiedTime;
+    uint64_t accessTime;
+    uint64_t creationTime;
+
+    ZipEntryInfo() : cbStoredName(0), versionMadeBy(0), flags(0), method(0), dosTime(0),
+        dosDate(0), crc32(0), compressedSize(0), uncompressedSize(0),
+        localHeaderOffset(0), diskStart(0), externalAttributes(0),
+        modifiedTime(0), accessTime(0), creationTime(0)
+    {
+    }
+
+    bool IsDirectory() const
+    {
+        return !name.empty() && (name.back() == '/' || name.back() == '\\');
+    }
+};
+
+
+inline uint16_t ReadLE16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t ReadLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t ReadLE64(const uint8_t *p)
+{
+    return (uint64_t)ReadLE32(p) | ((uint64_t)ReadLE32(p + 4) << 32);
+}
+
+
+//
+//   FUNCTION: FindRecordMarker
+//
+//   PURPOSE: Return the offset of the first "PK" at or after pos in
+//   p[0..cb), the two bytes every record signature starts with, or cb if
+//   there is none. Vectorized where the processor allows (see ZipCpu.h).
+//
+size_t FindRecordMarker(const uint8_t *p, size_t pos, size_t cb);
+
+//
+//   FUNCTION: FindLastSignature
+//
+//   PURPOSE: Return the offset of the last whole occurrence of the record
+//   signature in p[0..cb), or cb if there is none. Used to find the end of
+//   the central directory behind a comment; vectorized like
+//   FindRecordMarker.
+//
+size_t FindLastSignature(const uint8_t *p, size_t cb, uint32_t signature);
+
+
+//
+//   FUNCTION: ParseZip64Extra
+//
+//   PURPOSE: Replace the 32-bit fields of an entry that hold the ZIP64 marker
+//   with the 64-bit values from the ZIP64 extended information extra field.
+//
+//   PARAMETERS:
+//   * pExtra, cbExtra - The extra field block of the header.
+//   * entry - The entry whose fields are updated.
+//   * fSizesOnly - TRUE for local headers, which never carry the offset or
+//     disk number. In a local header both sizes are present whenever the
+//     field is present.
+//   * pfFound - Optional; receives whether the ZIP64 extra field was present.
+//
+//   RETURN VALUE: ZR_BAD_FORMAT if the field is shorter than the markers
+//   require, otherwise ZR_OK.
+//
+ZipResult ParseZip64Extra(const uint8_t *pExtra, size_t cbExtra,
+    ZipEntryInfo &entry, bool fSizesOnly, bool *pfFound);
+
+
+//
+//   FUNCTION: ParseTimestampExtra
+//
+//   PURPOSE: Fill in the modified, access and creation times of an entry
+//   from the NTFS extra field or, failing that, the Info-ZIP extended
+//   timestamp or old Unix extra field. Fields that are absent or too short
+//   are ignored, as is anything the entry already has a better source for.
+//
+void ParseTimestampExtra(const uint8_t *pExtra, size_t cbExtra, ZipEntryInfo &entry);
@@ -0,0 +1,800 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipIo.cpp
+Project:      ZipFolderEx
+
+The file implements the stream plumbing declared in ZipIo.h.
+\***************************************************************************/
+
+#include "ZipIo.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+
+#pragma region NativeFile
+
+#ifdef _WIN32
+
+NativeFile::NativeFile() : m_hFile(INVALID_HANDLE_VALUE), m_fOwned(false)
+{
+}
+
+ZipResult NativeFile::OpenRead(const NativePath &path)
+{
+    Close();
+    m_hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    m_fOwned = true;
+    return m_hFile != INVALID_HANDLE_VALUE ? ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::Create(const NativePath &path, bool fDirect)
+{
+    Close();
+    m_hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | (fDirect ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+    m_fOwned = true;
+    return m_hFile != INVALID_HANDLE_VALUE ? ZR_OK : ZR_IO_ERROR;
+}
+
+void NativeFile::AttachStdIn()
+{
+    Close();
+    m_hFile = GetStdHandle(STD_INPUT_HANDLE);
+    m_fOwned = false;
+}
+
+void NativeFile::Close()
+{
+    if (m_hFile != INVALID_HANDLE_VALUE && m_fOwned)
+    {
+        CloseHandle(m_hFile);
+    }
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_fOwned = false;
+}
+
+bool NativeFile::IsOpen() const
+{
+    return m_hFile != INVALID_HANDLE_VALUE;
+}
+
+ZipResult NativeFile::Read(void *pv, size_t cb, size_t *pcbRead)
+{
+    DWORD cbRead = 0;
+    DWORD cbChunk = (DWORD)std::min<size_t>(cb, 0x40000000);
+    *pcbRead = 0;
+    if (!ReadFile(m_hFile, pv, cbChunk, &cbRead, NULL))
+    {
+        // The writer closing its end of a pipe is the normal end of stream.
+        return GetLastError() == ERROR_BROKEN_PIPE ? ZR_OK : ZR_IO_ERROR;
+    }
+    *pcbRead = cbRead;
+    return ZR_OK;
+}
+
+ZipResult NativeFile::ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead)
+{
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD cbRead = 0;
+    DWORD cbChunk = (DWORD)std::min<size_t>(cb, 0x40000000);
+    *pcbRead = 0;
+    if (!ReadFile(m_hFile, pv, cbChunk, &cbRead, &ov))
+    {
+        return GetLastError() == ERROR_HANDLE_EOF ? ZR_OK : ZR_IO_ERROR;
+    }
+    *pcbRead = cbRead;
+    return ZR_OK;
+}
+
+ZipResult NativeFile::Write(const void *pv, size_t cb)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        DWORD cbChunk = (DWORD)std::min<size_t>(cb, 0x40000000);
+        DWORD cbWritten = 0;
+        if (!WriteFile(m_hFile, p, cbChunk, &cbWritten, NULL) || cbWritten == 0)
+        {
+            return ZR_IO_ERROR;
+        }
+        p += cbWritten;
+        cb -= cbWritten;
+    }
+    return ZR_OK;
+}
+
+ZipResult NativeFile::WriteAt(uint64_t offset, const void *pv, size_t cb)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        OVERLAPPED ov = { 0 };
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD cbChunk = (DWORD)std::min<size_t>(cb, 0x40000000);
+        DWORD cbWritten = 0;
+        if (!WriteFile(m_hFile, p, cbChunk, &cbWritten, &ov) || cbWritten == 0)
+        {
+            return ZR_IO_ERROR;
+        }
+        p += cbWritten;
+        offset += cbWritten;
+        cb -= cbWritten;
+    }
+    return ZR_OK;
+}
+
+ZipResult NativeFile::Sync()
+{
+    return FlushFileBuffers(m_hFile) ? ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::SetSize(uint64_t cb)
+{
+    // Writes give their own offsets, so the file pointer is free to move.
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)cb;
+    return SetFilePointerEx(m_hFile, size, NULL, FILE_BEGIN) && SetEndOfFile(m_hFile) ?
+        ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::SetSparse()
+{
+    DWORD cbReturned;
+    return DeviceIoControl(m_hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &cbReturned, NULL) ?
+        ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::GetSize(uint64_t *pcb)
+{
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_hFile, &size))
+    {
+        return ZR_IO_ERROR;
+    }
+    *pcb = (uint64_t)size.QuadPart;
+    return ZR_OK;
+}
+
+ZipResult NativeFile::GetDevice(uint64_t *pDevice)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(m_hFile, &info))
+    {
+        return ZR_IO_ERROR;
+    }
+    *pDevice = info.dwVolumeSerialNumber;
+    return ZR_OK;
+}
+
+void NativeFile::Advise(uint64_t offset, uint64_t cb)
+{
+    // Windows has no hint for a byte range of a file; the cache manager's
+    // own read-ahead follows reads that move forward through it.
+    (void)offset;
+    (void)cb;
+}
+
+#else
+
+NativeFile::NativeFile() : m_fd(-1), m_fOwned(false)
+{
+}
+
+ZipResult NativeFile::OpenRead(const NativePath &path)
+{
+    Close();
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    m_fOwned = true;
+    return m_fd >= 0 ? ZR_OK : ZR_IO_ERROR;
+}
+
+namespace
+{
+    int CreateFlags(bool fDirect)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+        flags |= fDirect ? O_DIRECT : 0;
+#else
+        (void)fDirect;
+#endif
+        return flags;
+    }
+
+    // macOS has no O_DIRECT; caching is turned off on the open file.
+    bool MakeUncached(int fd, bool fDirect)
+    {
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+        if (fd >= 0 && fDirect && fcntl(fd, F_NOCACHE, 1) != 0)
+        {
+            return false;
+        }
+#else
+        (void)fd;
+        (void)fDirect;
+#endif
+        return true;
+    }
+}
+
+ZipResult NativeFile::Create(const NativePath &path, bool fDirect)
+{
+    Close();
+    m_fd = open(path.c_str(), CreateFlags(fDirect), 0666);
+    m_fOwned = true;
+    return m_fd >= 0 && MakeUncached(m_fd, fDirect) ? ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::CreateAt(int dirFd, const NativePath &name, bool fDirect)
+{
+    Close();
+    m_fd = openat(dirFd, name.c_str(), CreateFlags(fDirect), 0666);
+    m_fOwned = true;
+    return m_fd >= 0 && MakeUncached(m_fd, fDirect) ? ZR_OK : ZR_IO_ERROR;
+}
+
+void NativeFile::AttachStdIn()
+{
+    Close();
+    m_fd = 0;
+    m_fOwned = false;
+}
+
+void NativeFile::Close()
+{
+    if (m_fd >= 0 && m_fOwned)
+    {
+        close(m_fd);
+    }
+    m_fd = -1;
+    m_fOwned = false;
+}
+
+bool NativeFile::IsOpen() const
+{
+    return m_fd >= 0;
+}
+
+ZipResult NativeFile::Read(void *pv, size_t cb, size_t *pcbRead)
+{
+    *pcbRead = 0;
+    for (;;)
+    {
+        ssize_t cbRead = read(m_fd, pv, cb);
+        if (cbRead >= 0)
+        {
+            *pcbRead = (size_t)cbRead;
+            return ZR_OK;
+        }
+        if (errno != EINTR)
+        {
+            return ZR_IO_ERROR;
+        }
+    }
+}
+
+ZipResult NativeFile::ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead)
+{
+    *pcbRead = 0;
+    for (;;)
+    {
+        ssize_t cbRead = pread(m_fd, pv, cb, (off_t)offset);
+        if (cbRead >= 0)
+        {
+            *pcbRead = (size_t)cbRead;
+            return ZR_OK;
+        }
+        if (errno != EINTR)
+        {
+            return ZR_IO_ERROR;
+        }
+    }
+}
+
+ZipResult NativeFile::Write(const void *pv, size_t cb)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        ssize_t cbWritten = write(m_fd, p, cb);
+        if (cbWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ZR_IO_ERROR;
+        }
+        p += cbWritten;
+        cb -= (size_t)cbWritten;
+    }
+    return ZR_OK;
+}
+
+ZipResult NativeFile::WriteAt(uint64_t offset, const void *pv, size_t cb)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        ssize_t cbWritten = pwrite(m_fd, p, cb, (off_t)offset);
+        if (cbWritten < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ZR_IO_ERROR;
+        }
+        p += cbWritten;
+        offset += (uint64_t)cbWritten;
+        cb -= (size_t)cbWritten;
+    }
+    return ZR_OK;
+}
+
+ZipResult NativeFile::Sync()
+{
+    return fsync(m_fd) == 0 ? ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::SetSize(uint64_t cb)
+{
+    return ftruncate(m_fd, (off_t)cb) == 0 ? ZR_OK : ZR_IO_ERROR;
+}
+
+ZipResult NativeFile::SetSparse()
+{
+    return ZR_OK;
+}
+
+ZipResult NativeFile::GetSize(uint64_t *pcb)
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        return ZR_IO_ERROR;
+    }
+    *pcb = (uint64_t)st.st_size;
+    return ZR_OK;
+}
+
+ZipResult NativeFile::GetDevice(uint64_t *pDevice)
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        return ZR_IO_ERROR;
+    }
+    *pDevice = (uint64_t)st.st_dev;
+    return ZR_OK;
+}
+
+void NativeFile::Advise(uint64_t offset, uint64_t cb)
+{
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(m_fd, (off_t)offset, (off_t)cb, POSIX_FADV_WILLNEED);
+#else
+    (void)offset;
+    (void)cb;
+#endif
+}
+
+#endif
+
+NativeFile::~NativeFile()
+{
+    Close();
+}
+
+#pragma endregion
+
+
+#pragma region RangeInputStream
+
+ZipResult RangeInputStream::Read(void *pv, size_t cb, size_t *pcbRead)
+{
+    *pcbRead = 0;
+    cb = (size_t)std::min<uint64_t>(cb, m_remaining);
+    if (cb == 0)
+    {
+        return ZR_OK;
+    }
+    ZipResult result = m_pSource->ReadAt(m_offset, pv, cb, pcbRead);
+    if (result == ZR_OK && *pcbRead == 0)
+    {
+        // The range runs past the end of the file.
+        result = ZR_TRUNCATED;
+    }
+    m_offset += *pcbRead;
+    m_remaining -= *pcbRead;
+    return result;
+}
+
+ZipResult MemoryInputStream::Read(void *pv, size_t cb, size_t *pcbRead)
+{
+    cb = std::min(cb, m_remaining);
+    memcpy(pv, m_p, cb);
+    m_p += cb;
+    m_remaining -= cb;
+    *pcbRead = cb;
+    return ZR_OK;
+}
+
+ZipResult ReadFullAt(ZipRandomAccess *pSource, uint64_t offset, void *pv, size_t cb)
+{
+    uint8_t *p = static_cast<uint8_t *>(pv);
+    while (cb > 0)
+    {
+        size_t cbRead = 0;
+        ZipResult result = pSource->ReadAt(offset, p, cb, &cbRead);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+        if (cbRead == 0)
+        {
+            return ZR_TRUNCATED;
+        }
+        offset += cbRead;
+        p += cbRead;
+        cb -= cbRead;
+    }
+    return ZR_OK;
+}
+
+#pragma endregion
+
+
+#pragma region PrefetchInputStream
+
+PrefetchInputStream::PrefetchInputStream(ZipInputStream *pSource,
+    size_t cbChunk, size_t cChunks) : m_pSource(pSource), m_cbChunk(cbChunk),
+    m_cChunks(cChunks), m_pCurrent(NULL), m_currentPos(0),
+    m_sourceResult(ZR_OK), m_fSourceDone(false), m_fStop(false)
+{
+    for (size_t i = 0; i < m_cChunks; ++i)
+    {
+        Chunk *pChunk = new Chunk;
+        pChunk->data.resize(m_cbChunk);
+        pChunk->cb = 0;
+        m_free.push_back(pChunk);
+    }
+    m_thread = std::thread(&PrefetchInputStream::ReaderThread, this);
+}
+
+PrefetchInputStream::~PrefetchInputStream()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_fStop = true;
+    }
+    m_cvFree.notify_all();
+    m_thread.join();
+
+    delete m_pCurrent;
+    for (size_t i = 0; i < m_filled.size(); ++i)
+    {
+        delete m_filled[i];
+    }
+    for (size_t i = 0; i < m_free.size(); ++i)
+    {
+        delete m_free[i];
+    }
+}
+
+void PrefetchInputStream::ReaderThread()
+{
+    for (;;)
+    {
+        Chunk *pChunk;
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_cvFree.wait(guard, [this] { return m_fStop || !m_free.empty(); });
+            if (m_fStop)
+            {
+                return;
+            }
+            pChunk = m_free.back();
+            m_free.pop_back();
+        }
+
+        // Fill the whole chunk unless the source ends, so a trickling pipe
+        // does not turn into many tiny hand-offs.
+        pChunk->cb = 0;
+        ZipResult result = ZR_OK;
+        while (pChunk->cb < m_cbChunk)
+        {
+            size_t cbRead = 0;
+            result = m_pSource->Read(&pChunk->data[pChunk->cb],
+                m_cbChunk - pChunk->cb, &cbRead);
+            if (result != ZR_OK || cbRead == 0)
+            {
+                break;
+            }
+            pChunk->cb += cbRead;
+        }
+
+        std::lock_guard<std::mutex> guard(m_lock);
+        bool fDone = pChunk->cb < m_cbChunk || result != ZR_OK;
+        if (pChunk->cb > 0)
+        {
+            m_filled.push_back(pChunk);
+        }
+        else
+        {
+            m_free.push_back(pChunk);
+        }
+        if (fDone)
+        {
+            m_sourceResult = result;
+            m_fSourceDone = true;
+        }
+        m_cvFilled.notify_one();
+        if (fDone)
+        {
+            return;
+        }
+    }
+}
+
+ZipResult PrefetchInputStream::Read(void *pv, size_t cb, size_t *pcbRead)
+{
+    *pcbRead = 0;
+
+    if (m_pCurrent == NULL || m_currentPos == m_pCurrent->cb)
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        if (m_pCurrent != NULL)
+        {
+            m_free.push_back(m_pCurrent);
+            m_pCurrent = NULL;
+            m_cvFree.notify_one();
+        }
+        m_cvFilled.wait(guard, [this] { return m_fSourceDone || !m_filled.empty(); });
+        if (m_filled.empty())
+        {
+            return m_sourceResult;
+        }
+        m_pCurrent = m_filled.front();
+        m_filled.pop_front();
+        m_currentPos = 0;
+    }
+
+    size_t cbCopy = std::min(cb, m_pCurrent->cb - m_currentPos);
+    memcpy(pv, &m_pCurrent->data[m_currentPos], cbCopy);
+    m_currentPos += cbCopy;
+    *pcbRead = cbCopy;
+    return ZR_OK;
+}
+
+#pragma endregion
+
+
+#pragma region BufferedReader
+
+const size_t BufferedReader::kLookbehind;
+
+BufferedReader::BufferedReader(ZipInputStream *pStream, size_t cbBuffer) :
+    m_pStream(pStream), m_buffer(cbBuffer + kLookbehind), m_pos(0), m_end(0),
+    m_base(0), m_fEof(false)
+{
+}
+
+void BufferedReader::Reset(ZipInputStream *pStream)
+{
+    m_pStream = pStream;
+    m_pos = 0;
+    m_end = 0;
+    m_base = 0;
+    m_fEof = false;
+}
+
+ZipResult BufferedReader::Fill(size_t cbWanted)
+{
+    if (Available() >= cbWanted || m_fEof)
+    {
+        return ZR_OK;
+    }
+
+    // Slide the unread bytes (and a little look-behind) to the front.
+    size_t keep = std::min(m_pos, kLookbehind);
+    size_t start = m_pos - keep;
+    if (start > 0)
+    {
+        memmove(&m_buffer[0], &m_buffer[start], m_end - start);
+        m_base += start;
+        m_pos -= start;
+        m_end -= start;
+    }
+
+    while (Available() < cbWanted && m_end < m_buffer.size())
+    {
+        size_t cbRead = 0;
+        ZipResult result = m_pStream->Read(&m_buffer[m_end],
+            m_buffer.size() - m_end, &cbRead);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+        if (cbRead == 0)
+        {
+            m_fEof = true;
+            break;
+        }
+        m_end += cbRead;
+    }
+
+    return ZR_OK;
+}
+
+ZipResult BufferedReader::ReadExact(void *pv, size_t cb)
+{
+    uint8_t *p = static_cast<uint8_t *>(pv);
+    while (cb > 0)
+    {
+        if (Available() == 0)
+        {
+            ZipResult result = Fill(std::min(cb, Capacity()));
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            if (Available() == 0)
+            {
+                return ZR_TRUNCATED;
+            }
+        }
+        size_t cbCopy = std::min(cb, Available());
+        memcpy(p, Data(), cbCopy);
+        Consume(cbCopy);
+        p += cbCopy;
+        cb -= cbCopy;
+    }
+    return ZR_OK;
+}
+
+ZipResult BufferedReader::Skip(uint64_t cb)
+{
+    while (cb > 0)
+    {
+        if (Available() == 0)
+        {
+            ZipResult result = Fill(1);
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            if (Available() == 0)
+            {
+                return ZR_TRUNCATED;
+            }
+        }
+        size_t cbSkip = (size_t)std::min<uint64_t>(cb, Available());
+        Consume(cbSkip);
+        cb -= cbSkip;
+    }
+    return ZR_OK;
+}
+
+#pragma endregion
+
+
+#pragma region Path Helpers
+
+ZipResult CreateDirectoryTree(const NativePath &path)
+{
+    if (path.empty())
+    {
+        return ZR_OK;
+    }
+
+#ifdef _WIN32
+    if (CreateDirectoryW(path.c_str(), NULL) ||
+        GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        return ZR_OK;
+    }
+    if (GetLastError() != ERROR_PATH_NOT_FOUND)
+    {
+        return ZR_IO_ERROR;
+    }
+#else
+    if (mkdir(path.c_str(), 0777) == 0 || errno == EEXIST)
+    {
+        return ZR_OK;
+    }
+    if (errno != ENOENT)
+    {
+        return ZR_IO_ERROR;
+    }
+#endif
+
+    // The parent is missing: create it first, then retry.
+    size_t sep = path.find_last_of(ZIP_NATIVE_SEPARATOR);
+    if (sep == NativePath::npos || sep == 0)
+    {
+        return ZR_IO_ERROR;
+    }
+    ZipResult result = CreateDirectoryTree(path.substr(0, sep));
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+#ifdef _WIN32
+    return CreateDirectoryW(path.c_str(), NULL) ||
+        GetLastError() == ERROR_ALREADY_EXISTS ? ZR_OK : ZR_IO_ERROR;
+#else
+    return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST ? ZR_OK : ZR_IO_ERROR;
+#endif
+}
+
+ZipResult GetFileStamp(const NativePath &path, uint64_t *pcb, uint64_t *pModified)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+    {
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? ZR_NOT_FOUND : ZR_IO_ERROR;
+    }
+    *pcb = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *pModified = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+        data.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return errno == ENOENT ? ZR_NOT_FOUND : ZR_IO_ERROR;
+    }
+    *pcb = (uint64_t)st.st_size;
+    *pModified = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+    return ZR_OK;
+}
+
+ZipResult RemoveFile(const NativePath &path)
+{
+#ifdef _WIN32
+    return DeleteFileW(path.c_str()) ? ZR_OK : ZR_IO_ERROR;
+#else
+    return unlink(path.c_str()) == 0 ? ZR_OK : ZR_IO_ERROR;
+#endif
+}
+
+ZipResult RenameFile(const NativePath &from, const NativePath &to)
+{
+#ifdef _WIN32
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) ? ZR_OK :
+        ZR_IO_ERROR;
+#else
+    return rename(from.c_str(), to.c_str()) == 0 ? ZR_OK : ZR_IO_ERROR;
+#endif
+}
+
+NativePath JoinPath(const NativePath &dir, const NativePath &relative)
+{
+    if (dir.empty())
+    {
+        return relative;
+    }
+    NativePath path = dir;
+    if (path[path.size() - 1] != ZIP_NATIVE_SEPARATOR)
+    {
+        path += ZIP_NATIVE_SEPARATOR;
+    }
+    path += relative;
+    return path;
+}
+
+#pragma endregion
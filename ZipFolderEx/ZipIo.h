@@ -0,0 +1,248 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipIo.h
+Project:      ZipFolderEx
+
+The file declares the byte stream plumbing used by the native extractor:
+
+ZipInputStream - a sequential source of bytes (a file, a pipe, stdin).
+ZipRandomAccess - a source that can be read at any offset.
+NativeFile - a thin wrapper over a Win32 HANDLE or a POSIX descriptor.
+RangeInputStream - a byte range of a random access source as a stream.
+MemoryInputStream - bytes already in memory as a stream.
+PrefetchInputStream - reads a slow source on a background thread so that
+    network or pipe latency overlaps with decompression and disk writes.
+BufferedReader - a refillable window over a stream with a small amount of
+    look-behind, so a decoder that read ahead can hand bytes back.
+
+The helpers at the end create directories, remove and stat files and join
+paths in the native path encoding (UTF-16 on Windows, bytes elsewhere).
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipFormat.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef std::wstring NativePath;
+#define ZIP_NATIVE_SEPARATOR L'\\'
+#else
+typedef std::string NativePath;
+#define ZIP_NATIVE_SEPARATOR '/'
+#endif
+
+
+class ZipInputStream
+{
+public:
+    virtual ~ZipInputStream() {}
+
+    // Read up to cb bytes. Success with *pcbRead == 0 means end of stream.
+    virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead) = 0;
+};
+
+
+class ZipRandomAccess
+{
+public:
+    virtual ~ZipRandomAccess() {}
+
+    // Read up to cb bytes at offset. A short count means end of file.
+    virtual ZipResult ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead) = 0;
+    virtual ZipResult GetSize(uint64_t *pcb) = 0;
+
+    // Hint that the cb bytes at offset will be read soon, so a source that
+    // can fetch them in the background should start. Does not wait.
+    virtual void Advise(uint64_t offset, uint64_t cb) { (void)offset; (void)cb; }
+};
+
+
+class NativeFile : public ZipInputStream, public ZipRandomAccess
+{
+public:
+    NativeFile();
+    virtual ~NativeFile();
+
+    ZipResult OpenRead(const NativePath &path);
+
+    // With fDirect, writes bypass the system cache (O_DIRECT, F_NOCACHE or
+    // FILE_FLAG_NO_BUFFERING), and must then start and end at multiples of
+    // the sector size from equally aligned memory. Fails where the file
+    // system cannot do that.
+    ZipResult Create(const NativePath &path, bool fDirect = false);
+#ifndef _WIN32
+    // Create name in the directory open as dirFd.
+    ZipResult CreateAt(int dirFd, const NativePath &name, bool fDirect = false);
+#endif
+    void AttachStdIn();
+    void Close();
+    bool IsOpen() const;
+
+    virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead);
+    virtual ZipResult ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead);
+    virtual ZipResult GetSize(uint64_t *pcb);
+    virtual void Advise(uint64_t offset, uint64_t cb);
+
+    // An id of the volume or device the file is on; files with different
+    // ids can be read at the same time without one slowing the other.
+    ZipResult GetDevice(uint64_t *pDevice);
+
+    ZipResult Write(const void *pv, size_t cb);
+    ZipResult WriteAt(uint64_t offset, const void *pv, size_t cb);
+
+    // Wait until what was written is on the disk.
+    ZipResult Sync();
+
+    // Cut or extend the file to cb bytes.
+    ZipResult SetSize(uint64_t cb);
+
+    // Let ranges that are never written stay unallocated. POSIX files are
+    // sparse already; NTFS files must be marked so.
+    ZipResult SetSparse();
+
+private:
+    NativeFile(const NativeFile &);
+    NativeFile &operator=(const NativeFile &);
+
+#ifdef _WIN32
+    HANDLE m_hFile;
+#else
+    int m_fd;
+#endif
+    bool m_fOwned;
+};
+
+
+// Reads a byte range of a random access source as a sequential stream.
+class RangeInputStream : public ZipInputStream
+{
+public:
+    RangeInputStream(ZipRandomAccess *pSource, uint64_t offset, uint64_t length) :
+        m_pSource(pSource), m_offset(offset), m_remaining(length)
+    {
+    }
+
+    virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead);
+
+private:
+    ZipRandomAccess *m_pSource;
+    uint64_t m_offset;
+    uint64_t m_remaining;
+};
+
+
+// Reads bytes the caller holds in memory, which must outlive the stream.
+class MemoryInputStream : public ZipInputStream
+{
+public:
+    MemoryInputStream(const void *pv, size_t cb) :
+        m_p(static_cast<const uint8_t *>(pv)), m_remaining(cb)
+    {
+    }
+
+    virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead);
+
+private:
+    const uint8_t *m_p;
+    size_t m_remaining;
+};
+
+
+// Reads exactly cb bytes at offset; a short read is ZR_TRUNCATED.
+ZipResult ReadFullAt(ZipRandomAccess *pSource, uint64_t offset, void *pv, size_t cb);
+
+
+class PrefetchInputStream : public ZipInputStream
+{
+public:
+    PrefetchInputStream(ZipInputStream *pSource, size_t cbChunk = 1024 * 1024,
+        size_t cChunks = 8);
+    virtual ~PrefetchInputStream();
+
+    virtual ZipResult Read(void *pv, size_t cb, size_t *pcbRead);
+
+private:
+    struct Chunk
+    {
+        std::vector<uint8_t> data;
+        size_t cb;
+    };
+
+    void ReaderThread();
+
+    ZipInputStream *m_pSource;
+    size_t m_cbChunk;
+    size_t m_cChunks;
+
+    std::mutex m_lock;
+    std::condition_variable m_cvFilled;
+    std::condition_variable m_cvFree;
+    std::deque<Chunk *> m_filled;
+    std::vector<Chunk *> m_free;
+    Chunk *m_pCurrent;
+    size_t m_currentPos;
+    ZipResult m_sourceResult;
+    bool m_fSourceDone;
+    bool m_fStop;
+    std::thread m_thread;
+};
+
+
+class BufferedReader
+{
+public:
+    // Bytes that stay addressable in front of Data() after a refill.
+    static const size_t kLookbehind = 8;
+
+    explicit BufferedReader(ZipInputStream *pStream, size_t cbBuffer = 256 * 1024);
+
+    // Make at least cbWanted bytes available unless the stream ends first.
+    // cbWanted must not exceed Capacity().
+    ZipResult Fill(size_t cbWanted);
+
+    const uint8_t *Data() const { return &m_buffer[0] + m_pos; }
+    size_t Available() const { return m_end - m_pos; }
+    size_t Capacity() const { return m_buffer.size() - kLookbehind; }
+    bool AtEnd() const { return m_fEof && m_pos == m_end; }
+
+    void Consume(size_t cb) { m_pos += cb; }
+
+    // Move the read position to p, which must lie between the oldest
+    // look-behind byte and the end of the buffered data.
+    void SetCursor(const uint8_t *p) { m_pos = p - &m_buffer[0]; }
+
+    ZipResult ReadExact(void *pv, size_t cb);
+    ZipResult Skip(uint64_t cb);
+
+    // Start over on pStream, keeping the buffer, so one reader can serve
+    // many small entries without allocating for each.
+    void Reset(ZipInputStream *pStream);
+
+    // Number of bytes consumed from the underlying stream so far.
+    uint64_t Position() const { return m_base + m_pos; }
+
+private:
+    ZipInputStream *m_pStream;
+    std::vector<uint8_t> m_buffer;
+    size_t m_pos;
+    size_t m_end;
+    uint64_t m_base;
+    bool m_fEof;
+};
+
+
+ZipResult CreateDirectoryTree(const NativePath &path);
+ZipResult RemoveFile(const NativePath &path);
+
+// Move the file at from to to in one step, replacing any file already there.
+ZipResult RenameFile(const NativePath &from, const NativePath &to);
+
+// Size and last write time of a file, for telling whether it has changed.
+// The time is in the platform's own units.
+ZipResult GetFileStamp(const NativePath &path, uint64_t *pcb, uint64_t *pModified);
+NativePath JoinPath(const NativePath &dir, const NativePath &relative);
@@ -0,0 +1,790 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipIpc.cpp
+Project:      ZipFolderEx
+
+The file implements the local message channel declared in ZipIpc.h.
+\***************************************************************************/
+
+#include "ZipIpc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <sddl.h>
+#include <aclapi.h>
+#pragma comment(lib, "advapi32.lib")
+
+// Vista and later, which is also when GetNamedPipeServerProcessId appears.
+#ifndef PROCESS_QUERY_LIMITED_INFORMATION
+#define PROCESS_QUERY_LIMITED_INFORMATION 0x1000
+#endif
+#else
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+
+namespace
+{
+    std::string EscapeValue(const std::string &value)
+    {
+        std::string escaped;
+        escaped.reserve(value.size());
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            switch (value[i])
+            {
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            default: escaped += value[i]; break;
+            }
+        }
+        return escaped;
+    }
+
+    std::string UnescapeValue(const std::string &value)
+    {
+        std::string plain;
+        plain.reserve(value.size());
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (value[i] == '\\' && i + 1 < value.size())
+            {
+                char c = value[++i];
+                plain += c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+            }
+            else
+            {
+                plain += value[i];
+            }
+        }
+        return plain;
+    }
+
+#ifdef _WIN32
+    std::string PathToUtf8(const NativePath &path)
+    {
+        std::string utf8;
+        int cb = WideCharToMultiByte(CP_UTF8, 0, path.data(), (int)path.size(),
+            NULL, 0, NULL, NULL);
+        if (cb > 0)
+        {
+            utf8.resize(cb);
+            WideCharToMultiByte(CP_UTF8, 0, path.data(), (int)path.size(),
+                &utf8[0], cb, NULL, NULL);
+        }
+        return utf8;
+    }
+
+    NativePath Utf8ToPath(const std::string &utf8)
+    {
+        NativePath path;
+        int cch = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), NULL, 0);
+        if (cch > 0)
+        {
+            path.resize(cch);
+            MultiByteToWideChar(CP_UTF8, 0, utf8.data(), (int)utf8.size(), &path[0], cch);
+        }
+        return path;
+    }
+
+    // The TOKEN_USER of hProcess, in pBuffer.
+    bool GetProcessUser(HANDLE hProcess, std::vector<uint8_t> *pBuffer)
+    {
+        HANDLE hToken;
+        if (!OpenProcessToken(hProcess, TOKEN_QUERY, &hToken))
+        {
+            return false;
+        }
+        DWORD cb = 0;
+        GetTokenInformation(hToken, TokenUser, NULL, 0, &cb);
+        bool fOk = cb > 0;
+        if (fOk)
+        {
+            pBuffer->resize(cb);
+            fOk = GetTokenInformation(hToken, TokenUser, &(*pBuffer)[0], cb, &cb) != FALSE;
+        }
+        CloseHandle(hToken);
+        return fOk;
+    }
+
+    PSID UserSid(std::vector<uint8_t> &tokenUser)
+    {
+        return reinterpret_cast<TOKEN_USER *>(&tokenUser[0])->User.Sid;
+    }
+
+    typedef BOOL (WINAPI *PFN_GET_NAMED_PIPE_SERVER_PROCESS_ID)(HANDLE, PULONG);
+
+    // Whether the server end of hPipe belongs to a process of this user.
+    // Before Vista the server process cannot be named, so the owner of the
+    // pipe is compared instead, which ZipIpcServer sets to its user and
+    // nobody else can set to ours.
+    bool IsServerSameUser(HANDLE hPipe)
+    {
+        std::vector<uint8_t> self, server;
+        if (!GetProcessUser(GetCurrentProcess(), &self))
+        {
+            return false;
+        }
+        PFN_GET_NAMED_PIPE_SERVER_PROCESS_ID pfnGetServerProcessId =
+            reinterpret_cast<PFN_GET_NAMED_PIPE_SERVER_PROCESS_ID>(GetProcAddress(
+                GetModuleHandleW(L"kernel32.dll"), "GetNamedPipeServerProcessId"));
+        if (pfnGetServerProcessId != NULL)
+        {
+            ULONG processId = 0;
+            HANDLE hProcess = pfnGetServerProcessId(hPipe, &processId) ?
+                OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId) : NULL;
+            if (hProcess == NULL)
+            {
+                return false;
+            }
+            bool fOk = GetProcessUser(hProcess, &server);
+            CloseHandle(hProcess);
+            return fOk && EqualSid(UserSid(self), UserSid(server));
+        }
+
+        PSID pOwner = NULL;
+        PSECURITY_DESCRIPTOR pSecurity = NULL;
+        if (GetSecurityInfo(hPipe, SE_KERNEL_OBJECT, OWNER_SECURITY_INFORMATION, &pOwner,
+            NULL, NULL, NULL, &pSecurity) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+        bool fSame = pOwner != NULL && EqualSid(pOwner, UserSid(self));
+        LocalFree(pSecurity);
+        return fSame;
+    }
+#else
+    // Paths are bytes here and travel as they are.
+    const std::string &PathToUtf8(const NativePath &path) { return path; }
+    const NativePath &Utf8ToPath(const std::string &utf8) { return utf8; }
+
+    // Whether the process at the other end of the connected socket fd runs
+    // as this user.
+    bool IsPeerSameUser(int fd)
+    {
+#ifdef SO_PEERCRED
+        struct ucred credentials;
+        socklen_t cb = sizeof(credentials);
+        return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &cb) == 0 &&
+            credentials.uid == getuid();
+#else
+        uid_t uid;
+        gid_t gid;
+        return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+    }
+#endif
+}
+
+
+#ifdef _WIN32
+NativePath ZipIpcUserSid()
+{
+    std::vector<uint8_t> tokenUser;
+    LPWSTR pszSid = NULL;
+    if (!GetProcessUser(GetCurrentProcess(), &tokenUser) ||
+        !ConvertSidToStringSidW(UserSid(tokenUser), &pszSid))
+    {
+        return NativePath();
+    }
+    NativePath sid = pszSid;
+    LocalFree(pszSid);
+    return sid;
+}
+#endif
+
+
+#pragma region ZipIpcMessage
+
+void ZipIpcMessage::SetNumber(const std::string &key, uint64_t value)
+{
+    char sz[24];
+    snprintf(sz, sizeof(sz), "%llu", (unsigned long long)value);
+    m_fields[key] = sz;
+}
+
+void ZipIpcMessage::SetPath(const std::string &key, const NativePath &path)
+{
+    m_fields[key] = PathToUtf8(path);
+}
+
+std::string ZipIpcMessage::Get(const std::string &key) const
+{
+    std::map<std::string, std::string>::const_iterator it = m_fields.find(key);
+    return it != m_fields.end() ? it->second : std::string();
+}
+
+uint64_t ZipIpcMessage::GetNumber(const std::string &key) const
+{
+    return strtoull(Get(key).c_str(), NULL, 10);
+}
+
+NativePath ZipIpcMessage::GetPath(const std::string &key) const
+{
+    return Utf8ToPath(Get(key));
+}
+
+std::string ZipIpcMessage::Encode() const
+{
+    std::string text = m_command;
+    text += '\n';
+    for (std::map<std::string, std::string>::const_iterator it = m_fields.begin();
+        it != m_fields.end(); ++it)
+    {
+        text += it->first;
+        text += '=';
+        text += EscapeValue(it->second);
+        text += '\n';
+    }
+    return text;
+}
+
+ZipResult ZipIpcMessage::Decode(const std::string &text)
+{
+    m_command.clear();
+    m_fields.clear();
+
+    size_t pos = text.find('\n');
+    if (pos == std::string::npos || pos == 0)
+    {
+        return ZR_BAD_FORMAT;
+    }
+    m_command = text.substr(0, pos++);
+    while (pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        size_t eq = text.find('=', pos);
+        if (eq == std::string::npos || eq > end || eq == pos)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        m_fields[text.substr(pos, eq - pos)] = UnescapeValue(text.substr(eq + 1, end - eq - 1));
+        pos = end + 1;
+    }
+    return ZR_OK;
+}
+
+#pragma endregion
+
+
+#pragma region ZipIpcConnection
+
+ZipResult ZipIpcConnection::Send(const ZipIpcMessage &message)
+{
+    std::string text = message.Encode();
+    if (text.size() > ZIP_IPC_MAX_MESSAGE)
+    {
+        return ZR_UNSUPPORTED;
+    }
+    uint32_t cb = (uint32_t)text.size();
+    uint8_t header[4] = { (uint8_t)cb, (uint8_t)(cb >> 8), (uint8_t)(cb >> 16), (uint8_t)(cb >> 24) };
+    ZipResult result = WriteAll(header, sizeof(header));
+    if (result == ZR_OK)
+    {
+        result = WriteAll(text.data(), text.size());
+    }
+    return result;
+}
+
+ZipResult ZipIpcConnection::Receive(ZipIpcMessage *pMessage)
+{
+    uint8_t header[4];
+    ZipResult result = ReadAll(header, sizeof(header));
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    uint32_t cb = ReadLE32(header);
+    if (cb == 0 || cb > ZIP_IPC_MAX_MESSAGE)
+    {
+        return ZR_BAD_FORMAT;
+    }
+    std::string text(cb, '\0');
+    result = ReadAll(&text[0], cb);
+    if (result == ZR_OK)
+    {
+        result = pMessage->Decode(text);
+    }
+    return result;
+}
+
+#ifdef _WIN32
+
+ZipIpcConnection::ZipIpcConnection() : m_hPipe(INVALID_HANDLE_VALUE), m_hEvent(NULL)
+{
+}
+
+ZipIpcConnection::~ZipIpcConnection()
+{
+    Close();
+    if (m_hEvent != NULL)
+    {
+        CloseHandle(m_hEvent);
+    }
+}
+
+ZipResult ZipIpcConnection::Connect(const NativePath &name, unsigned msTimeout)
+{
+    Close();
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(msTimeout);
+    for (;;)
+    {
+        m_hPipe = CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+        if (m_hPipe != INVALID_HANDLE_VALUE)
+        {
+            break;
+        }
+        DWORD error = GetLastError();
+        if (error != ERROR_PIPE_BUSY)
+        {
+            return error == ERROR_FILE_NOT_FOUND ? ZR_NOT_FOUND : ZR_IO_ERROR;
+        }
+
+        // Every instance is serving another client; wait for one to free up.
+        long long msLeft = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (msLeft <= 0 || !WaitNamedPipeW(name.c_str(), (DWORD)msLeft))
+        {
+            return ZR_IO_ERROR;
+        }
+    }
+
+    // Anyone can create a pipe of this name before the real server does.
+    if (!IsServerSameUser(m_hPipe))
+    {
+        Close();
+        return ZR_IO_ERROR;
+    }
+    DWORD mode = PIPE_READMODE_BYTE;
+    SetNamedPipeHandleState(m_hPipe, &mode, NULL, NULL);
+    return ZR_OK;
+}
+
+void ZipIpcConnection::Close()
+{
+    if (m_hPipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hPipe);
+        m_hPipe = INVALID_HANDLE_VALUE;
+    }
+}
+
+ZipResult ZipIpcConnection::WriteAll(const void *pv, size_t cb)
+{
+    if (m_hEvent == NULL && (m_hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)) == NULL)
+    {
+        return ZR_IO_ERROR;
+    }
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = m_hEvent;
+        DWORD cbWritten = 0;
+        if (!WriteFile(m_hPipe, p, (DWORD)cb, NULL, &overlapped) &&
+            GetLastError() != ERROR_IO_PENDING)
+        {
+            return ZR_IO_ERROR;
+        }
+        if (!GetOverlappedResult(m_hPipe, &overlapped, &cbWritten, TRUE) || cbWritten == 0)
+        {
+            return ZR_IO_ERROR;
+        }
+        p += cbWritten;
+        cb -= cbWritten;
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipIpcConnection::ReadAll(void *pv, size_t cb)
+{
+    if (m_hEvent == NULL && (m_hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)) == NULL)
+    {
+        return ZR_IO_ERROR;
+    }
+    uint8_t *p = static_cast<uint8_t *>(pv);
+    while (cb > 0)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = m_hEvent;
+        DWORD cbRead = 0;
+        if (!ReadFile(m_hPipe, p, (DWORD)cb, NULL, &overlapped) &&
+            GetLastError() != ERROR_IO_PENDING)
+        {
+            return ZR_IO_ERROR;
+        }
+        if (!GetOverlappedResult(m_hPipe, &overlapped, &cbRead, TRUE))
+        {
+            return GetLastError() == ERROR_BROKEN_PIPE ? ZR_TRUNCATED : ZR_IO_ERROR;
+        }
+        if (cbRead == 0)
+        {
+            return ZR_TRUNCATED;
+        }
+        p += cbRead;
+        cb -= cbRead;
+    }
+    return ZR_OK;
+}
+
+#else
+
+ZipIpcConnection::ZipIpcConnection() : m_fd(-1)
+{
+}
+
+ZipIpcConnection::~ZipIpcConnection()
+{
+    Close();
+}
+
+ZipResult ZipIpcConnection::Connect(const NativePath &name, unsigned msTimeout)
+{
+    Close();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (name.size() >= sizeof(address.sun_path))
+    {
+        return ZR_BAD_PATH;
+    }
+    memcpy(address.sun_path, name.c_str(), name.size() + 1);
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return ZR_IO_ERROR;
+    }
+
+    // A full backlog refuses with EAGAIN; retry until the timeout.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(msTimeout);
+    for (;;)
+    {
+        if (connect(m_fd, (sockaddr *)&address, sizeof(address)) == 0)
+        {
+            if (!IsPeerSameUser(m_fd))
+            {
+                Close();
+                return ZR_IO_ERROR;
+            }
+            return ZR_OK;
+        }
+        int error = errno;
+        if (error != EAGAIN || std::chrono::steady_clock::now() >= deadline)
+        {
+            Close();
+            return error == ENOENT || error == ECONNREFUSED ? ZR_NOT_FOUND : ZR_IO_ERROR;
+        }
+        usleep(10000);
+    }
+}
+
+void ZipIpcConnection::Close()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+ZipResult ZipIpcConnection::WriteAll(const void *pv, size_t cb)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(pv);
+    while (cb > 0)
+    {
+        // MSG_NOSIGNAL: a peer that went away is an error, not SIGPIPE.
+        ssize_t cbSent = send(m_fd, p, cb, MSG_NOSIGNAL);
+        if (cbSent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ZR_IO_ERROR;
+        }
+        p += cbSent;
+        cb -= (size_t)cbSent;
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipIpcConnection::ReadAll(void *pv, size_t cb)
+{
+    uint8_t *p = static_cast<uint8_t *>(pv);
+    while (cb > 0)
+    {
+        ssize_t cbRead = recv(m_fd, p, cb, 0);
+        if (cbRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ZR_IO_ERROR;
+        }
+        if (cbRead == 0)
+        {
+            return ZR_TRUNCATED;
+        }
+        p += cbRead;
+        cb -= (size_t)cbRead;
+    }
+    return ZR_OK;
+}
+
+#endif
+
+#pragma endregion
+
+
+#pragma region ZipIpcServer
+
+#ifdef _WIN32
+
+ZipIpcServer::ZipIpcServer() :
+    m_pSecurity(NULL), m_hPending(INVALID_HANDLE_VALUE), m_hEvent(NULL), m_fConnecting(false),
+    m_fFirst(true)
+{
+    memset(&m_overlapped, 0, sizeof(m_overlapped));
+}
+
+ZipIpcServer::~ZipIpcServer()
+{
+    Close();
+}
+
+ZipResult ZipIpcServer::Listen(const NativePath &name)
+{
+    Close();
+    m_name = name;
+    m_fFirst = true;
+
+    // Owned by this user and open to this user alone; the owner is what
+    // clients check before Vista.
+    NativePath sid = ZipIpcUserSid();
+    NativePath sddl = L"O:" + sid + L"D:P(A;;GA;;;" + sid + L")";
+    if (sid.empty() || !ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl.c_str(),
+        SDDL_REVISION_1, &m_pSecurity, NULL))
+    {
+        m_pSecurity = NULL;
+        return ZR_IO_ERROR;
+    }
+    m_hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (m_hEvent == NULL)
+    {
+        return ZR_IO_ERROR;
+    }
+    return CreateInstance();
+}
+
+ZipResult ZipIpcServer::CreateInstance()
+{
+    // The first instance claims the name, so a second server fails here
+    // instead of sharing it. Remote clients are refused where the system
+    // supports the flag; it is not known before Vista.
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+        (m_fFirst ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+    DWORD pipeMode = PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT;
+    SECURITY_ATTRIBUTES security = { sizeof(security), m_pSecurity, FALSE };
+    m_hPending = CreateNamedPipeW(m_name.c_str(), openMode,
+        pipeMode | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+        4096, 4096, 0, &security);
+    if (m_hPending == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER)
+    {
+        m_hPending = CreateNamedPipeW(m_name.c_str(), openMode, pipeMode,
+            PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, &security);
+    }
+    if (m_hPending == INVALID_HANDLE_VALUE)
+    {
+        return ZR_IO_ERROR;
+    }
+    m_fFirst = false;
+
+    memset(&m_overlapped, 0, sizeof(m_overlapped));
+    m_overlapped.hEvent = m_hEvent;
+    ResetEvent(m_hEvent);
+    m_fConnecting = false;
+    if (ConnectNamedPipe(m_hPending, &m_overlapped))
+    {
+        SetEvent(m_hEvent);
+    }
+    else
+    {
+        switch (GetLastError())
+        {
+        case ERROR_IO_PENDING:
+            m_fConnecting = true;
+            break;
+        case ERROR_PIPE_CONNECTED:
+            // A client got in between creating the pipe and connecting it.
+            SetEvent(m_hEvent);
+            break;
+        default:
+            CloseHandle(m_hPending);
+            m_hPending = INVALID_HANDLE_VALUE;
+            return ZR_IO_ERROR;
+        }
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipIpcServer::Accept(unsigned msTimeout, ZipIpcConnection *pConnection)
+{
+    if (m_hPending == INVALID_HANDLE_VALUE && CreateInstance() != ZR_OK)
+    {
+        return ZR_IO_ERROR;
+    }
+    if (WaitForSingleObject(m_hEvent, msTimeout) != WAIT_OBJECT_0)
+    {
+        return ZR_STOP;
+    }
+    DWORD cbUnused;
+    if (m_fConnecting && !GetOverlappedResult(m_hPending, &m_overlapped, &cbUnused, FALSE))
+    {
+        // The client gave up before we saw it; start over.
+        CloseHandle(m_hPending);
+        m_hPending = INVALID_HANDLE_VALUE;
+        return ZR_STOP;
+    }
+
+    pConnection->Close();
+    pConnection->m_hPipe = m_hPending;
+    m_hPending = INVALID_HANDLE_VALUE;
+
+    // Have the next instance listening before the caller serves this one.
+    CreateInstance();
+    return ZR_OK;
+}
+
+void ZipIpcServer::Close()
+{
+    if (m_hPending != INVALID_HANDLE_VALUE)
+    {
+        if (m_fConnecting)
+        {
+            CancelIo(m_hPending);
+        }
+        CloseHandle(m_hPending);
+        m_hPending = INVALID_HANDLE_VALUE;
+    }
+    if (m_hEvent != NULL)
+    {
+        CloseHandle(m_hEvent);
+        m_hEvent = NULL;
+    }
+    if (m_pSecurity != NULL)
+    {
+        LocalFree(m_pSecurity);
+        m_pSecurity = NULL;
+    }
+    m_fConnecting = false;
+}
+
+#else
+
+ZipIpcServer::ZipIpcServer() : m_fd(-1)
+{
+}
+
+ZipIpcServer::~ZipIpcServer()
+{
+    Close();
+}
+
+ZipResult ZipIpcServer::Listen(const NativePath &name)
+{
+    Close();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (name.size() >= sizeof(address.sun_path))
+    {
+        return ZR_BAD_PATH;
+    }
+    memcpy(address.sun_path, name.c_str(), name.size() + 1);
+
+    // A socket file that nobody answers on is left over from a server that
+    // died; one that answers belongs to a live server.
+    ZipIpcConnection probe;
+    if (probe.Connect(name, 0) == ZR_OK)
+    {
+        return ZR_IO_ERROR;
+    }
+    unlink(name.c_str());
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return ZR_IO_ERROR;
+    }
+
+    // Only the owner may connect. The mode is set between bind and listen,
+    // while a connection would still be refused; umask would do it for the
+    // whole process, under the feet of its other threads.
+    bool fBound = bind(m_fd, (sockaddr *)&address, sizeof(address)) == 0;
+    if (!fBound || chmod(name.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(m_fd, 64) != 0)
+    {
+        if (fBound)
+        {
+            unlink(name.c_str());
+        }
+        close(m_fd);
+        m_fd = -1;
+        return ZR_IO_ERROR;
+    }
+    m_name = name;
+    return ZR_OK;
+}
+
+ZipResult ZipIpcServer::Accept(unsigned msTimeout, ZipIpcConnection *pConnection)
+{
+    pollfd pfd = {};
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    int cReady = poll(&pfd, 1, (int)msTimeout);
+    if (cReady < 0 && errno != EINTR)
+    {
+        return ZR_IO_ERROR;
+    }
+    if (cReady <= 0)
+    {
+        return ZR_STOP;
+    }
+
+    int fd = accept4(m_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno == EAGAIN || errno == EINTR || errno == ECONNABORTED ? ZR_STOP : ZR_IO_ERROR;
+    }
+    pConnection->Close();
+    pConnection->m_fd = fd;
+    return ZR_OK;
+}
+
+void ZipIpcServer::Close()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+        unlink(m_name.c_str());
+    }
+    m_name.clear();
+}
+
+#endif
+
+#pragma endregion
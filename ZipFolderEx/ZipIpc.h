@@ -0,0 +1,151 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipIpc.h
+Project:      ZipFolderEx
+
+The file declares the local inter-process channel between the shell
+extension (or any other client) and the extraction service.
+
+The transport is a named pipe on Windows and a Unix domain socket
+elsewhere. Every exchange is one request and one reply on a fresh
+connection. A message is a 32-bit little-endian length followed by that
+many bytes of UTF-8 text: a command on the first line, then "key=value"
+lines. Backslashes and line breaks in values are escaped, so a path can
+hold any character.
+
+Only the user the server runs as may connect: its pipe is created with a
+security descriptor that grants that user alone, and its socket is made
+0600 before it listens. Since another user could still claim the name
+first, a client in turn makes sure the server runs as its own user before
+it sends anything, from the token of the pipe server's process (or the
+owner of the pipe before Vista) or from the socket peer's credentials.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+#include <map>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+
+// Largest message either side accepts.
+const size_t ZIP_IPC_MAX_MESSAGE = 64 * 1024;
+
+
+#ifdef _WIN32
+// The SID of the user this process runs as in string form ("S-1-5-21-..."),
+// or empty if it cannot be read.
+NativePath ZipIpcUserSid();
+#endif
+
+
+class ZipIpcMessage
+{
+public:
+    ZipIpcMessage() {}
+    explicit ZipIpcMessage(const std::string &command) : m_command(command) {}
+
+    const std::string &Command() const { return m_command; }
+    void SetCommand(const std::string &command) { m_command = command; }
+
+    void Set(const std::string &key, const std::string &value) { m_fields[key] = value; }
+    void SetNumber(const std::string &key, uint64_t value);
+    void SetPath(const std::string &key, const NativePath &path);
+
+    // Missing fields read as empty or as 0.
+    std::string Get(const std::string &key) const;
+    uint64_t GetNumber(const std::string &key) const;
+    NativePath GetPath(const std::string &key) const;
+    bool Has(const std::string &key) const { return m_fields.count(key) != 0; }
+
+    std::string Encode() const;
+    ZipResult Decode(const std::string &text);
+
+private:
+    std::string m_command;
+    std::map<std::string, std::string> m_fields;
+};
+
+
+class ZipIpcConnection
+{
+public:
+    ZipIpcConnection();
+    ~ZipIpcConnection();
+
+    //
+    //   FUNCTION: ZipIpcConnection::Connect
+    //
+    //   PURPOSE: Connect to the server listening on name, waiting up to
+    //   msTimeout milliseconds for a busy pipe. ZR_NOT_FOUND if there is
+    //   no server, ZR_IO_ERROR if the server runs as another user.
+    //
+    ZipResult Connect(const NativePath &name, unsigned msTimeout);
+    void Close();
+
+    ZipResult Send(const ZipIpcMessage &message);
+    ZipResult Receive(ZipIpcMessage *pMessage);
+
+private:
+    ZipIpcConnection(const ZipIpcConnection &);
+    ZipIpcConnection &operator=(const ZipIpcConnection &);
+
+    friend class ZipIpcServer;
+
+    ZipResult WriteAll(const void *pv, size_t cb);
+    ZipResult ReadAll(void *pv, size_t cb);
+
+#ifdef _WIN32
+    HANDLE m_hPipe;
+    HANDLE m_hEvent;
+#else
+    int m_fd;
+#endif
+};
+
+
+class ZipIpcServer
+{
+public:
+    ZipIpcServer();
+    ~ZipIpcServer();
+
+    //
+    //   FUNCTION: ZipIpcServer::Listen
+    //
+    //   PURPOSE: Take ownership of name, for connections from this user
+    //   only. Fails if another server already listens on it; a socket left
+    //   behind by a server that died is replaced.
+    //
+    ZipResult Listen(const NativePath &name);
+
+    //
+    //   FUNCTION: ZipIpcServer::Accept
+    //
+    //   PURPOSE: Wait up to msTimeout milliseconds for a client. Returns
+    //   ZR_STOP if none connected in time.
+    //
+    ZipResult Accept(unsigned msTimeout, ZipIpcConnection *pConnection);
+
+    void Close();
+
+private:
+    ZipIpcServer(const ZipIpcServer &);
+    ZipIpcServer &operator=(const ZipIpcServer &);
+
+    NativePath m_name;
+#ifdef _WIN32
+    ZipResult CreateInstance();
+
+    PSECURITY_DESCRIPTOR m_pSecurity;
+    HANDLE m_hPending;
+    HANDLE m_hEvent;
+    OVERLAPPED m_overlapped;
+    bool m_fConnecting;
+    bool m_fFirst;
+#else
+    int m_fd;
+#endif
+};
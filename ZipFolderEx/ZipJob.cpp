@@ -0,0 +1,237 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipJob.cpp
+Project:      ZipFolderEx
+
+The file implements the background job queue declared in ZipJob.h.
+\***************************************************************************/
+
+#include "ZipJob.h"
+#include <chrono>
+
+
+#ifdef _WIN32
+namespace
+{
+    // What a new queue thread is handed: its queue and the reference on the
+    // module it gives up as it exits.
+    struct WorkerStart
+    {
+        ZipJobQueue *pQueue;
+        HMODULE hModule;
+    };
+}
+#endif
+
+
+#pragma region ZipJob
+
+ZipJob::ZipJob(const NativePath &archivePath, const NativePath &destDir, unsigned cThreads) :
+    m_archivePath(archivePath), m_destDir(destDir), m_cThreads(cThreads),
+    m_state(ZJ_QUEUED), m_result(ZR_OK)
+{
+}
+
+ZipJob::~ZipJob()
+{
+}
+
+ZipJobState ZipJob::State() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_state;
+}
+
+ZipResult ZipJob::Result() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_result;
+}
+
+bool ZipJob::Wait(unsigned msTimeout)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    return m_cvDone.wait_for(lock, std::chrono::milliseconds(msTimeout),
+        [this] { return m_state == ZJ_DONE; });
+}
+
+void ZipJob::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_cvDone.wait(lock, [this] { return m_state == ZJ_DONE; });
+}
+
+ZipResult ZipJob::Run()
+{
+    ZipArchive archive;
+    ZipResult result = archive.Open(m_archivePath);
+    if (result == ZR_OK)
+    {
+        result = Extract(archive);
+    }
+    return result;
+}
+
+ZipResult ZipJob::Extract(ZipArchive &archive, ZipExtractStats *pStats, ZipTracer *pTracer)
+{
+    ZipExtractor extractor(m_destDir, m_cThreads);
+    extractor.SetProgress(&m_progress);
+    extractor.SetCancelToken(&m_cancel);
+    extractor.SetTracer(pTracer);
+    return extractor.Extract(archive, pStats);
+}
+
+void ZipJob::Execute()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_state = ZJ_RUNNING;
+    }
+
+    ZipResult result = IsCancelled() ? ZR_STOP : Run();
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_result = result;
+    }
+    OnComplete();
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_state = ZJ_DONE;
+    }
+    m_cvDone.notify_all();
+}
+
+#pragma endregion
+
+
+#pragma region ZipJobQueue
+
+ZipJobQueue::ZipJobQueue(unsigned cWorkers) :
+    m_cWorkers(cWorkers > 0 ? cWorkers : 1), m_cLive(0)
+{
+}
+
+ZipJobQueue::~ZipJobQueue()
+{
+    CancelAll();
+    WaitIdle();
+}
+
+void ZipJobQueue::Submit(const std::shared_ptr<ZipJob> &job)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_pending.push_back(job);
+    if (m_cLive < m_cWorkers && m_cLive < m_pending.size() + m_running.size())
+    {
+        // Should no thread start, the job waits for the next Submit.
+        m_cLive++;
+        if (!StartWorker())
+        {
+            m_cLive--;
+        }
+    }
+}
+
+void ZipJobQueue::CancelAll()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        m_pending[i]->Cancel();
+    }
+    for (std::list<std::shared_ptr<ZipJob> >::iterator it = m_running.begin();
+        it != m_running.end(); ++it)
+    {
+        (*it)->Cancel();
+    }
+}
+
+void ZipJobQueue::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_cvIdle.wait(lock, [this] { return m_cLive == 0; });
+}
+
+size_t ZipJobQueue::Count() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_pending.size() + m_running.size();
+}
+
+bool ZipJobQueue::IsIdle() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_cLive == 0;
+}
+
+#ifdef _WIN32
+
+bool ZipJobQueue::StartWorker()
+{
+    // The reference is taken here, not by the new thread, since the module
+    // could otherwise be unloaded before that thread first runs.
+    HMODULE hModule = NULL;
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+        reinterpret_cast<LPCWSTR>(&ZipJobQueue::ThreadProc), &hModule))
+    {
+        return false;
+    }
+    WorkerStart *pStart = new WorkerStart;
+    pStart->pQueue = this;
+    pStart->hModule = hModule;
+    HANDLE hThread = CreateThread(NULL, 0, &ZipJobQueue::ThreadProc, pStart, 0, NULL);
+    if (hThread == NULL)
+    {
+        delete pStart;
+        FreeLibrary(hModule);
+        return false;
+    }
+    CloseHandle(hThread);
+    return true;
+}
+
+DWORD WINAPI ZipJobQueue::ThreadProc(LPVOID pv)
+{
+    WorkerStart *pStart = static_cast<WorkerStart *>(pv);
+    ZipJobQueue *pQueue = pStart->pQueue;
+    HMODULE hModule = pStart->hModule;
+    delete pStart;
+    pQueue->WorkerThread();
+
+    // Nothing of the module may run after this, so it is the last call.
+    FreeLibraryAndExitThread(hModule, 0);
+}
+
+#else
+
+bool ZipJobQueue::StartWorker()
+{
+    std::thread(&ZipJobQueue::WorkerThread, this).detach();
+    return true;
+}
+
+#endif
+
+void ZipJobQueue::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_pending.empty())
+    {
+        std::shared_ptr<ZipJob> job = m_pending.front();
+        m_pending.pop_front();
+        m_running.push_back(job);
+        std::list<std::shared_ptr<ZipJob> >::iterator it = --m_running.end();
+
+        lock.unlock();
+        job->Execute();
+        lock.lock();
+        m_running.erase(it);
+    }
+
+    // Exit rather than wait for more work; Submit starts a new thread. The
+    // queue may be destroyed as soon as the lock is released.
+    m_cLive--;
+    m_cvIdle.notify_all();
+}
+
+#pragma endregion
@@ -0,0 +1,157 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipJob.h
+Project:      ZipFolderEx
+
+The file declares background extraction jobs and the queue that runs them.
+
+A ZipJob names an archive and a destination and carries its own progress
+counters and cancellation token. ZipJobQueue runs submitted jobs in order
+on a small number of background threads, so the caller (for example the
+shell's InvokeCommand) returns at once and can watch or cancel the job
+from any thread.
+
+Queue threads are started when there is work and exit when the queue is
+empty, so an idle queue holds no threads. They are detached rather than
+joined; WaitIdle is how to wait for them. That matters in a DLL, which
+must not be unloaded while one is still running, and must not wait for a
+thread under the loader lock. On Windows each queue thread therefore holds
+a reference on the module its code is in, taken before the thread starts
+and given up as the thread exits (FreeLibraryAndExitThread), so a DLL
+stays loaded until its last job has returned. A queue in a DLL must be
+destroyed before the DLL may be unloaded, not by a static destructor.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipExtractor.h"
+#include <memory>
+#include <list>
+#include <deque>
+#include <condition_variable>
+
+
+enum ZipJobState
+{
+    ZJ_QUEUED,
+    ZJ_RUNNING,
+    ZJ_DONE,
+};
+
+
+class ZipJob
+{
+public:
+    ZipJob(const NativePath &archivePath, const NativePath &destDir, unsigned cThreads = 0);
+    virtual ~ZipJob();
+
+    const NativePath &ArchivePath() const { return m_archivePath; }
+    const NativePath &DestDir() const { return m_destDir; }
+
+    // Ask the job to stop. A queued job will not start; a running one
+    // stops before its next entry or block and finishes with ZR_STOP.
+    void Cancel() { m_cancel.Cancel(); }
+    bool IsCancelled() const { return m_cancel.IsCancelled(); }
+
+    ZipJobState State() const;
+
+    // The result once State() is ZJ_DONE.
+    ZipResult Result() const;
+
+    void GetProgress(ZipProgressSnapshot *pSnapshot) const { m_progress.GetSnapshot(pSnapshot); }
+
+    //
+    //   FUNCTION: ZipJob::Wait
+    //
+    //   PURPOSE: Wait up to msTimeout milliseconds for the job to finish.
+    //   Returns true if it has.
+    //
+    bool Wait(unsigned msTimeout);
+    void Wait();
+
+protected:
+    //
+    //   FUNCTION: ZipJob::Run
+    //
+    //   PURPOSE: Do the work on a queue thread. The default opens the
+    //   archive and extracts it with Extract.
+    //
+    virtual ZipResult Run();
+
+    // Called on the queue thread after Run, or instead of it for a job
+    // cancelled before it started. Result() is already set.
+    virtual void OnComplete() {}
+
+    // For a Run that sets up its own extractor.
+    ZipProgress &Progress() { return m_progress; }
+    const ZipCancelToken &CancelToken() const { return m_cancel; }
+
+    // Extract archive into DestDir() with this job's progress and token.
+    ZipResult Extract(ZipArchive &archive, ZipExtractStats *pStats = NULL,
+        ZipTracer *pTracer = NULL);
+
+private:
+    ZipJob(const ZipJob &);
+    ZipJob &operator=(const ZipJob &);
+
+    friend class ZipJobQueue;
+    void Execute();
+
+    NativePath m_archivePath;
+    NativePath m_destDir;
+    unsigned m_cThreads;
+    ZipCancelToken m_cancel;
+    ZipProgress m_progress;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_cvDone;
+    ZipJobState m_state;
+    ZipResult m_result;
+};
+
+
+class ZipJobQueue
+{
+public:
+    //
+    //   FUNCTION: ZipJobQueue::ZipJobQueue
+    //
+    //   PURPOSE: Create a queue that runs up to cWorkers jobs at a time.
+    //   Each job may use several threads of its own for extraction.
+    //
+    explicit ZipJobQueue(unsigned cWorkers = 1);
+
+    // Cancels every job and waits for the running ones to stop.
+    ~ZipJobQueue();
+
+    void Submit(const std::shared_ptr<ZipJob> &job);
+
+    // Cancel every queued and running job.
+    void CancelAll();
+
+    // Wait until no job is queued or running.
+    void WaitIdle();
+
+    // Jobs queued or running.
+    size_t Count() const;
+
+    // True once no job is queued or running and every queue thread is done
+    // with the queue, so that it may be destroyed without waiting.
+    bool IsIdle() const;
+
+private:
+    ZipJobQueue(const ZipJobQueue &);
+    ZipJobQueue &operator=(const ZipJobQueue &);
+
+    bool StartWorker();
+    void WorkerThread();
+#ifdef _WIN32
+    static DWORD WINAPI ThreadProc(LPVOID pv);
+#endif
+
+    unsigned m_cWorkers;
+    mutable std::mutex m_lock;
+    std::condition_variable m_cvIdle;
+    std::deque<std::shared_ptr<ZipJob> > m_pending;
+    std::list<std::shared_ptr<ZipJob> > m_running;
+    unsigned m_cLive;
+};
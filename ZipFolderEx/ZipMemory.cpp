@@ -0,0 +1,228 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipMemory.cpp
+Project:      ZipFolderEx
+
+The file implements the memory budget declared in ZipMemory.h.
+\***************************************************************************/
+
+#include "ZipMemory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+namespace
+{
+    // How often a waiting Reserve looks at its cancel token.
+    const unsigned kWaitPollMs = 100;
+
+    void RaisePeak(std::atomic<uint64_t> &peak, uint64_t value)
+    {
+        uint64_t current = peak.load();
+        while (current < value && !peak.compare_exchange_weak(current, value))
+        {
+        }
+    }
+
+    uint64_t LimitFromEnvironment()
+    {
+        char sz[32];
+#ifdef _WIN32
+        DWORD cch = GetEnvironmentVariableA("ZIPFOLDEREX_MEMORY_MB", sz, sizeof(sz));
+        if (cch == 0 || cch >= sizeof(sz))
+        {
+            return 0;
+        }
+#else
+        const char *psz = getenv("ZIPFOLDEREX_MEMORY_MB");
+        if (psz == NULL || strlen(psz) >= sizeof(sz))
+        {
+            return 0;
+        }
+        strcpy(sz, psz);
+#endif
+        return strtoull(sz, NULL, 10) * 1024 * 1024;
+    }
+
+    ZipMemoryBudget g_processBudget(LimitFromEnvironment());
+}
+
+
+#pragma region ZipMemoryBudget
+
+ZipMemoryBudget::ZipMemoryBudget(uint64_t cbLimit) :
+    m_cbLimit(cbLimit), m_cbUsed(0), m_cbAccounts(0), m_cbPeak(0), m_cWaiters(0)
+{
+}
+
+ZipMemoryBudget &ZipMemoryBudget::Process()
+{
+    return g_processBudget;
+}
+
+bool ZipMemoryBudget::Add(uint64_t cb, bool fForce)
+{
+    uint64_t used = m_cbUsed.load();
+    for (;;)
+    {
+        uint64_t limit = m_cbLimit;
+        if (limit != 0 && used + cb > limit && !(fForce && m_cbAccounts == 0))
+        {
+            return false;
+        }
+        if (m_cbUsed.compare_exchange_weak(used, used + cb))
+        {
+            break;
+        }
+    }
+    RaisePeak(m_cbPeak, used + cb);
+    return true;
+}
+
+void ZipMemoryBudget::Reclaim(uint64_t cbWanted)
+{
+    std::lock_guard<std::mutex> lock(m_reclaimLock);
+    uint64_t cbFreed = 0;
+    for (size_t i = 0; i < m_reclaimers.size() && cbFreed < cbWanted; i++)
+    {
+        cbFreed += m_reclaimers[i]->Reclaim(cbWanted - cbFreed);
+    }
+}
+
+bool ZipMemoryBudget::TryReserve(uint64_t cb)
+{
+    if (Add(cb, false))
+    {
+        return true;
+    }
+    uint64_t limit = m_cbLimit;
+    uint64_t used = m_cbUsed;
+    if (cb > limit)
+    {
+        return false;
+    }
+    if (used + cb > limit)
+    {
+        Reclaim(used + cb - limit);
+    }
+    return Add(cb, false);
+}
+
+bool ZipMemoryBudget::Reserve(uint64_t cb, const ZipCancelToken *pCancel)
+{
+    if (TryReserve(cb))
+    {
+        return true;
+    }
+
+    m_cWaiters++;
+    bool fReserved = false;
+    for (;;)
+    {
+        if (pCancel != NULL && pCancel->IsCancelled())
+        {
+            break;
+        }
+
+        // Caches may have filled up again since the last look. Reclaimers
+        // call Release, which takes the wait lock, so ask them outside it.
+        uint64_t limit = m_cbLimit;
+        uint64_t used = m_cbUsed;
+        if (limit != 0 && used + cb > limit)
+        {
+            Reclaim(used + cb - limit);
+        }
+
+        // Release notifies under the lock after lowering the count, so a
+        // check made under it cannot miss a release.
+        std::unique_lock<std::mutex> lock(m_waitLock);
+        if ((fReserved = Add(cb, true)))
+        {
+            break;
+        }
+        m_cvReleased.wait_for(lock, std::chrono::milliseconds(kWaitPollMs));
+    }
+    m_cWaiters--;
+    return fReserved;
+}
+
+void ZipMemoryBudget::Release(uint64_t cb)
+{
+    m_cbUsed -= cb;
+    if (m_cWaiters > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_waitLock);
+        m_cvReleased.notify_all();
+    }
+}
+
+void ZipMemoryBudget::AddReclaimer(ZipMemoryReclaimer *pReclaimer)
+{
+    std::lock_guard<std::mutex> lock(m_reclaimLock);
+    m_reclaimers.push_back(pReclaimer);
+}
+
+void ZipMemoryBudget::RemoveReclaimer(ZipMemoryReclaimer *pReclaimer)
+{
+    std::lock_guard<std::mutex> lock(m_reclaimLock);
+    m_reclaimers.erase(std::remove(m_reclaimers.begin(), m_reclaimers.end(), pReclaimer),
+        m_reclaimers.end());
+}
+
+#pragma endregion
+
+
+#pragma region ZipMemoryAccount
+
+ZipMemoryAccount::ZipMemoryAccount(ZipMemoryBudget *pBudget) :
+    m_pBudget(pBudget), m_cbUsed(0), m_cbPeak(0)
+{
+}
+
+ZipMemoryAccount::~ZipMemoryAccount()
+{
+    if (m_cbUsed > 0)
+    {
+        Release(m_cbUsed);
+    }
+}
+
+void ZipMemoryAccount::Add(uint64_t cb)
+{
+    m_pBudget->m_cbAccounts += cb;
+    RaisePeak(m_cbPeak, m_cbUsed += cb);
+}
+
+bool ZipMemoryAccount::TryReserve(uint64_t cb)
+{
+    if (!m_pBudget->TryReserve(cb))
+    {
+        return false;
+    }
+    Add(cb);
+    return true;
+}
+
+bool ZipMemoryAccount::Reserve(uint64_t cb, const ZipCancelToken *pCancel)
+{
+    if (!m_pBudget->Reserve(cb, pCancel))
+    {
+        return false;
+    }
+    Add(cb);
+    return true;
+}
+
+void ZipMemoryAccount::Release(uint64_t cb)
+{
+    m_cbUsed -= cb;
+    m_pBudget->m_cbAccounts -= cb;
+    m_pBudget->Release(cb);
+}
+
+#pragma endregion
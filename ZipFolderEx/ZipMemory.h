@@ -0,0 +1,146 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipMemory.h
+Project:      ZipFolderEx
+
+The file declares the memory budget that extraction buffers are reserved
+from.
+
+Each extraction worker, the archive VFS block cache and seek index
+checkpoints, and the service's cache of archive directories hold memory
+that grows with the archive and the number of threads, and on a terminal
+server several extractions run side by side. Rather than cap each of them on its own, all of them reserve
+from one ZipMemoryBudget per process, whose limit comes from the
+ZIPFOLDEREX_MEMORY_MB environment variable (no limit if it is unset).
+
+When a reservation would go over the limit, the budget first asks its
+reclaimers - the caches - to drop data they can read again. If that is not
+enough, TryReserve fails and the caller makes do without: an extractor
+runs fewer workers, a cache keeps less. Reserve instead waits for memory
+to be released, and workers holding spare reservations give them up when
+they see someone waiting. Reserve is granted over the limit when no other
+ZipMemoryAccount holds anything: what the caches keep then is either
+reclaimable or in use by the caller, so a single extraction still runs.
+
+The counts are estimates made by the callers, not measured allocations.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipProgress.h"
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+class ZipMemoryReclaimer
+{
+public:
+    virtual ~ZipMemoryReclaimer() {}
+
+    // Drop up to about cbWanted bytes of data that can be had again and
+    // release them from the budget. Returns the bytes released. Called
+    // without any lock of the budget held.
+    virtual uint64_t Reclaim(uint64_t cbWanted) = 0;
+};
+
+
+class ZipMemoryBudget
+{
+public:
+    // cbLimit 0 means no limit; reservations are still counted.
+    explicit ZipMemoryBudget(uint64_t cbLimit = 0);
+
+    // The budget of this process, limited by ZIPFOLDEREX_MEMORY_MB.
+    static ZipMemoryBudget &Process();
+
+    void SetLimit(uint64_t cbLimit) { m_cbLimit = cbLimit; }
+    uint64_t Limit() const { return m_cbLimit; }
+
+    //
+    //   FUNCTION: ZipMemoryBudget::TryReserve
+    //
+    //   PURPOSE: Reserve cb bytes if they fit under the limit, reclaiming
+    //   cached data to make room if need be. Never waits for other users.
+    //
+    bool TryReserve(uint64_t cb);
+
+    //
+    //   FUNCTION: ZipMemoryBudget::Reserve
+    //
+    //   PURPOSE: Reserve cb bytes, waiting for others to release memory if
+    //   they do not fit. Granted regardless of the limit when no account
+    //   holds any. Returns false only if pCancel is cancelled first.
+    //
+    bool Reserve(uint64_t cb, const ZipCancelToken *pCancel = NULL);
+
+    void Release(uint64_t cb);
+
+    // Whether a call to Reserve is waiting; holders of memory they can do
+    // without should release it.
+    bool HasWaiters() const { return m_cWaiters > 0; }
+
+    uint64_t Used() const { return m_cbUsed; }
+    uint64_t Peak() const { return m_cbPeak; }
+
+    // Reclaimers are asked in the order they were added. A reclaimer must
+    // be removed before it is destroyed.
+    void AddReclaimer(ZipMemoryReclaimer *pReclaimer);
+    void RemoveReclaimer(ZipMemoryReclaimer *pReclaimer);
+
+private:
+    friend class ZipMemoryAccount;
+
+    ZipMemoryBudget(const ZipMemoryBudget &);
+    ZipMemoryBudget &operator=(const ZipMemoryBudget &);
+
+    bool Add(uint64_t cb, bool fForce);
+    void Reclaim(uint64_t cbWanted);
+
+    std::atomic<uint64_t> m_cbLimit;
+    std::atomic<uint64_t> m_cbUsed;
+    std::atomic<uint64_t> m_cbAccounts;     // the part of m_cbUsed held by accounts
+    std::atomic<uint64_t> m_cbPeak;
+    std::atomic<unsigned> m_cWaiters;
+
+    std::mutex m_waitLock;
+    std::condition_variable m_cvReleased;
+
+    // Held while a reclaimer runs, so one being removed is not in use.
+    std::mutex m_reclaimLock;
+    std::vector<ZipMemoryReclaimer *> m_reclaimers;
+};
+
+
+//
+//   CLASS: ZipMemoryAccount
+//
+//   PURPOSE: The reservations of one user of a budget, such as one
+//   extraction, with the peak they reached. Whatever is still reserved is
+//   released when the account is destroyed. Thread safe.
+//
+class ZipMemoryAccount
+{
+public:
+    explicit ZipMemoryAccount(ZipMemoryBudget *pBudget);
+    ~ZipMemoryAccount();
+
+    bool TryReserve(uint64_t cb);
+    bool Reserve(uint64_t cb, const ZipCancelToken *pCancel = NULL);
+    void Release(uint64_t cb);
+
+    ZipMemoryBudget *Budget() const { return m_pBudget; }
+    uint64_t Used() const { return m_cbUsed; }
+    uint64_t Peak() const { return m_cbPeak; }
+
+private:
+    ZipMemoryAccount(const ZipMemoryAccount &);
+    ZipMemoryAccount &operator=(const ZipMemoryAccount &);
+
+    void Add(uint64_t cb);
+
+    ZipMemoryBudget *m_pBudget;
+    std::atomic<uint64_t> m_cbUsed;
+    std::atomic<uint64_t> m_cbPeak;
+};
@@ -0,0 +1,195 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipMetadata.cpp
+Project:      ZipFolderEx
+
+The file implements the metadata restoring declared in ZipMetadata.h.
+\***************************************************************************/
+
+#include "ZipMetadata.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace
+{
+    // FILETIME ticks between 1601 and the Unix epoch.
+    const uint64_t kUnixEpochTicks = 116444736000000000ull;
+
+    // DOS attribute bits worth restoring: read-only, hidden, system and
+    // archive. The rest (directory, volume label) describe the entry.
+    const uint32_t kDosAttributeMask = 0x27;
+    const uint32_t kDosReadOnly = 0x01;
+
+    //
+    //   FUNCTION: DosTimeToTicks
+    //
+    //   PURPOSE: Convert a DOS date and time, which are local time, to
+    //   FILETIME ticks. Returns 0 for a date that cannot be valid.
+    //
+    uint64_t DosTimeToTicks(uint16_t dosDate, uint16_t dosTime)
+    {
+        unsigned day = dosDate & 0x1F;
+        unsigned month = (dosDate >> 5) & 0x0F;
+        if (day == 0 || month == 0 || month > 12)
+        {
+            return 0;
+        }
+#ifdef _WIN32
+        FILETIME local, utc;
+        if (!DosDateTimeToFileTime(dosDate, dosTime, &local) ||
+            !LocalFileTimeToFileTime(&local, &utc))
+        {
+            return 0;
+        }
+        return ((uint64_t)utc.dwHighDateTime << 32) | utc.dwLowDateTime;
+#else
+        // Days since 1970 of the date taken as UTC (the civil calendar
+        // algorithm), then less the local zone's offset at that moment.
+        // mktime would do the same but reads the zone file again on
+        // every call.
+        int year = 1980 + (dosDate >> 9);
+        int y = month <= 2 ? year - 1 : year;
+        int era = y / 400;
+        int yoe = y - era * 400;
+        int doy = (153 * (int)(month + (month > 2 ? -3 : 9)) + 2) / 5 + (int)day - 1;
+        int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        int64_t days = (int64_t)era * 146097 + doe - 719468;
+        int64_t t = days * 86400 + (dosTime >> 11) * 3600 + ((dosTime >> 5) & 0x3F) * 60 +
+            (dosTime & 0x1F) * 2;
+
+        // The offset at the local time read as UTC is right except within
+        // a few hours of a change of offset; the second look settles that.
+        struct tm tm;
+        time_t guess = (time_t)t;
+        if (localtime_r(&guess, &tm) == NULL)
+        {
+            return 0;
+        }
+        guess = (time_t)(t - tm.tm_gmtoff);
+        if (localtime_r(&guess, &tm) == NULL)
+        {
+            return 0;
+        }
+        t -= tm.tm_gmtoff;
+        return (uint64_t)(t * 10000000 + (int64_t)kUnixEpochTicks);
+#endif
+    }
+
+#ifndef _WIN32
+    // A time to leave alone is UTIME_OMIT.
+    void TicksToTimespec(uint64_t ticks, struct timespec *pTime)
+    {
+        if (ticks == 0)
+        {
+            pTime->tv_sec = 0;
+            pTime->tv_nsec = UTIME_OMIT;
+            return;
+        }
+        int64_t t = (int64_t)(ticks - kUnixEpochTicks);
+        int64_t sec = t / 10000000;
+        int64_t rem = t % 10000000;
+        if (rem < 0)
+        {
+            sec--;
+            rem += 10000000;
+        }
+        pTime->tv_sec = (time_t)sec;
+        pTime->tv_nsec = (long)(rem * 100);
+    }
+#endif
+}
+
+
+void GetEntryMetadata(const ZipEntryInfo &entry, ZipFileMetadata *pMetadata)
+{
+    pMetadata->modifiedTime = entry.modifiedTime != 0 ? entry.modifiedTime :
+        DosTimeToTicks(entry.dosDate, entry.dosTime);
+    pMetadata->accessTime = entry.accessTime;
+    pMetadata->creationTime = entry.creationTime;
+
+    pMetadata->attributes = 0;
+    pMetadata->mode = 0;
+    pMetadata->fMode = false;
+    switch (entry.versionMadeBy >> 8)
+    {
+    case ZIP_HOST_UNIX:
+    case ZIP_HOST_OSX:
+        // The high half is st_mode; Info-ZIP also keeps the DOS bits low.
+        if ((entry.externalAttributes >> 16) != 0)
+        {
+            pMetadata->mode = (entry.externalAttributes >> 16) & 0777;
+            pMetadata->fMode = true;
+        }
+        // Fall through.
+    case ZIP_HOST_MSDOS:
+    case ZIP_HOST_NTFS:
+    case ZIP_HOST_VFAT:
+        pMetadata->attributes = entry.externalAttributes & kDosAttributeMask;
+        break;
+    }
+}
+
+ZipResult ApplyMetadata(int dirFd, const NativePath &name, const NativePath &path,
+    bool fDirectory, const ZipFileMetadata &metadata)
+{
+    bool fOk = true;
+#ifdef _WIN32
+    (void)dirFd;
+    (void)name;
+    if (metadata.modifiedTime != 0 || metadata.accessTime != 0 || metadata.creationTime != 0)
+    {
+        // Write-attributes access is granted even on a read-only file.
+        HANDLE hFile = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+            fDirectory ? FILE_FLAG_BACKUP_SEMANTICS : 0, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            return ZR_IO_ERROR;
+        }
+        FILETIME times[3];
+        const uint64_t ticks[3] = { metadata.creationTime, metadata.accessTime,
+            metadata.modifiedTime };
+        for (int i = 0; i < 3; i++)
+        {
+            times[i].dwLowDateTime = (DWORD)ticks[i];
+            times[i].dwHighDateTime = (DWORD)(ticks[i] >> 32);
+        }
+        fOk = SetFileTime(hFile, ticks[0] != 0 ? &times[0] : NULL,
+            ticks[1] != 0 ? &times[1] : NULL, ticks[2] != 0 ? &times[2] : NULL) != FALSE;
+        CloseHandle(hFile);
+    }
+    if (metadata.attributes != 0 && !SetFileAttributesW(path.c_str(), metadata.attributes))
+    {
+        fOk = false;
+    }
+#else
+    (void)fDirectory;
+    int fd = dirFd >= 0 ? dirFd : AT_FDCWD;
+    const char *pszName = dirFd >= 0 ? name.c_str() : path.c_str();
+    if (metadata.modifiedTime != 0 || metadata.accessTime != 0)
+    {
+        struct timespec times[2];
+        TicksToTimespec(metadata.accessTime, &times[0]);
+        TicksToTimespec(metadata.modifiedTime, &times[1]);
+        fOk = utimensat(fd, pszName, times, 0) == 0;
+    }
+
+    // Permissions last: the times can still be set on a read-only file,
+    // but only by its owner, which is us.
+    if (metadata.fMode)
+    {
+        fOk = fchmodat(fd, pszName, (mode_t)metadata.mode, 0) == 0 && fOk;
+    }
+    else if ((metadata.attributes & kDosReadOnly) != 0)
+    {
+        struct stat st;
+        fOk = fstatat(fd, pszName, &st, 0) == 0 &&
+            fchmodat(fd, pszName, st.st_mode & 0555, 0) == 0 && fOk;
+    }
+#endif
+    return fOk ? ZR_OK : ZR_IO_ERROR;
+}
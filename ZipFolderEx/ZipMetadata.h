@@ -0,0 +1,71 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipMetadata.h
+Project:      ZipFolderEx
+
+The file declares the restoring of entry timestamps and attributes.
+
+Setting a file's times as soon as its data is written puts a metadata
+call between every two files' writes, and on some file systems makes the
+cache flush the file early. The extractors instead write all the data
+first and then restore the metadata in one pass of its own, by path (or
+relative to an open directory handle), and directories last of all,
+deepest first: creating a file in a directory changes the directory's
+modified time, and a directory made read-only would refuse its children's
+changes.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+
+
+//
+//   STRUCT: ZipFileMetadata
+//
+//   PURPOSE: What is restored for one file or directory. Times are FILETIME
+//   ticks as in ZipEntryInfo, 0 to leave the time alone.
+//
+struct ZipFileMetadata
+{
+    uint64_t modifiedTime;
+    uint64_t accessTime;
+    uint64_t creationTime;      // Windows only
+
+    // FILE_ATTRIBUTE_READONLY, HIDDEN, SYSTEM and ARCHIVE as stored by a
+    // DOS or Windows archiver. Elsewhere only read-only is honoured.
+    uint32_t attributes;
+
+    // POSIX permission bits from a Unix archiver, and whether there are
+    // any. Set-user-ID and the like are never restored.
+    uint32_t mode;
+    bool fMode;
+
+    ZipFileMetadata() : modifiedTime(0), accessTime(0), creationTime(0), attributes(0),
+        mode(0), fMode(false)
+    {
+    }
+};
+
+
+//
+//   FUNCTION: GetEntryMetadata
+//
+//   PURPOSE: Work out the metadata of an entry: the extra field times if
+//   there are any, else the DOS date and time, which are local time; and
+//   the attributes as the entry's host system stores them.
+//
+void GetEntryMetadata(const ZipEntryInfo &entry, ZipFileMetadata *pMetadata);
+
+
+//
+//   FUNCTION: ApplyMetadata
+//
+//   PURPOSE: Set the times and attributes of the file or directory name in
+//   the directory open as dirFd or, if dirFd is -1 (always on Windows), of
+//   the one at path.
+//
+//   RETURN VALUE: ZR_IO_ERROR if the file system refused; the data is
+//   there either way, so callers treat it as a warning.
+//
+ZipResult ApplyMetadata(int dirFd, const NativePath &name, const NativePath &path,
+    bool fDirectory, const ZipFileMetadata &metadata);
@@ -0,0 +1,663 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipPath.cpp
+Project:      ZipFolderEx
+
+The file implements the entry name conversion and the path set declared
+in ZipPath.h.
+\***************************************************************************/
+
+#include "ZipPath.h"
+#include "ZipCpu.h"
+#include "Crc32.h"
+#include <string.h>
+#include <algorithm>
+
+#ifdef ZIP_CPU_X86
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace
+{
+    // Unicode code points of the upper half of code page 437.
+    const uint16_t kCp437High[128] =
+    {
+        0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+        0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+        0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+        0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+        0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+        0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+        0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+        0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+        0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+        0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+        0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+        0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+        0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+        0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+        0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+        0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+    };
+
+    // Ranges whose upper and lower case letters alternate, upper first.
+    struct AlternatingRange
+    {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    const AlternatingRange kAlternating[] =
+    {
+        { 0x0100, 0x012F }, { 0x0132, 0x0137 }, { 0x0139, 0x0148 }, { 0x014A, 0x0177 },
+        { 0x0179, 0x017E }, { 0x01CD, 0x01DC }, { 0x01DE, 0x01EF }, { 0x01F8, 0x021F },
+        { 0x0222, 0x0233 }, { 0x0246, 0x024F }, { 0x03D8, 0x03EF }, { 0x0460, 0x0481 },
+        { 0x048A, 0x04BF }, { 0x04C1, 0x04CE }, { 0x04D0, 0x052F }, { 0x1E00, 0x1E95 },
+        { 0x1EA0, 0x1EFF }, { 0x2C80, 0x2CE3 }, { 0xA640, 0xA66D }, { 0xA680, 0xA69B },
+        { 0xA722, 0xA72F }, { 0xA732, 0xA76F }, { 0xA77E, 0xA787 }, { 0xA790, 0xA793 },
+        { 0xA796, 0xA7A9 },
+    };
+
+    // Ranges of upper case letters a fixed distance from their lower case.
+    struct OffsetRange
+    {
+        uint32_t first;
+        uint32_t last;
+        int32_t delta;
+    };
+
+    const OffsetRange kOffsets[] =
+    {
+        { 0x0041, 0x005A, 32 },     // Basic Latin
+        { 0x00C0, 0x00D6, 32 },     // Latin-1
+        { 0x00D8, 0x00DE, 32 },
+        { 0x0388, 0x038A, 37 },     // Greek
+        { 0x038E, 0x038F, 63 },
+        { 0x0391, 0x03A1, 32 },
+        { 0x03A3, 0x03AB, 32 },
+        { 0x0400, 0x040F, 80 },     // Cyrillic
+        { 0x0410, 0x042F, 32 },
+        { 0x0531, 0x0556, 48 },     // Armenian
+        { 0x10A0, 0x10C5, 7264 },   // Georgian
+        { 0x1F08, 0x1F0F, -8 },     // Greek Extended
+        { 0x1F18, 0x1F1D, -8 },
+        { 0x1F28, 0x1F2F, -8 },
+        { 0x1F38, 0x1F3F, -8 },
+        { 0x1F48, 0x1F4D, -8 },
+        { 0x1F68, 0x1F6F, -8 },
+        { 0x2160, 0x216F, 16 },     // Roman numerals
+        { 0x24B6, 0x24CF, 26 },     // Circled letters
+        { 0x2C00, 0x2C2F, 48 },     // Glagolitic
+        { 0xFF21, 0xFF3A, 32 },     // Full-width Latin
+        { 0x10400, 0x10427, 40 },   // Deseret
+    };
+
+    uint32_t FoldCodePoint(uint32_t c)
+    {
+        if (c < 0x80)
+        {
+            return c - 'A' < 26u ? c + 32 : c;
+        }
+        for (size_t i = 0; i < sizeof(kOffsets) / sizeof(kOffsets[0]); i++)
+        {
+            if (c >= kOffsets[i].first && c <= kOffsets[i].last)
+            {
+                return (uint32_t)((int32_t)c + kOffsets[i].delta);
+            }
+        }
+        for (size_t i = 0; i < sizeof(kAlternating) / sizeof(kAlternating[0]); i++)
+        {
+            if (c >= kAlternating[i].first && c <= kAlternating[i].last)
+            {
+                return ((c - kAlternating[i].first) & 1) == 0 ? c + 1 : c;
+            }
+        }
+        switch (c)
+        {
+        case 0x00B5: return 0x03BC;     // micro sign
+        case 0x0178: return 0x00FF;
+        case 0x017F: return 0x0073;     // long s
+        case 0x0386: return 0x03AC;
+        case 0x038C: return 0x03CC;
+        case 0x03C2: return 0x03C3;     // final sigma
+        case 0x04C0: return 0x04CF;
+        case 0x1E9E: return 0x00DF;     // capital sharp s
+        case 0x2126: return 0x03C9;     // ohm
+        case 0x212A: return 0x006B;     // kelvin
+        case 0x212B: return 0x00E5;     // angstrom
+        }
+        return c;
+    }
+
+    void AppendUtf8(uint32_t c, std::string *pOut)
+    {
+        if (c < 0x80)
+        {
+            *pOut += (char)c;
+        }
+        else if (c < 0x800)
+        {
+            *pOut += (char)(0xC0 | (c >> 6));
+            *pOut += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            *pOut += (char)(0xE0 | (c >> 12));
+            *pOut += (char)(0x80 | ((c >> 6) & 0x3F));
+            *pOut += (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            *pOut += (char)(0xF0 | (c >> 18));
+            *pOut += (char)(0x80 | ((c >> 12) & 0x3F));
+            *pOut += (char)(0x80 | ((c >> 6) & 0x3F));
+            *pOut += (char)(0x80 | (c & 0x3F));
+        }
+    }
+
+    // Decode the UTF-8 sequence at p, or return 0 if it is not valid.
+    size_t DecodeUtf8(const uint8_t *p, size_t cb, uint32_t *pc)
+    {
+        size_t cbSeq;
+        uint32_t c, min;
+        if (p[0] >= 0xF0 && p[0] < 0xF5)
+        {
+            cbSeq = 4, c = p[0] & 0x07, min = 0x10000;
+        }
+        else if (p[0] >= 0xE0 && p[0] < 0xF0)
+        {
+            cbSeq = 3, c = p[0] & 0x0F, min = 0x800;
+        }
+        else if (p[0] >= 0xC2 && p[0] < 0xE0)
+        {
+            cbSeq = 2, c = p[0] & 0x1F, min = 0x80;
+        }
+        else
+        {
+            return 0;
+        }
+        if (cb < cbSeq)
+        {
+            return 0;
+        }
+        for (size_t i = 1; i < cbSeq; i++)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+            c = (c << 6) | (p[i] & 0x3F);
+        }
+        if (c < min || c > 0x10FFFF || (c >= 0xD800 && c < 0xE000))
+        {
+            return 0;
+        }
+        *pc = c;
+        return cbSeq;
+    }
+
+    // Length of the run of ASCII bytes p starts with.
+    size_t CountAsciiGeneric(const uint8_t *p, size_t cb)
+    {
+        size_t i = 0;
+        while (i < cb && p[i] < 0x80)
+        {
+            i++;
+        }
+        return i;
+    }
+
+    // Widen the run of ASCII bytes p starts with to UTF-16 and return its
+    // length.
+    size_t WidenAsciiGeneric(const uint8_t *p, size_t cb, uint16_t *pOut)
+    {
+        size_t i = 0;
+        for (; i < cb && p[i] < 0x80; i++)
+        {
+            pOut[i] = p[i];
+        }
+        return i;
+    }
+
+#ifdef ZIP_CPU_X86
+    unsigned LowestBit(uint32_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return index;
+#else
+        return __builtin_ctz(bits);
+#endif
+    }
+
+    // The top bit of each byte is set only outside ASCII, which movemask
+    // collects 16 or 32 bytes at a time.
+    ZIP_TARGET("sse2")
+    size_t CountAsciiSse2(const uint8_t *p, size_t cb)
+    {
+        size_t i = 0;
+        for (; i + 16 <= cb; i += 16)
+        {
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+            if (bits != 0)
+            {
+                return i + LowestBit(bits);
+            }
+        }
+        return i + CountAsciiGeneric(p + i, cb - i);
+    }
+
+    ZIP_TARGET("sse2")
+    size_t WidenAsciiSse2(const uint8_t *p, size_t cb, uint16_t *pOut)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= cb; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(p + i));
+            if (_mm_movemask_epi8(bytes) != 0)
+            {
+                break;
+            }
+            _mm_storeu_si128((__m128i *)(pOut + i), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128((__m128i *)(pOut + i + 8), _mm_unpackhi_epi8(bytes, zero));
+        }
+        return i + WidenAsciiGeneric(p + i, cb - i, pOut + i);
+    }
+
+    ZIP_TARGET("avx2")
+    size_t CountAsciiAvx2(const uint8_t *p, size_t cb)
+    {
+        size_t i = 0;
+        for (; i + 32 <= cb; i += 32)
+        {
+            uint32_t bits = (uint32_t)_mm256_movemask_epi8(
+                _mm256_loadu_si256((const __m256i *)(p + i)));
+            if (bits != 0)
+            {
+                return i + LowestBit(bits);
+            }
+        }
+        return i + CountAsciiSse2(p + i, cb - i);
+    }
+
+    ZIP_TARGET("avx2")
+    size_t WidenAsciiAvx2(const uint8_t *p, size_t cb, uint16_t *pOut)
+    {
+        size_t i = 0;
+        for (; i + 16 <= cb; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(p + i));
+            if (_mm_movemask_epi8(bytes) != 0)
+            {
+                break;
+            }
+            _mm256_storeu_si256((__m256i *)(pOut + i), _mm256_cvtepu8_epi16(bytes));
+        }
+        return i + WidenAsciiGeneric(p + i, cb - i, pOut + i);
+    }
+#endif
+
+    typedef size_t (*CountAsciiFunction)(const uint8_t *p, size_t cb);
+    typedef size_t (*WidenAsciiFunction)(const uint8_t *p, size_t cb, uint16_t *pOut);
+
+    struct AsciiFunctions
+    {
+        CountAsciiFunction pfnCountAscii;
+        WidenAsciiFunction pfnWidenAscii;
+    };
+
+    AsciiFunctions ChooseAsciiFunctions()
+    {
+#ifdef ZIP_CPU_X86
+        if (ZipCpu().fAvx2)
+        {
+            AsciiFunctions avx2 = { CountAsciiAvx2, WidenAsciiAvx2 };
+            return avx2;
+        }
+        if (ZipCpu().fSse2)
+        {
+            AsciiFunctions sse2 = { CountAsciiSse2, WidenAsciiSse2 };
+            return sse2;
+        }
+#endif
+        AsciiFunctions generic = { CountAsciiGeneric, WidenAsciiGeneric };
+        return generic;
+    }
+
+    const AsciiFunctions g_ascii = ChooseAsciiFunctions();
+
+    bool IsValidUtf8(const uint8_t *p, size_t cb)
+    {
+        for (size_t i = 0; i < cb; )
+        {
+            i += g_ascii.pfnCountAscii(p + i, cb - i);
+            if (i == cb)
+            {
+                break;
+            }
+            uint32_t c;
+            size_t cbSeq = DecodeUtf8(p + i, cb - i, &c);
+            if (cbSeq == 0)
+            {
+                return false;
+            }
+            i += cbSeq;
+        }
+        return true;
+    }
+
+    // Make a stored name UTF-8 in place. A name that claims to be UTF-8 but
+    // is not was most likely written in the local code page by a tool that
+    // set the flag regardless; code page 437 is the best guess for it too,
+    // and unlike a replacement character it keeps distinct names distinct.
+    void DecodeName(std::string *pName, bool fUtf8)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(pName->data());
+        size_t cb = pName->size();
+        size_t cbAscii = g_ascii.pfnCountAscii(p, cb);
+        if (cbAscii == cb || (fUtf8 && IsValidUtf8(p + cbAscii, cb - cbAscii)))
+        {
+            return;
+        }
+        std::string decoded(*pName, 0, cbAscii);
+        decoded.reserve(cb + (cb - cbAscii) * 2);
+        for (size_t i = cbAscii; i < cb; i++)
+        {
+            if (p[i] < 0x80)
+            {
+                decoded += (char)p[i];
+            }
+            else
+            {
+                AppendUtf8(kCp437High[p[i] - 0x80], &decoded);
+            }
+        }
+        pName->swap(decoded);
+    }
+
+    // The name from an Info-ZIP Unicode path extra field: a version byte
+    // of 1, the CRC-32 of the stored name it stands for, and the name in
+    // UTF-8. A field whose CRC does not match was left behind by a tool
+    // that renamed the entry without knowing about it, and is ignored.
+    bool FindUnicodePath(const uint8_t *pExtra, size_t cbExtra, const std::string &stored,
+        const uint8_t **ppName, size_t *pcbName)
+    {
+        while (cbExtra >= 4)
+        {
+            uint16_t id = ReadLE16(pExtra);
+            size_t cbField = ReadLE16(pExtra + 2);
+            pExtra += 4;
+            cbExtra -= 4;
+            if (cbField > cbExtra)
+            {
+                break;
+            }
+            const uint8_t *p = pExtra;
+            pExtra += cbField;
+            cbExtra -= cbField;
+
+            if (id != ZIP_EXTRA_UNICODE_PATH || cbField <= 5 || p[0] != 1 ||
+                ReadLE32(p + 1) != Crc32Update(0, stored.data(), stored.size()) ||
+                !IsValidUtf8(p + 5, cbField - 5))
+            {
+                continue;
+            }
+            *ppName = p + 5;
+            *pcbName = cbField - 5;
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t HashBytes(const char *p, size_t cb)
+    {
+        uint64_t hash = 0x9E3779B97F4A7C15ull ^ cb;
+        while (cb >= 8)
+        {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            hash = (hash ^ v) * 0xBF58476D1CE4E5B9ull;
+            hash ^= hash >> 31;
+            p += 8;
+            cb -= 8;
+        }
+        uint64_t v = 0;
+        memcpy(&v, p, cb);
+        hash = (hash ^ v) * 0x94D049BB133111EBull;
+        return hash ^ (hash >> 29);
+    }
+}
+
+
+ZipResult NormalizeEntryName(const std::string &name, std::string *pNormalized,
+    bool fAllowEmpty)
+{
+    std::string &out = *pNormalized;
+    out.clear();
+    out.reserve(name.size());
+
+    size_t start = 0;
+    while (start < name.size())
+    {
+        size_t end = name.find_first_of("/\\", start);
+        if (end == std::string::npos)
+        {
+            end = name.size();
+        }
+        size_t cch = end - start;
+        const char *pComponent = name.data() + start;
+        start = end + 1;
+
+        if (cch == 0 || (cch == 1 && pComponent[0] == '.'))
+        {
+            continue;
+        }
+        if (cch == 2 && pComponent[0] == '.' && pComponent[1] == '.')
+        {
+            if (out.empty())
+            {
+                return ZR_BAD_PATH;
+            }
+            size_t sep = out.find_last_of('/');
+            out.resize(sep == std::string::npos ? 0 : sep);
+            continue;
+        }
+
+        if (!out.empty())
+        {
+            out += '/';
+        }
+        out.append(pComponent, cch);
+    }
+    return out.empty() && !fAllowEmpty ? ZR_BAD_PATH : ZR_OK;
+}
+
+ZipResult EntryNameToRelativePath(const ZipEntryInfo &entry, NativePath *pPath)
+{
+    std::string normalized;
+    ZipResult result = NormalizeEntryName(entry.name, &normalized);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // Names read by ZipArchive and ZipStreamReader are UTF-8 already (see
+    // DecodeEntryName); others are in the original IBM PC code page unless
+    // flagged. '/' is the same byte in all of them.
+    DecodeName(&normalized, (entry.flags & ZIP_FLAG_UTF8) != 0);
+
+#ifdef _WIN32
+    if (normalized.find(':') != std::string::npos)
+    {
+        return ZR_BAD_PATH;
+    }
+
+    // Nearly every name is plain ASCII, which widens 16 bytes at a time;
+    // the system converts whatever follows the first other character.
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(normalized.data());
+    size_t cb = normalized.size();
+    pPath->resize(cb);
+    size_t cchAscii = g_ascii.pfnWidenAscii(p, cb, reinterpret_cast<uint16_t *>(&(*pPath)[0]));
+    if (cchAscii < cb)
+    {
+        const char *pRest = normalized.data() + cchAscii;
+        int cbRest = (int)(cb - cchAscii);
+        int cchRest = MultiByteToWideChar(CP_UTF8, 0, pRest, cbRest, NULL, 0);
+        if (cchRest <= 0)
+        {
+            return ZR_BAD_PATH;
+        }
+        pPath->resize(cchAscii + cchRest);
+        MultiByteToWideChar(CP_UTF8, 0, pRest, cbRest, &(*pPath)[cchAscii], cchRest);
+    }
+    for (size_t i = 0; i < pPath->size(); i++)
+    {
+        if ((*pPath)[i] == L'/')
+        {
+            (*pPath)[i] = ZIP_NATIVE_SEPARATOR;
+        }
+    }
+#else
+    pPath->swap(normalized);
+#endif
+    return ZR_OK;
+}
+
+void DecodeEntryName(const uint8_t *pExtra, size_t cbExtra, ZipEntryInfo &entry)
+{
+    const uint8_t *pUnicode;
+    size_t cbUnicode;
+    entry.cbStoredName = (uint16_t)entry.name.size();
+    if (FindUnicodePath(pExtra, cbExtra, entry.name, &pUnicode, &cbUnicode))
+    {
+        entry.name.assign((const char *)pUnicode, cbUnicode);
+    }
+    else
+    {
+        DecodeName(&entry.name, (entry.flags & ZIP_FLAG_UTF8) != 0);
+    }
+    entry.flags |= ZIP_FLAG_UTF8;
+}
+
+void AppendFoldedName(const std::string &name, bool fUtf8, std::string *pFolded)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(name.data());
+    size_t cb = name.size();
+    for (size_t i = 0; i < cb; )
+    {
+        uint8_t b = p[i];
+        if (b < 0x80)
+        {
+            *pFolded += (char)((unsigned)(b - 'A') < 26u ? b + 32 : b);
+            i++;
+            continue;
+        }
+
+        uint32_t c;
+        size_t cbSeq = 1;
+        if (!fUtf8)
+        {
+            c = kCp437High[b - 0x80];
+        }
+        else if ((cbSeq = DecodeUtf8(p + i, cb - i, &c)) == 0)
+        {
+            *pFolded += (char)b;
+            i++;
+            continue;
+        }
+        AppendUtf8(FoldCodePoint(c), pFolded);
+        i += cbSeq;
+    }
+}
+
+
+#pragma region ZipPathSet
+
+ZipPathSet::ZipPathSet(bool fIgnoreCase) : m_fIgnoreCase(fIgnoreCase)
+{
+}
+
+void ZipPathSet::Reserve(size_t cNames, size_t cbNames)
+{
+    m_names.reserve(cNames);
+    m_buffer.reserve(cbNames);
+    size_t cSlots = 16;
+    while (cSlots < cNames * 2)
+    {
+        cSlots *= 2;
+    }
+    if (cSlots > m_slots.size())
+    {
+        m_slots.resize(cSlots);
+        Grow();
+    }
+}
+
+void ZipPathSet::Clear()
+{
+    m_buffer.clear();
+    m_names.clear();
+    std::fill(m_slots.begin(), m_slots.end(), 0);
+}
+
+bool ZipPathSet::Insert(const std::string &normalized, bool fUtf8)
+{
+    const std::string *pKey = &normalized;
+    if (m_fIgnoreCase)
+    {
+        m_folded.clear();
+        AppendFoldedName(normalized, fUtf8, &m_folded);
+        pKey = &m_folded;
+    }
+    uint64_t hash = HashBytes(pKey->data(), pKey->size());
+
+    // Keep the table at most half full.
+    if ((m_names.size() + 1) * 2 > m_slots.size())
+    {
+        m_slots.resize(m_slots.empty() ? 16 : m_slots.size() * 2);
+        Grow();
+    }
+
+    size_t mask = m_slots.size() - 1;
+    for (size_t slot = (size_t)hash & mask; ; slot = (slot + 1) & mask)
+    {
+        uint32_t index = m_slots[slot];
+        if (index == 0)
+        {
+            Name name = { hash, m_buffer.size(), pKey->size() };
+            m_buffer += *pKey;
+            m_names.push_back(name);
+            m_slots[slot] = (uint32_t)m_names.size();
+            return true;
+        }
+        const Name &other = m_names[index - 1];
+        if (other.hash == hash && other.cb == pKey->size() &&
+            memcmp(m_buffer.data() + other.offset, pKey->data(), other.cb) == 0)
+        {
+            return false;
+        }
+    }
+}
+
+void ZipPathSet::Grow()
+{
+    // m_slots has its new size; place every name again.
+    std::fill(m_slots.begin(), m_slots.end(), 0);
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = 0; i < m_names.size(); i++)
+    {
+        size_t slot = (size_t)m_names[i].hash & mask;
+        while (m_slots[slot] != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+        m_slots[slot] = (uint32_t)(i + 1);
+    }
+}
+
+#pragma endregion
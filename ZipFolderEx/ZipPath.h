@@ -0,0 +1,111 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipPath.h
+Project:      ZipFolderEx
+
+The file declares the conversion of archive entry names into relative
+output paths in the native encoding, and the set used to find entries that
+would be written to the same file.
+
+Two names can reach one file without being equal: "a//b", "a/./b",
+"x/../a/b" and "a\b" all name a/b, and on a case-insensitive file system
+(NTFS as Windows uses it) so does "A/B". ZipPathSet holds names in their
+normalised, optionally case-folded, form in a hash set over one shared
+buffer, so finding every such collision in a million entries is a single
+linear pass with no file system calls.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+
+
+//
+//   FUNCTION: NormalizeEntryName
+//
+//   PURPOSE: Put an entry name in canonical form: components separated by
+//   single '/', empty and "." components dropped, and each ".." removing
+//   the component before it.
+//
+//   RETURN VALUE: ZR_BAD_PATH if a ".." would climb above the top, since
+//   extracting it would write outside the destination ("zip slip"), or if
+//   nothing remains, unless fAllowEmpty: then a name of the top itself
+//   normalises to "".
+//
+ZipResult NormalizeEntryName(const std::string &name, std::string *pNormalized,
+    bool fAllowEmpty = false);
+
+
+//
+//   FUNCTION: EntryNameToRelativePath
+//
+//   PURPOSE: Turn an entry name into a path relative to the destination
+//   directory. Both '/' and '\' separate components; the name is
+//   normalised as by NormalizeEntryName.
+//
+//   RETURN VALUE: ZR_BAD_PATH if the name cannot be normalised or, on
+//   Windows, contains a colon, which would name a drive or a stream.
+//
+ZipResult EntryNameToRelativePath(const ZipEntryInfo &entry, NativePath *pPath);
+
+
+//
+//   FUNCTION: DecodeEntryName
+//
+//   PURPOSE: Replace the name of an entry, as stored in its header, with
+//   its UTF-8 form, set ZIP_FLAG_UTF8 to say so and keep the stored length
+//   in cbStoredName. The Info-ZIP Unicode path extra field gives the name
+//   if it has one for the stored name; otherwise the stored name is UTF-8
+//   if the entry is flagged so and valid, and code page 437 if not. Names
+//   that are all ASCII, nearly all of them, are recognized 16 or 32 bytes
+//   at a time and left in place.
+//
+void DecodeEntryName(const uint8_t *pExtra, size_t cbExtra, ZipEntryInfo &entry);
+
+
+//
+//   FUNCTION: AppendFoldedName
+//
+//   PURPOSE: Append the case folding of name to pFolded, as UTF-8. The
+//   name is UTF-8 if fUtf8 is set and code page 437 otherwise, as in the
+//   ZIP_FLAG_UTF8 flag. Folding is the Unicode simple (one to one) kind,
+//   which is what NTFS compares by, for Latin, Greek, Cyrillic, Armenian,
+//   Georgian and the full-width forms. Invalid UTF-8 is copied unchanged.
+//
+void AppendFoldedName(const std::string &name, bool fUtf8, std::string *pFolded);
+
+
+class ZipPathSet
+{
+public:
+    // With fIgnoreCase, names that differ only in case are equal.
+    explicit ZipPathSet(bool fIgnoreCase);
+
+    void Reserve(size_t cNames, size_t cbNames);
+
+    //
+    //   FUNCTION: ZipPathSet::Insert
+    //
+    //   PURPOSE: Add a normalised name (fUtf8 as for AppendFoldedName).
+    //   Returns false if an equal name is already in the set.
+    //
+    bool Insert(const std::string &normalized, bool fUtf8);
+
+    size_t Count() const { return m_names.size(); }
+    void Clear();
+
+private:
+    struct Name
+    {
+        uint64_t hash;
+        size_t offset;
+        size_t cb;
+    };
+
+    void Grow();
+
+    bool m_fIgnoreCase;
+    std::string m_buffer;               // every name, back to back
+    std::vector<Name> m_names;
+    std::vector<uint32_t> m_slots;      // index into m_names + 1, 0 if free
+    std::string m_folded;
+};
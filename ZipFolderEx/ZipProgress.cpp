@@ -0,0 +1,59 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipProgress.cpp
+Project:      ZipFolderEx
+
+The file implements the progress counters declared in ZipProgress.h.
+\***************************************************************************/
+
+#include "ZipProgress.h"
+#include "ZipStats.h"
+
+
+ZipProgress::ZipProgress() :
+    m_cEntriesDone(0), m_cEntriesTotal(0), m_cbDone(0), m_cbTotal(0), m_start(0)
+{
+}
+
+void ZipProgress::Begin(uint64_t cEntries, uint64_t cbTotal)
+{
+    m_cEntriesDone.store(0, std::memory_order_relaxed);
+    m_cbDone.store(0, std::memory_order_relaxed);
+    m_cEntriesTotal.store(cEntries, std::memory_order_relaxed);
+    m_cbTotal.store(cbTotal, std::memory_order_relaxed);
+    m_start.store(ZipStatsNow(), std::memory_order_relaxed);
+}
+
+void ZipProgress::GetSnapshot(ZipProgressSnapshot *pSnapshot) const
+{
+    pSnapshot->cEntriesDone = m_cEntriesDone.load(std::memory_order_relaxed);
+    pSnapshot->cEntriesTotal = m_cEntriesTotal.load(std::memory_order_relaxed);
+    pSnapshot->cbDone = m_cbDone.load(std::memory_order_relaxed);
+    pSnapshot->cbTotal = m_cbTotal.load(std::memory_order_relaxed);
+
+    uint64_t start = m_start.load(std::memory_order_relaxed);
+    pSnapshot->elapsedSeconds = start != 0 ? (double)(ZipStatsNow() - start) / 1e9 : 0.0;
+
+    double done, total;
+    if (pSnapshot->cbTotal > 0)
+    {
+        done = (double)pSnapshot->cbDone;
+        total = (double)pSnapshot->cbTotal;
+    }
+    else
+    {
+        done = (double)pSnapshot->cEntriesDone;
+        total = (double)pSnapshot->cEntriesTotal;
+    }
+
+    pSnapshot->fraction = total > 0 ? done / total : 0.0;
+    if (pSnapshot->fraction > 1.0)
+    {
+        pSnapshot->fraction = 1.0;
+    }
+    pSnapshot->etaSeconds = -1.0;
+    if (done > 0 && pSnapshot->elapsedSeconds > 0)
+    {
+        double remaining = total > done ? total - done : 0.0;
+        pSnapshot->etaSeconds = pSnapshot->elapsedSeconds * remaining / done;
+    }
+}
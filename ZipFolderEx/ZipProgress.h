@@ -0,0 +1,84 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipProgress.h
+Project:      ZipFolderEx
+
+The file declares the cancellation token and progress counters shared
+between an extraction and whoever started it.
+
+ZipCancelToken is a flag the owner sets and the extractor polls before
+each entry and each block of output, so a cancelled job stops within one
+block. ZipProgress is a set of atomic counters the extractor bumps as it
+goes; any thread can take a snapshot with a completion estimate at any
+time without stopping the workers.
+\***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+
+class ZipCancelToken
+{
+public:
+    ZipCancelToken() : m_fCancelled(false) {}
+
+    void Cancel() { m_fCancelled.store(true, std::memory_order_relaxed); }
+    void Reset() { m_fCancelled.store(false, std::memory_order_relaxed); }
+    bool IsCancelled() const { return m_fCancelled.load(std::memory_order_relaxed); }
+
+private:
+    ZipCancelToken(const ZipCancelToken &);
+    ZipCancelToken &operator=(const ZipCancelToken &);
+
+    std::atomic<bool> m_fCancelled;
+};
+
+
+struct ZipProgressSnapshot
+{
+    uint64_t cEntriesDone;
+    uint64_t cEntriesTotal;
+    uint64_t cbDone;
+    uint64_t cbTotal;
+    double elapsedSeconds;
+    double fraction;            // 0 to 1
+    double etaSeconds;          // negative until there is enough to go on
+};
+
+
+class ZipProgress
+{
+public:
+    ZipProgress();
+
+    //
+    //   FUNCTION: ZipProgress::Begin
+    //
+    //   PURPOSE: Reset the counters and start the clock for a job of
+    //   cEntries entries expanding to cbTotal bytes.
+    //
+    void Begin(uint64_t cEntries, uint64_t cbTotal);
+
+    void AddEntry() { m_cEntriesDone.fetch_add(1, std::memory_order_relaxed); }
+    void AddBytes(uint64_t cb) { m_cbDone.fetch_add(cb, std::memory_order_relaxed); }
+
+    //
+    //   FUNCTION: ZipProgress::GetSnapshot
+    //
+    //   PURPOSE: Read the counters. The estimate assumes the bytes still
+    //   to come are written at the average rate so far; for a job that
+    //   is all empty files it goes by entries instead.
+    //
+    void GetSnapshot(ZipProgressSnapshot *pSnapshot) const;
+
+private:
+    ZipProgress(const ZipProgress &);
+    ZipProgress &operator=(const ZipProgress &);
+
+    std::atomic<uint64_t> m_cEntriesDone;
+    std::atomic<uint64_t> m_cEntriesTotal;
+    std::atomic<uint64_t> m_cbDone;
+    std::atomic<uint64_t> m_cbTotal;
+    std::atomic<uint64_t> m_start;
+};
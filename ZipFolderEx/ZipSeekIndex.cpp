@@ -0,0 +1,666 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipSeekIndex.cpp
+Project:      ZipFolderEx
+
+The file implements the checkpoint index declared in ZipSeekIndex.h.
+
+Cache file layout (all fields little-endian):
+
+  header:   "ZFXI", u32 version, u64 archive size, u32 entry count
+  entry:    u32 index, u32 crc, u64 compressed size, u64 uncompressed
+            size, u64 local header offset, u32 checkpoint count
+  point:    u64 output offset, u64 input bit offset, u32 window size,
+            window bytes
+  trailer:  "ZFXE"
+\***************************************************************************/
+
+#include "ZipSeekIndex.h"
+#include "Crc32.h"
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+const uint64_t ZipSeekIndex::kDefaultSpan;
+
+namespace
+{
+    const uint32_t kCacheMagic = 0x4958465A;     // "ZFXI"
+    const uint32_t kCacheTrailer = 0x4558465A;   // "ZFXE"
+    const uint32_t kCacheVersion = 1;
+    const size_t kMaxWindow = 32768;
+
+    // Each checkpoint keeps a whole window, so an entry gets at most this
+    // many, 32 MB of windows, however large it is: past kMaxCheckpoints
+    // spans the span grows with the entry instead.
+    const uint64_t kMaxCheckpoints = 1024;
+
+    // Smaller than the extractor's buffer: a read from a checkpoint decodes
+    // at most one span, and many of them may run at once.
+    const size_t kReadBuffer = 64 * 1024;
+
+    NativePath CachePath(const NativePath &archivePath)
+    {
+#ifdef _WIN32
+        return archivePath + L".zfxidx";
+#else
+        return archivePath + ".zfxidx";
+#endif
+    }
+
+    // Where Save writes before renaming over the cache, unique to the
+    // process so that two saving at once do not write into one file.
+    NativePath TempCachePath(const NativePath &archivePath)
+    {
+#ifdef _WIN32
+        return CachePath(archivePath) + L"." + std::to_wstring(GetCurrentProcessId()) +
+            L".tmp";
+#else
+        return CachePath(archivePath) + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    }
+
+    // What a checkpoint is reserved from the budget for.
+    uint64_t CheckpointCost(size_t cbWindow)
+    {
+        return sizeof(ZipSeekIndex::Checkpoint) + cbWindow;
+    }
+
+    // Records a checkpoint at the first block boundary past each span that
+    // the budget has room for.
+    class CheckpointObserver : public InflateObserver
+    {
+    public:
+        CheckpointObserver(std::vector<ZipSeekIndex::Checkpoint> &points,
+            uint64_t span, ZipMemoryBudget *pBudget) : m_points(points), m_span(span),
+            m_pBudget(pBudget), m_cbReserved(0)
+        {
+        }
+
+        virtual void OnBlockBoundary(uint64_t inBit, uint64_t out,
+            const uint8_t *pWindow, size_t cbWindow)
+        {
+            if (out - m_points.back().out < m_span)
+            {
+                return;
+            }
+            if (m_pBudget != NULL && !m_pBudget->TryReserve(CheckpointCost(cbWindow)))
+            {
+                return;     // tried again at the next boundary
+            }
+            m_cbReserved += CheckpointCost(cbWindow);
+            m_points.push_back(ZipSeekIndex::Checkpoint());
+            ZipSeekIndex::Checkpoint &point = m_points.back();
+            point.out = out;
+            point.inBit = inBit;
+            point.window.assign(pWindow, pWindow + cbWindow);
+        }
+
+        uint64_t Reserved() const { return m_cbReserved; }
+
+    private:
+        std::vector<ZipSeekIndex::Checkpoint> &m_points;
+        uint64_t m_span;
+        ZipMemoryBudget *m_pBudget;
+        uint64_t m_cbReserved;
+    };
+
+    class CrcSink : public InflateSink
+    {
+    public:
+        CrcSink() : m_crc(0) {}
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            m_crc = Crc32Update(m_crc, pb, cb);
+            return ZR_OK;
+        }
+
+        uint32_t Crc() const { return m_crc; }
+
+    private:
+        uint32_t m_crc;
+    };
+
+    // Discards output up to the requested offset and passes the rest on.
+    class SkipSink : public InflateSink
+    {
+    public:
+        SkipSink(uint64_t cbSkip, InflateSink &target) : m_cbSkip(cbSkip),
+            m_target(target)
+        {
+        }
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            if (m_cbSkip >= cb)
+            {
+                m_cbSkip -= cb;
+                return ZR_OK;
+            }
+            pb += m_cbSkip;
+            cb -= (size_t)m_cbSkip;
+            m_cbSkip = 0;
+            return m_target.Write(pb, cb);
+        }
+
+    private:
+        uint64_t m_cbSkip;
+        InflateSink &m_target;
+    };
+
+    // Copies output into a caller buffer and stops the decoder when full.
+    class CopySink : public InflateSink
+    {
+    public:
+        CopySink(uint8_t *pDest, size_t cbDest) : m_pDest(pDest),
+            m_cbLeft(cbDest), m_cbCopied(0)
+        {
+        }
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            size_t cbCopy = std::min(cb, m_cbLeft);
+            memcpy(m_pDest + m_cbCopied, pb, cbCopy);
+            m_cbCopied += cbCopy;
+            m_cbLeft -= cbCopy;
+            return m_cbLeft == 0 ? ZR_STOP : ZR_OK;
+        }
+
+        size_t Copied() const { return m_cbCopied; }
+
+    private:
+        uint8_t *m_pDest;
+        size_t m_cbLeft;
+        size_t m_cbCopied;
+    };
+
+    bool IsSupported(const ZipEntryInfo &entry)
+    {
+        return (entry.flags & (ZIP_FLAG_ENCRYPTED | ZIP_FLAG_STRONG_ENCRYPTION)) == 0 &&
+            (entry.method == ZIP_METHOD_STORED || entry.method == ZIP_METHOD_DEFLATED);
+    }
+
+    void PutLE32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out.push_back((uint8_t)(value >> (i * 8)));
+        }
+    }
+
+    void PutLE64(std::vector<uint8_t> &out, uint64_t value)
+    {
+        PutLE32(out, (uint32_t)value);
+        PutLE32(out, (uint32_t)(value >> 32));
+    }
+
+    ZipResult GetLE32(BufferedReader &in, uint32_t *pValue)
+    {
+        uint8_t b[4];
+        ZipResult result = in.ReadExact(b, sizeof(b));
+        *pValue = ReadLE32(b);
+        return result;
+    }
+
+    ZipResult GetLE64(BufferedReader &in, uint64_t *pValue)
+    {
+        uint8_t b[8];
+        ZipResult result = in.ReadExact(b, sizeof(b));
+        *pValue = ReadLE64(b);
+        return result;
+    }
+}
+
+
+ZipSeekIndex::ZipSeekIndex(ZipArchive *pArchive, uint64_t span, ZipMemoryBudget *pBudget) :
+    m_pArchive(pArchive), m_span(std::max<uint64_t>(span, kMaxWindow)), m_pBudget(pBudget),
+    m_fDirty(false)
+{
+    if (m_pBudget != NULL)
+    {
+        m_pBudget->AddReclaimer(this);
+    }
+}
+
+ZipSeekIndex::~ZipSeekIndex()
+{
+    if (m_pBudget != NULL)
+    {
+        m_pBudget->RemoveReclaimer(this);
+    }
+    if (m_fDirty)
+    {
+        Save();
+    }
+    for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        ReleaseMemory(it->second->cbReserved);
+    }
+    for (size_t i = 0; i < m_inflaters.size(); i++)
+    {
+        delete m_inflaters[i];
+    }
+}
+
+void ZipSeekIndex::ReleaseMemory(uint64_t cb)
+{
+    if (m_pBudget != NULL && cb > 0)
+    {
+        m_pBudget->Release(cb);
+    }
+}
+
+uint64_t ZipSeekIndex::Reclaim(uint64_t cbWanted)
+{
+    // The largest first: they free the most for the fewest entries to
+    // build again. Dropped here, freed once no reader has them.
+    std::vector<std::shared_ptr<const EntryIndex> > dropped;
+    uint64_t cbFreed = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        while (cbFreed < cbWanted)
+        {
+            EntryMap::iterator largest = m_entries.end();
+            for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+            {
+                if (it->second->cbReserved > 0 && (largest == m_entries.end() ||
+                    it->second->cbReserved > largest->second->cbReserved))
+                {
+                    largest = it;
+                }
+            }
+            if (largest == m_entries.end())
+            {
+                break;
+            }
+            cbFreed += largest->second->cbReserved;
+            dropped.push_back(largest->second);
+            m_entries.erase(largest);
+        }
+    }
+    ReleaseMemory(cbFreed);
+    return cbFreed;
+}
+
+bool ZipSeekIndex::Matches(const EntryIndex &entryIndex, const ZipEntryInfo &entry) const
+{
+    return entryIndex.crc32 == entry.crc32 &&
+        entryIndex.compressedSize == entry.compressedSize &&
+        entryIndex.uncompressedSize == entry.uncompressedSize &&
+        entryIndex.localHeaderOffset == entry.localHeaderOffset;
+}
+
+void ZipSeekIndex::Load()
+{
+    if (m_pArchive->Path().empty())
+    {
+        return;
+    }
+    NativeFile file;
+    if (file.OpenRead(CachePath(m_pArchive->Path())) != ZR_OK)
+    {
+        return;
+    }
+
+    BufferedReader in(&file, kReadBuffer);
+    uint32_t magic = 0, version = 0, cEntries = 0;
+    uint64_t cbArchive = 0;
+    if (GetLE32(in, &magic) != ZR_OK || magic != kCacheMagic ||
+        GetLE32(in, &version) != ZR_OK || version != kCacheVersion ||
+        GetLE64(in, &cbArchive) != ZR_OK || cbArchive != m_pArchive->ArchiveSize() ||
+        GetLE32(in, &cEntries) != ZR_OK || cEntries != m_pArchive->EntryCount())
+    {
+        return;
+    }
+
+    // Parse everything before adding any of it, so that a damaged file
+    // does not leave half an index behind.
+    std::map<size_t, EntryIndex> loaded;
+    for (;;)
+    {
+        uint32_t index = 0;
+        if (GetLE32(in, &index) != ZR_OK)
+        {
+            return;
+        }
+        if (index == kCacheTrailer)
+        {
+            break;
+        }
+
+        EntryIndex entryIndex;
+        entryIndex.cbReserved = 0;
+        uint32_t cPoints = 0;
+        if (index >= cEntries ||
+            GetLE32(in, &entryIndex.crc32) != ZR_OK ||
+            GetLE64(in, &entryIndex.compressedSize) != ZR_OK ||
+            GetLE64(in, &entryIndex.uncompressedSize) != ZR_OK ||
+            GetLE64(in, &entryIndex.localHeaderOffset) != ZR_OK ||
+            GetLE32(in, &cPoints) != ZR_OK || cPoints == 0 || cPoints > kMaxCheckpoints ||
+            cPoints > entryIndex.uncompressedSize / kMaxWindow + 1)
+        {
+            return;
+        }
+
+        entryIndex.points.resize(cPoints);
+        for (uint32_t i = 0; i < cPoints; i++)
+        {
+            Checkpoint &point = entryIndex.points[i];
+            uint32_t cbWindow = 0;
+            if (GetLE64(in, &point.out) != ZR_OK ||
+                GetLE64(in, &point.inBit) != ZR_OK ||
+                GetLE32(in, &cbWindow) != ZR_OK || cbWindow > kMaxWindow ||
+                point.inBit / 8 > entryIndex.compressedSize ||
+                (i == 0 && (point.out != 0 || point.inBit != 0)) ||
+                (i > 0 && point.out <= entryIndex.points[i - 1].out))
+            {
+                return;
+            }
+            point.window.resize(cbWindow);
+            if (cbWindow > 0 && in.ReadExact(&point.window[0], cbWindow) != ZR_OK)
+            {
+                return;
+            }
+        }
+
+        if (Matches(entryIndex, m_pArchive->Entry(index)))
+        {
+            std::swap(loaded[index], entryIndex);
+        }
+    }
+
+    // Reserved an entry at a time; one the budget has no room for is
+    // built again when it is read.
+    for (std::map<size_t, EntryIndex>::iterator it = loaded.begin(); it != loaded.end(); ++it)
+    {
+        uint64_t cbReserve = 0;
+        for (size_t i = 0; i < it->second.points.size(); i++)
+        {
+            cbReserve += CheckpointCost(it->second.points[i].window.size());
+        }
+        if (m_pBudget != NULL && !m_pBudget->TryReserve(cbReserve))
+        {
+            continue;
+        }
+        it->second.cbReserved = cbReserve;
+        std::shared_ptr<EntryIndex> pIndex = std::make_shared<EntryIndex>();
+        std::swap(*pIndex, it->second);
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_entries.insert(std::make_pair(it->first, pIndex)).second)
+        {
+            ReleaseMemory(cbReserve);
+        }
+    }
+}
+
+ZipResult ZipSeekIndex::Save()
+{
+    if (m_pArchive->Path().empty())
+    {
+        return ZR_OK;
+    }
+
+    std::vector<uint8_t> data;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        PutLE32(data, kCacheMagic);
+        PutLE32(data, kCacheVersion);
+        PutLE64(data, m_pArchive->ArchiveSize());
+        PutLE32(data, (uint32_t)m_pArchive->EntryCount());
+
+        EntryMap::const_iterator it;
+        for (it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            // Entries within a single span are cheap to decode and have
+            // nothing worth caching.
+            const EntryIndex &entryIndex = *it->second;
+            if (entryIndex.points.size() < 2)
+            {
+                continue;
+            }
+            PutLE32(data, (uint32_t)it->first);
+            PutLE32(data, entryIndex.crc32);
+            PutLE64(data, entryIndex.compressedSize);
+            PutLE64(data, entryIndex.uncompressedSize);
+            PutLE64(data, entryIndex.localHeaderOffset);
+            PutLE32(data, (uint32_t)entryIndex.points.size());
+            for (size_t i = 0; i < entryIndex.points.size(); i++)
+            {
+                const Checkpoint &point = entryIndex.points[i];
+                PutLE64(data, point.out);
+                PutLE64(data, point.inBit);
+                PutLE32(data, (uint32_t)point.window.size());
+                data.insert(data.end(), point.window.begin(), point.window.end());
+            }
+        }
+        PutLE32(data, kCacheTrailer);
+        m_fDirty = false;
+    }
+
+    // Written aside and renamed over the old cache, so that a save cut
+    // short leaves the old cache or none, never half of one.
+    NativePath tempPath = TempCachePath(m_pArchive->Path());
+    NativeFile file;
+    ZipResult result = file.Create(tempPath);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    result = file.Write(&data[0], data.size());
+    file.Close();
+    if (result == ZR_OK)
+    {
+        result = RenameFile(tempPath, CachePath(m_pArchive->Path()));
+    }
+    if (result != ZR_OK)
+    {
+        RemoveFile(tempPath);
+    }
+    return result;
+}
+
+Inflater *ZipSeekIndex::AcquireInflater()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_inflaters.empty())
+        {
+            Inflater *pInflater = m_inflaters.back();
+            m_inflaters.pop_back();
+            return pInflater;
+        }
+    }
+    return new Inflater();
+}
+
+void ZipSeekIndex::ReleaseInflater(Inflater *pInflater)
+{
+    pInflater->SetObserver(NULL);
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_inflaters.push_back(pInflater);
+}
+
+ZipResult ZipSeekIndex::BuildEntry(size_t index)
+{
+    std::shared_ptr<const EntryIndex> pIndex;
+    return GetEntryIndex(index, &pIndex);
+}
+
+ZipResult ZipSeekIndex::GetEntryIndex(size_t index, std::shared_ptr<const EntryIndex> *pIndex)
+{
+    const ZipEntryInfo &entry = m_pArchive->Entry(index);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        EntryMap::const_iterator it = m_entries.find(index);
+        if (it != m_entries.end())
+        {
+            *pIndex = it->second;
+            return ZR_OK;
+        }
+    }
+
+    std::shared_ptr<EntryIndex> pBuilt = std::make_shared<EntryIndex>();
+    EntryIndex &entryIndex = *pBuilt;
+    entryIndex.cbReserved = 0;
+    entryIndex.crc32 = entry.crc32;
+    entryIndex.compressedSize = entry.compressedSize;
+    entryIndex.uncompressedSize = entry.uncompressedSize;
+    entryIndex.localHeaderOffset = entry.localHeaderOffset;
+    entryIndex.points.resize(1);
+    entryIndex.points[0].out = 0;
+    entryIndex.points[0].inBit = 0;
+
+    // Small entries are decoded from the start on every read.
+    if (entry.uncompressedSize > m_span)
+    {
+        uint64_t dataOffset;
+        ZipResult result = m_pArchive->GetDataOffset(index, &dataOffset);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+
+        RangeInputStream range(m_pArchive->Source(), dataOffset, entry.compressedSize);
+        BufferedReader reader(&range);
+        uint64_t span = std::max(m_span,
+            (entry.uncompressedSize + kMaxCheckpoints - 1) / kMaxCheckpoints);
+        CheckpointObserver observer(entryIndex.points, span, m_pBudget);
+        CrcSink sink;
+
+        Inflater *pInflater = AcquireInflater();
+        pInflater->SetObserver(&observer);
+        result = pInflater->Inflate(reader, sink);
+        uint64_t cbOut = pInflater->TotalOut();
+        ReleaseInflater(pInflater);
+        entryIndex.cbReserved = observer.Reserved();
+
+        if (result == ZR_OK &&
+            (cbOut != entry.uncompressedSize || sink.Crc() != entry.crc32))
+        {
+            result = ZR_CRC_MISMATCH;
+        }
+        if (result != ZR_OK)
+        {
+            ReleaseMemory(entryIndex.cbReserved);
+            return result;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::pair<EntryMap::iterator, bool> inserted =
+        m_entries.insert(std::make_pair(index, pBuilt));
+    if (inserted.second)
+    {
+        m_fDirty = m_fDirty || entryIndex.points.size() > 1;
+    }
+    else
+    {
+        // Another reader built it first.
+        ReleaseMemory(entryIndex.cbReserved);
+    }
+    *pIndex = inserted.first->second;
+    return ZR_OK;
+}
+
+ZipResult ZipSeekIndex::Read(size_t index, uint64_t offset, void *pv, size_t cb,
+    size_t *pcbRead)
+{
+    *pcbRead = 0;
+    const ZipEntryInfo &entry = m_pArchive->Entry(index);
+    if (offset >= entry.uncompressedSize || cb == 0)
+    {
+        return IsSupported(entry) ? ZR_OK : ZR_UNSUPPORTED;
+    }
+    cb = (size_t)std::min<uint64_t>(cb, entry.uncompressedSize - offset);
+
+    CopySink sink((uint8_t *)pv, cb);
+    ZipResult result = ReadStream(index, offset, sink);
+    *pcbRead = sink.Copied();
+    if (result == ZR_OK && *pcbRead < cb)
+    {
+        // The central directory promised more data than the stream holds.
+        result = ZR_TRUNCATED;
+    }
+    return result;
+}
+
+ZipResult ZipSeekIndex::ReadStream(size_t index, uint64_t offset, InflateSink &sink)
+{
+    const ZipEntryInfo &entry = m_pArchive->Entry(index);
+    if (!IsSupported(entry))
+    {
+        return ZR_UNSUPPORTED;
+    }
+    if (offset >= entry.uncompressedSize)
+    {
+        return ZR_OK;
+    }
+
+    uint64_t dataOffset;
+    ZipResult result = m_pArchive->GetDataOffset(index, &dataOffset);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    if (entry.method == ZIP_METHOD_STORED)
+    {
+        if (entry.compressedSize != entry.uncompressedSize)
+        {
+            return ZR_BAD_FORMAT;
+        }
+        std::vector<uint8_t> buffer((size_t)std::min<uint64_t>(kReadBuffer,
+            entry.uncompressedSize - offset));
+        while (offset < entry.uncompressedSize)
+        {
+            size_t cb = (size_t)std::min<uint64_t>(buffer.size(),
+                entry.uncompressedSize - offset);
+            result = ReadFullAt(m_pArchive->Source(), dataOffset + offset, &buffer[0], cb);
+            if (result == ZR_OK)
+            {
+                result = sink.Write(&buffer[0], cb);
+            }
+            if (result != ZR_OK)
+            {
+                return result == ZR_STOP ? ZR_OK : result;
+            }
+            offset += cb;
+        }
+        return ZR_OK;
+    }
+
+    std::shared_ptr<const EntryIndex> pIndex;
+    result = GetEntryIndex(index, &pIndex);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // The last checkpoint at or before the offset; the first is at 0.
+    const std::vector<Checkpoint> &points = pIndex->points;
+    std::vector<Checkpoint>::const_iterator it = std::upper_bound(points.begin(),
+        points.end(), offset, [](uint64_t value, const Checkpoint &point)
+        {
+            return value < point.out;
+        });
+    const Checkpoint &point = *(it - 1);
+
+    uint64_t inByte = point.inBit / 8;
+    RangeInputStream range(m_pArchive->Source(), dataOffset + inByte,
+        pIndex->compressedSize - inByte);
+    BufferedReader reader(&range, kReadBuffer);
+    SkipSink skip(offset - point.out, sink);
+
+    Inflater *pInflater = AcquireInflater();
+    result = pInflater->InflateFrom(reader, skip, (unsigned)(point.inBit % 8),
+        point.window.empty() ? NULL : &point.window[0], point.window.size());
+    ReleaseInflater(pInflater);
+
+    return result == ZR_STOP ? ZR_OK : result;
+}
@@ -0,0 +1,135 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipSeekIndex.h
+Project:      ZipFolderEx
+
+The file declares random access into the entries of a ZipArchive.
+
+A deflate stream can only be decoded from its start, so reading the last
+megabyte of a large entry normally costs decoding everything in front of
+it. ZipSeekIndex decodes an entry once and records a checkpoint at a block
+boundary roughly every span bytes of output: the output offset, the bit
+offset in the compressed data, and the 32 KB of history the next block may
+refer back to. A later read resumes at the nearest checkpoint in front of
+the requested offset, so its cost is bounded by the span instead of by the
+offset. An entry gets at most 1024 checkpoints; one so large that it would
+need more gets a longer span instead, so that its windows stay within
+32 MB.
+
+The windows are reserved from a ZipMemoryBudget (see ZipMemory.h) as the
+checkpoints are made or loaded. A checkpoint the budget has no room for is
+not made, which only lengthens the span it would have split, and the
+budget can take back the checkpoints of whole entries, which are built
+again on their next read.
+
+The checkpoints are saved next to the archive as "<archive>.zfxidx",
+written to a temporary file first and renamed over the old one, and
+reused as long as the archive size and the entry's CRC, sizes and offset
+still match. Stored entries are read in place and need no checkpoints.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipArchive.h"
+#include "Inflate.h"
+#include "ZipMemory.h"
+#include <memory>
+
+
+class ZipSeekIndex : private ZipMemoryReclaimer
+{
+public:
+    // Output bytes between checkpoints unless the caller asks otherwise.
+    static const uint64_t kDefaultSpan = 1024 * 1024;
+
+    // A point where decoding can resume: the output offset, the bit offset
+    // into the compressed data, and the history in front of it.
+    struct Checkpoint
+    {
+        uint64_t out;
+        uint64_t inBit;
+        std::vector<uint8_t> window;
+    };
+
+    // Windows are reserved from pBudget, or not counted if it is NULL.
+    explicit ZipSeekIndex(ZipArchive *pArchive, uint64_t span = kDefaultSpan,
+        ZipMemoryBudget *pBudget = &ZipMemoryBudget::Process());
+
+    // Saves any checkpoints built since the last Save; errors are ignored.
+    virtual ~ZipSeekIndex();
+
+    //
+    //   FUNCTION: ZipSeekIndex::Load
+    //
+    //   PURPOSE: Read the cached index of the archive, if one exists. Entries
+    //   that no longer match the archive are dropped. A missing or damaged
+    //   cache is not an error; the index is then built on demand.
+    //
+    void Load();
+
+    // Write the index next to the archive. Does nothing for an archive that
+    // was opened from a caller supplied source.
+    ZipResult Save();
+
+    //
+    //   FUNCTION: ZipSeekIndex::Read
+    //
+    //   PURPOSE: Read up to cb bytes of the uncompressed data of an entry,
+    //   starting at offset. *pcbRead is short only at the end of the entry.
+    //   The first read of a deflated entry larger than the span decodes it
+    //   completely to build its checkpoints and verify its CRC-32. Several
+    //   threads may read at the same time.
+    //
+    ZipResult Read(size_t index, uint64_t offset, void *pv, size_t cb,
+        size_t *pcbRead);
+
+    //
+    //   FUNCTION: ZipSeekIndex::ReadStream
+    //
+    //   PURPOSE: Pass the uncompressed data of an entry from offset onwards
+    //   to sink, until the entry ends or the sink returns ZR_STOP. Lets a
+    //   caller that wants more than one buffer's worth (a block cache
+    //   filling several blocks) pay for a single resume.
+    //
+    ZipResult ReadStream(size_t index, uint64_t offset, InflateSink &sink);
+
+    // Build the checkpoints of an entry now rather than on its first read.
+    ZipResult BuildEntry(size_t index);
+
+private:
+    ZipSeekIndex(const ZipSeekIndex &);
+    ZipSeekIndex &operator=(const ZipSeekIndex &);
+
+    struct EntryIndex
+    {
+        uint32_t crc32;
+        uint64_t compressedSize;
+        uint64_t uncompressedSize;
+        uint64_t localHeaderOffset;
+        std::vector<Checkpoint> points;
+        uint64_t cbReserved;        // from the budget, for the windows
+    };
+
+    typedef std::map<size_t, std::shared_ptr<const EntryIndex> > EntryMap;
+
+    ZipResult GetEntryIndex(size_t index, std::shared_ptr<const EntryIndex> *pIndex);
+    bool Matches(const EntryIndex &entryIndex, const ZipEntryInfo &entry) const;
+
+    Inflater *AcquireInflater();
+    void ReleaseInflater(Inflater *pInflater);
+
+    void ReleaseMemory(uint64_t cb);
+
+    // Drop the checkpoints of entries, largest first, for the budget.
+    virtual uint64_t Reclaim(uint64_t cbWanted);
+
+    ZipArchive *m_pArchive;
+    uint64_t m_span;
+    ZipMemoryBudget *m_pBudget;
+
+    // Readers hold their entry's index by shared_ptr, so that Reclaim can
+    // drop it from the map while they still read from it.
+    std::mutex m_lock;
+    EntryMap m_entries;
+    std::vector<Inflater *> m_inflaters;
+    bool m_fDirty;
+};
@@ -0,0 +1,680 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipService.cpp
+Project:      ZipFolderEx
+
+The file implements the extraction service and client declared in
+ZipService.h.
+\***************************************************************************/
+
+#include "ZipService.h"
+#include "ZipMemory.h"
+#include <stdlib.h>
+#include <chrono>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace
+{
+    // A WAIT holds its connection's thread; keep it short.
+    const unsigned kMaxWaitMs = 5000;
+
+    // Finished jobs kept for STATUS after they are done.
+    const size_t kMaxFinishedJobs = 64;
+
+    // How often Run looks at the stop flag and the idle clock.
+    const unsigned kAcceptPollMs = 250;
+
+    // Connecting to a service that is busy accepting another client.
+    const unsigned kConnectTimeoutMs = 2000;
+
+    void SetResult(ZipIpcMessage *pReply, ZipResult result)
+    {
+        pReply->SetCommand(result == ZR_OK ? "OK" : "ERROR");
+        if (result != ZR_OK)
+        {
+            pReply->SetNumber("result", result);
+            pReply->Set("message", ZipResultToString(result));
+        }
+    }
+}
+
+
+#pragma region ArchiveCache
+
+//
+//   CLASS: ZipService::ArchiveCache
+//
+//   PURPOSE: The most recently used archives with their directories
+//   loaded. An entry is reused while the file's size and write time are
+//   unchanged. Archives not in use have their files released, so the
+//   cache never keeps a file open between jobs. Each directory kept is
+//   reserved from the process memory budget; one the budget has no room
+//   for is dropped as soon as its jobs are done, and the budget can take
+//   back the ones not in use.
+//
+class ZipService::ArchiveCache : private ZipMemoryReclaimer
+{
+public:
+    explicit ArchiveCache(size_t cMax) : m_cMax(std::max<size_t>(cMax, 1)), m_cHits(0), m_cMisses(0)
+    {
+        ZipMemoryBudget::Process().AddReclaimer(this);
+    }
+
+    virtual ~ArchiveCache();
+
+    ZipResult Acquire(const NativePath &path, std::shared_ptr<ZipArchive> *pArchive);
+    void Release(const std::shared_ptr<ZipArchive> &archive);
+
+    uint64_t Hits() { std::lock_guard<std::mutex> lock(m_lock); return m_cHits; }
+    uint64_t Misses() { std::lock_guard<std::mutex> lock(m_lock); return m_cMisses; }
+    size_t Count() { std::lock_guard<std::mutex> lock(m_lock); return m_items.size(); }
+
+private:
+    struct Item
+    {
+        NativePath path;
+        uint64_t cb;
+        uint64_t modified;
+        std::shared_ptr<ZipArchive> archive;
+        unsigned cUsers;
+        uint64_t cbReserved;        // 0 if the budget had no room for it
+    };
+
+    // Erase an item, giving its memory back to the budget.
+    std::list<Item>::iterator Erase(std::list<Item>::iterator it);
+
+    // With the lock held: take another user of the item for path if it is
+    // still of size cb and written at modified, or erase it if not.
+    bool TakeCached(const NativePath &path, uint64_t cb, uint64_t modified,
+        std::shared_ptr<ZipArchive> *pArchive);
+
+    virtual uint64_t Reclaim(uint64_t cbWanted);
+
+    size_t m_cMax;
+    std::mutex m_lock;
+    std::list<Item> m_items;        // most recently used first
+    uint64_t m_cHits;
+    uint64_t m_cMisses;
+};
+
+ZipService::ArchiveCache::~ArchiveCache()
+{
+    ZipMemoryBudget::Process().RemoveReclaimer(this);
+    for (std::list<Item>::iterator it = m_items.begin(); it != m_items.end(); )
+    {
+        it = Erase(it);
+    }
+}
+
+std::list<ZipService::ArchiveCache::Item>::iterator ZipService::ArchiveCache::Erase(
+    std::list<Item>::iterator it)
+{
+    if (it->cbReserved > 0)
+    {
+        ZipMemoryBudget::Process().Release(it->cbReserved);
+    }
+    return m_items.erase(it);
+}
+
+uint64_t ZipService::ArchiveCache::Reclaim(uint64_t cbWanted)
+{
+    // Least recently used first; archives in use stay.
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t cbFreed = 0;
+    std::list<Item>::iterator it = m_items.end();
+    while (cbFreed < cbWanted && it != m_items.begin())
+    {
+        --it;
+        if (it->cUsers == 0 && it->cbReserved > 0)
+        {
+            cbFreed += it->cbReserved;
+            it = Erase(it);
+        }
+    }
+    return cbFreed;
+}
+
+ZipResult ZipService::ArchiveCache::Acquire(const NativePath &path,
+    std::shared_ptr<ZipArchive> *pArchive)
+{
+    uint64_t cb, modified;
+    ZipResult result = GetFileStamp(path, &cb, &modified);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (TakeCached(path, cb, modified, pArchive))
+        {
+            m_cHits++;
+            return ZR_OK;
+        }
+        m_cMisses++;
+    }
+
+    // Read the directory without holding up other lookups.
+    std::shared_ptr<ZipArchive> archive = std::make_shared<ZipArchive>();
+    result = archive->Open(path);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    // Outside the lock, since the budget may call Reclaim.
+    uint64_t cbMemory = archive->MemoryFootprint();
+    if (!ZipMemoryBudget::Process().TryReserve(cbMemory))
+    {
+        cbMemory = 0;
+    }
+
+    // Another job may have opened the same archive meanwhile. Its copy is
+    // the one kept, so that there is only ever one item per path.
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (TakeCached(path, cb, modified, pArchive))
+    {
+        if (cbMemory > 0)
+        {
+            ZipMemoryBudget::Process().Release(cbMemory);
+        }
+        return ZR_OK;
+    }
+    Item item;
+    item.path = path;
+    item.cb = cb;
+    item.modified = modified;
+    item.archive = archive;
+    item.cUsers = 1;
+    item.cbReserved = cbMemory;
+    m_items.push_front(item);
+
+    std::list<Item>::iterator it = m_items.end();
+    while (m_items.size() > m_cMax && it != m_items.begin())
+    {
+        --it;
+        if (it->cUsers == 0)
+        {
+            it = Erase(it);
+        }
+    }
+    *pArchive = archive;
+    return ZR_OK;
+}
+
+bool ZipService::ArchiveCache::TakeCached(const NativePath &path, uint64_t cb,
+    uint64_t modified, std::shared_ptr<ZipArchive> *pArchive)
+{
+    for (std::list<Item>::iterator it = m_items.begin(); it != m_items.end(); ++it)
+    {
+        if (it->path != path)
+        {
+            continue;
+        }
+        if (it->cb == cb && it->modified == modified &&
+            (it->cUsers > 0 || it->archive->ReopenFile() == ZR_OK))
+        {
+            it->cUsers++;
+            m_items.splice(m_items.begin(), m_items, it);
+            *pArchive = it->archive;
+            return true;
+        }
+
+        // The file changed. Jobs still using the old copy keep it alive
+        // through their own references.
+        Erase(it);
+        break;
+    }
+    return false;
+}
+
+void ZipService::ArchiveCache::Release(const std::shared_ptr<ZipArchive> &archive)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (std::list<Item>::iterator it = m_items.begin(); it != m_items.end(); ++it)
+    {
+        if (it->archive == archive)
+        {
+            if (--it->cUsers == 0)
+            {
+                archive->ReleaseFile();
+                if (it->cbReserved == 0)
+                {
+                    Erase(it);
+                }
+            }
+            return;
+        }
+    }
+}
+
+#pragma endregion
+
+
+#pragma region ServiceJob
+
+//
+//   CLASS: ZipService::ServiceJob
+//
+//   PURPOSE: A job that takes its archive from the cache and extracts it
+//   on the service's pool.
+//
+class ZipService::ServiceJob : public ZipJob
+{
+public:
+    ServiceJob(ZipService *pService, uint64_t id, const NativePath &archivePath,
+        const NativePath &destDir, unsigned cThreads, bool fRequireSupported) :
+        ZipJob(archivePath, destDir, cThreads), m_pService(pService), m_id(id),
+        m_cThreads(cThreads), m_fRequireSupported(fRequireSupported)
+    {
+    }
+
+    uint64_t Id() const { return m_id; }
+
+protected:
+    virtual ZipResult Run();
+
+private:
+    ZipService *m_pService;
+    uint64_t m_id;
+    unsigned m_cThreads;
+    bool m_fRequireSupported;
+};
+
+ZipResult ZipService::ServiceJob::Run()
+{
+    std::shared_ptr<ZipArchive> archive;
+    ZipResult result = m_pService->m_pCache->Acquire(ArchivePath(), &archive);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    for (size_t i = 0; m_fRequireSupported && i < archive->EntryCount(); i++)
+    {
+        if (!ZipExtractor::IsSupported(archive->Entry(i)))
+        {
+            result = ZR_UNSUPPORTED;
+            break;
+        }
+    }
+    if (result == ZR_OK)
+    {
+        ZipExtractor extractor(DestDir(), m_cThreads);
+        extractor.SetProgress(&Progress());
+        extractor.SetCancelToken(&CancelToken());
+        extractor.SetThreadPool(&m_pService->m_pool);
+        result = extractor.Extract(*archive);
+    }
+
+    m_pService->m_pCache->Release(archive);
+    return result;
+}
+
+#pragma endregion
+
+
+#pragma region ZipService
+
+NativePath ZipServiceDefaultName()
+{
+#ifdef _WIN32
+    // One service per user and logon session; pipe names are visible
+    // across both, so the name carries the user's SID as well.
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    wchar_t szSession[16];
+    swprintf_s(szSession, L".%lu", sessionId);
+    return L"\\\\.\\pipe\\ZipFolderEx." + ZipIpcUserSid() + szSession;
+#else
+    // The runtime directory is the user's own. Failing that, the socket
+    // goes in a directory of the user's own under /tmp, which must turn out
+    // to be a directory that this user owns and nobody else may enter;
+    // another user may have made it first. Failing that, the home
+    // directory.
+    const char *pszRuntimeDir = getenv("XDG_RUNTIME_DIR");
+    if (pszRuntimeDir != NULL && pszRuntimeDir[0] != '\0')
+    {
+        return NativePath(pszRuntimeDir) + "/zipfolderex.sock";
+    }
+    char szDir[64];
+    snprintf(szDir, sizeof(szDir), "/tmp/zipfolderex-%u", (unsigned)getuid());
+    mkdir(szDir, S_IRWXU);
+    struct stat st;
+    if (lstat(szDir, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+        (st.st_mode & (S_IRWXG | S_IRWXO)) == 0)
+    {
+        return NativePath(szDir) + "/service.sock";
+    }
+    const char *pszHome = getenv("HOME");
+    return NativePath(pszHome != NULL ? pszHome : ".") + "/.zipfolderex.sock";
+#endif
+}
+
+ZipService::ZipService(unsigned cPoolThreads, unsigned cConcurrentJobs, size_t cCachedArchives) :
+    m_pool(cPoolThreads), m_pCache(new ArchiveCache(cCachedArchives)),
+    m_queue(cConcurrentJobs), m_fStop(false), m_nextJob(1), m_cLiveConnections(0)
+{
+}
+
+ZipService::~ZipService()
+{
+    m_queue.CancelAll();
+    m_queue.WaitIdle();
+    ReapConnections(true);
+}
+
+ZipResult ZipService::Run(const NativePath &name, unsigned msIdleExit)
+{
+    ZipIpcServer server;
+    ZipResult result = server.Listen(name);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    std::chrono::steady_clock::time_point lastActive = std::chrono::steady_clock::now();
+    std::unique_ptr<Connection> next;
+    while (!m_fStop)
+    {
+        if (!next)
+        {
+            next.reset(new Connection());
+            next->fFinished = false;
+        }
+        result = server.Accept(kAcceptPollMs, &next->channel);
+        if (result == ZR_OK)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            Connection *pConnection = next.get();
+            m_connections.push_back(std::move(next));
+            m_cLiveConnections++;
+            pConnection->thread = std::thread(&ZipService::ServeConnection, this, pConnection);
+        }
+        else if (result != ZR_STOP)
+        {
+            break;
+        }
+        result = ZR_OK;
+
+        ReapConnections(false);
+        bool fBusy;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            fBusy = m_cLiveConnections > 0;
+        }
+        if (fBusy || m_queue.Count() > 0)
+        {
+            lastActive = std::chrono::steady_clock::now();
+        }
+        else if (msIdleExit > 0 && std::chrono::steady_clock::now() - lastActive >=
+            std::chrono::milliseconds(msIdleExit))
+        {
+            break;
+        }
+    }
+
+    // Stop taking clients before winding down, so a new one starts a new
+    // service rather than talking to this one.
+    server.Close();
+    m_queue.CancelAll();
+    m_queue.WaitIdle();
+    ReapConnections(true);
+    return result;
+}
+
+void ZipService::ServeConnection(Connection *pConnection)
+{
+    ZipIpcMessage request;
+    if (pConnection->channel.Receive(&request) == ZR_OK)
+    {
+        ZipIpcMessage reply;
+        Handle(request, &reply);
+        pConnection->channel.Send(reply);
+    }
+    pConnection->channel.Close();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    pConnection->fFinished = true;
+    m_cLiveConnections--;
+}
+
+void ZipService::ReapConnections(bool fAll)
+{
+    std::list<std::unique_ptr<Connection> > finished;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::list<std::unique_ptr<Connection> >::iterator it = m_connections.begin();
+        while (it != m_connections.end())
+        {
+            std::list<std::unique_ptr<Connection> >::iterator current = it++;
+            if (fAll || (*current)->fFinished)
+            {
+                finished.splice(finished.end(), m_connections, current);
+            }
+        }
+    }
+
+    // Join without the lock; a connection still running needs it to finish.
+    for (std::list<std::unique_ptr<Connection> >::iterator it = finished.begin();
+        it != finished.end(); ++it)
+    {
+        (*it)->thread.join();
+    }
+}
+
+std::shared_ptr<ZipService::ServiceJob> ZipService::FindJob(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::map<uint64_t, std::shared_ptr<ServiceJob> >::iterator it = m_jobs.find(id);
+    return it != m_jobs.end() ? it->second : std::shared_ptr<ServiceJob>();
+}
+
+void ZipService::PruneJobs()
+{
+    // Called with m_lock held. Ids grow, so the map runs oldest first.
+    size_t cFinished = 0;
+    for (std::map<uint64_t, std::shared_ptr<ServiceJob> >::iterator it = m_jobs.begin();
+        it != m_jobs.end(); ++it)
+    {
+        cFinished += it->second->State() == ZJ_DONE;
+    }
+    std::map<uint64_t, std::shared_ptr<ServiceJob> >::iterator it = m_jobs.begin();
+    while (cFinished > kMaxFinishedJobs && it != m_jobs.end())
+    {
+        if (it->second->State() == ZJ_DONE)
+        {
+            it = m_jobs.erase(it);
+            cFinished--;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void ZipService::Handle(const ZipIpcMessage &request, ZipIpcMessage *pReply)
+{
+    const std::string &command = request.Command();
+    if (command == "PING")
+    {
+        SetResult(pReply, ZR_OK);
+        pReply->SetNumber("version", ZIP_SERVICE_VERSION);
+    }
+    else if (command == "EXTRACT")
+    {
+        NativePath archivePath = request.GetPath("archive");
+        NativePath destDir = request.GetPath("dest");
+        if (archivePath.empty() || destDir.empty())
+        {
+            SetResult(pReply, ZR_BAD_PATH);
+            return;
+        }
+
+        std::shared_ptr<ServiceJob> job;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            PruneJobs();
+            job = std::make_shared<ServiceJob>(this, m_nextJob++, archivePath, destDir,
+                (unsigned)request.GetNumber("threads"),
+                request.GetNumber("require_supported") != 0);
+            m_jobs[job->Id()] = job;
+        }
+        m_queue.Submit(job);
+        SetResult(pReply, ZR_OK);
+        pReply->SetNumber("job", job->Id());
+    }
+    else if (command == "STATUS" || command == "WAIT" || command == "CANCEL")
+    {
+        std::shared_ptr<ServiceJob> job = FindJob(request.GetNumber("job"));
+        if (!job)
+        {
+            SetResult(pReply, ZR_NOT_FOUND);
+            return;
+        }
+        if (command == "CANCEL")
+        {
+            job->Cancel();
+        }
+        else if (command == "WAIT")
+        {
+            job->Wait((unsigned)std::min<uint64_t>(request.GetNumber("timeout"), kMaxWaitMs));
+        }
+
+        SetResult(pReply, ZR_OK);
+        ZipProgressSnapshot progress;
+        job->GetProgress(&progress);
+        ZipJobState state = job->State();
+        pReply->SetNumber("state", state);
+        pReply->SetNumber("result", state == ZJ_DONE ? job->Result() : ZR_OK);
+        pReply->SetNumber("entries_done", progress.cEntriesDone);
+        pReply->SetNumber("entries_total", progress.cEntriesTotal);
+        pReply->SetNumber("bytes_done", progress.cbDone);
+        pReply->SetNumber("bytes_total", progress.cbTotal);
+        if (progress.etaSeconds >= 0)
+        {
+            pReply->SetNumber("eta_ms", (uint64_t)(progress.etaSeconds * 1000));
+        }
+    }
+    else if (command == "STATS")
+    {
+        SetResult(pReply, ZR_OK);
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            pReply->SetNumber("jobs_submitted", m_nextJob - 1);
+        }
+        pReply->SetNumber("jobs_active", m_queue.Count());
+        pReply->SetNumber("cache_hits", m_pCache->Hits());
+        pReply->SetNumber("cache_misses", m_pCache->Misses());
+        pReply->SetNumber("cache_archives", m_pCache->Count());
+        pReply->SetNumber("pool_threads", m_pool.ThreadCount());
+    }
+    else if (command == "SHUTDOWN")
+    {
+        SetResult(pReply, ZR_OK);
+        Stop();
+    }
+    else
+    {
+        SetResult(pReply, ZR_UNSUPPORTED);
+    }
+}
+
+#pragma endregion
+
+
+#pragma region ZipServiceClient
+
+ZipResult ZipServiceClient::Call(const ZipIpcMessage &request, ZipIpcMessage *pReply)
+{
+    ZipIpcConnection connection;
+    ZipResult result = connection.Connect(m_name, kConnectTimeoutMs);
+    if (result == ZR_OK)
+    {
+        result = connection.Send(request);
+    }
+    if (result == ZR_OK)
+    {
+        result = connection.Receive(pReply);
+    }
+    if (result == ZR_OK && pReply->Command() != "OK")
+    {
+        result = (ZipResult)pReply->GetNumber("result");
+        if (result == ZR_OK)
+        {
+            result = ZR_BAD_FORMAT;
+        }
+    }
+    return result;
+}
+
+ZipResult ZipServiceClient::Ping()
+{
+    ZipIpcMessage reply;
+    return Call(ZipIpcMessage("PING"), &reply);
+}
+
+ZipResult ZipServiceClient::Submit(const NativePath &archivePath, const NativePath &destDir,
+    bool fRequireSupported, uint64_t *pJob)
+{
+    ZipIpcMessage request("EXTRACT");
+    request.SetPath("archive", archivePath);
+    request.SetPath("dest", destDir);
+    if (fRequireSupported)
+    {
+        request.SetNumber("require_supported", 1);
+    }
+    ZipIpcMessage reply;
+    ZipResult result = Call(request, &reply);
+    if (result == ZR_OK)
+    {
+        *pJob = reply.GetNumber("job");
+    }
+    return result;
+}
+
+ZipResult ZipServiceClient::Wait(uint64_t job, unsigned msTimeout, ZipServiceJobStatus *pStatus)
+{
+    ZipIpcMessage request("WAIT");
+    request.SetNumber("job", job);
+    request.SetNumber("timeout", msTimeout);
+    ZipIpcMessage reply;
+    ZipResult result = Call(request, &reply);
+    if (result == ZR_OK)
+    {
+        pStatus->state = (ZipJobState)reply.GetNumber("state");
+        pStatus->result = (ZipResult)reply.GetNumber("result");
+        ZipProgressSnapshot &progress = pStatus->progress;
+        progress.cEntriesDone = reply.GetNumber("entries_done");
+        progress.cEntriesTotal = reply.GetNumber("entries_total");
+        progress.cbDone = reply.GetNumber("bytes_done");
+        progress.cbTotal = reply.GetNumber("bytes_total");
+        progress.elapsedSeconds = 0;
+        progress.fraction = progress.cbTotal > 0 ? (double)progress.cbDone / progress.cbTotal :
+            progress.cEntriesTotal > 0 ? (double)progress.cEntriesDone / progress.cEntriesTotal : 0;
+        progress.etaSeconds = reply.Has("eta_ms") ? reply.GetNumber("eta_ms") / 1000.0 : -1;
+    }
+    return result;
+}
+
+ZipResult ZipServiceClient::Cancel(uint64_t job)
+{
+    ZipIpcMessage request("CANCEL");
+    request.SetNumber("job", job);
+    ZipIpcMessage reply;
+    return Call(request, &reply);
+}
+
+ZipResult ZipServiceClient::Shutdown()
+{
+    ZipIpcMessage reply;
+    return Call(ZipIpcMessage("SHUTDOWN"), &reply);
+}
+
+#pragma endregion
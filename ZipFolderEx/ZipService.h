@@ -0,0 +1,146 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipService.h
+Project:      ZipFolderEx
+
+The file declares the extraction service and its client.
+
+Explorer loads the shell extension into whichever process shows the menu,
+and each extraction there pays for thread start-up and for reading the
+archive's central directory again. ZipService runs in a process of its
+own instead: it keeps a ZipThreadPool warm, caches the directories of
+recently used archives, and takes jobs from any local client over the
+channel in ZipIpc.h. Cached directories count against the process memory
+budget (see ZipMemory.h) and are dropped when it runs short. The shell extension starts it on first use and it
+exits after a while without work.
+
+Each request is one message on its own connection; the reply is "OK" or
+"ERROR" with the failing ZipResult in "result". The commands are
+
+    PING                                    -> version
+    EXTRACT archive= dest= [threads=] [require_supported=1]
+                                            -> job
+    STATUS job=                             -> the job's status
+    WAIT job= timeout=                      -> the same, once the job is
+                                               done or timeout ms (at most
+                                               5 s) have passed
+    CANCEL job=
+    STATS                                   -> service counters
+    SHUTDOWN                                   cancels all jobs and exits
+
+A status carries state (a ZipJobState), result, entries_done,
+entries_total, bytes_done, bytes_total and, once known, eta_ms. With
+require_supported=1 a job that meets an entry Extract cannot decode fails
+with ZR_UNSUPPORTED before writing anything, so the caller can hand the
+archive to another extractor.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipJob.h"
+#include "ZipIpc.h"
+
+
+// Protocol version reported by PING.
+const unsigned ZIP_SERVICE_VERSION = 1;
+
+
+// The channel name for the current user and session. On POSIX systems
+// without XDG_RUNTIME_DIR this makes the private directory it lies in.
+NativePath ZipServiceDefaultName();
+
+
+struct ZipServiceJobStatus
+{
+    ZipJobState state;
+    ZipResult result;
+    ZipProgressSnapshot progress;
+};
+
+
+class ZipService
+{
+public:
+    //
+    //   FUNCTION: ZipService::ZipService
+    //
+    //   PURPOSE: Prepare a service with cPoolThreads extraction threads
+    //   (0 for one per processor) running up to cConcurrentJobs jobs at a
+    //   time and keeping the directories of cCachedArchives archives.
+    //
+    ZipService(unsigned cPoolThreads = 0, unsigned cConcurrentJobs = 2,
+        size_t cCachedArchives = 16);
+    ~ZipService();
+
+    //
+    //   FUNCTION: ZipService::Run
+    //
+    //   PURPOSE: Serve requests on name until SHUTDOWN, Stop, or
+    //   msIdleExit milliseconds without a job or a client (0 never
+    //   times out). Fails at once if another service owns name.
+    //
+    ZipResult Run(const NativePath &name, unsigned msIdleExit);
+
+    // Make Run return; safe from any thread.
+    void Stop() { m_fStop = true; }
+
+private:
+    ZipService(const ZipService &);
+    ZipService &operator=(const ZipService &);
+
+    class ArchiveCache;
+    class ServiceJob;
+
+    struct Connection
+    {
+        std::thread thread;
+        ZipIpcConnection channel;
+        bool fFinished;
+    };
+
+    void ServeConnection(Connection *pConnection);
+    void Handle(const ZipIpcMessage &request, ZipIpcMessage *pReply);
+    std::shared_ptr<ServiceJob> FindJob(uint64_t id);
+    void PruneJobs();
+    void ReapConnections(bool fAll);
+
+    ZipThreadPool m_pool;
+    std::unique_ptr<ArchiveCache> m_pCache;
+    ZipJobQueue m_queue;
+    std::atomic<bool> m_fStop;
+
+    std::mutex m_lock;
+    std::map<uint64_t, std::shared_ptr<ServiceJob> > m_jobs;
+    uint64_t m_nextJob;
+    std::list<std::unique_ptr<Connection> > m_connections;
+    unsigned m_cLiveConnections;
+};
+
+
+class ZipServiceClient
+{
+public:
+    explicit ZipServiceClient(const NativePath &name) : m_name(name) {}
+
+    // ZR_NOT_FOUND when no service is listening.
+    ZipResult Ping();
+
+    ZipResult Submit(const NativePath &archivePath, const NativePath &destDir,
+        bool fRequireSupported, uint64_t *pJob);
+
+    // Wait up to msTimeout milliseconds and report the job's status.
+    ZipResult Wait(uint64_t job, unsigned msTimeout, ZipServiceJobStatus *pStatus);
+
+    ZipResult Cancel(uint64_t job);
+    ZipResult Shutdown();
+
+    //
+    //   FUNCTION: ZipServiceClient::Call
+    //
+    //   PURPOSE: Send one request and read the reply. Returns the
+    //   transport error, or the result of an ERROR reply.
+    //
+    ZipResult Call(const ZipIpcMessage &request, ZipIpcMessage *pReply);
+
+private:
+    NativePath m_name;
+};
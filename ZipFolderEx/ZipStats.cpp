@@ -0,0 +1,215 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipStats.cpp
+Project:      ZipFolderEx
+
+The file implements the stage counters declared in ZipStats.h and their
+JSON formatting.
+\***************************************************************************/
+
+#include "ZipStats.h"
+#include "ZipTrace.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+
+namespace
+{
+    const char *const kStageNames[ZS_COUNT] =
+    {
+        "cd_parse",
+        "read",
+        "decrypt",
+        "inflate",
+        "crc",
+        "write",
+        "create",
+        "metadata",
+        "mkdir",
+        "scan",
+    };
+
+    void AppendFormat(std::string &out, const char *pszFormat, ...)
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, pszFormat);
+        int cch = vsnprintf(buffer, sizeof(buffer), pszFormat, args);
+        va_end(args);
+        if (cch > 0)
+        {
+            out.append(buffer, (size_t)cch < sizeof(buffer) ? (size_t)cch : sizeof(buffer) - 1);
+        }
+    }
+
+    double Seconds(uint64_t ns)
+    {
+        return (double)ns / 1e9;
+    }
+
+    void AppendStages(std::string &out, const ZipThreadStats &stats, const std::string &indent)
+    {
+        out += "{\n";
+        for (int i = 0; i < ZS_COUNT; i++)
+        {
+            const ZipStageCounter &counter = stats.stages[i];
+            AppendFormat(out, "%s    \"%s\": {\"calls\": %llu, \"s\": %.6f, \"bytes\": %llu}%s\n",
+                indent.c_str(), kStageNames[i], (unsigned long long)counter.calls,
+                Seconds(counter.ns), (unsigned long long)counter.bytes,
+                i + 1 < ZS_COUNT ? "," : "");
+        }
+        out += indent + "}";
+    }
+}
+
+
+const char *ZipStageName(ZipStage stage)
+{
+    return stage >= 0 && stage < ZS_COUNT ? kStageNames[stage] : "unknown";
+}
+
+uint64_t ZipStatsNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void ZipThreadStats::Reset()
+{
+    memset(stages, 0, sizeof(stages));
+    entries = 0;
+    pActive = NULL;
+    pTrace = NULL;
+    entry = 0;
+}
+
+void ZipThreadStats::Add(ZipStage stage, uint64_t ns, uint64_t cb)
+{
+    ZipStageCounter &counter = stages[stage];
+    counter.calls++;
+    counter.ns += ns;
+    counter.bytes += cb;
+}
+
+void ZipThreadStats::Merge(const ZipThreadStats &other)
+{
+    for (int i = 0; i < ZS_COUNT; i++)
+    {
+        stages[i].calls += other.stages[i].calls;
+        stages[i].ns += other.stages[i].ns;
+        stages[i].bytes += other.stages[i].bytes;
+    }
+    entries += other.entries;
+}
+
+
+void ZipStageTimer::Stop(uint64_t cb)
+{
+    if (m_pStats == NULL)
+    {
+        return;
+    }
+    uint64_t elapsed = ZipStatsNow() - m_start;
+    m_pStats->Add(m_stage, elapsed - std::min(elapsed, m_nsNested), cb);
+    if (m_pStats->pTrace != NULL)
+    {
+        m_pStats->pTrace->Add(m_start, elapsed, (uint16_t)m_stage, m_pStats->entry);
+    }
+    if (m_pParent != NULL)
+    {
+        m_pParent->m_nsNested += elapsed;
+    }
+    m_pStats->pActive = m_pParent;
+    m_pStats = NULL;
+}
+
+
+void ZipExtractStats::Reset()
+{
+    result = ZR_OK;
+    cThreads = 0;
+    cEntries = 0;
+    cFiles = 0;
+    cDirectories = 0;
+    cSkipped = 0;
+    cKept = 0;
+    cRenamed = 0;
+    cbWritten = 0;
+    cbHoles = 0;
+    cDirectFiles = 0;
+    cBatches = 0;
+    cBatchedFiles = 0;
+    cThrottledWorkers = 0;
+    cbMemoryPeak = 0;
+    cbMemoryLimit = 0;
+    wallNs = 0;
+    pszWriter = "";
+    total.Reset();
+    threads.clear();
+    tuning.clear();
+}
+
+
+std::string ZipStatsToJson(const ZipExtractStats &stats, const std::string &indent)
+{
+    std::string out = "{\n";
+    AppendFormat(out, "%s    \"result\": \"%s\",\n", indent.c_str(), ZipResultToString(stats.result));
+    AppendFormat(out, "%s    \"threads\": %u,\n", indent.c_str(), stats.cThreads);
+    AppendFormat(out, "%s    \"writer\": \"%s\",\n", indent.c_str(), stats.pszWriter);
+    AppendFormat(out, "%s    \"entries\": %llu,\n", indent.c_str(), (unsigned long long)stats.cEntries);
+    AppendFormat(out, "%s    \"files\": %llu,\n", indent.c_str(), (unsigned long long)stats.cFiles);
+    AppendFormat(out, "%s    \"directories\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cDirectories);
+    AppendFormat(out, "%s    \"skipped\": %llu,\n", indent.c_str(), (unsigned long long)stats.cSkipped);
+    AppendFormat(out, "%s    \"kept\": %llu,\n", indent.c_str(), (unsigned long long)stats.cKept);
+    AppendFormat(out, "%s    \"renamed\": %llu,\n", indent.c_str(), (unsigned long long)stats.cRenamed);
+    AppendFormat(out, "%s    \"bytes\": %llu,\n", indent.c_str(), (unsigned long long)stats.cbWritten);
+    AppendFormat(out, "%s    \"sparse_bytes\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cbHoles);
+    AppendFormat(out, "%s    \"direct_files\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cDirectFiles);
+    AppendFormat(out, "%s    \"batches\": %llu,\n", indent.c_str(), (unsigned long long)stats.cBatches);
+    AppendFormat(out, "%s    \"batched_files\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cBatchedFiles);
+    AppendFormat(out, "%s    \"memory_peak\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cbMemoryPeak);
+    AppendFormat(out, "%s    \"memory_limit\": %llu,\n", indent.c_str(),
+        (unsigned long long)stats.cbMemoryLimit);
+    AppendFormat(out, "%s    \"throttled_workers\": %u,\n", indent.c_str(), stats.cThrottledWorkers);
+    AppendFormat(out, "%s    \"wall_s\": %.6f,\n", indent.c_str(), Seconds(stats.wallNs));
+    AppendFormat(out, "%s    \"files_per_s\": %.1f,\n", indent.c_str(),
+        stats.wallNs > 0 ? stats.cFiles / Seconds(stats.wallNs) : 0.0);
+
+    std::string inner = indent + "    ";
+    out += inner + "\"stages\": ";
+    AppendStages(out, stats.total, inner);
+    out += ",\n" + inner + "\"per_thread\": [";
+    for (size_t i = 0; i < stats.threads.size(); i++)
+    {
+        std::string item = inner + "    ";
+        out += i == 0 ? "\n" : ",\n";
+        AppendFormat(out, "%s{\"entries\": %llu, \"stages\": ", item.c_str(),
+            (unsigned long long)stats.threads[i].entries);
+        AppendStages(out, stats.threads[i], item);
+        out += "}";
+    }
+    out += stats.threads.empty() ? "]" : "\n" + inner + "]";
+    out += ",\n" + inner + "\"tuning\": [";
+    for (size_t i = 0; i < stats.tuning.size(); i++)
+    {
+        const ZipTuneStep &step = stats.tuning[i];
+        const char *pszAction = step.cNext > step.cWorkers ? "up" :
+            step.cNext < step.cWorkers ? "down" : "hold";
+        out += i == 0 ? "\n" : ",\n";
+        AppendFormat(out, "%s    {\"t_s\": %.3f, \"workers\": %u, \"mb_per_s\": %.1f, "
+            "\"files_per_s\": %llu, \"entry_ms\": %.3f, \"action\": \"%s\", \"next\": %u}",
+            inner.c_str(), Seconds(step.atNs), step.cWorkers, step.cbPerSecond / 1e6,
+            (unsigned long long)step.filesPerSecond, step.entryUs / 1e3, pszAction, step.cNext);
+    }
+    out += stats.tuning.empty() ? "]\n" : "\n" + inner + "]\n";
+    out += indent + "}";
+    return out;
+}
@@ -0,0 +1,172 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipStats.h
+Project:      ZipFolderEx
+
+The file declares the counters and timers the extractor keeps for each
+stage of its work, and the stats object it hands back to callers.
+
+Every worker thread owns one ZipThreadStats and is the only writer to it,
+so recording a stage costs two clock reads and a few adds, without locks
+or atomic operations. The extractor merges the per-thread records once all
+workers have finished. Stages nest: time spent reading input while
+inflating is charged to "read", not to "inflate", so the stage times of a
+thread add up to the time it was busy.
+
+When the caller does not ask for stats, the extractor passes NULL and a
+ZipStageTimer does nothing but test that pointer. A thread record can also
+carry a trace ring (ZipTrace.h), in which case every timer adds a span.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipFormat.h"
+#include <vector>
+#include <string>
+
+
+enum ZipStage
+{
+    ZS_CD_PARSE = 0,    // reading the central directory
+    ZS_READ,            // reading local headers and entry data
+    ZS_DECRYPT,         // decrypting entry data (no encryption is supported yet)
+    ZS_INFLATE,         // decoding, excluding the read, CRC and write it drives
+    ZS_CRC,             // CRC-32 of the output
+    ZS_WRITE,           // writing output files
+    ZS_CREATE,          // creating and closing output files
+    ZS_METADATA,        // restoring timestamps and attributes
+    ZS_MKDIR,           // creating directories
+    ZS_SCAN,            // listing existing directories for the overwrite policy
+    ZS_COUNT
+};
+
+const char *ZipStageName(ZipStage stage);
+
+// Monotonic clock in nanoseconds.
+uint64_t ZipStatsNow();
+
+
+struct ZipStageCounter
+{
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t bytes;
+};
+
+
+class ZipStageTimer;
+class ZipTraceBuffer;
+
+struct ZipThreadStats
+{
+    ZipThreadStats() { Reset(); }
+
+    void Reset();
+    void Add(ZipStage stage, uint64_t ns, uint64_t cb);
+    void Merge(const ZipThreadStats &other);
+
+    ZipStageCounter stages[ZS_COUNT];
+    uint64_t entries;
+
+    // The innermost running timer on this thread.
+    ZipStageTimer *pActive;
+
+    // If not NULL, timers also record spans here, tagged with entry.
+    ZipTraceBuffer *pTrace;
+    uint32_t entry;
+};
+
+
+//
+//   CLASS: ZipStageTimer
+//
+//   PURPOSE: Charge the time between construction and Stop (or destruction)
+//   to a stage of pStats, minus the time of timers nested inside it. Does
+//   nothing if pStats is NULL.
+//
+class ZipStageTimer
+{
+public:
+    ZipStageTimer(ZipThreadStats *pStats, ZipStage stage) :
+        m_pStats(pStats), m_stage(stage), m_start(0), m_nsNested(0), m_pParent(NULL)
+    {
+        if (m_pStats != NULL)
+        {
+            m_pParent = m_pStats->pActive;
+            m_pStats->pActive = this;
+            m_start = ZipStatsNow();
+        }
+    }
+
+    ~ZipStageTimer() { Stop(); }
+
+    // Stop timing and record cb bytes processed. Later calls do nothing.
+    void Stop(uint64_t cb = 0);
+
+private:
+    ZipStageTimer(const ZipStageTimer &);
+    ZipStageTimer &operator=(const ZipStageTimer &);
+
+    ZipThreadStats *m_pStats;
+    ZipStage m_stage;
+    uint64_t m_start;
+    uint64_t m_nsNested;
+    ZipStageTimer *m_pParent;
+};
+
+
+//
+//   STRUCT: ZipTuneStep
+//
+//   PURPOSE: One sample of the worker count controller (ZipTuner.h): what
+//   the workers did since the previous sample and how many run next.
+//
+struct ZipTuneStep
+{
+    uint64_t atNs;              // since the workers started
+    unsigned cWorkers;          // running during the sample
+    unsigned cNext;             // running from now on
+    uint64_t cbPerSecond;       // bytes written
+    uint64_t filesPerSecond;
+    uint64_t entryUs;           // average time a worker spent on a file
+};
+
+
+//
+//   STRUCT: ZipExtractStats
+//
+//   PURPOSE: The outcome of one extraction. total is the sum of the
+//   per-thread records in threads, so its stage times are CPU-side busy
+//   time and may add up to more than the wall time.
+//
+struct ZipExtractStats
+{
+    ZipExtractStats() { Reset(); }
+
+    void Reset();
+
+    ZipResult result;
+    unsigned cThreads;
+    uint64_t cEntries;
+    uint64_t cFiles;
+    uint64_t cDirectories;
+    uint64_t cSkipped;
+    uint64_t cKept;             // files left as they were by the overwrite policy
+    uint64_t cRenamed;          // entries written under another name instead
+    uint64_t cbWritten;
+    uint64_t cbHoles;           // of those, left as holes rather than written
+    uint64_t cDirectFiles;      // files written around the system cache
+    uint64_t cBatches;          // reads that fetched several small entries
+    uint64_t cBatchedFiles;     // files whose data came from such a read
+    unsigned cThrottledWorkers; // workers not run, or stopped, for lack of memory
+    uint64_t cbMemoryPeak;      // the most reserved from the memory budget
+    uint64_t cbMemoryLimit;     // the budget's limit, 0 for none
+    uint64_t wallNs;
+    const char *pszWriter;      // the kind of file writer used, as a string
+    ZipThreadStats total;
+    std::vector<ZipThreadStats> threads;
+    std::vector<ZipTuneStep> tuning;    // empty if the worker count was fixed
+};
+
+// Format stats as a JSON object. Lines after the first are prefixed with
+// indent so the object can be nested in a larger document.
+std::string ZipStatsToJson(const ZipExtractStats &stats, const std::string &indent = "");
@@ -0,0 +1,558 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipStreamReader.cpp
+Project:      ZipFolderEx
+
+The file implements the forward-only archive reader and the stream
+extractor declared in ZipStreamReader.h.
+\***************************************************************************/
+
+#include "ZipStreamReader.h"
+#include "ZipPath.h"
+#include "Crc32.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace
+{
+    // Passes data through to an optional sink while keeping the CRC-32 and
+    // byte count of everything that went by.
+    class ChecksumSink : public InflateSink
+    {
+    public:
+        explicit ChecksumSink(InflateSink *pTarget) : m_pTarget(pTarget),
+            m_crc(0), m_cb(0)
+        {
+        }
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            m_crc = Crc32Update(m_crc, pb, cb);
+            m_cb += cb;
+            return m_pTarget != NULL ? m_pTarget->Write(pb, cb) : ZR_OK;
+        }
+
+        uint32_t Crc() const { return m_crc; }
+        uint64_t Count() const { return m_cb; }
+
+    private:
+        InflateSink *m_pTarget;
+        uint32_t m_crc;
+        uint64_t m_cb;
+    };
+
+    // How far the descriptor scan of a stored entry looks ahead: the largest
+    // descriptor (signature, CRC and two 8-byte sizes) plus a signature.
+    const size_t kDescriptorLookahead = 28;
+    const size_t kScanChunk = 64 * 1024;
+
+    bool IsRecordSignature(uint32_t sig)
+    {
+        return sig == ZIP_SIG_LOCAL_HEADER || sig == ZIP_SIG_CENTRAL_HEADER ||
+            sig == ZIP_SIG_END_OF_CD || sig == ZIP_SIG_ZIP64_END_OF_CD ||
+            sig == ZIP_SIG_DIGITAL_SIGNATURE;
+    }
+
+    // A descriptor ending at pos must be followed by another record. An
+    // empty entry's ZIP64 descriptor also reads as a valid 32-bit one, and
+    // only the bytes after it tell the two apart.
+    bool FollowedByRecord(const uint8_t *p, size_t avail, size_t pos)
+    {
+        return pos + 4 > avail || IsRecordSignature(ReadLE32(p + pos));
+    }
+}
+
+
+#pragma region ZipStreamReader
+
+ZipStreamReader::ZipStreamReader(ZipInputStream *pStream) : m_reader(pStream)
+{
+}
+
+ZipResult ZipStreamReader::Run(ZipStreamHandler &handler)
+{
+    bool fFirst = true;
+    for (;;)
+    {
+        ZipResult result = m_reader.Fill(4);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+        if (m_reader.Available() < 4)
+        {
+            // The stream ended without a central directory.
+            return ZR_TRUNCATED;
+        }
+
+        uint32_t sig = ReadLE32(m_reader.Data());
+        if (sig == ZIP_SIG_LOCAL_HEADER)
+        {
+            result = ReadEntry(handler);
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+        }
+        else if (fFirst && (sig == ZIP_SIG_DATA_DESCRIPTOR || sig == ZIP_SIG_SPANNING_MARKER))
+        {
+            // Split and spanning archives may start with a marker.
+            m_reader.Consume(4);
+        }
+        else if (IsRecordSignature(sig))
+        {
+            // Everything after the last entry is directory information.
+            while (!m_reader.AtEnd())
+            {
+                m_reader.Consume(m_reader.Available());
+                result = m_reader.Fill(m_reader.Capacity());
+                if (result != ZR_OK)
+                {
+                    return result;
+                }
+            }
+            return ZR_OK;
+        }
+        else
+        {
+            return ZR_BAD_FORMAT;
+        }
+        fFirst = false;
+    }
+}
+
+ZipResult ZipStreamReader::ReadEntry(ZipStreamHandler &handler)
+{
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    ZipResult result = m_reader.ReadExact(header, sizeof(header));
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    ZipEntryInfo entry;
+    entry.flags = ReadLE16(header + 6);
+    entry.method = ReadLE16(header + 8);
+    entry.dosTime = ReadLE16(header + 10);
+    entry.dosDate = ReadLE16(header + 12);
+    entry.crc32 = ReadLE32(header + 14);
+    entry.compressedSize = ReadLE32(header + 18);
+    entry.uncompressedSize = ReadLE32(header + 22);
+    entry.localHeaderOffset = m_reader.Position() - ZIP_LOCAL_HEADER_SIZE;
+    size_t cbName = ReadLE16(header + 26);
+    size_t cbExtra = ReadLE16(header + 28);
+
+    entry.name.resize(cbName);
+    std::vector<uint8_t> extra(cbExtra);
+    if (cbName > 0)
+    {
+        result = m_reader.ReadExact(&entry.name[0], cbName);
+    }
+    if (result == ZR_OK && cbExtra > 0)
+    {
+        result = m_reader.ReadExact(&extra[0], cbExtra);
+    }
+    bool fZip64 = false;
+    if (result == ZR_OK)
+    {
+        const uint8_t *pExtra = extra.empty() ? NULL : &extra[0];
+        DecodeEntryName(pExtra, cbExtra, entry);
+        ParseTimestampExtra(pExtra, cbExtra, entry);
+        result = ParseZip64Extra(pExtra, cbExtra, entry, true, &fZip64);
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    bool fDescriptor = (entry.flags & ZIP_FLAG_DATA_DESCRIPTOR) != 0;
+    bool fSupported = (entry.flags & (ZIP_FLAG_ENCRYPTED | ZIP_FLAG_STRONG_ENCRYPTION)) == 0 &&
+        (entry.method == ZIP_METHOD_STORED || entry.method == ZIP_METHOD_DEFLATED);
+
+    if (!fSupported)
+    {
+        // Without decoding the data, its end can only be found if the
+        // local header recorded the size.
+        if (fDescriptor)
+        {
+            return ZR_UNSUPPORTED;
+        }
+        result = m_reader.Skip(entry.compressedSize);
+        if (result == ZR_OK)
+        {
+            result = handler.EndEntry(entry, ZR_UNSUPPORTED);
+        }
+        return result;
+    }
+
+    InflateSink *pSink = NULL;
+    result = handler.BeginEntry(entry, &pSink);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    ChecksumSink checksum(pSink);
+    uint64_t start = m_reader.Position();
+    bool fScanned = false;
+
+    if (entry.method == ZIP_METHOD_DEFLATED)
+    {
+        result = m_inflater.Inflate(m_reader, checksum);
+        if (result == ZR_OK && !fDescriptor &&
+            m_reader.Position() - start != entry.compressedSize)
+        {
+            result = ZR_BAD_FORMAT;
+        }
+    }
+    else if (fDescriptor && entry.compressedSize == 0)
+    {
+        result = CopyUntilDescriptor(checksum, entry, fZip64);
+        fScanned = true;
+    }
+    else
+    {
+        result = CopyKnownSize(entry.compressedSize, checksum);
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    if (fDescriptor && !fScanned)
+    {
+        entry.compressedSize = m_reader.Position() - start;
+        entry.uncompressedSize = checksum.Count();
+        result = ReadDataDescriptor(entry, fZip64);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+
+    ZipResult entryResult = ZR_OK;
+    if (entry.crc32 != checksum.Crc() || entry.uncompressedSize != checksum.Count())
+    {
+        entryResult = ZR_CRC_MISMATCH;
+    }
+    return handler.EndEntry(entry, entryResult);
+}
+
+ZipResult ZipStreamReader::CopyKnownSize(uint64_t cb, InflateSink &sink)
+{
+    while (cb > 0)
+    {
+        if (m_reader.Available() == 0)
+        {
+            ZipResult result = m_reader.Fill(m_reader.Capacity());
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            if (m_reader.Available() == 0)
+            {
+                return ZR_TRUNCATED;
+            }
+        }
+        size_t cbChunk = (size_t)std::min<uint64_t>(cb, m_reader.Available());
+        ZipResult result = sink.Write(m_reader.Data(), cbChunk);
+        m_reader.Consume(cbChunk);
+        cb -= cbChunk;
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+    return ZR_OK;
+}
+
+//
+//   FUNCTION: ZipStreamReader::CopyUntilDescriptor
+//
+//   PURPOSE: Copy a stored entry whose size is only recorded in the data
+//   descriptor that follows it. Every "PK" in the data is a candidate end:
+//   either a descriptor signature, or the signature of the next record with
+//   an unsigned descriptor right in front of it. A candidate is accepted
+//   when both sizes equal the number of bytes before it, another record
+//   follows it and the CRC equals the CRC of those bytes, which stored
+//   archives nested inside the entry do not satisfy by accident.
+//
+//   On success the descriptor has been consumed and the entry fields hold
+//   its values.
+//
+ZipResult ZipStreamReader::CopyUntilDescriptor(InflateSink &sink,
+    ZipEntryInfo &entry, bool fZip64)
+{
+    uint32_t crc = 0;
+    uint64_t cbDone = 0;
+
+    for (;;)
+    {
+        ZipResult result = m_reader.Fill(std::min(kScanChunk, m_reader.Capacity()));
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+
+        const uint8_t *p = m_reader.Data();
+        size_t avail = m_reader.Available();
+        bool fEof = avail < std::min(kScanChunk, m_reader.Capacity());
+
+        // CRC of p[0..crcPos), folded onto the CRC of the earlier bytes.
+        // Candidates mostly move forward, so this is usually incremental.
+        uint32_t crcRun = crc;
+        size_t crcPos = 0;
+
+        size_t limit = avail >= 4 ? avail - 3 : 0;
+        for (size_t i = FindRecordMarker(p, 0, avail); i < limit;
+            i = FindRecordMarker(p, i + 1, avail))
+        {
+            uint32_t sig = ReadLE32(p + i);
+
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                bool fWide = (pass == 0) == fZip64;
+                size_t cbSizes = fWide ? 16 : 8;
+                size_t dataEnd, fieldsPos, cbDescriptor;
+
+                if (sig == ZIP_SIG_DATA_DESCRIPTOR)
+                {
+                    dataEnd = i;
+                    fieldsPos = i + 4;
+                    cbDescriptor = 4 + 4 + cbSizes;
+                }
+                else if (IsRecordSignature(sig) && i >= 4 + cbSizes)
+                {
+                    dataEnd = i - 4 - cbSizes;
+                    fieldsPos = dataEnd;
+                    cbDescriptor = 4 + cbSizes;
+                }
+                else
+                {
+                    continue;
+                }
+                if (fieldsPos + 4 + cbSizes > avail)
+                {
+                    continue;
+                }
+
+                const uint8_t *pFields = p + fieldsPos;
+                uint64_t cbCompressed = fWide ? ReadLE64(pFields + 4) : ReadLE32(pFields + 4);
+                uint64_t cbUncompressed = fWide ? ReadLE64(pFields + 12) : ReadLE32(pFields + 8);
+                if (cbCompressed != cbDone + dataEnd || cbUncompressed != cbCompressed ||
+                    !FollowedByRecord(p, avail, dataEnd + cbDescriptor))
+                {
+                    continue;
+                }
+
+                if (dataEnd < crcPos)
+                {
+                    crcRun = crc;
+                    crcPos = 0;
+                }
+                crcRun = Crc32Update(crcRun, p + crcPos, dataEnd - crcPos);
+                crcPos = dataEnd;
+                if (crcRun != ReadLE32(pFields))
+                {
+                    continue;
+                }
+
+                result = sink.Write(p, dataEnd);
+                m_reader.Consume(dataEnd + cbDescriptor);
+                entry.crc32 = crcRun;
+                entry.compressedSize = cbCompressed;
+                entry.uncompressedSize = cbUncompressed;
+                return result;
+            }
+        }
+
+        if (fEof)
+        {
+            return ZR_TRUNCATED;
+        }
+
+        // Nothing matched. Emit all but the tail that could still be the
+        // start of a descriptor for a signature in the next chunk.
+        size_t cbEmit = avail - kDescriptorLookahead;
+        crc = Crc32Update(crc, p, cbEmit);
+        cbDone += cbEmit;
+        result = sink.Write(p, cbEmit);
+        m_reader.Consume(cbEmit);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+    }
+}
+
+//
+//   FUNCTION: ZipStreamReader::ReadDataDescriptor
+//
+//   PURPOSE: Consume the data descriptor after an entry whose compressed
+//   and uncompressed sizes are already known from decoding it, and store
+//   the recorded CRC-32 in the entry. The descriptor width is taken from
+//   whichever interpretation matches the sizes and is followed by another
+//   record, trying 8-byte sizes first if the local header had a ZIP64
+//   extra field.
+//
+ZipResult ZipStreamReader::ReadDataDescriptor(ZipEntryInfo &entry, bool fZip64)
+{
+    ZipResult result = m_reader.Fill(kDescriptorLookahead);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    const uint8_t *p = m_reader.Data();
+    size_t avail = m_reader.Available();
+    size_t pos = 0;
+    if (avail >= 4 && ReadLE32(p) == ZIP_SIG_DATA_DESCRIPTOR)
+    {
+        pos = 4;
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        bool fWide = (pass == 0) == fZip64;
+        size_t cbDescriptor = 4 + (fWide ? 16 : 8);
+        if (pos + cbDescriptor > avail)
+        {
+            continue;
+        }
+
+        const uint8_t *pFields = p + pos;
+        uint64_t cbCompressed = fWide ? ReadLE64(pFields + 4) : ReadLE32(pFields + 4);
+        uint64_t cbUncompressed = fWide ? ReadLE64(pFields + 12) : ReadLE32(pFields + 8);
+        if (cbCompressed == entry.compressedSize &&
+            cbUncompressed == entry.uncompressedSize &&
+            FollowedByRecord(p, avail, pos + cbDescriptor))
+        {
+            entry.crc32 = ReadLE32(pFields);
+            m_reader.Consume(pos + cbDescriptor);
+            return ZR_OK;
+        }
+    }
+
+    return avail < pos + 12 ? ZR_TRUNCATED : ZR_BAD_FORMAT;
+}
+
+#pragma endregion
+
+
+#pragma region ZipStreamExtractor
+
+ZipStreamExtractor::ZipStreamExtractor(const NativePath &destDir) :
+    m_destDir(destDir), m_fSkipped(false)
+{
+}
+
+ZipResult ZipStreamExtractor::Extract(ZipInputStream *pStream)
+{
+    ZipResult result = CreateDirectoryTree(m_destDir);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+
+    ZipStreamReader reader(pStream);
+    result = reader.Run(*this);
+    m_sink.file.Close();
+    if (result == ZR_OK)
+    {
+        RestoreMetadata();
+    }
+    m_files.clear();
+    m_directories.clear();
+    if (result == ZR_OK && m_fSkipped)
+    {
+        result = ZR_UNSUPPORTED;
+    }
+    return result;
+}
+
+ZipResult ZipStreamExtractor::BeginEntry(const ZipEntryInfo &entry, InflateSink **ppSink)
+{
+    NativePath relative;
+    ZipResult result = EntryNameToRelativePath(entry, &relative);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    NativePath path = JoinPath(m_destDir, relative);
+
+    ZipFileMetadata metadata;
+    GetEntryMetadata(entry, &metadata);
+    if (entry.IsDirectory())
+    {
+        result = CreateDirectoryTree(path);
+        if (result == ZR_OK)
+        {
+            m_directories.push_back(std::make_pair(path, metadata));
+        }
+        return result;
+    }
+
+    // Entries of one directory are usually stored together, so remembering
+    // the last parent avoids most of the repeated directory checks.
+    size_t sep = path.find_last_of(ZIP_NATIVE_SEPARATOR);
+    NativePath parent = path.substr(0, sep);
+    if (parent != m_lastParent)
+    {
+        result = CreateDirectoryTree(parent);
+        if (result != ZR_OK)
+        {
+            return result;
+        }
+        m_lastParent = parent;
+    }
+
+    result = m_sink.file.Create(path);
+    if (result == ZR_OK)
+    {
+        *ppSink = &m_sink;
+        m_files.push_back(std::make_pair(path, metadata));
+    }
+    return result;
+}
+
+ZipResult ZipStreamExtractor::EndEntry(const ZipEntryInfo &entry, ZipResult result)
+{
+    (void)entry;
+    m_sink.file.Close();
+
+    // Entries we cannot decode are skipped; the rest of the archive is
+    // still extracted and the caller is told afterwards.
+    if (result == ZR_UNSUPPORTED)
+    {
+        m_fSkipped = true;
+        return ZR_OK;
+    }
+    return result;
+}
+
+void ZipStreamExtractor::RestoreMetadata()
+{
+    // Local headers carry no attributes, but the times are there. An entry
+    // that came twice gets the metadata of the later one, which also wrote
+    // the data.
+    for (size_t i = 0; i < m_files.size(); i++)
+    {
+        ApplyMetadata(-1, NativePath(), m_files[i].first, false, m_files[i].second);
+    }
+
+    // A directory's path sorts after its parent's, so in reverse order
+    // each is done before the directory holding it. Stable, so of several
+    // entries for one directory the last is applied last.
+    std::stable_sort(m_directories.begin(), m_directories.end(),
+        [](const MetadataList::value_type &a, const MetadataList::value_type &b)
+    {
+        return a.first > b.first;
+    });
+    for (size_t i = 0; i < m_directories.size(); i++)
+    {
+        ApplyMetadata(-1, NativePath(), m_directories[i].first, true,
+            m_directories[i].second);
+    }
+}
+
+#pragma endregion
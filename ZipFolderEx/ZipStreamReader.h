@@ -0,0 +1,106 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipStreamReader.h
+Project:      ZipFolderEx
+
+The file declares the forward-only (streaming) archive reader.
+
+ZipStreamReader walks the local file headers of an archive that arrives on
+a non-seekable stream such as a pipe or a download, without ever looking at
+the central directory. Entries written with general purpose bit 3 carry
+their sizes and CRC in a data descriptor after the data:
+
+  * deflated entries are decoded until the deflate stream ends, and the
+    descriptor that follows is checked against the bytes actually read;
+  * stored entries of unknown size are scanned for a descriptor whose CRC
+    and sizes match the data in front of it;
+  * 32-bit and ZIP64 (8-byte) descriptors, with or without the optional
+    signature, are both recognised.
+
+ZipStreamExtractor uses the reader to write the entries under a directory.
+It remembers the path and metadata of each entry it writes and restores
+their times and attributes once the stream has ended (see ZipMetadata.h).
+\***************************************************************************/
+
+#pragma once
+
+#include "Inflate.h"
+#include "ZipMetadata.h"
+
+
+class ZipStreamHandler
+{
+public:
+    virtual ~ZipStreamHandler() {}
+
+    // Called for each local header. Set *ppSink to receive the entry data,
+    // or leave it NULL to skip the entry.
+    virtual ZipResult BeginEntry(const ZipEntryInfo &entry, InflateSink **ppSink) = 0;
+
+    // Called once the data and any data descriptor have been consumed. The
+    // entry holds the sizes and CRC-32 found in the stream; result is ZR_OK,
+    // ZR_CRC_MISMATCH, or ZR_UNSUPPORTED for an entry that was skipped.
+    // Returning anything other than ZR_OK stops the reader.
+    virtual ZipResult EndEntry(const ZipEntryInfo &entry, ZipResult result) = 0;
+};
+
+
+class ZipStreamReader
+{
+public:
+    explicit ZipStreamReader(ZipInputStream *pStream);
+
+    //
+    //   FUNCTION: ZipStreamReader::Run
+    //
+    //   PURPOSE: Walk the stream up to the central directory, passing each
+    //   entry to the handler. The rest of the stream is drained so that a
+    //   process writing into the pipe does not fail on a closed reader.
+    //
+    ZipResult Run(ZipStreamHandler &handler);
+
+private:
+    ZipResult ReadEntry(ZipStreamHandler &handler);
+    ZipResult CopyKnownSize(uint64_t cb, InflateSink &sink);
+    ZipResult CopyUntilDescriptor(InflateSink &sink, ZipEntryInfo &entry, bool fZip64);
+    ZipResult ReadDataDescriptor(ZipEntryInfo &entry, bool fZip64);
+
+    BufferedReader m_reader;
+    Inflater m_inflater;
+};
+
+
+class ZipStreamExtractor : private ZipStreamHandler
+{
+public:
+    explicit ZipStreamExtractor(const NativePath &destDir);
+
+    // Extract every entry of the stream under the destination directory.
+    // Entries that use an unsupported method or encryption are skipped and
+    // reported as ZR_UNSUPPORTED once the rest has been extracted.
+    ZipResult Extract(ZipInputStream *pStream);
+
+private:
+    virtual ZipResult BeginEntry(const ZipEntryInfo &entry, InflateSink **ppSink);
+    virtual ZipResult EndEntry(const ZipEntryInfo &entry, ZipResult result);
+
+    class FileSink : public InflateSink
+    {
+    public:
+        NativeFile file;
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            return file.Write(pb, cb);
+        }
+    };
+
+    typedef std::vector<std::pair<NativePath, ZipFileMetadata> > MetadataList;
+
+    void RestoreMetadata();
+
+    NativePath m_destDir;
+    NativePath m_lastParent;
+    FileSink m_sink;
+    bool m_fSkipped;
+    MetadataList m_files;
+    MetadataList m_directories;
+};
@@ -0,0 +1,64 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipThreadPool.cpp
+Project:      ZipFolderEx
+
+The file implements the worker thread pool declared in ZipThreadPool.h.
+\***************************************************************************/
+
+#include "ZipThreadPool.h"
+#include <algorithm>
+
+
+ZipThreadPool::ZipThreadPool(unsigned cThreads) : m_fStop(false)
+{
+    if (cThreads == 0)
+    {
+        cThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (unsigned i = 0; i < cThreads; i++)
+    {
+        m_threads.push_back(std::thread(&ZipThreadPool::WorkerThread, this));
+    }
+}
+
+ZipThreadPool::~ZipThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_fStop = true;
+    }
+    m_cvWork.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i].join();
+    }
+}
+
+void ZipThreadPool::Post(const std::function<void()> &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_tasks.push_back(task);
+    }
+    m_cvWork.notify_one();
+}
+
+void ZipThreadPool::WorkerThread()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    for (;;)
+    {
+        m_cvWork.wait(lock, [this] { return m_fStop || !m_tasks.empty(); });
+        if (m_tasks.empty())
+        {
+            break;
+        }
+        std::function<void()> task;
+        task.swap(m_tasks.front());
+        m_tasks.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
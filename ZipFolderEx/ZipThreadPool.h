@@ -0,0 +1,49 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipThreadPool.h
+Project:      ZipFolderEx
+
+The file declares a fixed set of long-lived worker threads that run posted
+tasks in order.
+
+A ZipExtractor normally starts its worker threads for each Extract call,
+which is fine for one archive but adds thread start-up to every job of a
+process that extracts many. Given a pool, the extractor posts its workers
+to the pool instead, so a long-running process (the extraction service)
+keeps its threads warm across jobs.
+\***************************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+class ZipThreadPool
+{
+public:
+    // Start cThreads threads; 0 starts one per processor.
+    explicit ZipThreadPool(unsigned cThreads = 0);
+
+    // Runs the tasks already posted, then stops the threads.
+    ~ZipThreadPool();
+
+    unsigned ThreadCount() const { return (unsigned)m_threads.size(); }
+
+    void Post(const std::function<void()> &task);
+
+private:
+    ZipThreadPool(const ZipThreadPool &);
+    ZipThreadPool &operator=(const ZipThreadPool &);
+
+    void WorkerThread();
+
+    std::mutex m_lock;
+    std::condition_variable m_cvWork;
+    std::deque<std::function<void()> > m_tasks;
+    bool m_fStop;
+    std::vector<std::thread> m_threads;
+};
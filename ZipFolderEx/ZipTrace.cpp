@@ -0,0 +1,161 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipTrace.cpp
+Project:      ZipFolderEx
+
+The file implements the span rings and the Chrome trace writer declared in
+ZipTrace.h.
+\***************************************************************************/
+
+#include "ZipTrace.h"
+#include "ZipArchive.h"
+#include <stdio.h>
+
+
+namespace
+{
+    // Entry names are raw archive bytes in whatever code page the archive
+    // used; bytes outside ASCII are written as U+0080..U+00FF so the
+    // document stays valid JSON whatever the encoding.
+    void AppendJsonString(std::string &out, const std::string &text)
+    {
+        out += '"';
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            unsigned char c = (unsigned char)text[i];
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += (char)c;
+            }
+            else if (c < 0x20 || c >= 0x80)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out += escape;
+            }
+            else
+            {
+                out += (char)c;
+            }
+        }
+        out += '"';
+    }
+
+    // Chrome trace timestamps are microseconds.
+    void AppendMicroseconds(std::string &out, uint64_t ns)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%llu.%03u",
+            (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+        out += buffer;
+    }
+}
+
+
+ZipTraceBuffer::ZipTraceBuffer(const std::string &name, size_t cEvents) :
+    m_name(name), m_head(0)
+{
+    size_t cSlots = 1;
+    while (cSlots < cEvents)
+    {
+        cSlots <<= 1;
+    }
+    m_events.resize(cSlots);
+    m_mask = cSlots - 1;
+}
+
+uint64_t ZipTraceBuffer::Snapshot(std::vector<ZipTraceEvent> *pEvents) const
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t first = head > m_events.size() ? head - m_events.size() : 0;
+    pEvents->clear();
+    pEvents->reserve((size_t)(head - first));
+    for (uint64_t i = first; i < head; i++)
+    {
+        pEvents->push_back(m_events[(size_t)(i & m_mask)]);
+    }
+    return first;
+}
+
+
+ZipTracer::ZipTracer(size_t cEventsPerThread) :
+    m_cEventsPerThread(cEventsPerThread), m_origin(ZipStatsNow())
+{
+}
+
+ZipTraceBuffer *ZipTracer::AddThread(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_threads.push_back(std::unique_ptr<ZipTraceBuffer>(
+        new ZipTraceBuffer(name, m_cEventsPerThread)));
+    return m_threads.back().get();
+}
+
+std::string ZipTracer::ToJson(const ZipArchive *pArchive) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    uint64_t cDropped = 0;
+    bool fFirst = true;
+    std::vector<ZipTraceEvent> events;
+
+    for (size_t t = 0; t < m_threads.size(); t++)
+    {
+        char tid[32];
+        snprintf(tid, sizeof(tid), "%u", (unsigned)(t + 1));
+
+        out += fFirst ? "" : ",\n";
+        fFirst = false;
+        out += "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": ";
+        out += tid;
+        out += ", \"args\": {\"name\": ";
+        AppendJsonString(out, m_threads[t]->Name());
+        out += "}}";
+
+        cDropped += m_threads[t]->Snapshot(&events);
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            const ZipTraceEvent &event = events[i];
+            bool fEntry = event.kind == ZIP_TRACE_ENTRY;
+            out += ",\n{\"name\": ";
+            if (fEntry && pArchive != NULL && event.entry < pArchive->EntryCount())
+            {
+                AppendJsonString(out, pArchive->Entry(event.entry).name);
+            }
+            else
+            {
+                AppendJsonString(out, fEntry ? "entry" : ZipStageName((ZipStage)event.kind));
+            }
+            out += fEntry ? ", \"cat\": \"entry\"" : ", \"cat\": \"stage\"";
+            out += ", \"ph\": \"X\", \"pid\": 1, \"tid\": ";
+            out += tid;
+            out += ", \"ts\": ";
+            AppendMicroseconds(out, event.start > m_origin ? event.start - m_origin : 0);
+            out += ", \"dur\": ";
+            AppendMicroseconds(out, event.duration);
+
+            char args[48];
+            snprintf(args, sizeof(args), ", \"args\": {\"entry\": %u}}", event.entry);
+            out += args;
+        }
+    }
+
+    char tail[64];
+    snprintf(tail, sizeof(tail), "\n], \"otherData\": {\"dropped\": %llu}}\n",
+        (unsigned long long)cDropped);
+    out += tail;
+    return out;
+}
+
+ZipResult ZipTracer::Save(const NativePath &path, const ZipArchive *pArchive) const
+{
+    std::string json = ToJson(pArchive);
+    NativeFile file;
+    ZipResult result = file.Create(path);
+    if (result == ZR_OK)
+    {
+        result = file.Write(json.data(), json.size());
+    }
+    file.Close();
+    return result;
+}
@@ -0,0 +1,112 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipTrace.h
+Project:      ZipFolderEx
+
+The file declares an opt-in timeline recorder for the extractor that writes
+the Chrome trace event format, which chrome://tracing and the Perfetto UI
+load directly.
+
+Each worker thread gets a ZipTraceBuffer, a fixed size ring of spans that
+only that thread writes. Appending a span is a store into the next slot and
+a release store of the head index, so recording takes no lock and never
+waits on another thread. When a ring is full the oldest spans are
+overwritten and counted as dropped. The spans are the same stage timings
+ZipStats.h collects, plus one span per entry, so nested stages show up as
+a stack under the entry they belong to.
+
+ZipTracer owns the rings and formats them. Read it only after the threads
+that write to it have finished.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipStats.h"
+#include "ZipIo.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+class ZipArchive;
+
+
+// Span kinds below ZS_COUNT are stages; this one covers a whole entry.
+const uint16_t ZIP_TRACE_ENTRY = ZS_COUNT;
+
+
+struct ZipTraceEvent
+{
+    uint64_t start;         // ZipStatsNow() at the start of the span
+    uint64_t duration;      // nanoseconds
+    uint32_t entry;         // archive entry index
+    uint16_t kind;          // a ZipStage or ZIP_TRACE_ENTRY
+};
+
+
+class ZipTraceBuffer
+{
+public:
+    ZipTraceBuffer(const std::string &name, size_t cEvents);
+
+    // Append a span. Only the owning thread may call this.
+    void Add(uint64_t start, uint64_t duration, uint16_t kind, uint32_t entry)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        ZipTraceEvent &event = m_events[(size_t)(head & m_mask)];
+        event.start = start;
+        event.duration = duration;
+        event.entry = entry;
+        event.kind = kind;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    const std::string &Name() const { return m_name; }
+
+    // Copy the spans still in the ring, oldest first. Returns how many
+    // were overwritten.
+    uint64_t Snapshot(std::vector<ZipTraceEvent> *pEvents) const;
+
+private:
+    ZipTraceBuffer(const ZipTraceBuffer &);
+    ZipTraceBuffer &operator=(const ZipTraceBuffer &);
+
+    std::string m_name;
+    std::vector<ZipTraceEvent> m_events;
+    uint64_t m_mask;
+    std::atomic<uint64_t> m_head;
+};
+
+
+class ZipTracer
+{
+public:
+    //
+    //   FUNCTION: ZipTracer::ZipTracer
+    //
+    //   PURPOSE: Record up to cEventsPerThread spans per thread, rounded up
+    //   to a power of two, before the oldest are overwritten.
+    //
+    explicit ZipTracer(size_t cEventsPerThread = 64 * 1024);
+
+    // Create the ring for a new thread. The tracer keeps ownership.
+    ZipTraceBuffer *AddThread(const std::string &name);
+
+    //
+    //   FUNCTION: ZipTracer::ToJson
+    //
+    //   PURPOSE: Format every recorded span as a Chrome trace JSON
+    //   document. If pArchive is not NULL, entry spans are labelled with
+    //   the entry names.
+    //
+    std::string ToJson(const ZipArchive *pArchive) const;
+
+    ZipResult Save(const NativePath &path, const ZipArchive *pArchive) const;
+
+private:
+    ZipTracer(const ZipTracer &);
+    ZipTracer &operator=(const ZipTracer &);
+
+    size_t m_cEventsPerThread;
+    uint64_t m_origin;
+    mutable std::mutex m_lock;
+    std::vector<std::unique_ptr<ZipTraceBuffer> > m_threads;
+};
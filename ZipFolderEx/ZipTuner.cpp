@@ -0,0 +1,131 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipTuner.cpp
+Project:      ZipFolderEx
+
+The file implements the worker count controller declared in ZipTuner.h.
+\***************************************************************************/
+
+#include "ZipTuner.h"
+#include <algorithm>
+
+
+namespace
+{
+    // Time between samples. Long enough for a disk to show its rate with
+    // the new count, short enough that a job of a few seconds is tuned.
+    const uint64_t kSampleNs = 250 * 1000 * 1000;
+
+    // A sample with less done than this is mostly noise; wait longer.
+    const uint64_t kMinSampleFiles = 16;
+    const uint64_t kMinSampleBytes = 4 * 1024 * 1024;
+
+    // The work a file costs besides its bytes: creating, opening and
+    // closing it take about as long as writing this much.
+    const uint64_t kFileCost = 64 * 1024;
+
+    // Changes in rate smaller than this are taken as noise.
+    const double kMargin = 0.05;
+
+    // Samples to stay put after stepping back from a worse count.
+    const unsigned kSettleSamples = 4;
+
+    // Steps logged per job; a long job keeps only the first ones.
+    const size_t kMaxSteps = 1024;
+}
+
+
+ZipTuner::ZipTuner() :
+    m_cMax(1), m_cWorkers(1), m_direction(1), m_cHold(0), m_fMoved(false), m_start(0),
+    m_nextSample(0), m_lastTime(0), m_lastBytes(0), m_lastFiles(0), m_lastRate(0)
+{
+}
+
+unsigned ZipTuner::Start(unsigned cMax, uint64_t now)
+{
+    m_cMax = std::max(cMax, 1u);
+    m_cWorkers = (m_cMax + 1) / 2;
+    m_direction = 1;
+    m_cHold = 0;
+    m_fMoved = false;
+    m_start = now;
+    m_nextSample = now + kSampleNs;
+    m_lastTime = now;
+    m_lastBytes = 0;
+    m_lastFiles = 0;
+    m_lastRate = 0;
+    m_steps.clear();
+    return m_cWorkers;
+}
+
+unsigned ZipTuner::Move(int direction)
+{
+    unsigned cNext = m_cWorkers + direction;
+    if (cNext < 1 || cNext > m_cMax)
+    {
+        // At the end of the range; the next probe goes the other way.
+        m_direction = -direction;
+        return m_cWorkers;
+    }
+    m_direction = direction;
+    return cNext;
+}
+
+unsigned ZipTuner::Sample(uint64_t now, uint64_t cbDone, uint64_t cFilesDone)
+{
+    if (now < m_nextSample || m_cMax < 2)
+    {
+        return m_cWorkers;
+    }
+    uint64_t cb = cbDone - m_lastBytes;
+    uint64_t cFiles = cFilesDone - m_lastFiles;
+    if (cFiles < kMinSampleFiles && cb < kMinSampleBytes)
+    {
+        m_nextSample = now + kSampleNs / 4;
+        return m_cWorkers;
+    }
+
+    double seconds = (double)(now - m_lastTime) / 1e9;
+    double rate = (double)(cb + cFiles * kFileCost) / seconds;
+    unsigned cNext = m_cWorkers;
+    if (m_cHold > 0)
+    {
+        m_cHold--;
+    }
+    else if (!m_fMoved || rate > m_lastRate * (1 + kMargin))
+    {
+        // Probe from where it settled, or keep going the way that helped.
+        cNext = Move(m_direction);
+    }
+    else if (rate < m_lastRate * (1 - kMargin) || m_direction > 0)
+    {
+        // Worse, or one more worker did not help: step back and stay.
+        cNext = Move(-m_direction);
+        m_cHold = kSettleSamples;
+    }
+    else
+    {
+        // One fewer worker did as well; try fewer still.
+        cNext = Move(-1);
+    }
+
+    if (m_steps.size() < kMaxSteps)
+    {
+        ZipTuneStep step;
+        step.atNs = now - m_start;
+        step.cWorkers = m_cWorkers;
+        step.cNext = cNext;
+        step.cbPerSecond = (uint64_t)(cb / seconds);
+        step.filesPerSecond = (uint64_t)(cFiles / seconds);
+        step.entryUs = cFiles > 0 ? (uint64_t)(m_cWorkers * seconds * 1e6 / cFiles) : 0;
+        m_steps.push_back(step);
+    }
+
+    m_fMoved = cNext != m_cWorkers;
+    m_cWorkers = cNext;
+    m_lastTime = now;
+    m_lastBytes = cbDone;
+    m_lastFiles = cFilesDone;
+    m_lastRate = rate;
+    m_nextSample = now + kSampleNs;
+    return m_cWorkers;
+}
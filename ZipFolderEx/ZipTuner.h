@@ -0,0 +1,82 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipTuner.h
+Project:      ZipFolderEx
+
+The file declares the controller that picks how many extraction workers
+run at once.
+
+The best count depends on where the files go: a local SSD keeps getting
+faster with more writers, a spinning disk gets slower once its head has to
+move between them, and a network share is bound by round trips. Rather
+than guess, ZipTuner watches how much the workers get done and climbs
+towards the count that does the most. It starts at half the workers and,
+at each sample, tries one more or one fewer:
+
+  * if the rate rose by more than the noise margin, it keeps going the
+    same way;
+  * if the rate fell, it steps back and holds there for a while;
+  * if nothing changed, fewer workers are as good as more, so it moves
+    down, or steps back down after trying one more.
+
+Work is counted as bytes written plus a fixed cost per file, so archives
+of many small files, where the per-file calls dominate, are measured
+fairly too. The average entry latency follows from the rate and the
+number of workers (Little's law) and is logged with every decision.
+
+The tuner is not thread safe; the extractor lets one worker at a time
+take a sample.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipStats.h"
+#include <stdint.h>
+#include <vector>
+
+
+class ZipTuner
+{
+public:
+    ZipTuner();
+
+    //
+    //   FUNCTION: ZipTuner::Start
+    //
+    //   PURPOSE: Begin tuning a job that can run up to cMax workers, at
+    //   time now (ZipStatsNow). Returns the number of workers to start
+    //   with. Earlier steps are forgotten.
+    //
+    unsigned Start(unsigned cMax, uint64_t now);
+
+    // When the next sample is due.
+    uint64_t NextSample() const { return m_nextSample; }
+
+    //
+    //   FUNCTION: ZipTuner::Sample
+    //
+    //   PURPOSE: Take a sample at time now, given the bytes written and
+    //   files finished since Start, and return the number of workers to
+    //   run from now on. Does nothing before NextSample, and holds off a
+    //   sample until enough files are done to go on.
+    //
+    unsigned Sample(uint64_t now, uint64_t cbDone, uint64_t cFilesDone);
+
+    unsigned Workers() const { return m_cWorkers; }
+    const std::vector<ZipTuneStep> &Steps() const { return m_steps; }
+
+private:
+    unsigned Move(int direction);
+
+    unsigned m_cMax;
+    unsigned m_cWorkers;
+    int m_direction;            // +1 or -1, the way the last move went
+    unsigned m_cHold;           // samples left before moving again
+    bool m_fMoved;              // whether the last sample changed the count
+    uint64_t m_start;
+    uint64_t m_nextSample;
+    uint64_t m_lastTime;
+    uint64_t m_lastBytes;
+    uint64_t m_lastFiles;
+    double m_lastRate;          // work per second of the last sample, 0 if none
+    std::vector<ZipTuneStep> m_steps;
+};
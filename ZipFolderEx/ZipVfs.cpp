@@ -0,0 +1,313 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipVfs.cpp
+Project:      ZipFolderEx
+
+The file implements the read-only archive file system declared in ZipVfs.h.
+\***************************************************************************/
+
+#include "ZipVfs.h"
+#include "ZipPath.h"
+#include <string.h>
+#include <algorithm>
+
+
+namespace
+{
+    // Blocks decoded past the end of a read that missed the cache. Decoding
+    // resumes at a checkpoint, so a sequential reader that misses on every
+    // block would decode the same span over and over; reading ahead turns
+    // most of those misses into hits.
+    const uint64_t kReadAheadBlocks = 3;
+
+    const size_t kNoEntry = SIZE_MAX;
+
+    // Cuts decoded data into cache blocks and copies the part of each block
+    // that overlaps the caller's range. Stops after the last wanted block.
+    class BlockSink : public InflateSink
+    {
+    public:
+        BlockSink(BlockCache *pCache, uint64_t owner, uint64_t block,
+            uint64_t lastBlock, uint8_t *pDest, uint64_t offset, size_t cb) :
+            m_pCache(pCache), m_owner(owner), m_block(block),
+            m_lastBlock(lastBlock), m_pDest(pDest), m_offset(offset), m_cb(cb),
+            m_cbCopied(0)
+        {
+            m_buffer.reserve(pCache->BlockSize());
+        }
+
+        virtual ZipResult Write(const uint8_t *pb, size_t cb)
+        {
+            while (cb > 0)
+            {
+                size_t cbTake = std::min(cb, m_pCache->BlockSize() - m_buffer.size());
+                m_buffer.insert(m_buffer.end(), pb, pb + cbTake);
+                pb += cbTake;
+                cb -= cbTake;
+                if (m_buffer.size() == m_pCache->BlockSize())
+                {
+                    Flush();
+                    if (m_block > m_lastBlock)
+                    {
+                        return ZR_STOP;
+                    }
+                }
+            }
+            return ZR_OK;
+        }
+
+        // Store the short last block of an entry.
+        void Flush()
+        {
+            if (m_buffer.empty())
+            {
+                return;
+            }
+            m_pCache->Insert(m_owner, m_block, &m_buffer[0], m_buffer.size());
+
+            uint64_t start = m_block * m_pCache->BlockSize();
+            uint64_t end = start + m_buffer.size();
+            uint64_t copyStart = std::max(start, m_offset);
+            uint64_t copyEnd = std::min(end, m_offset + m_cb);
+            if (copyStart < copyEnd)
+            {
+                memcpy(m_pDest + (copyStart - m_offset), &m_buffer[copyStart - start],
+                    (size_t)(copyEnd - copyStart));
+                m_cbCopied += (size_t)(copyEnd - copyStart);
+            }
+
+            m_buffer.clear();
+            m_block++;
+        }
+
+        size_t Copied() const { return m_cbCopied; }
+
+    private:
+        BlockCache *m_pCache;
+        uint64_t m_owner;
+        uint64_t m_block;
+        uint64_t m_lastBlock;
+        uint8_t *m_pDest;
+        uint64_t m_offset;
+        size_t m_cb;
+        size_t m_cbCopied;
+        std::vector<uint8_t> m_buffer;
+    };
+}
+
+
+ZipVfs::ZipVfs(BlockCache *pCache, uint64_t cbCacheLimit) : m_pIndex(NULL),
+    m_pCache(pCache), m_fOwnCache(pCache == NULL), m_owner(0)
+{
+    if (m_fOwnCache)
+    {
+        m_pCache = new BlockCache(cbCacheLimit);
+    }
+}
+
+ZipVfs::~ZipVfs()
+{
+    delete m_pIndex;
+    if (m_fOwnCache)
+    {
+        delete m_pCache;
+    }
+}
+
+ZipResult ZipVfs::Mount(const NativePath &archivePath)
+{
+    delete m_pIndex;
+    m_pIndex = NULL;
+    m_nodes.clear();
+
+    // Blocks of the archive mounted before are cached under the old owner
+    // IDs; the new archive gets IDs of its own so that none of them is
+    // taken for its data. A private cache can drop them at once; in a
+    // shared one they age out.
+    if (m_fOwnCache)
+    {
+        m_pCache->Clear();
+    }
+    m_owner = m_pCache->NewOwnerRange();
+
+    ZipResult result = m_archive.Open(archivePath);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    m_pIndex = new ZipSeekIndex(&m_archive);
+    m_pIndex->Load();
+
+    AddNode(std::string(), true);
+    for (size_t i = 0; i < m_archive.EntryCount(); i++)
+    {
+        const ZipEntryInfo &entry = m_archive.Entry(i);
+        // Named as on extraction: "x/../y" is y, and a name that climbs out
+        // of the archive, or names nothing, is not shown.
+        std::string path;
+        if (NormalizeEntryName(entry.name, &path) != ZR_OK)
+        {
+            continue;
+        }
+
+        // A later entry of the same name replaces an earlier one, as it
+        // would on extraction. A name used for both a file and a directory
+        // keeps whichever kind came first, unless it is the parent of
+        // another entry, which makes it a directory.
+        Node &node = AddNode(path, entry.IsDirectory());
+        if (node.fDirectory == entry.IsDirectory())
+        {
+            node.entry = i;
+        }
+    }
+    return ZR_OK;
+}
+
+ZipVfs::Node &ZipVfs::AddNode(const std::string &path, bool fDirectory)
+{
+    std::unordered_map<std::string, Node>::iterator it = m_nodes.find(path);
+    if (it != m_nodes.end())
+    {
+        return it->second;
+    }
+
+    if (!path.empty())
+    {
+        size_t slash = path.rfind('/');
+        std::string parent = slash == std::string::npos ? std::string() : path.substr(0, slash);
+        Node &parentNode = AddNode(parent, true);
+        if (!parentNode.fDirectory)
+        {
+            // A file was already recorded under the parent's name; show the
+            // parent as a directory so that its children stay reachable.
+            parentNode.fDirectory = true;
+            parentNode.entry = kNoEntry;
+        }
+        parentNode.children.push_back(
+            slash == std::string::npos ? path : path.substr(slash + 1));
+    }
+
+    Node &node = m_nodes[path];
+    node.fDirectory = fDirectory;
+    node.entry = kNoEntry;
+    return node;
+}
+
+const ZipVfs::Node *ZipVfs::FindNode(const std::string &path) const
+{
+    std::string normal;
+    if (NormalizeEntryName(path, &normal, true) != ZR_OK)
+    {
+        return NULL;
+    }
+    std::unordered_map<std::string, Node>::const_iterator it = m_nodes.find(normal);
+    return it == m_nodes.end() ? NULL : &it->second;
+}
+
+ZipResult ZipVfs::Open(const std::string &path, ZipVfsFile *pFile)
+{
+    const Node *pNode = FindNode(path);
+    if (pNode == NULL)
+    {
+        return ZR_NOT_FOUND;
+    }
+    if (pNode->fDirectory)
+    {
+        return ZR_BAD_PATH;
+    }
+    *pFile = pNode->entry;
+    return ZR_OK;
+}
+
+ZipResult ZipVfs::Stat(const std::string &path, ZipVfsStat *pStat)
+{
+    const Node *pNode = FindNode(path);
+    if (pNode == NULL)
+    {
+        return ZR_NOT_FOUND;
+    }
+
+    memset(pStat, 0, sizeof(*pStat));
+    pStat->fDirectory = pNode->fDirectory;
+    if (pNode->entry != kNoEntry)
+    {
+        const ZipEntryInfo &entry = m_archive.Entry(pNode->entry);
+        pStat->size = pNode->fDirectory ? 0 : entry.uncompressedSize;
+        pStat->dosTime = entry.dosTime;
+        pStat->dosDate = entry.dosDate;
+        pStat->externalAttributes = entry.externalAttributes;
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipVfs::ReadDir(const std::string &path, std::vector<std::string> *pNames)
+{
+    const Node *pNode = FindNode(path);
+    if (pNode == NULL)
+    {
+        return ZR_NOT_FOUND;
+    }
+    if (!pNode->fDirectory)
+    {
+        return ZR_BAD_PATH;
+    }
+    *pNames = pNode->children;
+    return ZR_OK;
+}
+
+ZipResult ZipVfs::PRead(ZipVfsFile file, uint64_t offset, void *pv, size_t cb,
+    size_t *pcbRead)
+{
+    *pcbRead = 0;
+    const ZipEntryInfo &entry = m_archive.Entry(file);
+    if (offset >= entry.uncompressedSize || cb == 0)
+    {
+        return ZR_OK;
+    }
+    cb = (size_t)std::min<uint64_t>(cb, entry.uncompressedSize - offset);
+
+    // Stored data is read in place; the operating system already caches it.
+    if (entry.method == ZIP_METHOD_STORED)
+    {
+        return m_pIndex->Read(file, offset, pv, cb, pcbRead);
+    }
+
+    uint8_t *pDest = (uint8_t *)pv;
+    uint64_t cbBlock = m_pCache->BlockSize();
+    uint64_t firstBlock = offset / cbBlock;
+    uint64_t lastBlock = (offset + cb - 1) / cbBlock;
+
+    for (uint64_t block = firstBlock; block <= lastBlock; block++)
+    {
+        uint64_t start = std::max(block * cbBlock, offset);
+        uint64_t end = std::min((block + 1) * cbBlock, offset + cb);
+        if (!m_pCache->Read(m_owner + file, block, (size_t)(start - block * cbBlock),
+            pDest + (start - offset), (size_t)(end - start)))
+        {
+            // Decode the rest of the range in one go, refreshing any blocks
+            // of it that are still cached.
+            ZipResult result = FillBlocks(file, block, lastBlock + kReadAheadBlocks,
+                pDest + (start - offset), start, (size_t)(offset + cb - start));
+            if (result != ZR_OK)
+            {
+                return result;
+            }
+            break;
+        }
+    }
+
+    *pcbRead = cb;
+    return ZR_OK;
+}
+
+ZipResult ZipVfs::FillBlocks(ZipVfsFile file, uint64_t firstBlock, uint64_t lastBlock,
+    uint8_t *pDest, uint64_t offset, size_t cb)
+{
+    BlockSink sink(m_pCache, m_owner + file, firstBlock, lastBlock, pDest, offset, cb);
+    ZipResult result = m_pIndex->ReadStream(file, firstBlock * m_pCache->BlockSize(), sink);
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    sink.Flush();
+    return sink.Copied() == cb ? ZR_OK : ZR_TRUNCATED;
+}
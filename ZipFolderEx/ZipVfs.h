@@ -0,0 +1,102 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipVfs.h
+Project:      ZipFolderEx
+
+The file declares a read-only, in-process file system view of an archive.
+
+ZipVfs lets a tool open, stat, list and read the members of an archive by
+path as if they were files on disk, without extracting them first. Paths
+use '/' as the separator and are the entry names normalised as they are
+for extraction (see NormalizeEntryName): empty and "." components are
+ignored and ".." removes the component before it, so "x/../y" is y, and
+entries that climb out of the archive are not shown.
+Directories that only exist implicitly, as the parent of some entry, are
+listed as well.
+
+Reads of deflated entries go through a ZipSeekIndex, so a read far into a
+large entry resumes from a nearby checkpoint, and through a BlockCache of
+decompressed blocks, so repeated reads of the same region are a memcpy.
+Several ZipVfs instances may share one BlockCache to put a single memory
+cap on all open archives.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipSeekIndex.h"
+#include "BlockCache.h"
+
+
+struct ZipVfsStat
+{
+    bool fDirectory;
+    uint64_t size;
+    uint16_t dosTime;
+    uint16_t dosDate;
+    uint32_t externalAttributes;
+};
+
+
+// An open file: the index of its entry in the archive. Files need no
+// per-open state, so there is nothing to close.
+typedef size_t ZipVfsFile;
+
+
+class ZipVfs
+{
+public:
+    //
+    //   FUNCTION: ZipVfs::ZipVfs
+    //
+    //   PURPOSE: Create a view that caches decompressed blocks in pCache, or
+    //   in a private cache of cbCacheLimit bytes when pCache is NULL.
+    //
+    explicit ZipVfs(BlockCache *pCache = NULL, uint64_t cbCacheLimit = 64 * 1024 * 1024);
+    ~ZipVfs();
+
+    // Open the archive and build the directory tree. The checkpoint index
+    // cached next to the archive is loaded if present. May be called again
+    // to view another archive instead.
+    ZipResult Mount(const NativePath &archivePath);
+
+    // These return ZR_NOT_FOUND for a path that does not exist and
+    // ZR_BAD_PATH for one of the wrong kind (opening a directory, listing
+    // a file).
+    ZipResult Open(const std::string &path, ZipVfsFile *pFile);
+    ZipResult Stat(const std::string &path, ZipVfsStat *pStat);
+    ZipResult ReadDir(const std::string &path, std::vector<std::string> *pNames);
+
+    //
+    //   FUNCTION: ZipVfs::PRead
+    //
+    //   PURPOSE: Read up to cb bytes of an open file at offset. *pcbRead is
+    //   short only at the end of the file. Thread safe.
+    //
+    ZipResult PRead(ZipVfsFile file, uint64_t offset, void *pv, size_t cb,
+        size_t *pcbRead);
+
+    ZipArchive &Archive() { return m_archive; }
+    BlockCacheStats GetCacheStats() const { return m_pCache->GetStats(); }
+
+private:
+    ZipVfs(const ZipVfs &);
+    ZipVfs &operator=(const ZipVfs &);
+
+    struct Node
+    {
+        bool fDirectory;
+        size_t entry;                       // SIZE_MAX for implied directories
+        std::vector<std::string> children;  // Names, for directories
+    };
+
+    Node &AddNode(const std::string &path, bool fDirectory);
+    const Node *FindNode(const std::string &path) const;
+    ZipResult FillBlocks(ZipVfsFile file, uint64_t firstBlock, uint64_t lastBlock,
+        uint8_t *pDest, uint64_t offset, size_t cb);
+
+    ZipArchive m_archive;
+    ZipSeekIndex *m_pIndex;
+    BlockCache *m_pCache;
+    bool m_fOwnCache;
+    uint64_t m_owner;
+    std::unordered_map<std::string, Node> m_nodes;
+};
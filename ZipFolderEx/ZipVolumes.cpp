@@ -0,0 +1,362 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipVolumes.cpp
+Project:      ZipFolderEx
+
+The file implements the multi-volume archive source declared in
+ZipVolumes.h.
+\***************************************************************************/
+
+#include "ZipVolumes.h"
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+
+
+namespace
+{
+    typedef NativePath::value_type NativeChar;
+
+    // The position of the '.' that starts the extension of the file name
+    // in path, or npos if it has none.
+    size_t FindExtension(const NativePath &path)
+    {
+        const NativeChar separators[] = { ZIP_NATIVE_SEPARATOR, '/', 0 };
+        size_t dot = path.find_last_of((NativeChar)'.');
+        size_t sep = path.find_last_of(separators);
+        if (dot == NativePath::npos || (sep != NativePath::npos && dot < sep))
+        {
+            return NativePath::npos;
+        }
+        return dot;
+    }
+
+    bool IsDigits(const NativePath &path, size_t start)
+    {
+        if (start >= path.size())
+        {
+            return false;
+        }
+        for (size_t i = start; i < path.size(); i++)
+        {
+            if (path[i] < '0' || path[i] > '9')
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    NativePath AppendAscii(const NativePath &path, const char *psz)
+    {
+        NativePath result = path;
+        while (*psz != '\0')
+        {
+            result += (NativeChar)*psz++;
+        }
+        return result;
+    }
+
+    // stem followed by the extension prefix and n with at least cDigits
+    // digits: name.z01, name.001.
+    NativePath NumberedPath(const NativePath &stem, const char *pszPrefix, unsigned n,
+        size_t cDigits)
+    {
+        char sz[32];
+        snprintf(sz, sizeof(sz), "%s%0*u", pszPrefix, (int)cDigits, n);
+        return AppendAscii(stem, sz);
+    }
+
+    bool FileExists(const NativePath &path)
+    {
+        uint64_t cb, modified;
+        return GetFileStamp(path, &cb, &modified) == ZR_OK;
+    }
+
+    // The files of the set path belongs to, in order, or none if it is on
+    // its own.
+    std::vector<NativePath> FindSet(const NativePath &path)
+    {
+        std::vector<NativePath> paths;
+        size_t dot = FindExtension(path);
+        if (dot == NativePath::npos)
+        {
+            return paths;
+        }
+        NativePath stem = path.substr(0, dot);
+        size_t cchExtension = path.size() - dot - 1;
+        NativeChar first = cchExtension > 0 ? path[dot + 1] : 0;
+
+        if (cchExtension >= 3 && IsDigits(path, dot + 1))
+        {
+            // name.001, name.002, ...
+            for (unsigned n = 1; ; n++)
+            {
+                NativePath volume = NumberedPath(stem, ".", n, cchExtension);
+                if (!FileExists(volume))
+                {
+                    break;
+                }
+                paths.push_back(volume);
+            }
+            return paths;
+        }
+
+        // name.z01, name.z02, ..., name.zip, opened by any of them. The
+        // extensions follow the case of the one given.
+        bool fUpper = first == 'Z';
+        bool fDisk = cchExtension >= 3 && (first == 'z' || first == 'Z') &&
+            IsDigits(path, dot + 2);
+        bool fLast = cchExtension == 3 && (first == 'z' || first == 'Z') &&
+            (path[dot + 2] | 0x20) == 'i' && (path[dot + 3] | 0x20) == 'p';
+        if (!fDisk && !fLast)
+        {
+            return paths;
+        }
+        for (unsigned n = 1; ; n++)
+        {
+            NativePath volume = NumberedPath(stem, fUpper ? ".Z" : ".z", n, 2);
+            if (!FileExists(volume))
+            {
+                break;
+            }
+            paths.push_back(volume);
+        }
+        if (!paths.empty())
+        {
+            paths.push_back(fLast ? path : AppendAscii(stem, fUpper ? ".ZIP" : ".zip"));
+        }
+        return paths;
+    }
+}
+
+
+ZipVolumeSet::ZipVolumeSet() : m_cbTotal(0)
+{
+}
+
+ZipVolumeSet::~ZipVolumeSet()
+{
+    Close();
+}
+
+ZipResult ZipVolumeSet::Open(const NativePath &path)
+{
+    Close();
+    std::vector<NativePath> paths = FindSet(path);
+    if (paths.empty())
+    {
+        paths.push_back(path);
+    }
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        ZipResult result = AddVolume(paths[i]);
+        if (result != ZR_OK)
+        {
+            Close();
+            return result;
+        }
+    }
+    return ZR_OK;
+}
+
+ZipResult ZipVolumeSet::AddVolume(const NativePath &path)
+{
+    std::unique_ptr<Volume> pVolume(new Volume);
+    pVolume->path = path;
+    pVolume->start = m_cbTotal;
+    ZipResult result = pVolume->file.OpenRead(path);
+    if (result == ZR_OK)
+    {
+        result = pVolume->file.GetSize(&pVolume->cb);
+    }
+    if (result != ZR_OK)
+    {
+        return result;
+    }
+    if (pVolume->file.GetDevice(&pVolume->device) != ZR_OK)
+    {
+        // Unknown: read in turn with any other volume of unknown device.
+        pVolume->device = 0;
+    }
+    m_cbTotal += pVolume->cb;
+    m_volumes.push_back(std::move(pVolume));
+    return ZR_OK;
+}
+
+void ZipVolumeSet::Close()
+{
+    m_volumes.clear();
+    m_cbTotal = 0;
+}
+
+void ZipVolumeSet::Release()
+{
+    for (size_t i = 0; i < m_volumes.size(); i++)
+    {
+        m_volumes[i]->file.Close();
+    }
+}
+
+ZipResult ZipVolumeSet::Reopen()
+{
+    ZipResult result = ZR_OK;
+    for (size_t i = 0; i < m_volumes.size() && result == ZR_OK; i++)
+    {
+        Volume &volume = *m_volumes[i];
+        if (volume.file.IsOpen())
+        {
+            continue;
+        }
+        uint64_t cb = 0;
+        result = volume.file.OpenRead(volume.path);
+        if (result == ZR_OK)
+        {
+            result = volume.file.GetSize(&cb);
+        }
+        if (result == ZR_OK && cb != volume.cb)
+        {
+            result = ZR_BAD_FORMAT;
+        }
+    }
+    if (result != ZR_OK)
+    {
+        Release();
+    }
+    return result;
+}
+
+ZipResult ZipVolumeSet::GetSize(uint64_t *pcb)
+{
+    *pcb = m_cbTotal;
+    return ZR_OK;
+}
+
+size_t ZipVolumeSet::FindVolume(uint64_t offset) const
+{
+    // The last volume starting at or before offset; empty volumes share
+    // their start with the next one and so are never picked.
+    size_t lo = 0;
+    size_t hi = m_volumes.size();
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m_volumes[mid]->start <= offset)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+ZipResult ZipVolumeSet::ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead)
+{
+    *pcbRead = 0;
+    if (m_volumes.empty() || offset >= m_cbTotal || cb == 0)
+    {
+        return ZR_OK;
+    }
+    cb = (size_t)std::min<uint64_t>(cb, m_cbTotal - offset);
+
+    size_t i = FindVolume(offset);
+    Volume *pVolume = m_volumes[i].get();
+    uint64_t within = offset - pVolume->start;
+    if (within + cb <= pVolume->cb)
+    {
+        return pVolume->file.ReadAt(within, pv, cb, pcbRead);
+    }
+
+    std::vector<Piece> pieces;
+    uint8_t *p = static_cast<uint8_t *>(pv);
+    for (size_t cbLeft = cb; cbLeft > 0; i++)
+    {
+        pVolume = m_volumes[i].get();
+        within = offset - pVolume->start;
+        size_t cbPiece = (size_t)std::min<uint64_t>(cbLeft, pVolume->cb - within);
+        if (cbPiece > 0)
+        {
+            Piece piece = { pVolume, within, p, cbPiece };
+            pieces.push_back(piece);
+        }
+        offset += cbPiece;
+        p += cbPiece;
+        cbLeft -= cbPiece;
+    }
+
+    ZipResult result = ReadPieces(&pieces[0], pieces.size());
+    if (result == ZR_OK)
+    {
+        *pcbRead = cb;
+    }
+    return result;
+}
+
+ZipResult ZipVolumeSet::ReadPieces(const Piece *pPieces, size_t cPieces)
+{
+    // Pieces on the same device as the one before them are read in turn,
+    // since one disk gains nothing from being asked twice at once. Each run
+    // on another device is read on a thread of its own.
+    std::vector<size_t> runs;
+    for (size_t i = 0; i < cPieces; i++)
+    {
+        if (i == 0 || pPieces[i].pVolume->device != pPieces[i - 1].pVolume->device)
+        {
+            runs.push_back(i);
+        }
+    }
+    runs.push_back(cPieces);
+
+    std::vector<ZipResult> results(runs.size() - 1, ZR_OK);
+    auto readRun = [&](size_t run)
+    {
+        for (size_t i = runs[run]; i < runs[run + 1] && results[run] == ZR_OK; i++)
+        {
+            const Piece &piece = pPieces[i];
+            results[run] = ReadFullAt(&piece.pVolume->file, piece.offset, piece.p, piece.cb);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t run = 1; run + 1 < runs.size(); run++)
+    {
+        threads.push_back(std::thread(readRun, run));
+    }
+    readRun(0);
+    ZipResult result = ZR_OK;
+    for (size_t run = 0; run < results.size(); run++)
+    {
+        if (run > 0)
+        {
+            threads[run - 1].join();
+        }
+        if (result == ZR_OK)
+        {
+            result = results[run];
+        }
+    }
+    return result;
+}
+
+void ZipVolumeSet::Advise(uint64_t offset, uint64_t cb)
+{
+    if (m_volumes.empty() || offset >= m_cbTotal)
+    {
+        return;
+    }
+    cb = std::min(cb, m_cbTotal - offset);
+    for (size_t i = FindVolume(offset); i < m_volumes.size() && cb > 0; i++)
+    {
+        Volume &volume = *m_volumes[i];
+        uint64_t within = offset - volume.start;
+        uint64_t cbPiece = std::min(cb, volume.cb - within);
+        if (cbPiece > 0)
+        {
+            volume.file.Advise(within, cbPiece);
+        }
+        offset += cbPiece;
+        cb -= cbPiece;
+    }
+}
@@ -0,0 +1,92 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipVolumes.h
+Project:      ZipFolderEx
+
+The file declares ZipVolumeSet, which reads an archive that was split
+across several files as one seekable source.
+
+Two kinds of set are recognized from the name of any of their files:
+
+  * PKWARE split or spanned archives: name.z01, name.z02, ... and
+    name.zip last. Each file is a "disk"; the central directory records
+    which disk an entry starts on and its offset within that disk, and
+    ZipArchive turns those into offsets in the whole set (VolumeStart).
+  * Plain splits: name.001, name.002, ... (often name.zip.001), cut at
+    arbitrary points out of an ordinary archive. Offsets need no mapping.
+
+Each volume has its own file handle. A read that crosses from one volume
+into the next is filled from both in one call rather than coming back
+short, and when the volumes involved are on different devices their parts
+are read at the same time. Read-ahead hints are passed to every volume
+they touch.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+#include <memory>
+
+
+class ZipVolumeSet : public ZipRandomAccess
+{
+public:
+    ZipVolumeSet();
+    virtual ~ZipVolumeSet();
+
+    //
+    //   FUNCTION: ZipVolumeSet::Open
+    //
+    //   PURPOSE: Open the file at path together with the rest of its set,
+    //   if its name and its neighbours make it part of one, or on its own
+    //   otherwise. Fails if a file between the first and the last of the
+    //   set cannot be opened.
+    //
+    ZipResult Open(const NativePath &path);
+    void Close();
+
+    //
+    //   FUNCTION: ZipVolumeSet::Release
+    //
+    //   PURPOSE: Close the files but remember them, so that Reopen can open
+    //   them again. Reopen fails if any of them has changed size.
+    //
+    void Release();
+    ZipResult Reopen();
+
+    size_t VolumeCount() const { return m_volumes.size(); }
+    uint64_t VolumeStart(size_t index) const { return m_volumes[index]->start; }
+    const NativePath &VolumePath(size_t index) const { return m_volumes[index]->path; }
+
+    virtual ZipResult ReadAt(uint64_t offset, void *pv, size_t cb, size_t *pcbRead);
+    virtual ZipResult GetSize(uint64_t *pcb);
+    virtual void Advise(uint64_t offset, uint64_t cb);
+
+private:
+    ZipVolumeSet(const ZipVolumeSet &);
+    ZipVolumeSet &operator=(const ZipVolumeSet &);
+
+    struct Volume
+    {
+        NativePath path;
+        NativeFile file;
+        uint64_t start;         // offset of the first byte in the whole set
+        uint64_t cb;
+        uint64_t device;
+    };
+
+    // The part of a read that falls in one volume.
+    struct Piece
+    {
+        Volume *pVolume;
+        uint64_t offset;        // within the volume
+        uint8_t *p;
+        size_t cb;
+    };
+
+    ZipResult AddVolume(const NativePath &path);
+    size_t FindVolume(uint64_t offset) const;
+    static ZipResult ReadPieces(const Piece *pPieces, size_t cPieces);
+
+    std::vector<std::unique_ptr<Volume> > m_volumes;
+    uint64_t m_cbTotal;
+};
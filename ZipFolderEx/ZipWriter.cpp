@@ -0,0 +1,1186 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipWriter.cpp
+Project:      ZipFolderEx
+
+The file implements the file writers declared in ZipWriter.h. The io_uring
+writer talks to the kernel through the raw system calls and the shared
+rings, so it needs no library beyond the kernel headers.
+\***************************************************************************/
+
+#include "ZipWriter.h"
+#include "ZipCpu.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#ifdef ZIP_CPU_X86
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+// Direct descriptors (sqe->file_index) date from Linux 5.15; headers from
+// before 5.18 may lack them, and then only the pwrite writer is built.
+#ifdef IORING_SETUP_SUBMIT_ALL
+#define ZIP_HAVE_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+
+const char *ZipWriterKindToString(ZipWriterKind kind)
+{
+    switch (kind)
+    {
+    case ZIP_WRITER_AUTO:   return "auto";
+    case ZIP_WRITER_PWRITE: return "pwrite";
+    case ZIP_WRITER_URING:  return "uring";
+    }
+    return "unknown";
+}
+
+bool ZipWriterKindFromString(const char *psz, ZipWriterKind *pKind)
+{
+    const ZipWriterKind kinds[] = { ZIP_WRITER_AUTO, ZIP_WRITER_PWRITE, ZIP_WRITER_URING };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+    {
+        if (strcmp(psz, ZipWriterKindToString(kinds[i])) == 0)
+        {
+            *pKind = kinds[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+namespace
+{
+#pragma region IsZeroBlock
+
+    bool IsZeroBlockGeneric(const uint8_t *p, size_t cb)
+    {
+        size_t i = 0;
+        for (; i + 32 <= cb; i += 32)
+        {
+            uint64_t words[4];
+            memcpy(words, p + i, sizeof(words));
+            if ((words[0] | words[1] | words[2] | words[3]) != 0)
+            {
+                return false;
+            }
+        }
+        for (; i < cb; i++)
+        {
+            if (p[i] != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef ZIP_CPU_X86
+    ZIP_TARGET("sse2")
+    bool IsZeroBlockSse2(const uint8_t *p, size_t cb)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 64 <= cb; i += 64)
+        {
+            __m128i any = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i)),
+                    _mm_loadu_si128((const __m128i *)(p + i + 16))),
+                _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i + 32)),
+                    _mm_loadu_si128((const __m128i *)(p + i + 48))));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+            {
+                return false;
+            }
+        }
+        return IsZeroBlockGeneric(p + i, cb - i);
+    }
+
+    ZIP_TARGET("avx2")
+    bool IsZeroBlockAvx2(const uint8_t *p, size_t cb)
+    {
+        size_t i = 0;
+        for (; i + 128 <= cb; i += 128)
+        {
+            __m256i any = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(p + i)),
+                    _mm256_loadu_si256((const __m256i *)(p + i + 32))),
+                _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(p + i + 64)),
+                    _mm256_loadu_si256((const __m256i *)(p + i + 96))));
+            if (!_mm256_testz_si256(any, any))
+            {
+                return false;
+            }
+        }
+        return IsZeroBlockSse2(p + i, cb - i);
+    }
+#endif
+
+    typedef bool (*IsZeroBlockFunction)(const uint8_t *p, size_t cb);
+
+    IsZeroBlockFunction ChooseIsZeroBlock()
+    {
+#ifdef ZIP_CPU_X86
+        if (ZipCpu().fAvx2)
+        {
+            return IsZeroBlockAvx2;
+        }
+        if (ZipCpu().fSse2)
+        {
+            return IsZeroBlockSse2;
+        }
+#endif
+        return IsZeroBlockGeneric;
+    }
+
+    const IsZeroBlockFunction g_pfnIsZeroBlock = ChooseIsZeroBlock();
+
+    const uint8_t kZero = 0;
+
+#pragma endregion
+
+
+#pragma region PwriteFileWriter
+
+    class PwriteFileWriter : public ZipFileWriter
+    {
+    public:
+        explicit PwriteFileWriter(bool fSync) :
+            m_fSync(fSync), m_offset(0), m_fSparse(false), m_fHoleAtEnd(false)
+        {
+        }
+
+        virtual ZipWriterKind Kind() const { return ZIP_WRITER_PWRITE; }
+
+        virtual ZipResult Open(int dirFd, const NativePath &name, const NativePath &path)
+        {
+            m_path = path;
+            m_offset = 0;
+            m_fSparse = false;
+            m_fHoleAtEnd = false;
+#ifndef _WIN32
+            if (dirFd >= 0)
+            {
+                return m_file.CreateAt(dirFd, name);
+            }
+#else
+            (void)dirFd;
+            (void)name;
+#endif
+            return m_file.Create(path);
+        }
+
+        virtual ZipResult Write(const void *pv, size_t cb)
+        {
+            ZipResult result = m_file.WriteAt(m_offset, pv, cb);
+            m_offset += cb;
+            m_fHoleAtEnd = m_fHoleAtEnd && cb == 0;
+            return result;
+        }
+
+        virtual ZipResult Skip(uint64_t cb)
+        {
+            if (!m_fSparse)
+            {
+                // Without it the zeros are still there, just written.
+                m_file.SetSparse();
+                m_fSparse = true;
+            }
+            m_offset += cb;
+            m_fHoleAtEnd = m_fHoleAtEnd || cb != 0;
+            return ZR_OK;
+        }
+
+        virtual ZipResult Close()
+        {
+            ZipResult result = ZR_OK;
+            if (m_fHoleAtEnd && m_file.IsOpen())
+            {
+                result = m_file.WriteAt(m_offset - 1, &kZero, 1);
+            }
+            if (result == ZR_OK && m_fSync && m_file.IsOpen())
+            {
+                result = m_file.Sync();
+            }
+            m_file.Close();
+            return result;
+        }
+
+        virtual void Abandon()
+        {
+            if (m_file.IsOpen())
+            {
+                m_file.Close();
+                RemoveFile(m_path);
+            }
+        }
+
+        virtual ZipResult Finish()
+        {
+            return ZR_OK;
+        }
+
+    private:
+        NativeFile m_file;
+        NativePath m_path;
+        bool m_fSync;
+        uint64_t m_offset;
+        bool m_fSparse;
+        bool m_fHoleAtEnd;      // the last thing appended was a hole
+    };
+
+#pragma endregion
+
+
+#pragma region DirectFileWriter
+
+    // Unbuffered writes start and end on multiples of the sector size, and
+    // come from memory aligned the same way; 4 KB covers every disk in use.
+    const size_t kDirectAlign = 4096;
+
+    uint8_t *AllocateAligned(size_t cb)
+    {
+#ifdef _WIN32
+        return (uint8_t *)VirtualAlloc(NULL, cb, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+        void *pv = NULL;
+        return posix_memalign(&pv, kDirectAlign, cb) == 0 ? (uint8_t *)pv : NULL;
+#endif
+    }
+
+    void FreeAligned(uint8_t *p)
+    {
+#ifdef _WIN32
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        free(p);
+#endif
+    }
+
+    class DirectFileWriter : public ZipFileWriter
+    {
+    public:
+        DirectFileWriter(bool fSync, uint8_t *pBuffer) :
+            m_fSync(fSync), m_pBuffer(pBuffer), m_cbFilled(0), m_bufferOffset(0),
+            m_cbOnDisk(0), m_fSparse(false)
+        {
+        }
+
+        virtual ~DirectFileWriter()
+        {
+            FreeAligned(m_pBuffer);
+        }
+
+        // Reports the kind it falls back on, since its own is not one that
+        // can be asked for.
+        virtual ZipWriterKind Kind() const { return ZIP_WRITER_PWRITE; }
+
+        virtual ZipResult Open(int dirFd, const NativePath &name, const NativePath &path)
+        {
+            m_path = path;
+            m_cbFilled = 0;
+            m_bufferOffset = 0;
+            m_cbOnDisk = 0;
+            m_fSparse = false;
+#ifndef _WIN32
+            if (dirFd >= 0)
+            {
+                return m_file.CreateAt(dirFd, name, true) == ZR_OK ? ZR_OK :
+                    m_file.CreateAt(dirFd, name);
+            }
+#else
+            (void)dirFd;
+            (void)name;
+#endif
+            return m_file.Create(path, true) == ZR_OK ? ZR_OK : m_file.Create(path);
+        }
+
+        virtual ZipResult Write(const void *pv, size_t cb)
+        {
+            const uint8_t *p = static_cast<const uint8_t *>(pv);
+            while (cb > 0)
+            {
+                size_t cbCopy = std::min(cb, kDirectBufferSize - m_cbFilled);
+                memcpy(m_pBuffer + m_cbFilled, p, cbCopy);
+                m_cbFilled += cbCopy;
+                p += cbCopy;
+                cb -= cbCopy;
+                if (m_cbFilled == kDirectBufferSize)
+                {
+                    ZipResult result = Flush();
+                    if (result != ZR_OK)
+                    {
+                        return result;
+                    }
+                }
+            }
+            return ZR_OK;
+        }
+
+        virtual ZipResult Skip(uint64_t cb)
+        {
+            // A hole has to start and end on a sector as well; one that
+            // does not is written out as zeros.
+            if (m_cbFilled % kDirectAlign != 0 || cb % kDirectAlign != 0)
+            {
+                while (cb > 0)
+                {
+                    size_t cbZero = (size_t)std::min<uint64_t>(cb, kDirectBufferSize - m_cbFilled);
+                    memset(m_pBuffer + m_cbFilled, 0, cbZero);
+                    m_cbFilled += cbZero;
+                    cb -= cbZero;
+                    if (m_cbFilled == kDirectBufferSize && Flush() != ZR_OK)
+                    {
+                        return ZR_IO_ERROR;
+                    }
+                }
+                return ZR_OK;
+            }
+            ZipResult result = m_cbFilled > 0 ? Flush() : ZR_OK;
+            if (!m_fSparse)
+            {
+                m_file.SetSparse();
+                m_fSparse = true;
+            }
+            m_bufferOffset += cb;
+            return result;
+        }
+
+        virtual ZipResult Close()
+        {
+            ZipResult result = ZR_OK;
+            uint64_t cbFile = m_bufferOffset + m_cbFilled;
+            if (m_cbFilled > 0)
+            {
+                size_t cbPadded = (m_cbFilled + kDirectAlign - 1) / kDirectAlign * kDirectAlign;
+                memset(m_pBuffer + m_cbFilled, 0, cbPadded - m_cbFilled);
+                m_cbFilled = cbPadded;
+                result = Flush();
+            }
+            if (result == ZR_OK && m_cbOnDisk != cbFile)
+            {
+                // Cut off the padding, or extend over a hole at the end.
+                result = m_file.SetSize(cbFile);
+            }
+            if (result == ZR_OK && m_fSync)
+            {
+                result = m_file.Sync();
+            }
+            m_file.Close();
+            return result;
+        }
+
+        virtual void Abandon()
+        {
+            if (m_file.IsOpen())
+            {
+                m_file.Close();
+                RemoveFile(m_path);
+            }
+        }
+
+        virtual ZipResult Finish()
+        {
+            return ZR_OK;
+        }
+
+    private:
+        // Write the buffer, whose length is a multiple of kDirectAlign.
+        ZipResult Flush()
+        {
+            ZipResult result = m_file.WriteAt(m_bufferOffset, m_pBuffer, m_cbFilled);
+            m_bufferOffset += m_cbFilled;
+            m_cbOnDisk = m_bufferOffset;
+            m_cbFilled = 0;
+            return result;
+        }
+
+        NativeFile m_file;
+        NativePath m_path;
+        bool m_fSync;
+        uint8_t *m_pBuffer;
+        size_t m_cbFilled;
+        uint64_t m_bufferOffset;    // where the buffer goes in the file
+        uint64_t m_cbOnDisk;        // the size the writes have given the file
+        bool m_fSparse;
+    };
+
+#pragma endregion
+
+
+#ifdef ZIP_HAVE_URING
+#pragma region UringFileWriter
+
+    // Queue entries of the ring; a completion queue twice as long.
+    const unsigned kRingEntries = 512;
+
+    // Files in flight at once, each on a direct descriptor slot.
+    const uint32_t kSlots = 128;
+
+    // Registered buffers the data is copied into. Several small files
+    // share one buffer; it is reused once every write from it completes.
+    const uint32_t kBuffers = 8;
+    const size_t kBufferSize = 128 * 1024;
+
+    const uint32_t kNone = 0xFFFFFFFF;
+
+    // What a completion is for, in the top bits of its user_data.
+    enum UringOp
+    {
+        URING_OPEN = 1,
+        URING_WRITE,
+        URING_FSYNC,
+        URING_CLOSE,
+    };
+
+    uint64_t PackUserData(UringOp op, uint32_t slot, uint32_t buffer, uint32_t cb)
+    {
+        return ((uint64_t)op << 60) | ((uint64_t)(slot & 0xFFF) << 48) |
+            ((uint64_t)(buffer & 0xFFFF) << 32) | cb;
+    }
+
+    class UringFileWriter : public ZipFileWriter
+    {
+    public:
+        explicit UringFileWriter(bool fSync);
+        virtual ~UringFileWriter();
+
+        // False if the kernel lacks anything the writer needs.
+        bool Init();
+
+        virtual ZipWriterKind Kind() const { return ZIP_WRITER_URING; }
+        virtual ZipResult Open(int dirFd, const NativePath &name, const NativePath &path);
+        virtual ZipResult Write(const void *pv, size_t cb);
+        virtual ZipResult Skip(uint64_t cb);
+        virtual ZipResult Close();
+        virtual void Abandon();
+        virtual ZipResult Finish();
+
+    private:
+        struct Chunk
+        {
+            uint32_t buffer;
+            uint32_t cb;
+            const uint8_t *p;
+            uint64_t offset;
+        };
+
+        struct Slot
+        {
+            bool fBusy;
+            bool fStarted;      // the open has been queued
+            bool fOpened;       // and has completed
+            bool fClosed;
+            bool fEnded;        // Close or Abandon was called
+            bool fRemove;       // delete the file once closed
+            bool fHoleAtEnd;    // the last thing appended was a hole
+            unsigned cPending;  // operations queued or in flight
+            int dirFd;
+            NativePath target;  // name if dirFd is open, else path
+            NativePath path;
+            uint64_t cb;
+            std::vector<Chunk> chunks;  // data not yet queued
+        };
+
+        struct Buffer
+        {
+            uint8_t *p;
+            unsigned cRefs;     // chunks queued, in flight or held
+        };
+
+        io_uring_sqe *NextSqe();
+        bool Reserve(unsigned cSqes);
+        void QueueOpen(uint32_t slot, bool fLink);
+        void QueueWrites(uint32_t slot, bool fLink);
+        void QueueClose(uint32_t slot, bool fFsync);
+        ZipResult Submit(bool fWait);
+        void Reap();
+        void Complete(const io_uring_cqe &cqe);
+        void ReleaseSlot(uint32_t slot);
+        void DropChunks(Slot &slot);
+        ZipResult StartFile(uint32_t slot);
+        ZipResult WaitIdle(uint32_t slot);
+        ZipResult NextBuffer();
+        void SetError();
+
+        bool m_fSync;
+        int m_ringFd;
+        bool m_fFixedBuffers;
+
+        void *m_pSqRing;
+        void *m_pCqRing;
+        size_t m_cbSqRing;
+        size_t m_cbCqRing;
+        io_uring_sqe *m_pSqes;
+        size_t m_cbSqes;
+        unsigned *m_pSqHead;
+        unsigned *m_pSqTail;
+        unsigned m_sqMask;
+        unsigned m_sqEntries;
+        unsigned *m_pCqHead;
+        unsigned *m_pCqTail;
+        unsigned m_cqMask;
+        unsigned m_cqEntries;
+        io_uring_cqe *m_pCqes;
+
+        unsigned m_sqTail;      // ours, published on submit
+        unsigned m_cQueued;     // filled in since the last submit
+        unsigned m_cInFlight;   // submitted, not yet completed
+
+        uint8_t *m_pBufferMemory;
+        std::vector<Slot> m_slots;
+        std::vector<uint32_t> m_freeSlots;
+        Buffer m_buffers[kBuffers];
+        uint32_t m_currentBuffer;
+        size_t m_cbFilled;
+        uint32_t m_current;     // slot of the open file, or kNone
+        ZipResult m_error;
+    };
+
+    int SysSetup(unsigned entries, io_uring_params *pParams)
+    {
+        return (int)syscall(__NR_io_uring_setup, entries, pParams);
+    }
+
+    int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+    }
+
+    int SysRegister(int fd, unsigned opcode, const void *pArg, unsigned cArgs)
+    {
+        return (int)syscall(__NR_io_uring_register, fd, opcode, pArg, cArgs);
+    }
+
+    UringFileWriter::UringFileWriter(bool fSync) :
+        m_fSync(fSync), m_ringFd(-1), m_fFixedBuffers(false),
+        m_pSqRing(MAP_FAILED), m_pCqRing(MAP_FAILED), m_cbSqRing(0), m_cbCqRing(0),
+        m_pSqes((io_uring_sqe *)MAP_FAILED), m_cbSqes(0), m_pSqHead(NULL), m_pSqTail(NULL),
+        m_sqMask(0), m_sqEntries(0), m_pCqHead(NULL), m_pCqTail(NULL), m_cqMask(0),
+        m_cqEntries(0), m_pCqes(NULL), m_sqTail(0), m_cQueued(0), m_cInFlight(0),
+        m_pBufferMemory((uint8_t *)MAP_FAILED), m_currentBuffer(kNone), m_cbFilled(0),
+        m_current(kNone), m_error(ZR_OK)
+    {
+    }
+
+    UringFileWriter::~UringFileWriter()
+    {
+        // The kernel may still be writing from the buffers.
+        if (m_ringFd >= 0)
+        {
+            if (m_current != kNone)
+            {
+                Abandon();
+            }
+            Finish();
+            close(m_ringFd);
+        }
+        if (m_pSqes != MAP_FAILED)
+        {
+            munmap(m_pSqes, m_cbSqes);
+        }
+        if (m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing)
+        {
+            munmap(m_pCqRing, m_cbCqRing);
+        }
+        if (m_pSqRing != MAP_FAILED)
+        {
+            munmap(m_pSqRing, m_cbSqRing);
+        }
+        if (m_pBufferMemory != MAP_FAILED)
+        {
+            munmap(m_pBufferMemory, kBuffers * kBufferSize);
+        }
+    }
+
+    bool UringFileWriter::Init()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_ringFd = SysSetup(kRingEntries, &params);
+        if (m_ringFd < 0)
+        {
+            return false;
+        }
+        fcntl(m_ringFd, F_SETFD, FD_CLOEXEC);
+
+        m_cbSqRing = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cbCqRing = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool fSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (fSingleMmap)
+        {
+            m_cbSqRing = m_cbCqRing = std::max(m_cbSqRing, m_cbCqRing);
+        }
+        m_pSqRing = mmap(NULL, m_cbSqRing, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_ringFd, IORING_OFF_SQ_RING);
+        if (m_pSqRing == MAP_FAILED)
+        {
+            return false;
+        }
+        m_pCqRing = fSingleMmap ? m_pSqRing : mmap(NULL, m_cbCqRing, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        m_cbSqes = params.sq_entries * sizeof(io_uring_sqe);
+        m_pSqes = (io_uring_sqe *)mmap(NULL, m_cbSqes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+        if (m_pCqRing == MAP_FAILED || m_pSqes == MAP_FAILED)
+        {
+            return false;
+        }
+
+        uint8_t *pSq = (uint8_t *)m_pSqRing;
+        uint8_t *pCq = (uint8_t *)m_pCqRing;
+        m_pSqHead = (unsigned *)(pSq + params.sq_off.head);
+        m_pSqTail = (unsigned *)(pSq + params.sq_off.tail);
+        m_sqMask = *(unsigned *)(pSq + params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        m_pCqHead = (unsigned *)(pCq + params.cq_off.head);
+        m_pCqTail = (unsigned *)(pCq + params.cq_off.tail);
+        m_cqMask = *(unsigned *)(pCq + params.cq_off.ring_mask);
+        m_cqEntries = params.cq_entries;
+        m_pCqes = (io_uring_cqe *)(pCq + params.cq_off.cqes);
+        m_sqTail = *m_pSqTail;
+
+        // Queue entry i always sits at ring position i.
+        unsigned *pArray = (unsigned *)(pSq + params.sq_off.array);
+        for (unsigned i = 0; i < m_sqEntries; i++)
+        {
+            pArray[i] = i;
+        }
+
+        // An empty table of direct descriptors for the files in flight.
+        std::vector<int> fds(kSlots, -1);
+        if (SysRegister(m_ringFd, IORING_REGISTER_FILES, &fds[0], kSlots) < 0)
+        {
+            return false;
+        }
+
+        m_pBufferMemory = (uint8_t *)mmap(NULL, kBuffers * kBufferSize,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m_pBufferMemory == MAP_FAILED)
+        {
+            return false;
+        }
+        struct iovec iov[kBuffers];
+        for (uint32_t i = 0; i < kBuffers; i++)
+        {
+            m_buffers[i].p = m_pBufferMemory + i * kBufferSize;
+            m_buffers[i].cRefs = 0;
+            iov[i].iov_base = m_buffers[i].p;
+            iov[i].iov_len = kBufferSize;
+        }
+        // Registering pins the pages, which counts against the locked
+        // memory limit; without it the writes name the buffers each time.
+        m_fFixedBuffers = SysRegister(m_ringFd, IORING_REGISTER_BUFFERS, iov, kBuffers) == 0;
+
+        m_slots.resize(kSlots);
+        for (uint32_t i = kSlots; i-- > 0; )
+        {
+            m_slots[i].fBusy = false;
+            m_freeSlots.push_back(i);
+        }
+
+        // Kernels before 5.15 reject direct descriptors only when the first
+        // open runs, so try one now rather than fail an extraction.
+        uint32_t slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        Slot &probe = m_slots[slot];
+        probe.fBusy = true;
+        probe.fStarted = probe.fOpened = probe.fClosed = probe.fRemove = probe.fHoleAtEnd = false;
+        probe.fEnded = true;
+        probe.cPending = 0;
+        probe.dirFd = AT_FDCWD;
+        probe.target = "/";
+        probe.path.clear();
+        probe.cb = 0;
+        io_uring_sqe *pSqe = NextSqe();
+        pSqe->opcode = IORING_OP_OPENAT;
+        pSqe->fd = AT_FDCWD;
+        pSqe->addr = (uint64_t)(uintptr_t)probe.target.c_str();
+        pSqe->open_flags = O_RDONLY | O_DIRECTORY;
+        pSqe->file_index = slot + 1;
+        pSqe->user_data = PackUserData(URING_OPEN, slot, 0, 0);
+        probe.cPending++;
+        probe.fStarted = true;
+        WaitIdle(slot);
+        return m_error == ZR_OK;
+    }
+
+    io_uring_sqe *UringFileWriter::NextSqe()
+    {
+        io_uring_sqe *pSqe = &m_pSqes[m_sqTail & m_sqMask];
+        memset(pSqe, 0, sizeof(*pSqe));
+        m_sqTail++;
+        m_cQueued++;
+        return pSqe;
+    }
+
+    bool UringFileWriter::Reserve(unsigned cSqes)
+    {
+        // A linked chain must go to the kernel in one submission, and no
+        // more may be in flight than the completion queue can hold.
+        if (m_cQueued + cSqes > m_sqEntries)
+        {
+            if (Submit(false) != ZR_OK)
+            {
+                return false;
+            }
+        }
+        while (m_cInFlight + m_cQueued + cSqes > m_cqEntries)
+        {
+            if (Submit(true) != ZR_OK)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void UringFileWriter::QueueOpen(uint32_t slot, bool fLink)
+    {
+        Slot &s = m_slots[slot];
+        io_uring_sqe *pSqe = NextSqe();
+        pSqe->opcode = IORING_OP_OPENAT;
+        pSqe->flags = fLink ? IOSQE_IO_LINK : 0;
+        pSqe->fd = s.dirFd;
+        pSqe->addr = (uint64_t)(uintptr_t)s.target.c_str();
+        pSqe->len = 0666;
+        // A direct descriptor is never inherited; the kernel refuses
+        // O_CLOEXEC on one.
+        pSqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        pSqe->file_index = slot + 1;
+        pSqe->user_data = PackUserData(URING_OPEN, slot, 0, 0);
+        s.cPending++;
+        s.fStarted = true;
+    }
+
+    void UringFileWriter::QueueWrites(uint32_t slot, bool fLink)
+    {
+        Slot &s = m_slots[slot];
+        for (size_t i = 0; i < s.chunks.size(); i++)
+        {
+            const Chunk &chunk = s.chunks[i];
+            io_uring_sqe *pSqe = NextSqe();
+            pSqe->opcode = m_fFixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            pSqe->flags = IOSQE_FIXED_FILE |
+                (fLink || i + 1 < s.chunks.size() ? IOSQE_IO_LINK : 0);
+            pSqe->fd = (int)slot;
+            pSqe->addr = (uint64_t)(uintptr_t)chunk.p;
+            pSqe->len = chunk.cb;
+            pSqe->off = chunk.offset;
+            pSqe->buf_index = m_fFixedBuffers ? (uint16_t)chunk.buffer : 0;
+            pSqe->user_data = PackUserData(URING_WRITE, slot, chunk.buffer, chunk.cb);
+            s.cPending++;
+        }
+        s.chunks.clear();
+    }
+
+    void UringFileWriter::QueueClose(uint32_t slot, bool fFsync)
+    {
+        Slot &s = m_slots[slot];
+        if (fFsync)
+        {
+            io_uring_sqe *pSqe = NextSqe();
+            pSqe->opcode = IORING_OP_FSYNC;
+            pSqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            pSqe->fd = (int)slot;
+            pSqe->user_data = PackUserData(URING_FSYNC, slot, 0, 0);
+            s.cPending++;
+        }
+        io_uring_sqe *pSqe = NextSqe();
+        pSqe->opcode = IORING_OP_CLOSE;
+        pSqe->file_index = slot + 1;
+        pSqe->user_data = PackUserData(URING_CLOSE, slot, 0, 0);
+        s.cPending++;
+    }
+
+    ZipResult UringFileWriter::Submit(bool fWait)
+    {
+        __atomic_store_n(m_pSqTail, m_sqTail, __ATOMIC_RELEASE);
+        fWait = fWait && m_cInFlight + m_cQueued > 0;
+        while (m_cQueued > 0 || fWait)
+        {
+            unsigned flags = fWait ? IORING_ENTER_GETEVENTS : 0;
+            int cSubmitted = SysEnter(m_ringFd, m_cQueued, fWait ? 1 : 0, flags);
+            if (cSubmitted < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if ((errno == EAGAIN || errno == EBUSY) && m_cInFlight > 0)
+                {
+                    // Completions must be taken off before more go in.
+                    SysEnter(m_ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+                    Reap();
+                    continue;
+                }
+                SetError();
+                return ZR_IO_ERROR;
+            }
+            m_cQueued -= (unsigned)cSubmitted;
+            m_cInFlight += (unsigned)cSubmitted;
+            fWait = false;
+        }
+        Reap();
+        return ZR_OK;
+    }
+
+    void UringFileWriter::Reap()
+    {
+        // Handling a completion can queue, submit and so reap again, so the
+        // head is read afresh each time.
+        for (;;)
+        {
+            unsigned head = *m_pCqHead;
+            if (head == __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE))
+            {
+                break;
+            }
+            io_uring_cqe cqe = m_pCqes[head & m_cqMask];
+            __atomic_store_n(m_pCqHead, head + 1, __ATOMIC_RELEASE);
+            m_cInFlight--;
+            Complete(cqe);
+        }
+    }
+
+    void UringFileWriter::Complete(const io_uring_cqe &cqe)
+    {
+        UringOp op = (UringOp)(cqe.user_data >> 60);
+        uint32_t slot = (uint32_t)(cqe.user_data >> 48) & 0xFFF;
+        uint32_t buffer = (uint32_t)(cqe.user_data >> 32) & 0xFFFF;
+        uint32_t cb = (uint32_t)cqe.user_data;
+        Slot &s = m_slots[slot];
+
+        // Operations linked behind a failure come back as cancelled; the
+        // failure itself has been recorded.
+        bool fFailed = cqe.res < 0 && cqe.res != -ECANCELED;
+        switch (op)
+        {
+        case URING_OPEN:
+            s.fOpened = cqe.res >= 0;
+            break;
+        case URING_WRITE:
+            m_buffers[buffer].cRefs--;
+            fFailed = fFailed || (cqe.res >= 0 && (uint32_t)cqe.res != cb);
+            break;
+        case URING_FSYNC:
+            break;
+        case URING_CLOSE:
+            s.fClosed = cqe.res >= 0;
+            break;
+        }
+        if (fFailed)
+        {
+            SetError();
+        }
+
+        s.cPending--;
+        if (s.cPending == 0 && s.fEnded)
+        {
+            ReleaseSlot(slot);
+        }
+    }
+
+    void UringFileWriter::ReleaseSlot(uint32_t slot)
+    {
+        Slot &s = m_slots[slot];
+        if (s.fOpened && !s.fClosed)
+        {
+            // Its chain broke before the close; the slot must be emptied
+            // before another file can use it.
+            if (Reserve(1))
+            {
+                QueueClose(slot, false);
+                return;
+            }
+        }
+        if (s.fRemove && s.fOpened)
+        {
+            RemoveFile(s.path);
+        }
+        s.fBusy = false;
+        m_freeSlots.push_back(slot);
+    }
+
+    void UringFileWriter::DropChunks(Slot &slot)
+    {
+        for (size_t i = 0; i < slot.chunks.size(); i++)
+        {
+            m_buffers[slot.chunks[i].buffer].cRefs--;
+        }
+        slot.chunks.clear();
+    }
+
+    ZipResult UringFileWriter::StartFile(uint32_t slot)
+    {
+        // The file's data so far rides behind the open; later writes go
+        // on their own, so they must wait until the descriptor exists.
+        Slot &s = m_slots[slot];
+        if (!Reserve(1 + (unsigned)s.chunks.size()))
+        {
+            return m_error;
+        }
+        QueueOpen(slot, !s.chunks.empty());
+        QueueWrites(slot, false);
+        while (m_error == ZR_OK && !s.fOpened)
+        {
+            Submit(true);
+        }
+        return m_error;
+    }
+
+    ZipResult UringFileWriter::WaitIdle(uint32_t slot)
+    {
+        Slot &s = m_slots[slot];
+        while (s.fBusy && s.cPending > 0)
+        {
+            if (Submit(true) != ZR_OK)
+            {
+                return m_error;
+            }
+        }
+        return m_error;
+    }
+
+    ZipResult UringFileWriter::NextBuffer()
+    {
+        for (;;)
+        {
+            for (uint32_t i = 0; i < kBuffers; i++)
+            {
+                if (m_buffers[i].cRefs == 0)
+                {
+                    m_currentBuffer = i;
+                    m_cbFilled = 0;
+                    return ZR_OK;
+                }
+            }
+
+            // Every buffer holds data. The open file may hold the lot, so
+            // set it going, then wait for writes to finish.
+            if (m_current != kNone && !m_slots[m_current].chunks.empty())
+            {
+                Slot &s = m_slots[m_current];
+                if (!s.fStarted)
+                {
+                    StartFile(m_current);
+                }
+                else if (Reserve((unsigned)s.chunks.size()))
+                {
+                    QueueWrites(m_current, false);
+                }
+            }
+            else if (m_cInFlight + m_cQueued == 0)
+            {
+                // Nothing can free a buffer; should not happen.
+                SetError();
+            }
+            if (m_error != ZR_OK || Submit(true) != ZR_OK)
+            {
+                return m_error;
+            }
+        }
+    }
+
+    void UringFileWriter::SetError()
+    {
+        if (m_error == ZR_OK)
+        {
+            m_error = ZR_IO_ERROR;
+        }
+    }
+
+    ZipResult UringFileWriter::Open(int dirFd, const NativePath &name, const NativePath &path)
+    {
+        while (m_error == ZR_OK && m_freeSlots.empty())
+        {
+            Submit(true);
+        }
+        if (m_error != ZR_OK)
+        {
+            return m_error;
+        }
+        m_current = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        Slot &s = m_slots[m_current];
+        s.fBusy = true;
+        s.fStarted = s.fOpened = s.fClosed = s.fEnded = s.fRemove = s.fHoleAtEnd = false;
+        s.cPending = 0;
+        s.dirFd = dirFd >= 0 ? dirFd : AT_FDCWD;
+        s.target = dirFd >= 0 ? name : path;
+        s.path = path;
+        s.cb = 0;
+        s.chunks.clear();
+        return ZR_OK;
+    }
+
+    ZipResult UringFileWriter::Write(const void *pv, size_t cb)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(pv);
+        while (cb > 0 && m_error == ZR_OK)
+        {
+            if (m_currentBuffer == kNone || m_cbFilled == kBufferSize)
+            {
+                if (NextBuffer() != ZR_OK)
+                {
+                    break;
+                }
+            }
+            Buffer &buffer = m_buffers[m_currentBuffer];
+            size_t cbCopy = std::min(cb, kBufferSize - m_cbFilled);
+            uint8_t *pDest = buffer.p + m_cbFilled;
+            memcpy(pDest, p, cbCopy);
+
+            // Consecutive writes into one buffer become one write, unless
+            // a hole lies between them.
+            Slot &s = m_slots[m_current];
+            s.fHoleAtEnd = false;
+            // The buffers lie end to end, so check it is the same one.
+            if (!s.chunks.empty() && s.chunks.back().buffer == m_currentBuffer &&
+                s.chunks.back().p + s.chunks.back().cb == pDest &&
+                s.chunks.back().offset + s.chunks.back().cb == s.cb)
+            {
+                s.chunks.back().cb += (uint32_t)cbCopy;
+            }
+            else
+            {
+                Chunk chunk = { m_currentBuffer, (uint32_t)cbCopy, pDest, s.cb };
+                s.chunks.push_back(chunk);
+                buffer.cRefs++;
+            }
+            s.cb += cbCopy;
+            m_cbFilled += cbCopy;
+            p += cbCopy;
+            cb -= cbCopy;
+        }
+        return m_error;
+    }
+
+    ZipResult UringFileWriter::Skip(uint64_t cb)
+    {
+        // Every write carries its own offset, so a hole is only a gap
+        // between two of them.
+        Slot &s = m_slots[m_current];
+        s.cb += cb;
+        s.fHoleAtEnd = s.fHoleAtEnd || cb != 0;
+        return m_error;
+    }
+
+    ZipResult UringFileWriter::Close()
+    {
+        if (m_slots[m_current].fHoleAtEnd && m_error == ZR_OK)
+        {
+            m_slots[m_current].cb--;
+            Write(&kZero, 1);
+        }
+        uint32_t slot = m_current;
+        m_current = kNone;
+        Slot &s = m_slots[slot];
+
+        // A file that was started has writes in flight, which must finish
+        // before its close is queued behind the last of its data.
+        if (s.fStarted && m_error == ZR_OK)
+        {
+            WaitIdle(slot);
+        }
+        s.fEnded = true;
+        if (m_error != ZR_OK)
+        {
+            // Nothing more is queued once an error is known.
+            DropChunks(s);
+            if (s.cPending == 0)
+            {
+                ReleaseSlot(slot);
+            }
+            return m_error;
+        }
+        if (!Reserve((s.fStarted ? 0 : 1) + (unsigned)s.chunks.size() + 2))
+        {
+            DropChunks(s);
+            return m_error;
+        }
+        if (!s.fStarted)
+        {
+            QueueOpen(slot, true);
+        }
+        QueueWrites(slot, true);
+        QueueClose(slot, m_fSync);
+        return ZR_OK;
+    }
+
+    void UringFileWriter::Abandon()
+    {
+        uint32_t slot = m_current;
+        m_current = kNone;
+        Slot &s = m_slots[slot];
+        DropChunks(s);
+        s.fEnded = true;
+        s.fRemove = true;
+        if (s.fStarted)
+        {
+            // The release closes it, then deletes it.
+            WaitIdle(slot);
+        }
+        if (s.fBusy && s.cPending == 0)
+        {
+            ReleaseSlot(slot);
+        }
+    }
+
+    ZipResult UringFileWriter::Finish()
+    {
+        // Even after an error: the kernel may still be using the buffers.
+        while (m_cQueued > 0 || m_cInFlight > 0)
+        {
+            if (Submit(m_cQueued == 0) != ZR_OK)
+            {
+                break;
+            }
+        }
+        return m_error;
+    }
+
+#pragma endregion
+#endif
+}
+
+
+bool IsZeroBlock(const void *pv, size_t cb)
+{
+    return g_pfnIsZeroBlock(static_cast<const uint8_t *>(pv), cb);
+}
+
+
+ZipFileWriter *ZipFileWriter::Create(ZipWriterKind kind, bool fSync)
+{
+#ifdef ZIP_HAVE_URING
+    if (kind != ZIP_WRITER_PWRITE)
+    {
+        std::unique_ptr<UringFileWriter> pWriter(new UringFileWriter(fSync));
+        if (pWriter->Init())
+        {
+            return pWriter.release();
+        }
+    }
+#else
+    (void)kind;
+#endif
+    return new PwriteFileWriter(fSync);
+}
+
+ZipFileWriter *ZipFileWriter::CreateDirect(bool fSync)
+{
+    uint8_t *pBuffer = AllocateAligned(kDirectBufferSize);
+    return pBuffer != NULL ? new DirectFileWriter(fSync, pBuffer) : NULL;
+}
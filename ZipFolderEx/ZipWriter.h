@@ -0,0 +1,118 @@
+/****************************** Module Header ******************************\
+Module Name:  ZipWriter.h
+Project:      ZipFolderEx
+
+The file declares the output side of the extractor: how the files it
+decodes reach the disk.
+
+ZipFileWriter takes one file at a time: Open, any number of Writes, then
+Close. A writer may hold on to the data and finish the file later; Finish
+waits for everything and returns the first error. Two kinds exist:
+
+  * pwrite - opens, writes and closes each file with blocking calls as
+    they come. It works everywhere and is the fallback.
+  * io_uring (Linux 5.15 or later) - copies the data into buffers
+    registered with a ring and queues each file as one linked chain of
+    openat, writes, optionally fsync, and close, on a descriptor slot of
+    the ring's own. The chains of a hundred small files go to the kernel
+    in a single system call, instead of three or more calls per file.
+    A file too large to hold is started early and written as it comes.
+
+Each worker thread owns its own writer, so neither kind locks.
+
+A third writer, made by CreateDirect, is for huge files. It writes around
+the system cache (O_DIRECT, or FILE_FLAG_NO_BUFFERING on Windows), so that
+extracting a 50 GB entry does not push everything else out of memory. The
+data is gathered in a page aligned buffer and written a whole buffer at a
+time. The last, partial buffer is padded with zeros to the sector size and
+the file is then cut back to its length. Where the file system refuses
+unbuffered writes, the file is written through the cache instead.
+
+A caller that finds a run of zeros can Skip it rather than Write it. Both
+kinds then just move the file offset on, which leaves a hole that reads
+back as zeros and takes no space on the disk. The file is created empty,
+so nothing needs punching. On NTFS the file is marked sparse first. A file
+that ends in a hole gets its last byte written, so that it has its full
+size.
+\***************************************************************************/
+
+#pragma once
+
+#include "ZipIo.h"
+
+
+enum ZipWriterKind
+{
+    ZIP_WRITER_AUTO = 0,        // io_uring where the kernel has it, else pwrite
+    ZIP_WRITER_PWRITE,
+    ZIP_WRITER_URING,
+};
+
+const char *ZipWriterKindToString(ZipWriterKind kind);
+
+// Parse "auto", "pwrite" or "uring"; false for anything else.
+bool ZipWriterKindFromString(const char *psz, ZipWriterKind *pKind);
+
+
+class ZipFileWriter
+{
+public:
+    //
+    //   FUNCTION: ZipFileWriter::Create
+    //
+    //   PURPOSE: Make a writer of the given kind, falling back to pwrite
+    //   where io_uring cannot be set up. With fSync, each file is flushed
+    //   to the disk before it is closed. The caller deletes the writer.
+    //
+    static ZipFileWriter *Create(ZipWriterKind kind, bool fSync);
+
+    // The aligned buffer a writer from CreateDirect holds.
+    static const size_t kDirectBufferSize = 1024 * 1024;
+
+    //
+    //   FUNCTION: ZipFileWriter::CreateDirect
+    //
+    //   PURPOSE: Make a writer that bypasses the system cache, or return
+    //   NULL if its buffer cannot be had. fSync is as for Create.
+    //
+    static ZipFileWriter *CreateDirect(bool fSync);
+
+    virtual ~ZipFileWriter() {}
+
+    virtual ZipWriterKind Kind() const = 0;
+
+    //
+    //   FUNCTION: ZipFileWriter::Open
+    //
+    //   PURPOSE: Start a file, replacing any that exists: name in the
+    //   directory open as dirFd, or path if dirFd is -1 (always on
+    //   Windows). The strings are copied.
+    //
+    virtual ZipResult Open(int dirFd, const NativePath &name, const NativePath &path) = 0;
+
+    // Append to the file; the data is copied or written before returning.
+    virtual ZipResult Write(const void *pv, size_t cb) = 0;
+
+    // Append cb zero bytes as a hole, without writing them.
+    virtual ZipResult Skip(uint64_t cb) = 0;
+
+    // End the file. Errors may only show in a later call or in Finish.
+    virtual ZipResult Close() = 0;
+
+    // End the file and delete whatever of it was written, as when the
+    // extraction is cancelled part way through it.
+    virtual void Abandon() = 0;
+
+    // Wait for every file to be written and closed.
+    virtual ZipResult Finish() = 0;
+};
+
+
+//
+//   FUNCTION: IsZeroBlock
+//
+//   PURPOSE: Whether the cb bytes at pv are all zero, tested 128 bytes at a
+//   time with AVX2 or 64 with SSE2 where the processor has them. Returns
+//   at the first block of 128 or 64 bytes that holds anything else.
+//
+bool IsZeroBlock(const void *pv, size_t cb);
@@ -18,6 +18,9 @@ context menu handler is associated with the .cpp file class.
 
 DllUnregisterServer unregisters the COM server and the context menu handler. 
 
+ZipFolderExServiceW is a rundll32 entry point that runs the extraction 
+service the context menu handler hands its jobs to.
+
 This source is subject to the Microsoft Public License.
 See http://www.microsoft.com/opensource/licenses.mspx#Ms-PL.
 All other rights reserved.
@@ -30,7 +33,9 @@ WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
 #include <windows.h>
 #include <Guiddef.h>
 #include "ClassFactory.h"           // For the class factory
+#include "ContextMenuExtractTo.h"
 #include "Reg.h"
+#include "ZipService.h"
 
 
 // {2DAF224E-DDA2-4725-A3E7-E1DAE80A64EE}
@@ -104,11 +109,17 @@ STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, void **ppv)
 //   PURPOSE: Check if we can unload the component from the memory.
 //
 //   NOTE: The component can be unloaded from the memory when its reference 
-//   count is zero (i.e. nobody is still using the component).
+//   count is zero (i.e. nobody is still using the component) and no
+//   extraction is queued or running. The extraction queue is deleted here,
+//   not at DLL_PROCESS_DETACH, where waiting for its threads would deadlock.
 // 
 STDAPI DllCanUnloadNow(void)
 {
-    return g_cDllRef > 0 ? S_FALSE : S_OK;
+    if (g_cDllRef > 0 || !ContextMenuExtractTo::ReleaseQueue())
+    {
+        return S_FALSE;
+    }
+    return S_OK;
 }
 
 
@@ -140,6 +151,25 @@ STDAPI DllRegisterServer(void)
 			CLSID_FileContextMenuExt,
 			L"CppShellExtContextMenuHandler.ContextMenuExtractTo");
 
+		// The first volume of a split archive (name.z01 ... name.zip, or
+		// name.zip.001, name.zip.002, ...) opens the whole set too. Other
+		// tools number their splits .001 as well; the handler hides itself
+		// for those that are not ZIP archives (see
+		// ContextMenuExtractTo::Initialize).
+		RegisterShellExtContextMenuHandler(L".z01",
+			CLSID_FileContextMenuExt,
+			L"CppShellExtContextMenuHandler.ContextMenuExtractTo");
+		RegisterShellExtContextMenuHandler(L".001",
+			CLSID_FileContextMenuExt,
+			L"CppShellExtContextMenuHandler.ContextMenuExtractTo");
+
+		// Self-extracting archives; the handler hides itself for other
+		// executables, and shows only on Shift+right-click for those it
+		// does not check (see ContextMenuExtractTo::Initialize).
+		RegisterShellExtContextMenuHandler(L".exe",
+			CLSID_FileContextMenuExt,
+			L"CppShellExtContextMenuHandler.ContextMenuExtractTo");
+
         hr2 = RegDeleteKey(HKEY_CLASSES_ROOT, L"CompressedFolder\\ShellEx\\ContextMenuHandlers\\{b8cdcb65-b1bf-4b42-9428-1dfdb7ee92af}");
 	}
 
@@ -170,6 +200,9 @@ STDAPI DllUnregisterServer(void)
         // Unregister the context menu handler.
         hr = UnregisterShellExtContextMenuHandler(L".zip", 
             CLSID_FileContextMenuExt);
+        UnregisterShellExtContextMenuHandler(L".z01", CLSID_FileContextMenuExt);
+        UnregisterShellExtContextMenuHandler(L".001", CLSID_FileContextMenuExt);
+        UnregisterShellExtContextMenuHandler(L".exe", CLSID_FileContextMenuExt);
 
         HKEY hk;
         DWORD dwDisp;
@@ -181,4 +214,19 @@ STDAPI DllUnregisterServer(void)
     }
 
     return hr;
-}
\ No newline at end of file
+}
+
+
+//
+//   FUNCTION: ZipFolderExServiceW
+//
+//   PURPOSE: Run the extraction service for this logon session until it
+//   has had nothing to do for ten minutes. The context menu handler starts
+//   it on first use with "rundll32 ZipFolderEx.dll,ZipFolderExService".
+//
+extern "C" void CALLBACK ZipFolderExServiceW(HWND hwnd, HINSTANCE hinst,
+    LPWSTR pszCmdLine, int nCmdShow)
+{
+    ZipService service;
+    service.Run(ZipServiceDefaultName(), 10 * 60 * 1000);
+}